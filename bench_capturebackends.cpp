@@ -0,0 +1,212 @@
+#include "src/capture/captureengine.h"
+#include "src/capture/packetdecoder.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Capture backend benchmark: floods one end of a veth pair with small UDP frames and captures
+// them on the other end with each backend in turn, reporting packets per second, kernel drops
+// and capture-thread CPU time per packet. Every captured frame is also run through the
+// PacketDecoder selected for the link type, as NetworkMonitor does.
+//
+// Set up the pair first (needs root or CAP_NET_ADMIN/CAP_NET_RAW):
+//   ip link add nwbench0 type veth peer name nwbench1
+//   ip link set nwbench0 up && ip link set nwbench1 up
+//
+// Usage: bench_capturebackends <capture-interface> <inject-interface> [seconds] [pcap|mmap|all]
+
+static const int FrameLength = 64;
+static const int SendBatch = 64;
+
+struct CaptureCounters {
+    quint64 frames;
+    quint64 decoded;
+    quint64 bytes;
+};
+
+static void countFrame(void *user, const CaptureEngine::FrameHeader &header, const quint8 *frame)
+{
+    static thread_local PacketDecoder::DecodeFunction decode =
+        PacketDecoder::decoderForDataLink(PacketDecoder::DataLinkEthernet);
+    CaptureCounters *counters = static_cast<CaptureCounters *>(user);
+    PacketDescriptor descriptor;
+    TunnelEndpoints endpoints;
+    counters->frames++;
+    counters->bytes += header.wireLength;
+    if (decode(frame, header.captureLength, &descriptor, &endpoints)) {
+        counters->decoded++;
+    }
+}
+
+static void buildFrame(quint8 *frame, int index)
+{
+    std::memset(frame, 0, FrameLength);
+    std::memset(frame, 0xff, 6);      // Broadcast destination so the peer accepts it
+    frame[6] = 0x02;                  // Locally administered source
+    frame[11] = quint8(index);
+    frame[12] = 0x08;                 // IPv4
+    quint8 *ip = frame + 14;
+    ip[0] = 0x45;
+    ip[3] = FrameLength - 14;
+    ip[8] = 64;
+    ip[9] = PacketDecoder::ProtocolUdp;
+    ip[12] = 10; ip[15] = 1;
+    ip[16] = 10; ip[19] = 2;
+    quint8 *udp = ip + 20;
+    udp[0] = quint8((10000 + index) >> 8); udp[1] = quint8(10000 + index);
+    udp[2] = 0x00; udp[3] = 53;
+    udp[5] = FrameLength - 14 - 20;
+}
+
+// Sends frames as fast as the kernel accepts them until stop is set
+static void injectFrames(int socketFd, const std::atomic<bool> *stop, quint64 *sent)
+{
+    std::vector<quint8> frames(SendBatch * FrameLength);
+    struct iovec iov[SendBatch];
+    struct mmsghdr messages[SendBatch];
+    std::memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < SendBatch; ++i) {
+        buildFrame(frames.data() + i * FrameLength, i);
+        iov[i].iov_base = frames.data() + i * FrameLength;
+        iov[i].iov_len = FrameLength;
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (!stop->load(std::memory_order_relaxed)) {
+        int count = sendmmsg(socketFd, messages, SendBatch, 0);
+        if (count > 0) {
+            *sent += quint64(count);
+        } else if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+            std::perror("sendmmsg");
+            return;
+        }
+    }
+}
+
+static int openInjectSocket(const char *interfaceName)
+{
+    int fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0) {
+        std::perror("socket(AF_PACKET)");
+        return -1;
+    }
+    int bypass = 1;
+    setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &bypass, sizeof(bypass));
+
+    struct sockaddr_ll address;
+    std::memset(&address, 0, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_IP);
+    address.sll_ifindex = int(if_nametoindex(interfaceName));
+    if (address.sll_ifindex == 0 || bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+        std::fprintf(stderr, "Cannot bind to %s\n", interfaceName);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static double threadCpuSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+}
+
+static bool benchmark(CaptureEngine::Backend backend, const char *captureInterface, int injectFd, int seconds)
+{
+    CaptureEngine *engine = CaptureEngine::create(backend);
+    if (!engine) {
+        std::printf("%-22s not available in this build\n", qPrintable(CaptureEngine::backendName(backend)));
+        return true;
+    }
+
+    CaptureEngine::Config config;
+    config.interfaceName = QString::fromLocal8Bit(captureInterface);
+    config.backend = backend;
+    config.promiscuous = false;
+    if (!engine->open(config)) {
+        std::fprintf(stderr, "%s: %s\n", qPrintable(CaptureEngine::backendName(backend)),
+                     qPrintable(engine->errorString()));
+        delete engine;
+        return false;
+    }
+
+    CaptureCounters counters = {0, 0, 0};
+    double cpuSeconds = 0;
+    std::thread captureThread([&]() {
+        const double start = threadCpuSeconds();
+        engine->run(&countFrame, &counters);
+        cpuSeconds = threadCpuSeconds() - start;
+    });
+
+    std::atomic<bool> stopInjecting(false);
+    quint64 sent = 0;
+    const auto started = std::chrono::steady_clock::now();
+    std::thread injectThread(injectFrames, injectFd, &stopInjecting, &sent);
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stopInjecting.store(true);
+    injectThread.join();
+
+    // Let the last partly filled blocks retire before stopping
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    engine->stop();
+    captureThread.join();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    const CaptureEngine::Statistics stats = engine->statistics();
+
+    std::printf("%-22s sent %10llu  captured %10llu  decoded %10llu  %7.3f Mpps  dropped %llu  "
+                "%6.1f ns CPU/packet\n",
+                qPrintable(CaptureEngine::backendName(backend)),
+                static_cast<unsigned long long>(sent),
+                static_cast<unsigned long long>(counters.frames),
+                static_cast<unsigned long long>(counters.decoded),
+                double(counters.frames) / elapsed / 1e6,
+                static_cast<unsigned long long>(stats.totalDropped),
+                counters.frames ? cpuSeconds * 1e9 / double(counters.frames) : 0.0);
+
+    engine->close();
+    delete engine;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: %s <capture-interface> <inject-interface> [seconds] [pcap|mmap|all]\n", argv[0]);
+        return 1;
+    }
+    const char *captureInterface = argv[1];
+    const int seconds = argc > 3 ? std::atoi(argv[3]) : 5;
+    const char *which = argc > 4 ? argv[4] : "all";
+
+    int injectFd = openInjectSocket(argv[2]);
+    if (injectFd < 0) {
+        return 1;
+    }
+
+    bool ok = true;
+    if (std::strcmp(which, "pcap") == 0 || std::strcmp(which, "all") == 0) {
+        ok = benchmark(CaptureEngine::BackendPcap, captureInterface, injectFd, seconds) && ok;
+    }
+    if (std::strcmp(which, "mmap") == 0 || std::strcmp(which, "all") == 0) {
+        ok = benchmark(CaptureEngine::BackendPacketMmap, captureInterface, injectFd, seconds) && ok;
+    }
+
+    close(injectFd);
+    return ok ? 0 : 1;
+}
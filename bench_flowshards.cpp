@@ -0,0 +1,210 @@
+#include "src/capture/flowshard.h"
+#include <QHostAddress>
+#include <QList>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Scaling benchmark for the packet processing workers: producer threads stand in for the
+// capture threads and spread synthetic PacketDescriptors over the shards by the symmetric
+// flow hash, as CaptureWorker does. Each shard runs on its own thread and a merge thread
+// collects the published deltas, as NetworkMonitor does. Reports packets per second for
+// 1 to 8 processing workers.
+//
+// Usage: bench_flowshards [packets] [producers] [flows]
+
+static const size_t QueueCapacity = 65536;
+static const size_t PushBatch = 64;
+
+static std::vector<PacketDescriptor> buildPackets(size_t count, size_t flows, quint32 seed)
+{
+    std::vector<PacketDescriptor> packets(count);
+    quint64 state = 0x9e3779b97f4a7c15ULL ^ seed;
+    for (size_t i = 0; i < count; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        const quint32 flow = quint32((state >> 33) % flows);
+        const bool reply = (state >> 20) & 1;
+        PacketDescriptor &packet = packets[i];
+        const IpAddress local = IpAddress::fromIPv4(htonl(0x0a000001));
+        const IpAddress remote = IpAddress::fromIPv4(htonl(0xc6120000 | (flow >> 4)));
+        const quint16 localPort = quint16(32768 + (flow & 0x7fff));
+        const quint16 remotePort = (flow & 1) ? 443 : 53;
+        packet.srcAddr = reply ? remote : local;
+        packet.dstAddr = reply ? local : remote;
+        packet.srcPort = reply ? remotePort : localPort;
+        packet.dstPort = reply ? localPort : remotePort;
+        packet.protocol = (flow & 1) ? 6 : 17;
+        packet.ipVersion = 4;
+        packet.wireLength = 64 + (flow % 1400);
+        packet.timestampUs = 1700000000000000ULL + i;
+    }
+    return packets;
+}
+
+// A socket for every fourth flow, so attribution takes both the hit and the miss paths
+static std::shared_ptr<FlowShard::Attribution> buildAttribution(size_t flows)
+{
+    std::shared_ptr<FlowShard::Attribution> attribution = std::make_shared<FlowShard::Attribution>(flows);
+    attribution->localAddresses.refresh(QList<QHostAddress>() << QHostAddress("10.0.0.1"));
+    attribution->socketGeneration = 1;
+    for (quint32 flow = 0; flow < flows; flow += 4) {
+        const IpAddress local = IpAddress::fromIPv4(htonl(0x0a000001));
+        const IpAddress remote = IpAddress::fromIPv4(htonl(0xc6120000 | (flow >> 4)));
+        const FlowKey key = FlowKey::make(local, quint16(32768 + (flow & 0x7fff)), remote,
+                                          (flow & 1) ? 443 : 53, (flow & 1) ? 6 : 17);
+        if (qint64 *pid = attribution->sockets.findOrInsert(key)) {
+            *pid = 1000 + flow % 50;
+        }
+    }
+    return attribution;
+}
+
+static double run(int workers, const std::vector<std::vector<PacketDescriptor>> &inputs, size_t flows,
+                  quint64 *merged)
+{
+    std::vector<FlowShard *> shards;
+    for (int i = 0; i < workers; ++i) {
+        shards.push_back(new FlowShard(i, flows * 2));
+        shards.back()->setAttribution(buildAttribution(flows));
+    }
+
+    // rings[producer][shard]
+    std::vector<std::vector<SpscRing<PacketDescriptor> *>> rings(inputs.size());
+    for (size_t p = 0; p < inputs.size(); ++p) {
+        for (FlowShard *shard : shards) {
+            rings[p].push_back(new SpscRing<PacketDescriptor>(QueueCapacity, shard->doorbell()));
+        }
+    }
+    for (int s = 0; s < workers; ++s) {
+        QList<SpscRing<PacketDescriptor> *> shardInputs;
+        for (size_t p = 0; p < inputs.size(); ++p) {
+            shardInputs.append(rings[p][s]);
+        }
+        shards[s]->setInputs(shardInputs);
+    }
+
+    std::atomic<bool> producing(true);
+    std::atomic<bool> processing(true);
+    std::atomic<quint64> mergedPackets(0);
+
+    std::vector<std::thread> shardThreads;
+    for (FlowShard *shard : shards) {
+        shardThreads.emplace_back([shard, &producing]() {
+            while (true) {
+                if (shard->processInputs() > 0) {
+                    shard->publish();
+                    continue;
+                }
+                shard->publish();
+                if (!producing.load(std::memory_order_acquire) && !shard->hasInput()) {
+                    break;
+                }
+                shard->doorbell()->wait([shard]() { return shard->hasInput(); }, 10);
+            }
+        });
+    }
+
+    std::thread mergeThread([&shards, &processing, &mergedPackets]() {
+        while (processing.load(std::memory_order_acquire)) {
+            for (FlowShard *shard : shards) {
+                while (FlowShard::Delta *delta = shard->takeDelta()) {
+                    mergedPackets.fetch_add(delta->packets, std::memory_order_relaxed);
+                    delete delta;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(FlowShard::PublishIntervalMs));
+        }
+    });
+
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < inputs.size(); ++p) {
+        producers.emplace_back([&inputs, &rings, p, workers]() {
+            const std::vector<PacketDescriptor> &packets = inputs[p];
+            for (size_t i = 0; i < packets.size(); ++i) {
+                const PacketDescriptor &packet = packets[i];
+                SpscRing<PacketDescriptor> *ring = rings[p][0];
+                if (workers > 1) {
+                    const FlowKey key = FlowKey::make(packet.srcAddr, packet.srcPort, packet.dstAddr,
+                                                      packet.dstPort, packet.protocol);
+                    ring = rings[p][key.hash() % quint64(workers)];
+                }
+                // Unlike a capture thread, wait instead of dropping so every packet is processed
+                while (!ring->tryPush(packet)) {
+                    std::this_thread::yield();
+                }
+                if (i % PushBatch == 0) {
+                    ring->wakeUp();
+                }
+            }
+        });
+    }
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+    producing.store(false, std::memory_order_release);
+    for (FlowShard *shard : shards) {
+        shard->doorbell()->wakeUp();
+    }
+    for (std::thread &thread : shardThreads) {
+        thread.join();
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    processing.store(false, std::memory_order_release);
+    mergeThread.join();
+    quint64 total = mergedPackets.load();
+    for (FlowShard *shard : shards) {
+        while (FlowShard::Delta *delta = shard->takeDelta()) {
+            total += delta->packets;
+            delete delta;
+        }
+        FlowShard::Delta *delta = shard->takeUnpublished();
+        total += delta->packets;
+        delete delta;
+    }
+    *merged = total;
+
+    for (auto &producerRings : rings) {
+        for (SpscRing<PacketDescriptor> *ring : producerRings) {
+            delete ring;
+        }
+    }
+    for (FlowShard *shard : shards) {
+        delete shard;
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    const size_t packetCount = argc > 1 ? size_t(std::atoll(argv[1])) : 20000000;
+    const int producerCount = argc > 2 ? std::atoi(argv[2]) : 2;
+    const size_t flows = argc > 3 ? size_t(std::atoll(argv[3])) : 100000;
+
+    std::vector<std::vector<PacketDescriptor>> inputs;
+    for (int p = 0; p < producerCount; ++p) {
+        inputs.push_back(buildPackets(packetCount / size_t(producerCount), flows, quint32(p)));
+    }
+    const quint64 expected = quint64(packetCount / size_t(producerCount)) * quint64(producerCount);
+
+    std::printf("%llu packets over %zu flows from %d producer threads, %u hardware threads\n",
+                static_cast<unsigned long long>(expected), flows, producerCount,
+                std::thread::hardware_concurrency());
+    double baseline = 0;
+    for (int workers = 1; workers <= 8; ++workers) {
+        quint64 merged = 0;
+        const double elapsed = run(workers, inputs, flows, &merged);
+        const double rate = double(expected) / elapsed;
+        if (workers == 1) {
+            baseline = rate;
+        }
+        std::printf("%d workers  %8.3f Mpps  %5.2fx%s\n", workers, rate / 1e6, rate / baseline,
+                    merged == expected ? "" : "  MERGED COUNT MISMATCH");
+    }
+    return 0;
+}
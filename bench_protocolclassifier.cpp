@@ -0,0 +1,112 @@
+#include "src/capture/protocolclassifier.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Microbenchmark for ProtocolClassifier: classifies a synthetic mix of TCP and UDP payloads
+// in a loop and reports payloads per second. Most payloads in real traffic are the middle of
+// a stream (TLS records, QUIC short headers, bulk data), so most of the mix is too.
+//
+// Usage: bench_protocolclassifier [payload-count]
+
+struct SyntheticPayload {
+    size_t offset;
+    quint32 length;
+    quint8 transport;
+    quint16 port;
+};
+
+static quint32 buildPayload(quint8 *p, int index, quint8 *transport, quint16 *port)
+{
+    static const char *const Starts[] = {
+        "GET /index.html HTTP/1.1\r\nHost: example.com\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n",
+        "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n",
+        "SSH-2.0-OpenSSH_9.6\r\n",
+    };
+    const quint32 length = 64 + quint32(index % 13) * 100;
+    for (quint32 i = 0; i < length; ++i) {
+        p[i] = quint8((index * 131 + i * 29) ^ (i >> 3));
+    }
+
+    *transport = 6;
+    *port = 443;
+    switch (index % 10) {
+    case 0:
+    case 1:
+    case 2: // TLS application data
+        p[0] = 0x17; p[1] = 0x03; p[2] = 0x03;
+        break;
+    case 3: // TLS handshake
+        p[0] = 0x16; p[1] = 0x03; p[2] = 0x01;
+        break;
+    case 4: { // Plain text protocols
+        const char *start = Starts[(index / 10) % 4];
+        std::memcpy(p, start, std::strlen(start));
+        *port = 80;
+        break;
+    }
+    case 5: // QUIC long header
+        *transport = 17;
+        p[0] = 0xC3; p[1] = 0; p[2] = 0; p[3] = 0; p[4] = 1;
+        break;
+    case 6: // QUIC short header
+        *transport = 17;
+        p[0] = 0x40 | (p[0] & 0x3F);
+        break;
+    case 7: // DNS query
+        *transport = 17;
+        *port = 53;
+        p[2] = 0x01; p[3] = 0x00; p[4] = 0x00; p[5] = 0x01;
+        break;
+    default: // Bulk data of an unknown protocol
+        *port = 8000;
+        break;
+    }
+    return length;
+}
+
+int main(int argc, char *argv[])
+{
+    const quint64 payloadCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000000ULL;
+    const int bufferCount = 4096;
+
+    std::vector<quint8> buffer(size_t(bufferCount) * 2048);
+    std::vector<SyntheticPayload> payloads(bufferCount);
+    size_t offset = 0;
+    for (int i = 0; i < bufferCount; ++i) {
+        payloads[i].offset = offset;
+        payloads[i].length = buildPayload(buffer.data() + offset, i, &payloads[i].transport, &payloads[i].port);
+        offset += payloads[i].length;
+    }
+
+    const auto compileStart = std::chrono::steady_clock::now();
+    const ProtocolClassifier classifier;
+    const double compileSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - compileStart).count();
+
+    quint64 counts[ProtocolClassifier::ProtocolCount] = {};
+    const auto start = std::chrono::steady_clock::now();
+    for (quint64 n = 0; n < payloadCount; ++n) {
+        const SyntheticPayload &payload = payloads[n & (bufferCount - 1)];
+        const ProtocolClassifier::Protocol protocol =
+            classifier.classify(buffer.data() + payload.offset, payload.length, payload.transport, 40000,
+                                payload.port);
+        counts[protocol]++;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+
+    std::printf("Compiled the automata in %.3f ms\n", compileSeconds * 1e3);
+    std::printf("Classified %llu payloads in %.3f s\n", static_cast<unsigned long long>(payloadCount), seconds);
+    std::printf("%.2f Mpps, %.2f ns/payload\n", payloadCount / seconds / 1e6, seconds * 1e9 / payloadCount);
+    for (int protocol = 0; protocol < ProtocolClassifier::ProtocolCount; ++protocol) {
+        if (counts[protocol] > 0) {
+            std::printf("  %-10s %llu\n", ProtocolClassifier::name(ProtocolClassifier::Protocol(protocol)),
+                        static_cast<unsigned long long>(counts[protocol]));
+        }
+    }
+    return counts[ProtocolClassifier::Unknown] < payloadCount ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+#include "captureengine.h"
+#include "pcapcaptureengine.h"
+#include "pcapfilecaptureengine.h"
+#include "packetmmapcaptureengine.h"
+#include "packetdecoder.h"
+#include <cstdio>
+
+CaptureEngine::CaptureEngine()
+    : m_running(false)
+    , m_packetsPerSecond(0)
+    , m_dropsPerSecond(0)
+    , m_interfaceDropsPerSecond(0)
+    , m_filteredPerSecond(0)
+    , m_totalPackets(0)
+    , m_totalDropped(0)
+    , m_totalInterfaceDropped(0)
+    , m_totalFiltered(0)
+    , m_totalDelivered(0)
+    , m_filteredAvailable(false)
+    , m_lastInterfacePackets(0)
+{
+}
+
+CaptureEngine::~CaptureEngine()
+{
+}
+
+int CaptureEngine::Config::captureLength(int dataLink) const
+{
+    int length = snapLength;
+    if (headersOnly) {
+        length = qMin(int(PacketDecoder::headerSnapLength(dataLink)) + qMax(payloadLength, 0), snapLength);
+    }
+    // Recording has its own snap length and may keep more than the analysis reads
+    return qMax(length, recordLength);
+}
+
+CaptureEngine *CaptureEngine::create(Backend backend)
+{
+    switch (backend) {
+#ifdef HAVE_PCAP
+    case BackendPcap:
+        return new PcapCaptureEngine();
+    case BackendPcapFile:
+        return new PcapFileCaptureEngine();
+#endif
+#ifdef Q_OS_LINUX
+    case BackendPacketMmap:
+        return new PacketMmapCaptureEngine();
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+bool CaptureEngine::isBackendAvailable(Backend backend)
+{
+    switch (backend) {
+    case BackendPcap:
+    case BackendPcapFile:
+#ifdef HAVE_PCAP
+        return true;
+#else
+        return false;
+#endif
+    case BackendPacketMmap:
+#ifdef Q_OS_LINUX
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+QString CaptureEngine::backendName(Backend backend)
+{
+    switch (backend) {
+    case BackendPcap: return "libpcap";
+    case BackendPacketMmap: return "AF_PACKET TPACKET_V3";
+    case BackendPcapFile: return "pcap file";
+    }
+    return QString();
+}
+
+QString CaptureEngine::defaultFilter(bool tunnels)
+{
+    // protochain follows IPv6 extension headers, which "ip6 proto" does not
+    QString packets = "ip proto 6 or ip proto 17 or ip6 protochain 6 or ip6 protochain 17";
+    if (tunnels) {
+        // VXLAN and GENEVE ride on UDP already; GRE (47), IPv4-in-IP (4) and IPv6-in-IP (41) do not
+        packets += " or ip proto 47 or ip proto 4 or ip proto 41"
+                   " or ip6 protochain 47 or ip6 protochain 4 or ip6 protochain 41";
+    }
+    // Tags the NIC did not strip into metadata, up to the decoder's two (802.1Q, or QinQ).
+    // Each vlan keyword moves the offsets of everything after it, so the second one nests.
+    return QString("%1 or (vlan and (%1 or (vlan and (%1))))").arg(packets);
+}
+
+void CaptureEngine::stop()
+{
+    m_running.store(false, std::memory_order_relaxed);
+}
+
+QString CaptureEngine::filter() const
+{
+    std::lock_guard<std::mutex> lock(m_filterMutex);
+    return m_filter;
+}
+
+void CaptureEngine::setInstalledFilter(const QString &expression)
+{
+    std::lock_guard<std::mutex> lock(m_filterMutex);
+    m_filter = expression;
+}
+
+CaptureEngine::Statistics CaptureEngine::statistics() const
+{
+    Statistics stats;
+    stats.packetsPerSecond = m_packetsPerSecond.load(std::memory_order_relaxed);
+    stats.dropsPerSecond = m_dropsPerSecond.load(std::memory_order_relaxed);
+    stats.interfaceDropsPerSecond = m_interfaceDropsPerSecond.load(std::memory_order_relaxed);
+    stats.filteredPerSecond = m_filteredPerSecond.load(std::memory_order_relaxed);
+    stats.totalPackets = m_totalPackets.load(std::memory_order_relaxed);
+    stats.totalDropped = m_totalDropped.load(std::memory_order_relaxed);
+    stats.totalInterfaceDropped = m_totalInterfaceDropped.load(std::memory_order_relaxed);
+    stats.totalFiltered = m_totalFiltered.load(std::memory_order_relaxed);
+    stats.totalDelivered = m_totalDelivered.load(std::memory_order_relaxed);
+    stats.filteredAvailable = m_filteredAvailable.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CaptureEngine::updateStatistics()
+{
+    auto now = std::chrono::steady_clock::now();
+    quint64 received = 0;
+    quint64 dropped = 0;
+    quint64 ifDropped = 0;
+    quint64 interfacePackets = 0;
+    // A fanout member only sees its share of the interface, so it cannot tell what was filtered
+    const bool haveInterfacePackets = m_config.fanoutGroup < 0 && readInterfacePackets(&interfacePackets);
+    const quint64 interfaceDelta = haveInterfacePackets ? interfacePackets - m_lastInterfacePackets : 0;
+    if (haveInterfacePackets) {
+        m_lastInterfacePackets = interfacePackets;
+    }
+    if (!readKernelCounters(&received, &dropped, &ifDropped)) {
+        m_lastStatsTime = now;
+        return;
+    }
+
+    // The kernel only counts packets that passed the filter, so what it rejected is the
+    // rest of the interface's traffic. The two counters are not read atomically, hence the clamp.
+    quint64 filtered = 0;
+    if (haveInterfacePackets && !filter().isEmpty() && interfaceDelta > received) {
+        filtered = interfaceDelta - received;
+    }
+    m_filteredAvailable.store(haveInterfacePackets, std::memory_order_relaxed);
+
+    qint64 elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_lastStatsTime).count();
+    if (elapsedMs <= 0) {
+        elapsedMs = 1000;
+    }
+    m_lastStatsTime = now;
+
+    m_packetsPerSecond.store(received * 1000 / elapsedMs, std::memory_order_relaxed);
+    m_dropsPerSecond.store(dropped * 1000 / elapsedMs, std::memory_order_relaxed);
+    m_interfaceDropsPerSecond.store(ifDropped * 1000 / elapsedMs, std::memory_order_relaxed);
+    m_filteredPerSecond.store(filtered * 1000 / elapsedMs, std::memory_order_relaxed);
+    m_totalPackets.fetch_add(received, std::memory_order_relaxed);
+    m_totalDropped.fetch_add(dropped, std::memory_order_relaxed);
+    m_totalInterfaceDropped.fetch_add(ifDropped, std::memory_order_relaxed);
+    m_totalFiltered.fetch_add(filtered, std::memory_order_relaxed);
+}
+
+bool CaptureEngine::readInterfacePackets(quint64 *packets) const
+{
+#ifdef Q_OS_LINUX
+    // A capture socket sees both directions, so compare against both interface counters
+    static const char *const counters[] = { "rx_packets", "tx_packets" };
+    const QByteArray device = m_config.interfaceName.toUtf8();
+    quint64 total = 0;
+    for (const char *counter : counters) {
+        char path[256];
+        std::snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s", device.constData(), counter);
+        std::FILE *file = std::fopen(path, "r");
+        if (!file) {
+            return false;
+        }
+        unsigned long long value = 0;
+        const bool ok = std::fscanf(file, "%llu", &value) == 1;
+        std::fclose(file);
+        if (!ok) {
+            return false;
+        }
+        total += value;
+    }
+    *packets = total;
+    return true;
+#else
+    // Npcap and BPF devices do not report what their filter rejected
+    Q_UNUSED(packets);
+    return false;
+#endif
+}
+
+void CaptureEngine::resetStatistics()
+{
+    m_packetsPerSecond.store(0, std::memory_order_relaxed);
+    m_dropsPerSecond.store(0, std::memory_order_relaxed);
+    m_interfaceDropsPerSecond.store(0, std::memory_order_relaxed);
+    m_filteredPerSecond.store(0, std::memory_order_relaxed);
+    m_totalPackets.store(0, std::memory_order_relaxed);
+    m_totalDropped.store(0, std::memory_order_relaxed);
+    m_totalInterfaceDropped.store(0, std::memory_order_relaxed);
+    m_totalFiltered.store(0, std::memory_order_relaxed);
+    m_totalDelivered.store(0, std::memory_order_relaxed);
+    m_filteredAvailable.store(false, std::memory_order_relaxed);
+    m_lastStatsTime = std::chrono::steady_clock::now();
+    m_lastInterfacePackets = 0;
+    readInterfacePackets(&m_lastInterfacePackets);
+}
@@ -0,0 +1,177 @@
+#ifndef CAPTUREENGINE_H
+#define CAPTUREENGINE_H
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+/**
+ * @brief The CaptureEngine class is the interface to a live packet capture backend.
+ *
+ * A backend opens one interface, runs a batched capture loop on the calling thread and hands
+ * every frame to a FrameHandler together with a backend-neutral FrameHeader. The loop blocks
+ * in the kernel while the link is idle instead of polling. Per-second packet and drop counts
+ * are derived from the backend's kernel counters while it runs and can be read from any thread.
+ *
+ * A BPF filter compiled from a libpcap expression can be installed in the kernel with
+ * setFilter(), also while the loop is running, so that rejected packets never reach userspace.
+ *
+ * Use create() to get the backend selected in Config::backend.
+ */
+class CaptureEngine
+{
+public:
+    enum Backend {
+        BackendPcap,        // libpcap/Npcap, available wherever libpcap is
+        BackendPacketMmap,  // Linux AF_PACKET socket with a TPACKET_V3 memory-mapped block ring
+        BackendPcapFile     // Replay of a pcap/pcapng file through libpcap
+    };
+
+    struct Config {
+        QString interfaceName; // Or the file to replay (pcap file)
+        Backend backend;
+        int snapLength;       // Bytes captured per packet unless headersOnly is set
+        int batchSize;        // Maximum packets handled per pcap_dispatch() call (pcap)
+        int readTimeoutMs;    // How long the kernel may hold packets before waking us
+        int bufferSize;       // Kernel capture buffer in bytes (pcap)
+        bool immediateMode;   // Deliver every packet as soon as it arrives (pcap)
+        bool promiscuous;
+        int blockSize;        // Bytes per ring block, a power-of-two multiple of the page size (mmap)
+        int blockCount;       // Number of blocks in the ring (mmap)
+        int blockTimeoutMs;   // The kernel retires a partly filled block after this long (mmap)
+        QString filter;       // BPF filter expression installed on open(), empty for none
+        bool headersOnly;     // Capture just the headers the decoders read, plus payloadLength
+        int payloadLength;    // Payload bytes kept in headers-only mode for payload inspection
+        double replaySpeed;   // Multiple of the recorded packet rate, 0 for as fast as possible (pcap file)
+        int recordLength;     // Bytes per packet a CaptureRecorder writes to disk, 0 when not recording
+        int fanoutGroup;      // PACKET_FANOUT_HASH group shared with the interface's other sockets, -1 for none (mmap)
+
+        Config() : backend(BackendPcap), snapLength(65535), batchSize(256), readTimeoutMs(100),
+                   bufferSize(16 * 1024 * 1024), immediateMode(false),
+                   promiscuous(true), blockSize(1 << 20), blockCount(16),
+                   blockTimeoutMs(50), filter(defaultFilter()), headersOnly(true),
+                   payloadLength(0), replaySpeed(1.0), recordLength(0),
+                   fanoutGroup(-1) {}
+
+        // Bytes the kernel should copy per packet on a DLT_* link, -1 when it is not known yet
+        int captureLength(int dataLink) const;
+    };
+
+    struct Statistics {
+        quint64 packetsPerSecond;         // Packets accepted by the kernel filter in the last second
+        quint64 dropsPerSecond;           // Packets dropped for lack of buffer space
+        quint64 interfaceDropsPerSecond;  // Packets dropped by the NIC/driver
+        quint64 filteredPerSecond;        // Packets rejected by the kernel filter
+        quint64 totalPackets;
+        quint64 totalDropped;
+        quint64 totalInterfaceDropped;
+        quint64 totalFiltered;
+        quint64 totalDelivered;           // Packets handed to the frame handler
+        bool filteredAvailable;           // Whether the platform exposes what the filter rejected
+
+        Statistics() : packetsPerSecond(0), dropsPerSecond(0), interfaceDropsPerSecond(0),
+                       filteredPerSecond(0), totalPackets(0), totalDropped(0),
+                       totalInterfaceDropped(0), totalFiltered(0), totalDelivered(0),
+                       filteredAvailable(false) {}
+    };
+
+    // What every backend knows about a captured frame
+    // Byte counts must use wireLength: captureLength stops at the snap length.
+    struct FrameHeader {
+        quint64 timestampUs;    // Capture time, microseconds since the epoch
+        quint32 captureLength;  // Bytes available at the frame pointer
+        quint32 wireLength;     // Original length of the packet on the wire, never below captureLength
+    };
+
+    // Called on the capture thread for every frame. The frame points into the backend's buffer
+    // and is only valid for the duration of the call.
+    typedef void (*FrameHandler)(void *user, const FrameHeader &header, const quint8 *frame);
+
+    virtual ~CaptureEngine();
+
+    // Returns a new engine for the backend, or nullptr if it is not available in this build
+    static CaptureEngine *create(Backend backend);
+    static bool isBackendAvailable(Backend backend);
+    static QString backendName(Backend backend);
+
+    // Keeps only what the aggregation uses: TCP and UDP over IPv4/IPv6, untagged, VLAN or QinQ. With
+    // tunnels, also the GRE and IP-in-IP packets whose inner TCP and UDP the decoder unwraps.
+    static QString defaultFilter(bool tunnels = false);
+
+    virtual Backend backend() const = 0;
+    virtual bool open(const Config &config) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    // DLT_* link type of the open interface as pcap_datalink() would report it, -1 if not open
+    virtual int dataLinkType() const = 0;
+
+    // Runs the capture loop on the calling thread until stop() is called or an error occurs.
+    // Returns straight away if stop() was called after open(), even before run() began.
+    virtual bool run(FrameHandler handler, void *user) = 0;
+
+    // Safe to call from any thread
+    virtual void stop();
+
+    // Compiles a libpcap filter expression for the open handle's link type and installs it in
+    // the kernel; an empty expression accepts everything. Safe to call from any thread while
+    // run() is active, the running loop switches programs without losing its position. Returns
+    // once the program is in place, false if it did not compile or could not be installed.
+    virtual bool setFilter(const QString &expression) = 0;
+    QString filter() const; // The expression currently installed
+
+    // True from a successful open() until stop() or the end of run()
+    bool isRunning() const { return m_running.load(std::memory_order_relaxed); }
+    QString errorString() const { return m_errorString; }
+    const Config &config() const { return m_config; }
+    Statistics statistics() const;
+
+protected:
+    CaptureEngine();
+
+    // Kernel counters accumulated since the previous call; returns false if they are unavailable
+    virtual bool readKernelCounters(quint64 *received, quint64 *dropped, quint64 *interfaceDropped) = 0;
+
+    // Called by run() after every batch; refreshes the per-second rates about once a second
+    void updateStatisticsIfDue()
+    {
+        if (std::chrono::steady_clock::now() - m_lastStatsTime >= std::chrono::seconds(1)) {
+            updateStatistics();
+        }
+    }
+
+    void addDelivered(quint64 count) { m_totalDelivered.fetch_add(count, std::memory_order_relaxed); }
+    void resetStatistics();
+    void setInstalledFilter(const QString &expression);
+
+    Config m_config;
+    QString m_errorString;
+    std::atomic<bool> m_running;
+
+private:
+    void updateStatistics();
+    bool readInterfacePackets(quint64 *packets) const;
+
+    // Written by the capture thread, read by the UI
+    std::atomic<quint64> m_packetsPerSecond;
+    std::atomic<quint64> m_dropsPerSecond;
+    std::atomic<quint64> m_interfaceDropsPerSecond;
+    std::atomic<quint64> m_filteredPerSecond;
+    std::atomic<quint64> m_totalPackets;
+    std::atomic<quint64> m_totalDropped;
+    std::atomic<quint64> m_totalInterfaceDropped;
+    std::atomic<quint64> m_totalFiltered;
+    std::atomic<quint64> m_totalDelivered;
+    std::atomic<bool> m_filteredAvailable;
+
+    // Capture thread only
+    std::chrono::steady_clock::time_point m_lastStatsTime;
+    quint64 m_lastInterfacePackets; // Packets the interface passed in both directions
+
+    mutable std::mutex m_filterMutex;
+    QString m_filter;
+};
+
+#endif // CAPTUREENGINE_H
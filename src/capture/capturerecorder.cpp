@@ -0,0 +1,322 @@
+#include "capturerecorder.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QtConcurrent/QtConcurrent>
+#include <cstring>
+
+namespace {
+
+// pcapng block types and options, see draft-ietf-opsawg-pcapng
+const quint32 SectionHeaderBlock = 0x0A0D0D0A;
+const quint32 InterfaceDescriptionBlock = 0x00000001;
+const quint32 EnhancedPacketBlock = 0x00000006;
+const quint32 ByteOrderMagic = 0x1A2B3C4D;
+const quint16 OptionEnd = 0;
+const quint16 OptionInterfaceName = 2;
+
+const size_t WriterBatchSize = 256; // Frames taken from one spool before moving to the next
+const int WriterWaitMs = 100;
+
+quint32 padded(quint32 length)
+{
+    return (length + 3) & ~3u;
+}
+
+template <typename T>
+void append(QByteArray *buffer, T value)
+{
+    buffer->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void appendPadded(QByteArray *buffer, const quint8 *data, quint32 length)
+{
+    buffer->append(reinterpret_cast<const char *>(data), length);
+    static const char zeros[4] = {0, 0, 0, 0};
+    buffer->append(zeros, int(padded(length) - length));
+}
+
+} // namespace
+
+CaptureRecorder::CaptureRecorder()
+    : m_snapLength(65535)
+    , m_running(false)
+    , m_fileBytes(0)
+    , m_fileSequence(0)
+    , m_packetsWritten(0)
+    , m_bytesWritten(0)
+    , m_filesStarted(0)
+{
+    m_threadPool.setMaxThreadCount(1);
+}
+
+CaptureRecorder::~CaptureRecorder()
+{
+    stop();
+    qDeleteAll(m_spools);
+}
+
+bool CaptureRecorder::start(const Config &config, const QList<Source> &sources)
+{
+    stop();
+    m_config = config;
+    m_sources = sources;
+    m_errorString.clear();
+    m_snapLength = quint32(qMax(config.snapLength, 64));
+
+    qDeleteAll(m_spools);
+    m_spools.clear();
+    for (int i = 0; i < sources.size(); ++i) {
+        for (int thread = 0; thread < qMax(sources.at(i).captureThreads, 1); ++thread) {
+            m_spools.append(new Spool(size_t(qMax(config.spoolBytes, 4096)), &m_doorbell, quint32(i)));
+        }
+    }
+
+    m_packetsWritten.store(0, std::memory_order_relaxed);
+    m_bytesWritten.store(0, std::memory_order_relaxed);
+    m_filesStarted.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> locker(m_statsMutex);
+        m_writerError.clear();
+    }
+
+    if (!QDir().mkpath(config.directory)) {
+        m_errorString = QString("Cannot create %1").arg(config.directory);
+        return false;
+    }
+
+    // Files left by earlier recordings count towards the limit, oldest first by name
+    m_files.clear();
+    const QDir directory(config.directory);
+    const QStringList existing = directory.entryList(QStringList() << config.baseName + "-*.pcapng",
+                                                     QDir::Files, QDir::Name);
+    for (const QString &name : existing) {
+        m_files.append(directory.filePath(name));
+    }
+
+    m_buffer.clear();
+    m_buffer.reserve(config.writeBufferBytes + 2 * int(m_snapLength));
+    m_fileSequence = 0;
+    if (!openFile()) {
+        m_errorString = m_writerError;
+        return false;
+    }
+
+    m_running.store(true, std::memory_order_relaxed);
+    m_future = QtConcurrent::run(&m_threadPool, [this]() {
+        runWriter();
+    });
+    qDebug() << "Recording" << sources.size() << "sources to" << config.directory;
+    return true;
+}
+
+void CaptureRecorder::stop()
+{
+    if (!m_running.exchange(false, std::memory_order_relaxed)) {
+        return;
+    }
+    m_doorbell.wakeUp();
+    if (m_future.isRunning()) {
+        m_future.waitForFinished();
+    }
+}
+
+CaptureRecorder::Statistics CaptureRecorder::statistics() const
+{
+    Statistics stats;
+    stats.recording = isRunning();
+    stats.packetsWritten = m_packetsWritten.load(std::memory_order_relaxed);
+    stats.bytesWritten = m_bytesWritten.load(std::memory_order_relaxed);
+    stats.filesStarted = m_filesStarted.load(std::memory_order_relaxed);
+    for (const Spool *spool : m_spools) {
+        stats.packetsDropped += spool->dropped.load(std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> locker(m_statsMutex);
+    stats.currentFile = m_currentFile;
+    stats.errorString = m_writerError;
+    return stats;
+}
+
+void CaptureRecorder::runWriter()
+{
+    auto hasData = [this]() {
+        for (const Spool *spool : m_spools) {
+            if (!spool->frames.isEmpty()) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    bool ok = true;
+    while (ok) {
+        const size_t count = drainSpools();
+
+        // Rotation is checked between frames, so a file can exceed the limit by one buffer
+        const auto now = std::chrono::steady_clock::now();
+        const bool full = m_config.maxFileBytes > 0 && m_fileBytes >= m_config.maxFileBytes;
+        const bool expired = m_config.maxFileSeconds > 0 &&
+                             now - m_fileOpened >= std::chrono::seconds(m_config.maxFileSeconds);
+        if (full || expired) {
+            ok = flush();
+            closeFile();
+            ok = ok && openFile();
+        } else if (m_buffer.size() >= m_config.writeBufferBytes ||
+                   (!m_buffer.isEmpty() && now - m_lastFlush >= std::chrono::milliseconds(m_config.flushIntervalMs))) {
+            ok = flush();
+        }
+        if (count > 0) {
+            continue;
+        }
+
+        // The capture threads have stopped before stop() is called, so the spools are final
+        if (!m_running.load(std::memory_order_relaxed)) {
+            break;
+        }
+        m_doorbell.wait(hasData, WriterWaitMs);
+    }
+
+    flush();
+    closeFile();
+    m_running.store(false, std::memory_order_relaxed);
+}
+
+size_t CaptureRecorder::drainSpools()
+{
+    size_t total = 0;
+    for (Spool *spool : m_spools) {
+        const quint32 interfaceId = spool->interfaceId;
+        total += spool->frames.consume([this, interfaceId](const FrameSpool::FrameRecord &record,
+                                                           const quint8 *data) {
+            appendPacket(interfaceId, record, data);
+        }, WriterBatchSize);
+    }
+    return total;
+}
+
+bool CaptureRecorder::openFile()
+{
+    // The timestamp keeps names in chronological order across restarts
+    const QString name = QString("%1-%2-%3.pcapng")
+                             .arg(m_config.baseName,
+                                  QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"))
+                             .arg(m_fileSequence++, 4, 10, QChar('0'));
+    const QString path = QDir(m_config.directory).filePath(name);
+
+    // Unbuffered: m_buffer already batches the writes
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        setError(QString("Cannot open %1: %2").arg(path, m_file.errorString()));
+        return false;
+    }
+
+    m_files.append(path);
+    removeOldFiles();
+
+    m_fileBytes = 0;
+    m_fileOpened = std::chrono::steady_clock::now();
+    m_lastFlush = m_fileOpened;
+    appendSectionHeader();
+    for (const Source &source : m_sources) {
+        appendInterfaceDescription(source);
+    }
+
+    m_filesStarted.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> locker(m_statsMutex);
+    m_currentFile = path;
+    return true;
+}
+
+bool CaptureRecorder::flush()
+{
+    m_lastFlush = std::chrono::steady_clock::now();
+    if (m_buffer.isEmpty() || !m_file.isOpen()) {
+        return m_file.isOpen();
+    }
+    const qint64 written = m_file.write(m_buffer);
+    const bool ok = written == m_buffer.size();
+    if (!ok) {
+        setError(QString("Cannot write %1: %2").arg(m_file.fileName(), m_file.errorString()));
+    }
+    m_bytesWritten.fetch_add(quint64(qMax(written, qint64(0))), std::memory_order_relaxed);
+    m_buffer.clear();
+    return ok;
+}
+
+void CaptureRecorder::closeFile()
+{
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+    std::lock_guard<std::mutex> locker(m_statsMutex);
+    m_currentFile.clear();
+}
+
+void CaptureRecorder::removeOldFiles()
+{
+    if (m_config.maxFiles <= 0) {
+        return;
+    }
+    while (m_files.size() > m_config.maxFiles) {
+        const QString oldest = m_files.takeFirst();
+        if (!QFile::remove(oldest)) {
+            qWarning() << "Cannot remove old capture file" << oldest;
+        }
+    }
+}
+
+void CaptureRecorder::appendSectionHeader()
+{
+    const quint32 length = 28;
+    append(&m_buffer, SectionHeaderBlock);
+    append(&m_buffer, length);
+    append(&m_buffer, ByteOrderMagic);
+    append(&m_buffer, quint16(1));   // Major version
+    append(&m_buffer, quint16(0));   // Minor version
+    append(&m_buffer, qint64(-1));   // Section length not known
+    append(&m_buffer, length);
+    m_fileBytes += length;
+}
+
+void CaptureRecorder::appendInterfaceDescription(const Source &source)
+{
+    // Timestamps are in microseconds, the default if_tsresol, so only the name is written
+    const QByteArray name = source.name.toUtf8();
+    const quint32 optionsLength = 4 + padded(quint32(name.size())) + 4;
+    const quint32 length = 20 + optionsLength;
+    append(&m_buffer, InterfaceDescriptionBlock);
+    append(&m_buffer, length);
+    append(&m_buffer, quint16(source.dataLink));
+    append(&m_buffer, quint16(0));   // Reserved
+    append(&m_buffer, m_snapLength);
+    append(&m_buffer, OptionInterfaceName);
+    append(&m_buffer, quint16(name.size()));
+    appendPadded(&m_buffer, reinterpret_cast<const quint8 *>(name.constData()), quint32(name.size()));
+    append(&m_buffer, OptionEnd);
+    append(&m_buffer, quint16(0));
+    append(&m_buffer, length);
+    m_fileBytes += length;
+}
+
+void CaptureRecorder::appendPacket(quint32 interfaceId, const FrameSpool::FrameRecord &record, const quint8 *data)
+{
+    const quint32 length = 32 + padded(record.captureLength);
+    append(&m_buffer, EnhancedPacketBlock);
+    append(&m_buffer, length);
+    append(&m_buffer, interfaceId);
+    append(&m_buffer, quint32(record.timestampUs >> 32));
+    append(&m_buffer, quint32(record.timestampUs));
+    append(&m_buffer, record.captureLength);
+    append(&m_buffer, record.wireLength);
+    appendPadded(&m_buffer, data, record.captureLength);
+    append(&m_buffer, length);
+    m_fileBytes += length;
+    m_packetsWritten.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CaptureRecorder::setError(const QString &error)
+{
+    qWarning() << "Capture recording:" << error;
+    std::lock_guard<std::mutex> locker(m_statsMutex);
+    m_writerError = error;
+}
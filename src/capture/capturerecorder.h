@@ -0,0 +1,151 @@
+#ifndef CAPTURERECORDER_H
+#define CAPTURERECORDER_H
+
+#include "captureengine.h"
+#include "framespool.h"
+#include "spscring.h"
+#include <QByteArray>
+#include <QFile>
+#include <QFuture>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+/**
+ * @brief The CaptureRecorder class spools captured frames to a rolling set of pcapng files.
+ *
+ * Every capture thread gets its own FrameSpool; the threads of one source, such as the fanout
+ * sockets of an interface, share its pcapng interface. The capture threads copy frames into
+ * their spool with record() and never touch the disk; when a spool is full the frame is counted as
+ * dropped instead of waiting. A single writer thread drains the spools into a large in-memory
+ * block buffer and writes it out in big unbuffered writes.
+ *
+ * A new file is started when the current one reaches Config::maxFileBytes or has been open
+ * for Config::maxFileSeconds. Only the newest Config::maxFiles files are kept; the oldest is
+ * deleted when a new one is opened, so the recording uses bounded disk space.
+ */
+class CaptureRecorder
+{
+public:
+    struct Config {
+        bool enabled;
+        QString directory;
+        QString baseName;       // Files are named <baseName>-<yyyyMMdd-hhmmss>-<sequence>.pcapng
+        qint64 maxFileBytes;    // Rotate once a file reaches this size, 0 for no limit
+        int maxFileSeconds;     // Rotate once a file has been open this long, 0 for no limit
+        int maxFiles;           // Files kept in the directory, 0 to keep them all
+        int snapLength;         // Bytes written per frame, independent of the analysis snap length
+        int spoolBytes;         // Spool between each capture thread and the writer
+        int writeBufferBytes;   // Size of the writes issued to the file
+        int flushIntervalMs;    // Longest a frame waits in the write buffer
+
+        Config() : enabled(false), baseName("netwire"), maxFileBytes(100LL * 1024 * 1024),
+                   maxFileSeconds(0), maxFiles(10), snapLength(65535),
+                   spoolBytes(16 * 1024 * 1024), writeBufferBytes(4 * 1024 * 1024),
+                   flushIntervalMs(1000) {}
+    };
+
+    struct Statistics {
+        bool recording;
+        quint64 packetsWritten;
+        quint64 bytesWritten;   // File bytes, including pcapng framing
+        quint64 packetsDropped; // Frames lost because a spool was full
+        quint64 filesStarted;
+        QString currentFile;
+        QString errorString;    // Why the writer stopped, if it did
+
+        Statistics() : recording(false), packetsWritten(0), bytesWritten(0),
+                       packetsDropped(0), filesStarted(0) {}
+    };
+
+    // One pcapng interface per capture source
+    struct Source {
+        QString name;
+        int dataLink;       // DLT_* link type
+        int captureThreads; // Threads recording this source, each with a spool of its own
+
+        Source() : dataLink(-1), captureThreads(1) {}
+        Source(const QString &sourceName, int sourceDataLink, int sourceThreads = 1)
+            : name(sourceName), dataLink(sourceDataLink), captureThreads(sourceThreads) {}
+    };
+
+    CaptureRecorder();
+    ~CaptureRecorder();
+
+    CaptureRecorder(const CaptureRecorder &) = delete;
+    CaptureRecorder &operator=(const CaptureRecorder &) = delete;
+
+    // Opens the first file and starts the writer thread
+    bool start(const Config &config, const QList<Source> &sources);
+    // Writes out everything spooled so far and closes the file
+    void stop();
+    bool isRunning() const { return m_running.load(std::memory_order_relaxed); }
+
+    // Capture thread of the given spool only. Spools are numbered source by source, the
+    // captureThreads of each in turn. Copies at most snapLength bytes of the frame.
+    void record(int spoolIndex, const CaptureEngine::FrameHeader &header, const quint8 *frame)
+    {
+        Spool *spool = m_spools.at(spoolIndex);
+        const quint32 length = qMin(header.captureLength, m_snapLength);
+        if (!spool->frames.tryPush(header.timestampUs, header.wireLength, frame, length)) {
+            spool->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    Config config() const { return m_config; }
+    QString errorString() const { return m_errorString; }
+    Statistics statistics() const;
+
+private:
+    struct Spool {
+        FrameSpool frames;
+        std::atomic<quint64> dropped;
+        quint32 interfaceId; // Index of the source
+
+        Spool(size_t capacity, RingDoorbell *doorbell, quint32 source)
+            : frames(capacity, doorbell), dropped(0), interfaceId(source) {}
+    };
+
+    void runWriter();
+    size_t drainSpools();
+    bool openFile();
+    bool flush();
+    void closeFile();
+    void removeOldFiles();
+    void appendSectionHeader();
+    void appendInterfaceDescription(const Source &source);
+    void appendPacket(quint32 interfaceId, const FrameSpool::FrameRecord &record, const quint8 *data);
+    void setError(const QString &error);
+
+    Config m_config;
+    QList<Source> m_sources;
+    QList<Spool *> m_spools; // Index = spool index
+    quint32 m_snapLength;
+    RingDoorbell m_doorbell; // Shared by all spools so the writer sleeps on all of them
+    QThreadPool m_threadPool; // Own thread so a slow disk never holds up the global pool
+    QFuture<void> m_future;
+    std::atomic<bool> m_running;
+    QString m_errorString;
+
+    // Writer thread only while running
+    QFile m_file;
+    QByteArray m_buffer;
+    qint64 m_fileBytes; // Written plus buffered
+    int m_fileSequence;
+    std::chrono::steady_clock::time_point m_fileOpened;
+    std::chrono::steady_clock::time_point m_lastFlush;
+    QStringList m_files; // Oldest first
+
+    mutable std::mutex m_statsMutex; // Guards the strings below
+    QString m_currentFile;
+    QString m_writerError;
+    std::atomic<quint64> m_packetsWritten;
+    std::atomic<quint64> m_bytesWritten;
+    std::atomic<quint64> m_filesStarted;
+};
+
+#endif // CAPTURERECORDER_H
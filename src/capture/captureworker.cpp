@@ -0,0 +1,465 @@
+#include "captureworker.h"
+#include <QDebug>
+#include <QtConcurrent/QtConcurrent>
+
+// DNS messages and ClientHellos are few next to packets and are drained on every merge
+static const size_t DnsQueueCapacity = 1024;
+static const size_t TlsQueueCapacity = 256;
+
+// Bounds on ClientHello reassembly
+static const size_t MaxPendingHellos = 256;
+static const quint8 MaxHelloSegments = 8;
+static const quint64 PendingHelloTimeoutUs = 2000000;
+
+// Flows whose payload classification a capture thread keeps track of; a power of two
+static const size_t ClassifiedFlowSlots = 16384;
+
+// Tunnel endpoint pairs a capture thread looks up without taking the shared table's lock
+static const size_t MaxCachedTunnelEndpoints = 256;
+
+CaptureWorker::CaptureWorker(quint8 interfaceIndex, size_t queueCapacity, const QList<RingDoorbell *> &doorbells)
+    : m_interfaceIndex(interfaceIndex)
+    , m_engine(nullptr)
+    , m_decodeFunction(nullptr)
+    , m_tunnelDecodeFunction(nullptr)
+    , m_decapsulate(false)
+    , m_inspection(0)
+    , m_classifiedFlows(ClassifiedFlowSlots, ClassifiedFlow{0, 0})
+    , m_dnsQueue(DnsQueueCapacity)
+    , m_tlsQueue(TlsQueueCapacity)
+    , m_pendingHellos(MaxPendingHellos)
+    , m_tunnelEndpoints(nullptr)
+    , m_tunnelEndpointCache(MaxCachedTunnelEndpoints)
+    , m_recorder(nullptr)
+    , m_recorderSpool(0)
+    , m_enqueued(0)
+    , m_overflows(0)
+    , m_dnsOverflows(0)
+    , m_tlsOverflows(0)
+    , m_highWatermark(0)
+    , m_finished(false)
+{
+    m_threadPool.setMaxThreadCount(1);
+    m_reassembler.addConsumer(&HttpLatencyTracker::acceptStream, &HttpLatencyTracker::streamData,
+                              &HttpLatencyTracker::streamClosed, &m_httpLatency);
+    for (RingDoorbell *doorbell : doorbells) {
+        m_queues.append(new SpscRing<PacketDescriptor>(queueCapacity, doorbell));
+    }
+}
+
+CaptureWorker::~CaptureWorker()
+{
+    close();
+    delete m_engine;
+    m_engine = nullptr;
+    qDeleteAll(m_queues);
+    m_queues.clear();
+}
+
+bool CaptureWorker::open(const CaptureEngine::Config &config)
+{
+    close();
+    m_config = config;
+    m_errorString.clear();
+    m_finished.store(false, std::memory_order_relaxed);
+
+    // The backend can change between captures
+    if (!m_engine || m_engine->backend() != config.backend) {
+        delete m_engine;
+        m_engine = CaptureEngine::create(config.backend);
+        if (!m_engine) {
+            m_errorString = QString("%1 capture is not available in this build")
+                                .arg(CaptureEngine::backendName(config.backend));
+            return false;
+        }
+    }
+
+    if (!m_engine->open(config)) {
+        m_errorString = m_engine->errorString();
+        return false;
+    }
+
+    // Pick the decoder for this handle's link layer once, not per packet
+    const int dataLink = m_engine->dataLinkType();
+    m_decodeFunction = PacketDecoder::decoderForDataLink(dataLink);
+    if (!m_decodeFunction) {
+        m_errorString = QString("Unsupported link type %1").arg(dataLink);
+        m_engine->close();
+        return false;
+    }
+    m_tunnelDecodeFunction = PacketDecoder::decoderForDataLink(dataLink, true);
+
+    m_enqueued.store(0, std::memory_order_relaxed);
+    m_overflows.store(0, std::memory_order_relaxed);
+    m_dnsOverflows.store(0, std::memory_order_relaxed);
+    m_tlsOverflows.store(0, std::memory_order_relaxed);
+    m_pendingHellos.clear();
+    m_classifiedFlows.assign(ClassifiedFlowSlots, ClassifiedFlow{0, 0});
+    m_fragments.clear();
+    m_reassembler.clear();
+    m_httpLatency.clear();
+    m_highWatermark.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+void CaptureWorker::close()
+{
+    stop();
+    if (m_engine) {
+        m_engine->close();
+    }
+}
+
+bool CaptureWorker::setFilter(const QString &expression)
+{
+    if (!m_engine || !m_engine->isOpen()) {
+        m_errorString = "Capture is not open";
+        return false;
+    }
+    if (!m_engine->setFilter(expression)) {
+        m_errorString = m_engine->errorString();
+        return false;
+    }
+    m_config.filter = expression;
+    return true;
+}
+
+QString CaptureWorker::filter() const
+{
+    return m_engine ? m_engine->filter() : QString();
+}
+
+void CaptureWorker::setRecorder(CaptureRecorder *recorder, int spoolIndex)
+{
+    if (isRunning()) {
+        return;
+    }
+    m_recorder = recorder;
+    m_recorderSpool = spoolIndex;
+}
+
+void CaptureWorker::start()
+{
+    if (!m_engine || !m_engine->isOpen()) {
+        return;
+    }
+
+    // The backend blocks in the kernel while the link is idle
+    m_future = QtConcurrent::run(&m_threadPool, [this]() {
+        if (!m_engine->run(&CaptureWorker::frameHandler, this)) {
+            qWarning() << "Packet capture on" << m_config.interfaceName << "stopped:" << m_engine->errorString();
+        } else {
+            qDebug() << "Packet capture on" << m_config.interfaceName << "finished";
+        }
+        m_finished.store(true, std::memory_order_release);
+    });
+}
+
+void CaptureWorker::stop()
+{
+    if (m_engine) {
+        m_engine->stop();
+    }
+    if (m_future.isRunning()) {
+        m_future.waitForFinished();
+    }
+}
+
+bool CaptureWorker::isRunning() const
+{
+    return m_future.isRunning();
+}
+
+CaptureEngine::Statistics CaptureWorker::captureStatistics() const
+{
+    return m_engine ? m_engine->statistics() : CaptureEngine::Statistics();
+}
+
+CaptureWorker::QueueStatistics CaptureWorker::queueStatistics() const
+{
+    QueueStatistics stats;
+    for (const SpscRing<PacketDescriptor> *queue : m_queues) {
+        stats.depth += queue->size();
+        stats.capacity += queue->capacity();
+    }
+    stats.highWatermark = m_highWatermark.load(std::memory_order_relaxed);
+    stats.enqueued = m_enqueued.load(std::memory_order_relaxed);
+    stats.overflows = m_overflows.load(std::memory_order_relaxed);
+    stats.dnsOverflows = m_dnsOverflows.load(std::memory_order_relaxed);
+    stats.tlsOverflows = m_tlsOverflows.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CaptureWorker::frameHandler(void *user, const CaptureEngine::FrameHeader &header, const quint8 *frame)
+{
+    static_cast<CaptureWorker *>(user)->processFrame(header, frame);
+}
+
+void CaptureWorker::processFrame(const CaptureEngine::FrameHeader &header, const quint8 *frame)
+{
+    // The spool copy never waits for the disk; frames that don't fit are counted as dropped
+    if (m_recorder) {
+        m_recorder->record(m_recorderSpool, header, frame);
+    }
+
+    // Packet sampling skips frames before they cost a decode
+    const PacketSampler::Setting sampling = m_sampler.setting();
+    if (!m_sampler.keepFrame(sampling)) {
+        return;
+    }
+
+    // Capture thread: decode and hand off, never block on shared state. The decoder is
+    // bounds-checked against the captured length and keeps addresses binary.
+    const PacketDecoder::DecodeFunction decode = m_decapsulate.load(std::memory_order_relaxed)
+                                                     ? m_tunnelDecodeFunction
+                                                     : m_decodeFunction;
+    PacketDescriptor descriptor;
+    TunnelEndpoints endpoints;
+    if (!decode(frame, header.captureLength, &descriptor, &endpoints)) {
+        return;
+    }
+    if (descriptor.tunnel.depth > 0) {
+        descriptor.tunnel.endpoints = tunnelEndpointIndex(endpoints);
+    }
+    descriptor.timestampUs = header.timestampUs;
+    descriptor.wireLength = header.wireLength;
+    descriptor.interfaceIndex = m_interfaceIndex;
+    descriptor.sampleRate = sampling.rate;
+    descriptor.sampling = sampling.mode;
+
+    // A later fragment takes the ports of its datagram's first fragment, and waits for it if
+    // it came first
+    const bool held = descriptor.fragment != 0 && !m_fragments.track(&descriptor);
+    if (SpscRing<PacketDescriptor> *queue = held ? nullptr : queueFor(descriptor)) {
+        const quint32 payloadLength = descriptor.availablePayloadLength();
+        const quint8 inspection = m_inspection.load(std::memory_order_relaxed);
+        if (inspection & InspectProtocol) {
+            classifyPayload(&descriptor, frame + descriptor.payloadOffset(header.captureLength), payloadLength);
+        }
+        if (payloadLength > 0 && inspection != 0) {
+            if (descriptor.srcPort == DnsParser::Port || descriptor.dstPort == DnsParser::Port) {
+                if (inspection & InspectDns) {
+                    processDns(descriptor, header, frame);
+                }
+            } else if (descriptor.protocol == PacketDecoder::ProtocolTcp && (inspection & InspectTls)) {
+                processTls(descriptor, header, frame);
+            }
+        }
+        // A stream sampled packet by packet is all holes, so only whole flows are reassembled
+        if (descriptor.protocol == PacketDecoder::ProtocolTcp && descriptor.sampling != PacketSampler::EveryNth &&
+            m_reassembler.depth() > 0) {
+            m_reassembler.process(descriptor, frame + descriptor.payloadOffset(header.captureLength));
+            m_reassembler.expire(header.timestampUs);
+        }
+        push(queue, descriptor);
+    }
+
+    // Held fragments follow their first fragment, or go on without ports when it never came
+    if (!m_fragments.isEmpty()) {
+        m_fragments.expire(header.timestampUs);
+        PacketDescriptor released;
+        while (m_fragments.takeReleased(&released)) {
+            if (SpscRing<PacketDescriptor> *queue = queueFor(released)) {
+                push(queue, released);
+            }
+        }
+    }
+}
+
+// Both directions of a flow hash alike, so its packets stay in order on one processing worker,
+// and flow sampling keeps or skips them together. nullptr if the flow is sampled out.
+SpscRing<PacketDescriptor> *CaptureWorker::queueFor(const PacketDescriptor &descriptor) const
+{
+    const bool flowSampling = descriptor.sampling == PacketSampler::FlowHash;
+    if (m_queues.size() == 1 && !flowSampling) {
+        return m_queues.first();
+    }
+    const FlowKey key = FlowKey::make(descriptor.srcAddr, descriptor.srcPort, descriptor.dstAddr,
+                                      descriptor.dstPort, descriptor.protocol);
+    const quint64 hash = key.hash();
+    if (flowSampling && !PacketSampler::keepFlow(PacketSampler::Setting{PacketSampler::FlowHash, descriptor.sampleRate},
+                                                 hash)) {
+        return nullptr;
+    }
+    // Multiply-shift on the tag half: a modulo would take the same low bits that pick the slot
+    // in each shard's FlowHashMap, crowding every shard's flows into a fraction of its table
+    return m_queues.at(int((quint64(quint32(hash >> 32)) * quint64(m_queues.size())) >> 32));
+}
+
+// Names the protocol of a flow's first payload packets only; the shard ignores the rest, and
+// classifying them would cost a table step per byte of every payload packet
+void CaptureWorker::classifyPayload(PacketDescriptor *descriptor, const quint8 *payload, quint32 length)
+{
+    const bool syn = descriptor->protocol == PacketDecoder::ProtocolTcp &&
+                     (descriptor->tcpFlags & (PacketDescriptor::TcpSyn | PacketDescriptor::TcpAck)) ==
+                         PacketDescriptor::TcpSyn;
+    if (length == 0 && !syn) {
+        return;
+    }
+    const quint64 hash = FlowKey::make(descriptor->srcAddr, descriptor->srcPort, descriptor->dstAddr,
+                                       descriptor->dstPort, descriptor->protocol).hash();
+    ClassifiedFlow &flow = m_classifiedFlows[hash & (ClassifiedFlowSlots - 1)];
+    const quint32 tag = quint32(hash >> 32) | 1;
+    // A new connection on a reused 5-tuple starts over, as it does in the shard
+    if (flow.tag != tag || syn) {
+        flow.tag = tag;
+        flow.payloadPackets = 0;
+    }
+    if (length == 0 || flow.payloadPackets >= ProtocolClassifier::MaxPayloadPackets) {
+        return;
+    }
+    flow.payloadPackets++;
+    descriptor->appProtocol = m_classifier.classify(payload, length, descriptor->protocol, descriptor->srcPort,
+                                                    descriptor->dstPort);
+    if (descriptor->appProtocol != ProtocolClassifier::Unknown) {
+        flow.payloadPackets = ProtocolClassifier::MaxPayloadPackets;
+    }
+}
+
+// Index of a pair from this thread's cache, or from the shared table the first time
+quint16 CaptureWorker::tunnelEndpointIndex(const TunnelEndpoints &endpoints)
+{
+    if (!m_tunnelEndpoints) {
+        return 0;
+    }
+    const FlowKey key = TunnelEndpointTable::key(endpoints);
+    if (const quint16 *index = m_tunnelEndpointCache.find(key)) {
+        return *index;
+    }
+    const quint16 index = m_tunnelEndpoints->intern(endpoints);
+    // A full cache only means more trips to the shared table
+    if (quint16 *cached = m_tunnelEndpointCache.findOrInsert(key)) {
+        *cached = index;
+    }
+    return index;
+}
+
+void CaptureWorker::push(SpscRing<PacketDescriptor> *queue, const PacketDescriptor &descriptor)
+{
+    if (!queue->tryPush(descriptor)) {
+        m_overflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    m_enqueued.fetch_add(1, std::memory_order_relaxed);
+
+    quint64 depth = queue->size();
+    if (depth > m_highWatermark.load(std::memory_order_relaxed)) {
+        m_highWatermark.store(depth, std::memory_order_relaxed);
+    }
+}
+
+void CaptureWorker::processDns(const PacketDescriptor &descriptor, const CaptureEngine::FrameHeader &header,
+                               const quint8 *frame)
+{
+    const quint8 *payload = frame + descriptor.payloadOffset(header.captureLength);
+    quint32 length = descriptor.availablePayloadLength();
+    if (descriptor.protocol == PacketDecoder::ProtocolTcp) {
+        // DNS over TCP: only a message at the start of a segment, after its length prefix
+        if (length < 2) {
+            return;
+        }
+        length = qMin(length - 2, quint32(PacketDecoder::readBe16(payload)));
+        payload += 2;
+    } else if (descriptor.protocol != PacketDecoder::ProtocolUdp) {
+        return;
+    }
+
+    DnsMessage message;
+    if (!DnsParser::parse(payload, length, &message)) {
+        return;
+    }
+    // The resolver is the end on port 53, whichever way the message goes
+    message.timestampUs = descriptor.timestampUs;
+    message.client = message.response ? descriptor.dstAddr : descriptor.srcAddr;
+    message.server = message.response ? descriptor.srcAddr : descriptor.dstAddr;
+    message.clientPort = message.response ? descriptor.dstPort : descriptor.srcPort;
+    if (!m_dnsQueue.tryPush(message)) {
+        m_dnsOverflows.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void CaptureWorker::processTls(const PacketDescriptor &descriptor, const CaptureEngine::FrameHeader &header,
+                               const quint8 *frame)
+{
+    const quint8 *payload = frame + descriptor.payloadOffset(header.captureLength);
+    const quint32 length = descriptor.availablePayloadLength();
+    const bool truncated = descriptor.capturedPayloadLength < descriptor.payloadLength;
+
+    if (TlsParser::isClientHelloStart(payload, length)) {
+        const quint32 helloLength = TlsParser::helloLength(payload, length);
+        if (helloLength <= length) {
+            pushClientHello(descriptor, payload, helloLength);
+            return;
+        }
+        if (truncated || helloLength > TlsParser::MaxHelloLength) {
+            return;
+        }
+        bool reversed = false;
+        const FlowKey key = FlowKey::make(descriptor.srcAddr, descriptor.srcPort, descriptor.dstAddr,
+                                          descriptor.dstPort, descriptor.protocol, &reversed);
+        PendingHello *pending = m_pendingHellos.findOrInsert(key);
+        if (!pending) {
+            // Make room from hellos whose flows went quiet
+            const quint64 now = descriptor.timestampUs;
+            m_pendingHellos.removeIf([now](const FlowKey &, PendingHello &hello) {
+                return now - hello.startedUs > PendingHelloTimeoutUs;
+            });
+            pending = m_pendingHellos.findOrInsert(key);
+            if (!pending) {
+                return;
+            }
+        }
+        pending->startedUs = descriptor.timestampUs;
+        pending->nextSeq = descriptor.tcpSeq + length;
+        pending->helloLength = helloLength;
+        pending->reversed = reversed;
+        pending->segments = 1;
+        pending->data.assign(payload, payload + length);
+        return;
+    }
+
+    // Nothing to look up once the handshakes in flight are done
+    if (m_pendingHellos.size() == 0) {
+        return;
+    }
+    bool reversed = false;
+    const FlowKey key = FlowKey::make(descriptor.srcAddr, descriptor.srcPort, descriptor.dstAddr,
+                                      descriptor.dstPort, descriptor.protocol, &reversed);
+    PendingHello *pending = m_pendingHellos.find(key);
+    if (!pending || pending->reversed != reversed) {
+        return;
+    }
+    const qint32 offset = qint32(descriptor.tcpSeq - pending->nextSeq);
+    if (offset < 0 && descriptor.timestampUs - pending->startedUs <= PendingHelloTimeoutUs) {
+        return; // A retransmission of what we already have
+    }
+    if (offset != 0 || truncated || ++pending->segments > MaxHelloSegments ||
+        descriptor.timestampUs - pending->startedUs > PendingHelloTimeoutUs) {
+        m_pendingHellos.remove(key);
+        return;
+    }
+    const quint32 needed = pending->helloLength - quint32(pending->data.size());
+    pending->data.insert(pending->data.end(), payload, payload + qMin(length, needed));
+    pending->nextSeq += length;
+    if (length >= needed) {
+        pushClientHello(descriptor, pending->data.data(), pending->helloLength);
+        m_pendingHellos.remove(key);
+    }
+}
+
+void CaptureWorker::pushClientHello(const PacketDescriptor &descriptor, const quint8 *data, quint32 length)
+{
+    TlsClientHello hello;
+    if (!TlsParser::parse(data, length, &hello)) {
+        return;
+    }
+    // Only clients send a ClientHello, so the sender is the client
+    hello.timestampUs = descriptor.timestampUs;
+    hello.client = descriptor.srcAddr;
+    hello.server = descriptor.dstAddr;
+    hello.clientPort = descriptor.srcPort;
+    hello.serverPort = descriptor.dstPort;
+    if (!m_tlsQueue.tryPush(hello)) {
+        m_tlsOverflows.fetch_add(1, std::memory_order_relaxed);
+    }
+}
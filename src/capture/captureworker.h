@@ -0,0 +1,198 @@
+#ifndef CAPTUREWORKER_H
+#define CAPTUREWORKER_H
+
+#include "captureengine.h"
+#include "capturerecorder.h"
+#include "dnsparser.h"
+#include "flowtable.h"
+#include "fragmenttracker.h"
+#include "httplatencytracker.h"
+#include "packetdecoder.h"
+#include "packetdescriptor.h"
+#include "packetsampler.h"
+#include "protocolclassifier.h"
+#include "spscring.h"
+#include "tcpreassembler.h"
+#include "tlsparser.h"
+#include "tunnelendpointtable.h"
+#include <QFuture>
+#include <QList>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include <vector>
+
+/**
+ * @brief The CaptureWorker class captures on one interface and feeds the packet processing workers.
+ *
+ * Each worker owns a CaptureEngine for its interface, a capture thread and one
+ * single-producer ring per packet processing worker that carries decoded PacketDescriptors
+ * onwards. With more than one ring, a descriptor goes to the ring picked by its symmetric
+ * flow hash, so each flow always reaches the same processing worker. Rings of different
+ * workers can share one RingDoorbell so that a single consumer can sleep on all of them at
+ * once. Descriptors are stamped with the worker's interface index.
+ * With a CaptureRecorder attached, every frame is also copied to the recorder's spool.
+ * DNS messages on port 53 and TLS ClientHellos are decoded here, while the payload is at
+ * hand, and queued separately for the merging thread. A hello is parsed in place when it fits
+ * its segment; only one that spans segments is copied until it is complete.
+ * With sampling on, frames the sampler skips go no further than the recorder. Later IP
+ * fragments get their ports from the first fragment before they are hashed to a ring.
+ * TCP streams that look like HTTP/1.x are reassembled up to the stream depth and their
+ * request latencies queued like the DNS messages.
+ * With tunnel decapsulation on, packets inside VXLAN, GENEVE, GRE and IP-in-IP tunnels are
+ * described, hashed and analysed by their inner headers.
+ */
+class CaptureWorker
+{
+public:
+    // Backpressure between the capture thread and the processing workers, summed over the rings
+    struct QueueStatistics {
+        quint64 depth;          // Descriptors waiting to be processed
+        quint64 capacity;
+        quint64 highWatermark;  // Deepest the queue has been since capture started
+        quint64 enqueued;
+        quint64 overflows;      // Descriptors dropped because the queue was full
+        quint64 dnsOverflows;   // DNS messages dropped because their queue was full
+        quint64 tlsOverflows;   // ClientHellos dropped because their queue was full
+
+        QueueStatistics() : depth(0), capacity(0), highWatermark(0),
+                           enqueued(0), overflows(0), dnsOverflows(0), tlsOverflows(0) {}
+    };
+
+    enum Inspection : quint8 {
+        InspectDns = 0x1,      // Passive DNS from port 53 payloads
+        InspectTls = 0x2,      // ClientHello fingerprints
+        InspectProtocol = 0x4  // Application protocol from the first payload bytes
+    };
+
+    // One ring of queueCapacity per doorbell, in processing worker order
+    CaptureWorker(quint8 interfaceIndex, size_t queueCapacity, const QList<RingDoorbell *> &doorbells);
+    ~CaptureWorker();
+
+    CaptureWorker(const CaptureWorker &) = delete;
+    CaptureWorker &operator=(const CaptureWorker &) = delete;
+
+    // Creates the engine for config.backend, opens config.interfaceName and picks the decoder
+    bool open(const CaptureEngine::Config &config);
+    void close();
+
+    // Compiles and installs a BPF filter, also while the capture is running
+    bool setFilter(const QString &expression);
+    QString filter() const;
+
+    // Also spool every frame to the given spool of the recorder; call before start(),
+    // nullptr stops recording
+    void setRecorder(CaptureRecorder *recorder, int spoolIndex);
+    // Where the outer addresses of decapsulated tunnels are numbered, shared by all workers;
+    // call before start(). Without one, tunnelled packets carry no outer addresses.
+    void setTunnelEndpoints(TunnelEndpointTable *table)
+    {
+        m_tunnelEndpoints = table;
+        m_tunnelEndpointCache.clear();
+    }
+
+    // Any thread, also while the capture is running; applies from the next frame
+    void setSampling(PacketSampler::Mode mode, int rate) { m_sampler.configure(mode, rate); }
+    PacketSampler::Setting sampling() const { return m_sampler.setting(); }
+    // Bytes per direction reassembled for stream analysis, 0 for none. Any thread; applies
+    // to streams opened from then on.
+    void setStreamDepth(quint32 bytes) { m_reassembler.setDepth(bytes); }
+    // Decode tunnelled packets by their inner headers. Any thread; applies from the next frame.
+    void setTunnelDecapsulation(bool enabled) { m_decapsulate.store(enabled, std::memory_order_relaxed); }
+    // Payload consumers run on the capture thread, Inspection flags or'ed together; none by
+    // default. Any thread; applies from the next frame.
+    void setInspection(quint8 inspection) { m_inspection.store(inspection, std::memory_order_relaxed); }
+
+    // Runs the capture loop on a pool thread until stop() or an error
+    void start();
+    void stop();
+    bool isRunning() const;
+    // The capture loop has returned since open(), e.g. at the end of a replayed file.
+    // Everything it pushed is in the queue by the time this is true.
+    bool hasFinished() const { return m_finished.load(std::memory_order_acquire); }
+
+    quint8 interfaceIndex() const { return m_interfaceIndex; }
+    QString interfaceName() const { return m_config.interfaceName; }
+    int dataLinkType() const { return m_engine ? m_engine->dataLinkType() : -1; }
+    QString errorString() const { return m_errorString; }
+
+    // Consumer side of the rings, each for its processing worker only
+    int queueCount() const { return m_queues.size(); }
+    SpscRing<PacketDescriptor> *queue(int index) const { return m_queues.at(index); }
+    // Consumer side for the thread that owns the passive DNS table
+    SpscRing<DnsMessage> *dnsQueue() { return &m_dnsQueue; }
+    SpscRing<TlsClientHello> *tlsQueue() { return &m_tlsQueue; }
+    SpscRing<HttpTransaction> *httpQueue() { return m_httpLatency.queue(); }
+
+    CaptureEngine::Statistics captureStatistics() const;
+    QueueStatistics queueStatistics() const;
+    FragmentTracker::Statistics fragmentStatistics() const { return m_fragments.statistics(); }
+    TcpReassembler::Statistics reassemblyStatistics() const { return m_reassembler.statistics(); }
+    HttpLatencyTracker::Statistics httpStatistics() const { return m_httpLatency.statistics(); }
+
+private:
+    // A ClientHello that did not fit its first segment, collected until it is complete
+    struct PendingHello {
+        quint64 startedUs;
+        quint32 nextSeq;     // Client sequence number the next segment must start at
+        quint32 helloLength; // Bytes from the record header to the end of the hello
+        bool reversed;       // The client is side B of the flow key
+        quint8 segments;
+        std::vector<quint8> data;
+
+        PendingHello() : startedUs(0), nextSeq(0), helloLength(0), reversed(false), segments(0) {}
+    };
+
+    static void frameHandler(void *user, const CaptureEngine::FrameHeader &header, const quint8 *frame);
+    void processFrame(const CaptureEngine::FrameHeader &header, const quint8 *frame);
+    SpscRing<PacketDescriptor> *queueFor(const PacketDescriptor &descriptor) const;
+    void push(SpscRing<PacketDescriptor> *queue, const PacketDescriptor &descriptor);
+    void processDns(const PacketDescriptor &descriptor, const CaptureEngine::FrameHeader &header,
+                    const quint8 *frame);
+    void processTls(const PacketDescriptor &descriptor, const CaptureEngine::FrameHeader &header,
+                    const quint8 *frame);
+    void pushClientHello(const PacketDescriptor &descriptor, const quint8 *data, quint32 length);
+    quint16 tunnelEndpointIndex(const TunnelEndpoints &endpoints);
+    void classifyPayload(PacketDescriptor *descriptor, const quint8 *payload, quint32 length);
+
+    // Payload packets classified for a flow, in a direct-mapped table by flow hash. A flow that
+    // loses its slot to another one is only classified again, which the shard ignores.
+    struct ClassifiedFlow {
+        quint32 tag;           // High half of the flow hash, 0 for an unused slot
+        quint8 payloadPackets; // ProtocolClassifier::MaxPayloadPackets once recognised
+    };
+
+    quint8 m_interfaceIndex;
+    CaptureEngine::Config m_config;
+    CaptureEngine *m_engine;
+    PacketDecoder::DecodeFunction m_decodeFunction; // Specialised for the handle's link type
+    PacketDecoder::DecodeFunction m_tunnelDecodeFunction; // The same, decapsulating tunnels
+    std::atomic<bool> m_decapsulate;
+    std::atomic<quint8> m_inspection;
+    ProtocolClassifier m_classifier;
+    std::vector<ClassifiedFlow> m_classifiedFlows; // Capture thread only
+    PacketSampler m_sampler;
+    QList<SpscRing<PacketDescriptor> *> m_queues;
+    SpscRing<DnsMessage> m_dnsQueue;
+    SpscRing<TlsClientHello> m_tlsQueue;
+    FlowHashMap<PendingHello> m_pendingHellos; // Capture thread only
+    TunnelEndpointTable *m_tunnelEndpoints; // Only changed while the capture thread is stopped
+    FlowHashMap<quint16> m_tunnelEndpointCache; // Capture thread only: pairs already numbered
+    FragmentTracker m_fragments;
+    TcpReassembler m_reassembler;
+    HttpLatencyTracker m_httpLatency; // Consumer of m_reassembler
+    CaptureRecorder *m_recorder; // Read by the capture thread, only changed while it is stopped
+    int m_recorderSpool;
+    QThreadPool m_threadPool; // Own thread so long-running captures never exhaust the global pool
+    QFuture<void> m_future;
+    QString m_errorString;
+
+    std::atomic<quint64> m_enqueued;
+    std::atomic<quint64> m_overflows;
+    std::atomic<quint64> m_dnsOverflows;
+    std::atomic<quint64> m_tlsOverflows;
+    std::atomic<quint64> m_highWatermark; // Deepest of the rings
+    std::atomic<bool> m_finished;
+};
+
+#endif // CAPTUREWORKER_H
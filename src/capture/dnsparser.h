@@ -0,0 +1,188 @@
+#ifndef DNSPARSER_H
+#define DNSPARSER_H
+
+#include "ipaddress.h"
+#include <QtGlobal>
+#include <cstring>
+
+/**
+ * @brief The DnsMessage struct is what the capture path keeps of one DNS query or response.
+ *
+ * Fixed-size so that it can travel through an SpscRing without allocating: the question name
+ * in lower case and up to MaxAddresses A/AAAA answers with their TTLs.
+ */
+struct DnsMessage {
+    static constexpr int MaxNameLength = 253; // Presentation form, without the trailing dot
+    static constexpr int MaxAddresses = 8;
+
+    quint64 timestampUs;
+    IpAddress client;
+    IpAddress server;
+    quint16 clientPort;
+    quint16 id;
+    bool response;
+    quint8 responseCode;   // RCODE, 0 = NOERROR, 2 = SERVFAIL, 3 = NXDOMAIN
+    quint16 questionType;
+    quint8 addressCount;
+    quint8 nameLength;
+    char name[MaxNameLength + 1];
+    IpAddress addresses[MaxAddresses];
+    quint32 ttls[MaxAddresses]; // Seconds
+
+    DnsMessage() : timestampUs(0), clientPort(0), id(0), response(false), responseCode(0),
+                   questionType(0), addressCount(0), nameLength(0)
+    {
+        name[0] = 0;
+        std::memset(ttls, 0, sizeof(ttls));
+    }
+};
+
+/**
+ * @brief The DnsParser class decodes the DNS messages seen on port 53.
+ *
+ * Like PacketDecoder it is bounds-checked against the captured bytes, reads byte-wise and
+ * never allocates, so it can run on the capture thread. Only standard queries with a single
+ * question are decoded. Answers cut off by the snap length are skipped, not rejected, so a
+ * headers-only capture still yields the records that fit.
+ */
+class DnsParser
+{
+public:
+    static const quint16 Port = 53;
+    static const quint32 HeaderLength = 12;
+    static const quint16 TypeA = 1;
+    static const quint16 TypeCname = 5;
+    static const quint16 TypeAaaa = 28;
+    static const quint16 ClassIn = 1;
+    static const int CaptureLength = 512; // Payload bytes to capture, the classic UDP message limit
+    static const int MaxPointerJumps = 16;
+
+    enum ResponseCode : quint8 {
+        NoError = 0,
+        ServerFailure = 2,
+        NameError = 3 // NXDOMAIN
+    };
+
+    // Fills in everything but the timestamp and the endpoints. Returns false for anything that
+    // is not a well-formed standard query or response.
+    static bool parse(const quint8 *data, quint32 length, DnsMessage *out)
+    {
+        if (length < HeaderLength) {
+            return false;
+        }
+        const quint16 flags = readBe16(data + 2);
+        const quint8 opcode = quint8((flags >> 11) & 0x0F);
+        if (opcode != 0 || readBe16(data + 4) != 1) {
+            return false;
+        }
+        out->id = readBe16(data);
+        out->response = (flags & 0x8000) != 0;
+        out->responseCode = quint8(flags & 0x000F);
+        out->addressCount = 0;
+
+        quint32 offset = HeaderLength;
+        if (!readName(data, length, &offset, out->name, &out->nameLength) || offset + 4 > length) {
+            return false;
+        }
+        out->questionType = readBe16(data + offset);
+        offset += 4;
+        if (!out->response) {
+            return true;
+        }
+
+        // Every address in the answer section is taken as an address of the question name,
+        // which is what the application asked for, whatever CNAMEs led there
+        const quint16 answerCount = readBe16(data + 6);
+        for (quint16 i = 0; i < answerCount && out->addressCount < DnsMessage::MaxAddresses; ++i) {
+            if (!readName(data, length, &offset, nullptr, nullptr) || offset + 10 > length) {
+                break;
+            }
+            const quint16 type = readBe16(data + offset);
+            const quint16 recordClass = readBe16(data + offset + 2);
+            const quint32 ttl = readBe32(data + offset + 4);
+            const quint16 dataLength = readBe16(data + offset + 8);
+            offset += 10;
+            if (offset + dataLength > length) {
+                break;
+            }
+            if (recordClass == ClassIn && type == TypeA && dataLength == 4) {
+                quint32 networkOrder;
+                std::memcpy(&networkOrder, data + offset, 4);
+                out->addresses[out->addressCount] = IpAddress::fromIPv4(networkOrder);
+                out->ttls[out->addressCount++] = ttl;
+            } else if (recordClass == ClassIn && type == TypeAaaa && dataLength == 16) {
+                out->addresses[out->addressCount] = IpAddress::fromIPv6(data + offset);
+                out->ttls[out->addressCount++] = ttl;
+            }
+            offset += dataLength;
+        }
+        return true;
+    }
+
+private:
+    static quint16 readBe16(const quint8 *p)
+    {
+        return quint16((quint16(p[0]) << 8) | p[1]);
+    }
+
+    static quint32 readBe32(const quint8 *p)
+    {
+        return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | p[3];
+    }
+
+    // Reads the name at *offset and moves *offset past it, following compression pointers.
+    // With name set, the dotted lower-case form is written there and its length to nameLength.
+    static bool readName(const quint8 *data, quint32 length, quint32 *offset, char *name, quint8 *nameLength)
+    {
+        quint32 position = *offset;
+        quint32 end = 0; // Where the name ends in the record, once a pointer was followed
+        int jumps = 0;
+        int written = 0;
+        while (true) {
+            if (position >= length) {
+                return false;
+            }
+            const quint8 label = data[position];
+            if (label == 0) {
+                ++position;
+                break;
+            }
+            if ((label & 0xC0) == 0xC0) {
+                if (position + 1 >= length || ++jumps > MaxPointerJumps) {
+                    return false;
+                }
+                if (end == 0) {
+                    end = position + 2;
+                }
+                position = (quint32(label & 0x3F) << 8) | data[position + 1];
+                continue;
+            }
+            if ((label & 0xC0) != 0 || position + 1 + label > length) {
+                return false;
+            }
+            if (written + (written > 0 ? 1 : 0) + label > DnsMessage::MaxNameLength) {
+                return false;
+            }
+            if (name) {
+                if (written > 0) {
+                    name[written++] = '.';
+                }
+                for (quint8 i = 0; i < label; ++i) {
+                    const char c = char(data[position + 1 + i]);
+                    name[written++] = (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+                }
+            } else {
+                written += (written > 0 ? 1 : 0) + label;
+            }
+            position += 1 + quint32(label);
+        }
+        *offset = end != 0 ? end : position;
+        if (name) {
+            name[written] = 0;
+            *nameLength = quint8(written);
+        }
+        return true;
+    }
+};
+
+#endif // DNSPARSER_H
@@ -0,0 +1,534 @@
+#include "flowshard.h"
+#include "packetsampler.h"
+#include "protocolclassifier.h"
+
+// A packet seen again on a second interface within this long is the same packet captured
+// twice, e.g. on a bridge and its member port
+static const quint64 DuplicateWindowUs = 10000;
+
+// Flows without packets for this long are dropped from the flow table
+static const quint64 FlowIdleTimeoutUs = 120ull * 1000000;
+
+// TCP connections that ended only linger for late retransmissions
+static const quint64 ClosedFlowTimeoutUs = 30ull * 1000000;
+
+FlowShard::FlowShard(int index, size_t maxFlows)
+    : m_index(index)
+    , m_flowTable(maxFlows)
+    , m_delta(new Delta())
+    , m_deltaGeneration(1)
+    , m_lastFlowExpiryUs(0)
+    , m_lastPublish(std::chrono::steady_clock::now())
+    , m_deltas(DeltaQueueCapacity)
+    , m_attributionChanged(false)
+{
+}
+
+FlowShard::~FlowShard()
+{
+    delete m_delta;
+    while (Delta *delta = takeDelta()) {
+        delete delta;
+    }
+}
+
+bool FlowShard::hasInput() const
+{
+    for (const SpscRing<PacketDescriptor> *input : m_inputs) {
+        if (!input->isEmpty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FlowShard::setAttribution(const std::shared_ptr<const Attribution> &attribution)
+{
+    std::lock_guard<std::mutex> locker(m_attributionMutex);
+    m_pendingAttribution = attribution;
+    m_attributionChanged.store(true, std::memory_order_release);
+}
+
+void FlowShard::refreshAttribution()
+{
+    std::lock_guard<std::mutex> locker(m_attributionMutex);
+    m_attribution = m_pendingAttribution;
+    m_attributionChanged.store(false, std::memory_order_relaxed);
+}
+
+size_t FlowShard::processInputs()
+{
+    PacketDescriptor batch[BatchSize];
+
+    // One batch from each ring per round so a busy interface cannot starve the others
+    size_t total = 0;
+    for (SpscRing<PacketDescriptor> *input : m_inputs) {
+        const size_t count = input->popBatch(batch, BatchSize);
+        if (count > 0) {
+            process(batch, count);
+            total += count;
+        }
+    }
+    return total;
+}
+
+void FlowShard::process(const PacketDescriptor *packets, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    // A pointer swap between batches, never per packet
+    if (m_attributionChanged.load(std::memory_order_acquire)) {
+        refreshAttribution();
+    }
+    const Attribution *attribution = m_attribution.get();
+    Delta &delta = *m_delta;
+
+    for (size_t i = 0; i < count; ++i) {
+        const PacketDescriptor &packet = packets[i];
+        InterfaceCounters &counters = delta.interfaces[packet.interfaceIndex % MaxInterfaces];
+        delta.packets++;
+        delta.bytes += packet.wireLength;
+        if (packet.tunnel.depth > 0) {
+            delta.tunnelledPackets++;
+        }
+        // A sampled packet stands for sampleRate packets in every count above the flow
+        const quint64 weight = packet.sampleRate;
+        const quint64 weightedBytes = weight * packet.wireLength;
+        if (packet.protocol != 6 && packet.protocol != 17) {
+            // Not kept as flows, so each packet is its own sampling unit
+            const int outbound = attribution && attribution->localAddresses.contains(packet.srcAddr) ? 1 : 0;
+            counters.packets[outbound] += weight;
+            counters.bytes[outbound] += weightedBytes;
+            counters.variance[outbound].add(packet.sampleRate, packet.wireLength);
+            continue;
+        }
+
+        // One hash probe per packet; both directions map to the same entry
+        bool reversed = false;
+        FlowKey key = FlowKey::make(packet.srcAddr, packet.srcPort, packet.dstAddr, packet.dstPort,
+                                    packet.protocol, &reversed);
+        bool inserted = false;
+        FlowEntry *flow = m_flowTable.findOrInsert(key, &inserted);
+        if (!flow) {
+            delta.flowTableOverflows++;
+            continue;
+        }
+
+        // Work out which endpoint is ours once per flow, and again only if our addresses change
+        if (attribution && flow->localAddressGeneration != attribution->localAddresses.generation()) {
+            flow->localAddressGeneration = attribution->localAddresses.generation();
+            flow->localSide = attribution->localAddresses.contains(key.addressA) ? 0
+                            : attribution->localAddresses.contains(key.addressB) ? 1 : -1;
+        }
+        const bool outbound = flow->isOutbound(reversed);
+        const int side = reversed ? 1 : 0;
+        // Flow sampling keeps whole flows: the unit is the flow's side, as far as it got before
+        // this packet, and its own counts need no scaling
+        const bool wholeFlows = packet.sampling == PacketSampler::FlowHash;
+        const quint64 unitPackets = wholeFlows ? flow->packets[side] : 0;
+        const quint64 unitBytes = wholeFlows ? flow->bytes[side] : 0;
+        const quint64 flowWeight = wholeFlows ? 1 : weight;
+        counters.packets[outbound ? 1 : 0] += weight;
+        counters.bytes[outbound ? 1 : 0] += weightedBytes;
+        counters.variance[outbound ? 1 : 0].add(packet.sampleRate, packet.wireLength, unitPackets, unitBytes);
+
+        if (inserted) {
+            flow->firstSeenUs = packet.timestampUs;
+            flow->tunnel = packet.tunnel;
+        }
+        // Each interface counts what it saw, but a packet is only counted once
+        if (isDuplicate(packet, key, side)) {
+            delta.duplicatePackets++;
+            continue;
+        }
+        if (packet.timestampUs > flow->lastSeenUs) {
+            flow->lastSeenUs = packet.timestampUs;
+        }
+        flow->packets[side] += flowWeight;
+        flow->bytes[side] += flowWeight * packet.wireLength;
+        flow->rate.add(packet.timestampUs, side, flowWeight * packet.wireLength);
+        if (!wholeFlows) {
+            flow->variance[side].add(packet.sampleRate, packet.wireLength);
+        }
+        if (flow->updateGeneration != m_deltaGeneration) {
+            flow->updateGeneration = m_deltaGeneration;
+            m_touchedFlows.push_back(key);
+        }
+
+        // Resolve the owning process once per socket table generation
+        if (attribution && flow->processId <= 0 && flow->processGeneration != attribution->socketGeneration) {
+            attributeFlow(key, flow);
+        }
+        // Traffic between two hosts that are both remote has no local side and is
+        // counted as received
+        ProcessCounters *process = flow->processId > 0 ? &delta.processes[flow->processId] : nullptr;
+        if (process) {
+            if (outbound) {
+                process->packetsSent += weight;
+                process->bytesSent += weightedBytes;
+                process->sentVariance.add(packet.sampleRate, packet.wireLength, unitPackets, unitBytes);
+            } else {
+                process->packetsReceived += weight;
+                process->bytesReceived += weightedBytes;
+                process->receivedVariance.add(packet.sampleRate, packet.wireLength, unitPackets, unitBytes);
+            }
+        }
+
+        // Packet sampling leaves gaps in every connection that would read as loss, and rarely
+        // keeps a whole handshake. Later fragments have no TCP header.
+        if (packet.protocol == 6 && packet.sampling != PacketSampler::EveryNth && !packet.isLaterFragment()) {
+            TcpStatistics *processTcp = process ? &process->tcp : nullptr;
+            if (packet.tcpFlags != 0) {
+                trackTcp(packet, key, flow, reversed, processTcp);
+            }
+            measureTcp(packet, flow, reversed, processTcp);
+        }
+
+        // The capture thread classified the payload; the flow keeps the first answer
+        if (packet.payloadLength > 0 && flow->appProtocol == ProtocolClassifier::Unknown &&
+            flow->classifiedPackets < ProtocolClassifier::MaxPayloadPackets) {
+            flow->classifiedPackets++;
+            flow->appProtocol = packet.appProtocol;
+        }
+    }
+
+    if (delta.firstPacketUs == 0) {
+        delta.firstPacketUs = packets[0].timestampUs;
+    }
+
+    // Expire idle flows about once a second of capture time. Batches from different
+    // interfaces can arrive slightly out of time order, so never step the clock back.
+    const quint64 now = packets[count - 1].timestampUs;
+    delta.lastPacketUs = qMax(delta.lastPacketUs, now);
+    if (now >= m_lastFlowExpiryUs + 1000000) {
+        m_lastFlowExpiryUs = now;
+        m_flowTable.removeIf([now, &delta](const FlowKey &key, FlowEntry &flow) {
+            const bool ended = flow.tcpState == FlowEntry::TcpClosed || flow.tcpState == FlowEntry::TcpReset;
+            const quint64 timeout = ended ? ClosedFlowTimeoutUs : FlowIdleTimeoutUs;
+            if (now > flow.lastSeenUs && now - flow.lastSeenUs > timeout) {
+                if (flow.isTcpOpen()) {
+                    ConnectionEvent event;
+                    event.type = ConnectionEvent::TimedOut;
+                    event.key = key;
+                    event.entry = flow;
+                    delta.connectionEvents.push_back(event);
+                }
+                delta.expiredFlows.push_back(key);
+                return true;
+            }
+            return false;
+        });
+    }
+}
+
+static quint64 mixIdentity(quint64 x)
+{
+    // Final mixer from MurmurHash3
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// A copy of a packet travels in the same direction and carries the same IPv4 identification or
+// TCP sequence numbers, and the same length. Different packets of one flow that show up on two
+// interfaces at once, e.g. over two links of a bond, are all counted.
+bool FlowShard::isDuplicate(const PacketDescriptor &packet, const FlowKey &key, int side)
+{
+    // One input ring per capture interface
+    if (m_inputs.size() < 2) {
+        return false;
+    }
+    // IPv6 UDP, and IPv4 UDP sent without an identification, can't be told apart from the
+    // flow's next packet of the same length
+    const bool tcp = packet.protocol == 6 && !packet.isLaterFragment();
+    if (!tcp && packet.fragmentId == 0) {
+        return false;
+    }
+    if (m_recentPackets.empty()) {
+        m_recentPackets.resize(RecentPacketSlots);
+    }
+
+    const quint64 ipIdentity = quint64(side) << 63 | quint64(packet.fragment) << 32 | packet.fragmentId;
+    quint64 identity = mixIdentity(key.hash() ^ ipIdentity);
+    identity = mixIdentity(identity ^ (quint64(packet.wireLength) << 8 | packet.tcpFlags));
+    if (tcp) {
+        identity = mixIdentity(identity ^ (quint64(packet.tcpSeq) << 32 | packet.tcpAck));
+    }
+    identity |= 1; // Never 0, which marks an unused slot
+
+    RecentPacket &recent = m_recentPackets[(identity >> 32) % RecentPacketSlots];
+    if (recent.identity == identity && recent.interfaceIndex != packet.interfaceIndex) {
+        const quint64 gap = packet.timestampUs > recent.timestampUs ? packet.timestampUs - recent.timestampUs
+                                                                    : recent.timestampUs - packet.timestampUs;
+        if (gap <= DuplicateWindowUs) {
+            return true;
+        }
+    }
+    recent.identity = identity;
+    recent.timestampUs = packet.timestampUs;
+    recent.interfaceIndex = packet.interfaceIndex;
+    return false;
+}
+
+// Exact socket match first, then a bound but unconnected socket on either endpoint,
+// then a wildcard-address listener
+void FlowShard::attributeFlow(const FlowKey &key, FlowEntry *flow)
+{
+    const FlowHashMap<qint64> &sockets = m_attribution->sockets;
+    flow->processGeneration = m_attribution->socketGeneration;
+
+    if (const qint64 *pid = sockets.find(key)) {
+        flow->processId = *pid;
+        return;
+    }
+
+    const IpAddress any;
+    const FlowKey candidates[4] = {
+        FlowKey::make(key.addressA, key.portA, any, 0, key.protocol),
+        FlowKey::make(key.addressB, key.portB, any, 0, key.protocol),
+        FlowKey::make(any, key.portA, any, 0, key.protocol),
+        FlowKey::make(any, key.portB, any, 0, key.protocol)
+    };
+    for (const FlowKey &candidate : candidates) {
+        if (const qint64 *pid = sockets.find(candidate)) {
+            flow->processId = *pid;
+            return;
+        }
+    }
+}
+
+// Follows a TCP connection through its handshake and teardown. Retransmitted SYNs and FINs
+// leave the state alone; a handshake that is refused or never completes reports nothing.
+void FlowShard::trackTcp(const PacketDescriptor &packet, const FlowKey &key, FlowEntry *flow, bool reversed,
+                         TcpStatistics *processTcp)
+{
+    const quint8 flags = packet.tcpFlags;
+    const qint8 side = reversed ? 1 : 0; // Side that sent this packet
+    ConnectionEvent::Type type;
+
+    if (flags & PacketDescriptor::TcpRst) {
+        const bool open = flow->isTcpOpen();
+        if (flow->tcpState != FlowEntry::TcpUntracked && flow->tcpState != FlowEntry::TcpClosed) {
+            flow->tcpState = FlowEntry::TcpReset;
+        }
+        if (!open) {
+            return;
+        }
+        type = ConnectionEvent::Reset;
+    } else if (flags & PacketDescriptor::TcpSyn) {
+        if (!(flags & PacketDescriptor::TcpAck)) {
+            // A SYN once the previous connection on this 5-tuple is gone starts a new one,
+            // which only counts from here
+            if (flow->tcpState != FlowEntry::TcpUntracked && flow->tcpState != FlowEntry::TcpClosed &&
+                flow->tcpState != FlowEntry::TcpReset) {
+                return;
+            }
+            flow->tcpState = FlowEntry::TcpSynSent;
+            flow->tcpClient = side;
+            flow->tcpFinSides = 0;
+            flow->firstSeenUs = packet.timestampUs;
+            flow->packets[side] = 1;
+            flow->bytes[side] = packet.wireLength;
+            flow->packets[1 - side] = 0;
+            flow->bytes[1 - side] = 0;
+            flow->tcp = TcpFlowMetrics();
+            flow->appProtocol = ProtocolClassifier::Unknown;
+            flow->classifiedPackets = 0;
+        } else if (flow->tcpState == FlowEntry::TcpSynSent && side != flow->tcpClient) {
+            flow->tcpState = FlowEntry::TcpSynReceived;
+        }
+        return;
+    } else if ((flow->tcpState == FlowEntry::TcpSynSent || flow->tcpState == FlowEntry::TcpSynReceived) &&
+               side == flow->tcpClient && (flags & PacketDescriptor::TcpAck)) {
+        // The client's ACK completes the handshake, even if the SYN-ACK was not captured. SYN
+        // to that ACK is one round trip wherever the capture point is.
+        flow->tcpState = FlowEntry::TcpEstablished;
+        type = ConnectionEvent::Established;
+        if (packet.timestampUs > flow->firstSeenUs) {
+            const quint64 rttUs = packet.timestampUs - flow->firstSeenUs;
+            flow->tcp.handshakeRttUs = quint32(qMin(rttUs, quint64(0xFFFFFFFF)));
+            m_delta->tcp.handshakeRtt.add(rttUs);
+            if (processTcp) {
+                processTcp->handshakeRtt.add(rttUs);
+            }
+        }
+    } else if ((flags & PacketDescriptor::TcpFin) && flow->isTcpOpen()) {
+        flow->tcpFinSides |= quint8(1 << side);
+        if (flow->tcpFinSides != 3) {
+            flow->tcpState = FlowEntry::TcpClosing;
+            return;
+        }
+        flow->tcpState = FlowEntry::TcpClosed;
+        type = ConnectionEvent::Closed;
+    } else {
+        return;
+    }
+
+    ConnectionEvent event;
+    event.type = type;
+    event.key = key;
+    event.entry = *flow;
+    m_delta->connectionEvents.push_back(event);
+}
+
+// Follows the sequence space of both directions for retransmissions, gaps and zero windows,
+// and times data segments of the measured side against the acknowledgements they get
+void FlowShard::measureTcp(const PacketDescriptor &packet, FlowEntry *flow, bool reversed, TcpStatistics *processTcp)
+{
+    TcpFlowMetrics &tcp = flow->tcp;
+    TcpStatistics &total = m_delta->tcp;
+    const int side = reversed ? 1 : 0;
+    const quint8 sideBit = quint8(1 << side);
+    const quint8 flags = packet.tcpFlags;
+    const bool measured = side == flow->measuredSide();
+
+    // SYN and FIN take up a sequence number each, like a byte of data
+    const quint32 length = packet.payloadLength + ((flags & PacketDescriptor::TcpSyn) ? 1 : 0) +
+                           ((flags & PacketDescriptor::TcpFin) ? 1 : 0);
+    if (length > 0 && !(flags & PacketDescriptor::TcpRst)) {
+        const quint32 end = packet.tcpSeq + length;
+        if (!(tcp.seqValid & sideBit)) {
+            tcp.seqValid |= sideBit;
+            tcp.nextSeq[side] = end;
+        } else {
+            const qint32 ahead = qint32(packet.tcpSeq - tcp.nextSeq[side]);
+            if (ahead < 0) {
+                // A keepalive resends the last byte before the next sequence number
+                const bool keepAlive = packet.payloadLength <= 1 && ahead == -1;
+                if (!keepAlive) {
+                    tcp.retransmissions++;
+                    total.retransmissions++;
+                    if (processTcp) {
+                        processTcp->retransmissions++;
+                    }
+                    // Karn: a retransmitted probe could be acknowledged for either copy
+                    if (measured && tcp.probeUs != 0 && qint32(packet.tcpSeq - tcp.probeAck) < 0) {
+                        tcp.probeUs = 0;
+                    }
+                }
+                if (qint32(end - tcp.nextSeq[side]) > 0) {
+                    tcp.nextSeq[side] = end;
+                }
+            } else {
+                if (ahead > 0) {
+                    tcp.outOfOrder++;
+                    total.outOfOrder++;
+                    if (processTcp) {
+                        processTcp->outOfOrder++;
+                    }
+                }
+                tcp.nextSeq[side] = end;
+                if (measured && tcp.probeUs == 0) {
+                    tcp.probeAck = end;
+                    tcp.probeUs = packet.timestampUs;
+                }
+            }
+        }
+        if (packet.payloadLength > 0) {
+            tcp.dataSegments++;
+            total.dataSegments++;
+            if (processTcp) {
+                processTcp->dataSegments++;
+            }
+        }
+    }
+
+    // The other side acknowledging everything up to the probe closes it
+    if (!measured && tcp.probeUs != 0 && (flags & PacketDescriptor::TcpAck) &&
+        qint32(packet.tcpAck - tcp.probeAck) >= 0) {
+        if (packet.timestampUs >= tcp.probeUs) {
+            const quint64 rttUs = packet.timestampUs - tcp.probeUs;
+            tcp.addRttSample(quint32(qMin(rttUs, quint64(0xFFFFFFFF))));
+            total.rtt.add(rttUs);
+            if (processTcp) {
+                processTcp->rtt.add(rttUs);
+            }
+        }
+        tcp.probeUs = 0;
+    }
+
+    // Count a zero window once when a side starts advertising it
+    if (!(flags & (PacketDescriptor::TcpSyn | PacketDescriptor::TcpRst))) {
+        if (packet.tcpWindow == 0) {
+            if (!(tcp.zeroWindowSides & sideBit)) {
+                tcp.zeroWindowSides |= sideBit;
+                tcp.zeroWindows++;
+                total.zeroWindows++;
+                if (processTcp) {
+                    processTcp->zeroWindows++;
+                }
+            }
+        } else {
+            tcp.zeroWindowSides &= quint8(~sideBit);
+        }
+    }
+}
+
+void FlowShard::collectFlowUpdates()
+{
+    m_delta->flows.reserve(m_touchedFlows.size());
+    for (const FlowKey &key : m_touchedFlows) {
+        // Flows that expired since they were touched are already in expiredFlows
+        if (const FlowEntry *flow = m_flowTable.find(key)) {
+            FlowUpdate update;
+            update.key = key;
+            update.entry = *flow;
+            m_delta->flows.push_back(update);
+        }
+    }
+    m_touchedFlows.clear();
+    m_deltaGeneration++;
+}
+
+bool FlowShard::publish(bool force)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const bool events = !m_delta->connectionEvents.empty();
+    const int intervalMs = events ? EventPublishIntervalMs : PublishIntervalMs;
+    if (!force && now - m_lastPublish < std::chrono::milliseconds(intervalMs)) {
+        return false;
+    }
+    m_lastPublish = now;
+    if (m_delta->packets == 0 && m_delta->expiredFlows.empty()) {
+        return false;
+    }
+
+    // A merge that falls behind only makes the next delta larger
+    collectFlowUpdates();
+    if (m_deltas.tryPush(m_delta)) {
+        m_delta = new Delta();
+        return events;
+    }
+    return false;
+}
+
+FlowShard::Delta *FlowShard::takeDelta()
+{
+    Delta *delta = nullptr;
+    return m_deltas.popBatch(&delta, 1) == 1 ? delta : nullptr;
+}
+
+FlowShard::Delta *FlowShard::takeUnpublished()
+{
+    collectFlowUpdates();
+    Delta *delta = m_delta;
+    m_delta = new Delta();
+    return delta;
+}
+
+void FlowShard::clear()
+{
+    m_flowTable.clear();
+    m_touchedFlows.clear();
+    m_lastFlowExpiryUs = 0;
+    m_recentPackets.clear();
+    delete m_delta;
+    m_delta = new Delta();
+    while (Delta *delta = takeDelta()) {
+        delete delta;
+    }
+}
@@ -0,0 +1,184 @@
+#ifndef FLOWSHARD_H
+#define FLOWSHARD_H
+
+#include "flowtable.h"
+#include "localaddresstable.h"
+#include "packetdescriptor.h"
+#include "spscring.h"
+#include <QHash>
+#include <QList>
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief The FlowShard class is the private state of one packet processing worker.
+ *
+ * Capture threads spread packets over the shards by the symmetric FlowKey hash, so both
+ * directions of a flow always reach the same shard and a shard never shares a flow with
+ * another one. A shard owns its part of the flow table and counts per process and per
+ * interface without any locking. A packet kept by a PacketSampler counts for its sample rate.
+ *
+ * What a shard counted is handed to the merging thread as a Delta through a single-producer
+ * ring about every PublishIntervalMs, so the merge never has to stop the processing thread.
+ * Socket ownership and local addresses arrive the other way as immutable Attribution
+ * snapshots.
+ */
+class FlowShard
+{
+public:
+    // Interface indices travel in PacketDescriptor::interfaceIndex
+    static constexpr int MaxInterfaces = 32;
+    static constexpr int PublishIntervalMs = 250;
+    // Deltas carrying connection events go out this soon instead
+    static constexpr int EventPublishIntervalMs = 5;
+
+    // Socket table and local addresses as of one rebuild, shared read-only by all shards
+    struct Attribution {
+        FlowHashMap<qint64> sockets; // Socket 5-tuple -> PID
+        LocalAddressTable localAddresses;
+        quint32 socketGeneration;
+
+        explicit Attribution(size_t maxSockets) : sockets(maxSockets), socketGeneration(0) {}
+    };
+
+    struct ProcessCounters {
+        quint64 packetsSent;
+        quint64 bytesSent;
+        quint64 packetsReceived;
+        quint64 bytesReceived;
+        SampleVariance sentVariance; // Of the counts above while sampling
+        SampleVariance receivedVariance;
+        TcpStatistics tcp;
+
+        ProcessCounters() : packetsSent(0), bytesSent(0), packetsReceived(0), bytesReceived(0) {}
+    };
+
+    struct InterfaceCounters {
+        quint64 packets[2]; // Indexed by outbound
+        quint64 bytes[2];
+        SampleVariance variance[2];
+    };
+
+    // Current state of a flow that saw packets since the previous delta
+    struct FlowUpdate {
+        FlowKey key;
+        FlowEntry entry;
+    };
+
+    // A TCP connection completed its handshake or ended, with the flow as of that packet
+    struct ConnectionEvent {
+        enum Type : quint8 {
+            Established,
+            Closed,   // Both sides sent a FIN
+            Reset,
+            TimedOut  // Open connection that went idle and was dropped from the flow table
+        };
+
+        Type type;
+        FlowKey key;
+        FlowEntry entry;
+    };
+
+    // Everything a shard counted since its previous delta
+    struct Delta {
+        QHash<qint64, ProcessCounters> processes; // Key: process ID
+        InterfaceCounters interfaces[MaxInterfaces];
+        std::vector<FlowUpdate> flows;
+        std::vector<FlowKey> expiredFlows;
+        std::vector<ConnectionEvent> connectionEvents; // In packet order
+        TcpStatistics tcp; // All TCP flows, attributed or not
+        quint64 packets;
+        quint64 bytes;
+        quint64 firstPacketUs; // Capture time of the first and latest packet, 0 if none
+        quint64 lastPacketUs;
+        quint64 flowTableOverflows;
+        quint64 duplicatePackets;
+        quint64 tunnelledPackets; // Decoded from inside a tunnel
+
+        Delta() : interfaces(), packets(0), bytes(0), firstPacketUs(0), lastPacketUs(0),
+                  flowTableOverflows(0), duplicatePackets(0), tunnelledPackets(0) {}
+    };
+
+    FlowShard(int index, size_t maxFlows);
+    ~FlowShard();
+
+    FlowShard(const FlowShard &) = delete;
+    FlowShard &operator=(const FlowShard &) = delete;
+
+    int index() const { return m_index; }
+
+    // Shared by every ring that feeds this shard so that it can sleep on all of them
+    RingDoorbell *doorbell() { return &m_doorbell; }
+
+    // The rings this shard drains, one per capture worker; only set while it is stopped
+    void setInputs(const QList<SpscRing<PacketDescriptor> *> &inputs) { m_inputs = inputs; }
+    const QList<SpscRing<PacketDescriptor> *> &inputs() const { return m_inputs; }
+    bool hasInput() const;
+
+    // Any thread. The processing thread picks the snapshot up before its next batch.
+    void setAttribution(const std::shared_ptr<const Attribution> &attribution);
+
+    // Processing thread. Drains one batch from every input and returns how many packets it handled.
+    size_t processInputs();
+    void process(const PacketDescriptor *packets, size_t count);
+    // Hands the counts over to the merging thread if PublishIntervalMs has passed, or
+    // EventPublishIntervalMs when connection events are waiting, or now if forced. Returns
+    // true if the delta it handed over carries connection events.
+    bool publish(bool force = false);
+
+    // Merging thread. Returns the next published delta, which the caller deletes, or nullptr.
+    Delta *takeDelta();
+    // Only while the processing thread is stopped: whatever was not published yet
+    Delta *takeUnpublished();
+
+    size_t flowCount() const { return m_flowTable.size(); }
+
+    // Only while the processing thread is stopped
+    void clear();
+
+private:
+    static constexpr size_t BatchSize = 256;
+    static constexpr size_t DeltaQueueCapacity = 64;
+
+    void refreshAttribution();
+    void attributeFlow(const FlowKey &key, FlowEntry *flow);
+    void trackTcp(const PacketDescriptor &packet, const FlowKey &key, FlowEntry *flow, bool reversed,
+                  TcpStatistics *processTcp);
+    void measureTcp(const PacketDescriptor &packet, FlowEntry *flow, bool reversed, TcpStatistics *processTcp);
+    void collectFlowUpdates();
+    bool isDuplicate(const PacketDescriptor &packet, const FlowKey &key, int side);
+
+    // A packet counted on one interface, kept to recognise its copy on another
+    struct RecentPacket {
+        quint64 identity; // 0 for an unused slot
+        quint64 timestampUs;
+        quint8 interfaceIndex;
+    };
+    static constexpr size_t RecentPacketSlots = 8192;
+
+    int m_index;
+    QList<SpscRing<PacketDescriptor> *> m_inputs;
+    RingDoorbell m_doorbell;
+
+    // Processing thread only
+    FlowTable m_flowTable;
+    std::shared_ptr<const Attribution> m_attribution;
+    Delta *m_delta;
+    std::vector<FlowKey> m_touchedFlows; // Flows to report in the next delta
+    quint32 m_deltaGeneration;           // Marks flows already in m_touchedFlows
+    quint64 m_lastFlowExpiryUs;
+    std::vector<RecentPacket> m_recentPackets; // Direct-mapped by identity; empty with a single input
+    std::chrono::steady_clock::time_point m_lastPublish;
+
+    SpscRing<Delta *> m_deltas;
+
+    std::mutex m_attributionMutex; // Guards m_pendingAttribution
+    std::shared_ptr<const Attribution> m_pendingAttribution;
+    std::atomic<bool> m_attributionChanged;
+};
+
+#endif // FLOWSHARD_H
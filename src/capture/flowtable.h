@@ -0,0 +1,363 @@
+#ifndef FLOWTABLE_H
+#define FLOWTABLE_H
+
+#include "ipaddress.h"
+#include "packetdescriptor.h"
+#include "packetsampler.h"
+#include "ratewindow.h"
+#include "tcpmetrics.h"
+#include <QtGlobal>
+#include <vector>
+
+/**
+ * @brief The FlowKey struct is a direction-normalised binary 5-tuple.
+ *
+ * The endpoint that compares lower becomes side A, so both directions of a conversation
+ * produce the same key. make() reports whether the packet travelled B->A.
+ */
+struct FlowKey {
+    IpAddress addressA;
+    IpAddress addressB;
+    quint16 portA;
+    quint16 portB;
+    quint8 protocol;
+    quint8 reserved[3];
+
+    FlowKey() : portA(0), portB(0), protocol(0) { reserved[0] = reserved[1] = reserved[2] = 0; }
+
+    static FlowKey make(const IpAddress &src, quint16 srcPort, const IpAddress &dst, quint16 dstPort,
+                        quint8 protocol, bool *reversed = nullptr)
+    {
+        FlowKey key;
+        bool swap = dst < src || (dst == src && dstPort < srcPort);
+        key.addressA = swap ? dst : src;
+        key.addressB = swap ? src : dst;
+        key.portA = swap ? dstPort : srcPort;
+        key.portB = swap ? srcPort : dstPort;
+        key.protocol = protocol;
+        if (reversed) {
+            *reversed = swap;
+        }
+        return key;
+    }
+
+    bool operator==(const FlowKey &other) const
+    {
+        return addressA == other.addressA && addressB == other.addressB &&
+               portA == other.portA && portB == other.portB && protocol == other.protocol;
+    }
+
+    // Symmetric by construction because the key is normalised
+    quint64 hash() const
+    {
+        quint64 h = 0x9e3779b97f4a7c15ULL ^ (quint64(portA) << 32 | quint64(portB) << 16 | protocol);
+        h = mix(h ^ addressA.words[0]);
+        h = mix(h ^ addressA.words[1]);
+        h = mix(h ^ addressB.words[0]);
+        h = mix(h ^ addressB.words[1]);
+        return h;
+    }
+
+private:
+    static quint64 mix(quint64 x)
+    {
+        // Final mixer from MurmurHash3
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+};
+
+/**
+ * @brief The FlowHashMap class is an open-addressing hash map keyed by FlowKey.
+ *
+ * Probing walks a compact array of 8-byte slots holding a 32-bit hash tag and an index
+ * into a dense node array, so a miss or a collision rarely touches more than one cache
+ * line and full key comparisons only happen on tag matches. Removal uses backward-shift
+ * deletion, so there are no tombstones. The table grows by doubling up to maxEntries and
+ * then refuses new keys instead of growing without bound.
+ */
+template <typename Value>
+class FlowHashMap
+{
+public:
+    explicit FlowHashMap(size_t maxEntries = 1 << 20)
+        : m_maxEntries(maxEntries)
+        , m_count(0)
+    {
+        reserveSlots(1024);
+    }
+
+    size_t size() const { return m_count; }
+    size_t maxEntries() const { return m_maxEntries; }
+
+    void clear()
+    {
+        m_slots.assign(m_slots.size(), Slot());
+        m_nodes.clear();
+        m_freeNodes.clear();
+        m_count = 0;
+    }
+
+    Value *find(const FlowKey &key) { return find(key, key.hash()); }
+
+    Value *find(const FlowKey &key, quint64 hash)
+    {
+        const quint32 tag = tagOf(hash);
+        for (size_t pos = hash & m_mask;; pos = (pos + 1) & m_mask) {
+            const Slot &slot = m_slots[pos];
+            if (slot.node == 0) {
+                return nullptr;
+            }
+            if (slot.tag == tag) {
+                Node &node = m_nodes[slot.node - 1];
+                if (node.key == key) {
+                    return &node.value;
+                }
+            }
+        }
+    }
+
+    const Value *find(const FlowKey &key) const { return const_cast<FlowHashMap *>(this)->find(key); }
+
+    // Returns nullptr when the table is full; *inserted tells whether the value is new
+    Value *findOrInsert(const FlowKey &key, bool *inserted = nullptr) { return findOrInsert(key, key.hash(), inserted); }
+
+    Value *findOrInsert(const FlowKey &key, quint64 hash, bool *inserted = nullptr)
+    {
+        if (inserted) {
+            *inserted = false;
+        }
+        const quint32 tag = tagOf(hash);
+        size_t pos = hash & m_mask;
+        for (;; pos = (pos + 1) & m_mask) {
+            const Slot &slot = m_slots[pos];
+            if (slot.node == 0) {
+                break;
+            }
+            if (slot.tag == tag) {
+                Node &node = m_nodes[slot.node - 1];
+                if (node.key == key) {
+                    return &node.value;
+                }
+            }
+        }
+
+        if (m_count >= m_maxEntries) {
+            return nullptr;
+        }
+        if ((m_count + 1) * 2 > m_slots.size()) {
+            reserveSlots(m_slots.size() * 2);
+            // Slot positions changed, find the new empty slot for this key
+            for (pos = hash & m_mask; m_slots[pos].node != 0; pos = (pos + 1) & m_mask) {
+            }
+        }
+
+        quint32 nodeIndex;
+        if (!m_freeNodes.empty()) {
+            nodeIndex = m_freeNodes.back();
+            m_freeNodes.pop_back();
+            m_nodes[nodeIndex] = Node();
+        } else {
+            nodeIndex = quint32(m_nodes.size());
+            m_nodes.push_back(Node());
+        }
+        Node &node = m_nodes[nodeIndex];
+        node.key = key;
+        node.used = true;
+
+        m_slots[pos].tag = tag;
+        m_slots[pos].node = nodeIndex + 1;
+        ++m_count;
+        if (inserted) {
+            *inserted = true;
+        }
+        return &node.value;
+    }
+
+    bool remove(const FlowKey &key)
+    {
+        const quint64 hash = key.hash();
+        const quint32 tag = tagOf(hash);
+        for (size_t pos = hash & m_mask;; pos = (pos + 1) & m_mask) {
+            const Slot &slot = m_slots[pos];
+            if (slot.node == 0) {
+                return false;
+            }
+            if (slot.tag == tag && m_nodes[slot.node - 1].key == key) {
+                eraseSlot(pos);
+                return true;
+            }
+        }
+    }
+
+    // Calls visitor(const FlowKey &, Value &) for every entry
+    template <typename Visitor>
+    void forEach(Visitor visitor)
+    {
+        for (Node &node : m_nodes) {
+            if (node.used) {
+                visitor(node.key, node.value);
+            }
+        }
+    }
+
+    template <typename Visitor>
+    void forEach(Visitor visitor) const
+    {
+        for (const Node &node : m_nodes) {
+            if (node.used) {
+                visitor(node.key, node.value);
+            }
+        }
+    }
+
+    // Removes every entry for which predicate(const FlowKey &, Value &) returns true
+    template <typename Predicate>
+    size_t removeIf(Predicate predicate)
+    {
+        size_t removed = 0;
+        for (size_t i = 0; i < m_nodes.size(); ++i) {
+            Node &node = m_nodes[i];
+            if (node.used && predicate(node.key, node.value)) {
+                remove(FlowKey(node.key));
+                ++removed;
+            }
+        }
+        return removed;
+    }
+
+private:
+    struct Slot {
+        quint32 tag;
+        quint32 node; // Index + 1 into m_nodes, 0 marks an empty slot
+        Slot() : tag(0), node(0) {}
+    };
+
+    struct Node {
+        FlowKey key;
+        Value value;
+        bool used;
+        Node() : value(), used(false) {}
+    };
+
+    static quint32 tagOf(quint64 hash) { return quint32(hash >> 32); }
+
+    void eraseSlot(size_t pos)
+    {
+        const quint32 nodeIndex = m_slots[pos].node - 1;
+        m_nodes[nodeIndex].used = false;
+        m_freeNodes.push_back(nodeIndex);
+        --m_count;
+
+        // Backward-shift the rest of the probe run so lookups never stop early
+        size_t hole = pos;
+        for (size_t next = (pos + 1) & m_mask; m_slots[next].node != 0; next = (next + 1) & m_mask) {
+            const size_t home = m_nodes[m_slots[next].node - 1].key.hash() & m_mask;
+            const bool movable = hole <= next ? (home <= hole || home > next)
+                                              : (home <= hole && home > next);
+            if (movable) {
+                m_slots[hole] = m_slots[next];
+                hole = next;
+            }
+        }
+        m_slots[hole] = Slot();
+    }
+
+    void reserveSlots(size_t slotCount)
+    {
+        std::vector<Slot> oldSlots;
+        oldSlots.swap(m_slots);
+        m_slots.assign(slotCount, Slot());
+        m_mask = slotCount - 1;
+
+        for (const Slot &slot : oldSlots) {
+            if (slot.node == 0) {
+                continue;
+            }
+            const quint64 hash = m_nodes[slot.node - 1].key.hash();
+            size_t pos = hash & m_mask;
+            while (m_slots[pos].node != 0) {
+                pos = (pos + 1) & m_mask;
+            }
+            m_slots[pos] = slot;
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    std::vector<Node> m_nodes;
+    std::vector<quint32> m_freeNodes;
+    size_t m_mask;
+    size_t m_maxEntries;
+    size_t m_count;
+};
+
+/**
+ * @brief The FlowEntry struct holds per-flow counters and the owning process.
+ *
+ * Index 0 of the directional counters is traffic from side A to side B of the FlowKey.
+ * localSide records which endpoint belongs to this host, so the A/B counters can be read
+ * as sent/received without looking at the addresses again.
+ *
+ * TCP flows also follow the connection through its handshake and teardown from the SYN,
+ * FIN and RST flags. Flows picked up mid-connection stay in TcpUntracked.
+ */
+struct FlowEntry {
+    enum TcpState : quint8 {
+        TcpUntracked,   // Not TCP, or no SYN seen
+        TcpSynSent,
+        TcpSynReceived, // SYN-ACK seen
+        TcpEstablished,
+        TcpClosing,     // One side has sent a FIN
+        TcpClosed,      // Both sides have sent a FIN
+        TcpReset
+    };
+
+    qint64 processId;           // -1 until attributed
+    quint32 processGeneration;  // Socket table generation the attribution was made against
+    qint8 localSide;            // 0 if side A is local, 1 if side B is, -1 if neither
+    quint32 localAddressGeneration; // Local address table generation localSide was derived from
+    quint32 updateGeneration;   // Last FlowShard delta the flow was reported in
+    quint64 packets[2];
+    quint64 bytes[2];
+    RateWindow<quint32, 2> rate; // By side like bytes; the last complete second and its EWMA
+    SampleVariance variance[2];  // By side, of packets and bytes scaled up by packet sampling
+    quint64 firstSeenUs;
+    quint64 lastSeenUs;
+    quint8 tcpState;
+    qint8 tcpClient;            // Side that sent the SYN, -1 if not seen
+    quint8 tcpFinSides;         // Bit 0: side A has sent a FIN, bit 1: side B has
+    quint8 appProtocol;         // ProtocolClassifier::Protocol, 0 (Unknown) until recognised
+    quint8 classifiedPackets;   // Payload packets looked at for appProtocol
+    TcpFlowMetrics tcp;
+    TunnelInfo tunnel;          // Outermost tunnel of the flow's first packet, type None if it had none
+
+    FlowEntry() : processId(-1), processGeneration(0), localSide(-1), localAddressGeneration(0),
+                  updateGeneration(0), firstSeenUs(0), lastSeenUs(0),
+                  tcpState(TcpUntracked), tcpClient(-1), tcpFinSides(0), appProtocol(0),
+                  classifiedPackets(0)
+    {
+        packets[0] = packets[1] = 0;
+        bytes[0] = bytes[1] = 0;
+    }
+
+    // True if a packet that travelled in the given direction (reversed = B->A) left this host
+    bool isOutbound(bool reversed) const { return localSide == (reversed ? 1 : 0); }
+
+    // Both are zero while neither endpoint is known to be local
+    quint64 bytesSent() const { return localSide < 0 ? 0 : bytes[localSide]; }
+    quint64 bytesReceived() const { return localSide < 0 ? 0 : bytes[1 - localSide]; }
+
+    // Side whose data is timed for RTT samples: ours, or the client's if neither is local
+    int measuredSide() const { return localSide >= 0 ? localSide : (tcpClient >= 0 ? tcpClient : 0); }
+
+    // The handshake completed and the connection has not ended yet
+    bool isTcpOpen() const { return tcpState == TcpEstablished || tcpState == TcpClosing; }
+};
+
+typedef FlowHashMap<FlowEntry> FlowTable;
+
+#endif // FLOWTABLE_H
@@ -0,0 +1,192 @@
+#include "fragmenttracker.h"
+#include "packetdecoder.h"
+
+// Timed-out datagrams are looked for at most this often; a full table is the same sweep
+static const quint64 ExpiryIntervalUs = 100000;
+
+FragmentTracker::FragmentTracker()
+    : m_datagrams(MaxDatagrams)
+    , m_held(MaxHeldFragments)
+    , m_next(MaxHeldFragments)
+    , m_fragments(0)
+    , m_completed(0)
+    , m_attributed(0)
+    , m_unattributed(0)
+    , m_overflows(0)
+{
+    clear();
+}
+
+void FragmentTracker::clear()
+{
+    m_datagrams.clear();
+    for (size_t i = 0; i < MaxHeldFragments; ++i) {
+        m_next[i] = i + 1 < MaxHeldFragments ? qint32(i + 1) : -1;
+    }
+    m_freeHead = 0;
+    m_releasedHead = -1;
+    m_releasedTail = -1;
+    m_nextExpiryUs = 0;
+    m_fragments.store(0, std::memory_order_relaxed);
+    m_completed.store(0, std::memory_order_relaxed);
+    m_attributed.store(0, std::memory_order_relaxed);
+    m_unattributed.store(0, std::memory_order_relaxed);
+    m_overflows.store(0, std::memory_order_relaxed);
+}
+
+FragmentTracker::Statistics FragmentTracker::statistics() const
+{
+    Statistics stats;
+    stats.fragments = m_fragments.load(std::memory_order_relaxed);
+    stats.datagrams = m_completed.load(std::memory_order_relaxed);
+    stats.attributed = m_attributed.load(std::memory_order_relaxed);
+    stats.unattributed = m_unattributed.load(std::memory_order_relaxed);
+    stats.overflows = m_overflows.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// One direction of one datagram; the identification takes the place of the ports
+FlowKey FragmentTracker::keyOf(const PacketDescriptor &fragment)
+{
+    FlowKey key;
+    key.addressA = fragment.srcAddr;
+    key.addressB = fragment.dstAddr;
+    key.portA = quint16(fragment.fragmentId >> 16);
+    key.portB = quint16(fragment.fragmentId);
+    key.protocol = fragment.protocol;
+    return key;
+}
+
+bool FragmentTracker::track(PacketDescriptor *fragment)
+{
+    // Other protocols have no ports to hand on
+    if (fragment->protocol != PacketDecoder::ProtocolTcp && fragment->protocol != PacketDecoder::ProtocolUdp) {
+        return true;
+    }
+    m_fragments.fetch_add(1, std::memory_order_relaxed);
+    const bool later = fragment->isLaterFragment();
+
+    const FlowKey key = keyOf(*fragment);
+    bool inserted = false;
+    Datagram *datagram = m_datagrams.findOrInsert(key, &inserted);
+    if (!datagram) {
+        // Make room from datagrams that went quiet, then give up on this one
+        expire(fragment->timestampUs);
+        datagram = m_datagrams.findOrInsert(key, &inserted);
+        if (!datagram) {
+            m_overflows.fetch_add(1, std::memory_order_relaxed);
+            if (later) {
+                m_unattributed.fetch_add(1, std::memory_order_relaxed);
+            }
+            return true;
+        }
+    }
+    if (inserted) {
+        datagram->startedUs = fragment->timestampUs;
+    }
+
+    datagram->seenBytes += fragment->fragmentLength;
+    if (!(fragment->fragment & PacketDescriptor::FragmentMore)) {
+        datagram->totalBytes = quint32(fragment->fragment & PacketDescriptor::FragmentOffsetMask) * 8 +
+                               fragment->fragmentLength;
+    }
+
+    if (!later) {
+        datagram->haveFirst = true;
+        datagram->srcPort = fragment->srcPort;
+        datagram->dstPort = fragment->dstPort;
+        release(datagram);
+    } else if (datagram->haveFirst) {
+        fragment->srcPort = datagram->srcPort;
+        fragment->dstPort = datagram->dstPort;
+        m_attributed.fetch_add(1, std::memory_order_relaxed);
+    } else if (hold(datagram, *fragment)) {
+        return false;
+    } else {
+        m_unattributed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (datagram->haveFirst && datagram->totalBytes != 0 && datagram->seenBytes >= datagram->totalBytes) {
+        m_completed.fetch_add(1, std::memory_order_relaxed);
+        m_datagrams.remove(key);
+    }
+    return true;
+}
+
+bool FragmentTracker::hold(Datagram *datagram, const PacketDescriptor &fragment)
+{
+    if (m_freeHead < 0 || datagram->heldCount >= MaxHeldPerDatagram) {
+        return false;
+    }
+    const qint32 slot = m_freeHead;
+    m_freeHead = m_next[slot];
+    m_held[slot] = fragment;
+    m_next[slot] = -1;
+    if (datagram->heldTail >= 0) {
+        m_next[datagram->heldTail] = slot;
+    } else {
+        datagram->heldHead = slot;
+    }
+    datagram->heldTail = slot;
+    datagram->heldCount++;
+    return true;
+}
+
+// Moves the held fragments to the released list, with the ports of the first fragment if it came
+void FragmentTracker::release(Datagram *datagram)
+{
+    if (datagram->heldHead < 0) {
+        return;
+    }
+    for (qint32 slot = datagram->heldHead; slot >= 0; slot = m_next[slot]) {
+        if (datagram->haveFirst) {
+            m_held[slot].srcPort = datagram->srcPort;
+            m_held[slot].dstPort = datagram->dstPort;
+        }
+    }
+    if (datagram->haveFirst) {
+        m_attributed.fetch_add(datagram->heldCount, std::memory_order_relaxed);
+    } else {
+        m_unattributed.fetch_add(datagram->heldCount, std::memory_order_relaxed);
+    }
+
+    if (m_releasedTail >= 0) {
+        m_next[m_releasedTail] = datagram->heldHead;
+    } else {
+        m_releasedHead = datagram->heldHead;
+    }
+    m_releasedTail = datagram->heldTail;
+    datagram->heldHead = datagram->heldTail = -1;
+    datagram->heldCount = 0;
+}
+
+bool FragmentTracker::takeReleased(PacketDescriptor *fragment)
+{
+    if (m_releasedHead < 0) {
+        return false;
+    }
+    const qint32 slot = m_releasedHead;
+    *fragment = m_held[slot];
+    m_releasedHead = m_next[slot];
+    if (m_releasedHead < 0) {
+        m_releasedTail = -1;
+    }
+    m_next[slot] = m_freeHead;
+    m_freeHead = slot;
+    return true;
+}
+
+void FragmentTracker::expire(quint64 nowUs)
+{
+    if (m_datagrams.size() == 0 || nowUs < m_nextExpiryUs) {
+        return;
+    }
+    m_nextExpiryUs = nowUs + ExpiryIntervalUs;
+    m_datagrams.removeIf([this, nowUs](const FlowKey &, Datagram &datagram) {
+        if (nowUs <= datagram.startedUs || nowUs - datagram.startedUs <= TimeoutUs) {
+            return false;
+        }
+        release(&datagram);
+        return true;
+    });
+}
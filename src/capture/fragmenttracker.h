@@ -0,0 +1,95 @@
+#ifndef FRAGMENTTRACKER_H
+#define FRAGMENTTRACKER_H
+
+#include "flowtable.h"
+#include "packetdescriptor.h"
+#include <QtGlobal>
+#include <atomic>
+#include <vector>
+
+/**
+ * @brief The FragmentTracker class gives the later fragments of a TCP or UDP datagram the
+ * ports of its first fragment, so that they are counted on the right flow.
+ *
+ * Datagrams in flight live in a fixed-size table keyed by addresses, protocol and IP
+ * identification, and are forgotten once all of their bytes were seen or after TimeoutUs.
+ * A later fragment that arrives before the first one, as some stacks send them in reverse
+ * order, is held in a fixed pool until the first fragment arrives or its datagram times out.
+ *
+ * Memory is fixed whatever arrives. Fragments that never complete can fill the table or the
+ * pool, but then new datagrams just go through untracked and their later fragments have no
+ * ports. They are still counted, only not on a flow; a fragment is never given the ports of
+ * another datagram.
+ *
+ * Capture thread only, apart from statistics().
+ */
+class FragmentTracker
+{
+public:
+    static const size_t MaxDatagrams = 1024;
+    static const size_t MaxHeldFragments = 512;
+    static const quint16 MaxHeldPerDatagram = 64; // A 64 KB datagram over a 1500-byte MTU is 45 fragments
+    static const quint64 TimeoutUs = 2000000;
+
+    struct Statistics {
+        quint64 fragments;    // TCP and UDP fragments seen
+        quint64 datagrams;    // Fragmented datagrams seen whole
+        quint64 attributed;   // Later fragments given the ports of their first fragment
+        quint64 unattributed; // Later fragments passed on without ports
+        quint64 overflows;    // Datagrams not tracked because the table was full
+
+        Statistics() : fragments(0), datagrams(0), attributed(0), unattributed(0), overflows(0) {}
+    };
+
+    FragmentTracker();
+
+    // Fills in the ports of a later fragment if its first fragment was seen. Returns false if
+    // the fragment is held until then; it comes out of takeReleased() later.
+    bool track(PacketDescriptor *fragment);
+    // Held fragments whose first fragment has arrived, or, without ports, whose datagram timed out
+    bool takeReleased(PacketDescriptor *fragment);
+    // Drops datagrams whose fragments stopped arriving; cheap to call on every packet
+    void expire(quint64 nowUs);
+
+    // No datagram in flight and nothing to release
+    bool isEmpty() const { return m_datagrams.size() == 0 && m_releasedHead < 0; }
+    void clear();
+
+    Statistics statistics() const;
+
+private:
+    struct Datagram {
+        quint64 startedUs;
+        quint32 seenBytes;  // Payload bytes of the fragments seen, duplicates included
+        quint32 totalBytes; // Known once the last fragment is seen, 0 until then
+        quint16 srcPort;    // From the first fragment
+        quint16 dstPort;
+        bool haveFirst;
+        quint16 heldCount;
+        qint32 heldHead;    // Held fragments in arrival order, -1 if none
+        qint32 heldTail;
+
+        Datagram() : startedUs(0), seenBytes(0), totalBytes(0), srcPort(0), dstPort(0), haveFirst(false),
+                     heldCount(0), heldHead(-1), heldTail(-1) {}
+    };
+
+    static FlowKey keyOf(const PacketDescriptor &fragment);
+    bool hold(Datagram *datagram, const PacketDescriptor &fragment);
+    void release(Datagram *datagram);
+
+    FlowHashMap<Datagram> m_datagrams;
+    std::vector<PacketDescriptor> m_held; // Fixed pool of MaxHeldFragments
+    std::vector<qint32> m_next;           // Links of the free, held and released lists
+    qint32 m_freeHead;
+    qint32 m_releasedHead;
+    qint32 m_releasedTail;
+    quint64 m_nextExpiryUs;
+
+    std::atomic<quint64> m_fragments;
+    std::atomic<quint64> m_completed;
+    std::atomic<quint64> m_attributed;
+    std::atomic<quint64> m_unattributed;
+    std::atomic<quint64> m_overflows;
+};
+
+#endif // FRAGMENTTRACKER_H
@@ -0,0 +1,143 @@
+#ifndef FRAMESPOOL_H
+#define FRAMESPOOL_H
+
+#include "spscring.h"
+#include <QtGlobal>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief The FrameSpool class is a bounded single-producer/single-consumer byte ring for
+ * whole captured frames.
+ *
+ * Each frame is stored contiguously behind a small header, so the consumer can hand it on
+ * without copying. A frame that would straddle the end of the buffer is preceded by a
+ * padding record and starts again at offset 0. Like SpscRing, the producer never blocks:
+ * tryPush() fails when there is no room and the caller counts the loss.
+ */
+class FrameSpool
+{
+public:
+    struct FrameRecord {
+        quint32 size;           // Whole record including this header, a multiple of RecordAlignment
+        quint32 captureLength;  // Bytes of frame data that follow, PaddingRecord for padding
+        quint32 wireLength;
+        quint32 reserved;
+        quint64 timestampUs;
+    };
+
+    static const size_t RecordAlignment = 8;
+    static const quint32 PaddingRecord = 0xFFFFFFFF;
+
+    explicit FrameSpool(size_t capacityBytes, RingDoorbell *doorbell = nullptr)
+        : m_head(0)
+        , m_cachedTail(0)
+        , m_tail(0)
+        , m_cachedHead(0)
+        , m_doorbell(doorbell ? doorbell : &m_ownDoorbell)
+    {
+        size_t size = 4096;
+        while (size < capacityBytes) {
+            size <<= 1;
+        }
+        m_buffer.resize(size);
+        m_mask = size - 1;
+    }
+
+    FrameSpool(const FrameSpool &) = delete;
+    FrameSpool &operator=(const FrameSpool &) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    bool isEmpty() const
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    // Producer side. Copies the frame in, or returns false without blocking when it does not fit.
+    bool tryPush(quint64 timestampUs, quint32 wireLength, const quint8 *data, quint32 length)
+    {
+        const size_t recordSize = alignUp(sizeof(FrameRecord) + length);
+        if (recordSize > capacity() / 2) {
+            return false;
+        }
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        const size_t offset = head & m_mask;
+        const size_t untilEnd = capacity() - offset;
+        const size_t needed = recordSize <= untilEnd ? recordSize : untilEnd + recordSize;
+        if (capacity() - (head - m_cachedTail) < needed) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (capacity() - (head - m_cachedTail) < needed) {
+                return false;
+            }
+        }
+
+        size_t position = head;
+        if (recordSize > untilEnd) {
+            FrameRecord *padding = reinterpret_cast<FrameRecord *>(&m_buffer[offset]);
+            padding->size = quint32(untilEnd);
+            padding->captureLength = PaddingRecord;
+            position += untilEnd;
+        }
+
+        FrameRecord *record = reinterpret_cast<FrameRecord *>(&m_buffer[position & m_mask]);
+        record->size = quint32(recordSize);
+        record->captureLength = length;
+        record->wireLength = wireLength;
+        record->reserved = 0;
+        record->timestampUs = timestampUs;
+        std::memcpy(record + 1, data, length);
+
+        m_head.store(position + recordSize, std::memory_order_release);
+        m_doorbell->ring();
+        return true;
+    }
+
+    // Consumer side. Calls visitor(const FrameRecord &, const quint8 *data) for up to maxFrames
+    // frames in place and then releases their space; returns how many were visited.
+    template <typename Visitor>
+    size_t consume(Visitor visitor, size_t maxFrames)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_cachedHead) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+        }
+
+        size_t count = 0;
+        while (tail != m_cachedHead && count < maxFrames) {
+            const FrameRecord *record = reinterpret_cast<const FrameRecord *>(&m_buffer[tail & m_mask]);
+            if (record->captureLength != PaddingRecord) {
+                visitor(*record, reinterpret_cast<const quint8 *>(record + 1));
+                ++count;
+            }
+            tail += record->size;
+        }
+        m_tail.store(tail, std::memory_order_release);
+        return count;
+    }
+
+private:
+    static constexpr size_t CacheLineSize = 64;
+
+    static size_t alignUp(size_t size)
+    {
+        return (size + RecordAlignment - 1) & ~(RecordAlignment - 1);
+    }
+
+    // Producer cache line
+    alignas(CacheLineSize) std::atomic<size_t> m_head;
+    size_t m_cachedTail;
+
+    // Consumer cache line
+    alignas(CacheLineSize) std::atomic<size_t> m_tail;
+    size_t m_cachedHead;
+
+    RingDoorbell m_ownDoorbell;
+    RingDoorbell *m_doorbell;
+
+    std::vector<quint8> m_buffer; // Heap storage is aligned enough for FrameRecord
+    size_t m_mask;
+};
+
+#endif // FRAMESPOOL_H
@@ -0,0 +1,366 @@
+#include "httplatencytracker.h"
+#include "protocolclassifier.h"
+#include <cstring>
+
+// Streams on these ports are followed even before their payload is classified
+static const quint16 HttpPorts[] = {80, 8000, 8008, 8080};
+
+static const char *const Methods[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS", "PATCH", "CONNECT", "TRACE"};
+static const int HeadMethod = 2;
+static const int ConnectMethod = 7;
+
+// Larger chunks than this are taken for garbage rather than skipped
+static const quint64 MaxChunkSize = quint64(1) << 40;
+
+static char toLower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// The value of the header if the line is that header, trimmed; name is lower case
+static bool headerValue(const char *line, int length, const char *name, const char **value, int *valueLength)
+{
+    const int nameLength = int(std::strlen(name));
+    if (length <= nameLength || line[nameLength] != ':') {
+        return false;
+    }
+    for (int i = 0; i < nameLength; ++i) {
+        if (toLower(line[i]) != name[i]) {
+            return false;
+        }
+    }
+    int begin = nameLength + 1;
+    int end = length;
+    while (begin < end && (line[begin] == ' ' || line[begin] == '\t')) {
+        ++begin;
+    }
+    while (end > begin && (line[end - 1] == ' ' || line[end - 1] == '\t')) {
+        --end;
+    }
+    *value = line + begin;
+    *valueLength = end - begin;
+    return true;
+}
+
+static bool containsIgnoreCase(const char *text, int length, const char *word)
+{
+    const int wordLength = int(std::strlen(word));
+    for (int i = 0; i + wordLength <= length; ++i) {
+        int j = 0;
+        while (j < wordLength && toLower(text[i + j]) == word[j]) {
+            ++j;
+        }
+        if (j == wordLength) {
+            return true;
+        }
+    }
+    return false;
+}
+
+HttpLatencyTracker::HttpLatencyTracker()
+    : m_streams(MaxStreams)
+    , m_queue(QueueCapacity)
+    , m_requests(0)
+    , m_responses(0)
+    , m_unanswered(0)
+    , m_overflows(0)
+{
+}
+
+void HttpLatencyTracker::clear()
+{
+    m_streams.clear();
+    m_requests.store(0, std::memory_order_relaxed);
+    m_responses.store(0, std::memory_order_relaxed);
+    m_unanswered.store(0, std::memory_order_relaxed);
+    m_overflows.store(0, std::memory_order_relaxed);
+}
+
+HttpLatencyTracker::Statistics HttpLatencyTracker::statistics() const
+{
+    Statistics stats;
+    stats.requests = m_requests.load(std::memory_order_relaxed);
+    stats.responses = m_responses.load(std::memory_order_relaxed);
+    stats.unanswered = m_unanswered.load(std::memory_order_relaxed);
+    stats.overflows = m_overflows.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool HttpLatencyTracker::acceptStream(void *user, const PacketDescriptor &packet)
+{
+    Q_UNUSED(user);
+    if (packet.appProtocol == ProtocolClassifier::Http) {
+        return true;
+    }
+    for (quint16 port : HttpPorts) {
+        if (packet.srcPort == port || packet.dstPort == port) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpLatencyTracker::streamData(void *user, const TcpReassembler::Span &span)
+{
+    HttpLatencyTracker *tracker = static_cast<HttpLatencyTracker *>(user);
+    Stream *stream = tracker->m_streams.find(*span.key);
+    if (!stream) {
+        // Without the first bytes there is no telling where a message starts
+        if (span.offset != 0) {
+            return;
+        }
+        stream = tracker->m_streams.findOrInsert(*span.key);
+        if (!stream) {
+            return;
+        }
+    }
+    if (!stream->ignored) {
+        tracker->consume(span, stream);
+    }
+}
+
+void HttpLatencyTracker::streamClosed(void *user, const FlowKey &key)
+{
+    HttpLatencyTracker *tracker = static_cast<HttpLatencyTracker *>(user);
+    if (const Stream *stream = tracker->m_streams.find(key)) {
+        tracker->m_unanswered.fetch_add(stream->pendingCount, std::memory_order_relaxed);
+        tracker->m_streams.remove(key);
+    }
+}
+
+void HttpLatencyTracker::consume(const TcpReassembler::Span &span, Stream *stream)
+{
+    Parser *parser = &stream->sides[span.sender];
+    const quint8 *data = span.data;
+    const quint8 *end = data + span.length;
+    while (data < end && !stream->ignored) {
+        switch (parser->state) {
+        case Body:
+        case ChunkData: {
+            const quint64 skipped = qMin(parser->remaining, quint64(end - data));
+            data += skipped;
+            parser->remaining -= skipped;
+            if (parser->remaining == 0) {
+                parser->state = parser->state == Body ? StartLine : ChunkEnd;
+            }
+            break;
+        }
+        case UntilClose:
+            data = end;
+            break;
+        default: {
+            // Line by line; only the start of a long line is kept
+            const quint8 *newline = static_cast<const quint8 *>(std::memchr(data, '\n', size_t(end - data)));
+            const quint32 count = quint32((newline ? newline : end) - data);
+            if (parser->state == StartLine && parser->lineLength == 0) {
+                parser->messageStartUs = span.timestampUs;
+            }
+            const quint32 kept = parser->lineLength < LineCapacity ? quint32(LineCapacity - parser->lineLength) : 0;
+            std::memcpy(parser->line + parser->lineLength, data, qMin(count, kept));
+            parser->lineLength = quint16(qMin(quint32(parser->lineLength) + count, quint32(LineCapacity)));
+            data = newline ? newline + 1 : end;
+            if (newline) {
+                processLine(span, stream, parser);
+                parser->lineLength = 0;
+            }
+            break;
+        }
+        }
+    }
+}
+
+void HttpLatencyTracker::processLine(const TcpReassembler::Span &span, Stream *stream, Parser *parser)
+{
+    const char *line = parser->line;
+    int length = parser->lineLength;
+    if (length > 0 && line[length - 1] == '\r') {
+        --length;
+    }
+    const bool request = span.sender == stream->clientSide;
+
+    switch (parser->state) {
+    case StartLine:
+        // Blank lines between messages are tolerated
+        if (length > 0) {
+            startMessage(span, stream, parser, line, length);
+        }
+        break;
+    case Headers: {
+        if (length == 0) {
+            endHeaders(stream, parser, request);
+            break;
+        }
+        const char *value = nullptr;
+        int valueLength = 0;
+        if (headerValue(line, length, "content-length", &value, &valueLength)) {
+            quint64 contentLength = 0;
+            for (int i = 0; i < valueLength; ++i) {
+                if (!isDigit(value[i]) || contentLength > MaxChunkSize) {
+                    stream->ignored = true; // Unframed from here on
+                    return;
+                }
+                contentLength = contentLength * 10 + quint64(value[i] - '0');
+            }
+            parser->hasLength = true;
+            parser->remaining = contentLength;
+        } else if (headerValue(line, length, "transfer-encoding", &value, &valueLength)) {
+            parser->chunked = containsIgnoreCase(value, valueLength, "chunked");
+        } else if (request && headerValue(line, length, "host", &value, &valueLength)) {
+            stream->hostLength = quint8(qMin(valueLength, HttpTransaction::MaxHostLength));
+            std::memcpy(stream->host, value, stream->hostLength);
+            stream->host[stream->hostLength] = 0;
+        }
+        break;
+    }
+    case ChunkSize: {
+        // Hexadecimal, possibly followed by extensions
+        quint64 size = 0;
+        int digits = 0;
+        for (; digits < length; ++digits) {
+            const char c = toLower(line[digits]);
+            const int digit = isDigit(c) ? c - '0' : (c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1);
+            if (digit < 0) {
+                break;
+            }
+            size = size * 16 + quint64(digit);
+            if (size > MaxChunkSize) {
+                stream->ignored = true;
+                return;
+            }
+        }
+        if (digits == 0) {
+            stream->ignored = true;
+            return;
+        }
+        parser->remaining = size;
+        parser->state = size == 0 ? Trailers : ChunkData;
+        break;
+    }
+    case ChunkEnd:
+        if (length != 0) {
+            stream->ignored = true;
+            return;
+        }
+        parser->state = ChunkSize;
+        break;
+    case Trailers:
+        if (length == 0) {
+            parser->state = StartLine;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void HttpLatencyTracker::startMessage(const TcpReassembler::Span &span, Stream *stream, Parser *parser,
+                                      const char *line, int length)
+{
+    // "HTTP/1.1 200 OK" or "GET /path HTTP/1.1"
+    const bool response = length >= 12 && std::memcmp(line, "HTTP/1.", 7) == 0 && line[8] == ' ' &&
+                          isDigit(line[9]) && isDigit(line[10]) && isDigit(line[11]);
+    int method = -1;
+    if (!response && length >= 9 && std::memcmp(line + length - 9, " HTTP/1.", 8) == 0) {
+        for (int i = 0; i < int(sizeof(Methods) / sizeof(Methods[0])); ++i) {
+            const int methodLength = int(std::strlen(Methods[i]));
+            if (length > methodLength && std::memcmp(line, Methods[i], methodLength) == 0 &&
+                line[methodLength] == ' ') {
+                method = i;
+                break;
+            }
+        }
+    }
+    const bool request = method >= 0;
+    if (!request && !response) {
+        stream->ignored = true;
+        return;
+    }
+    if (stream->clientSide < 0) {
+        stream->clientSide = qint8(request ? span.sender : 1 - span.sender);
+    }
+    if (request != (span.sender == stream->clientSide)) {
+        stream->ignored = true;
+        return;
+    }
+
+    parser->state = Headers;
+    parser->chunked = false;
+    parser->hasLength = false;
+    parser->remaining = 0;
+    if (request) {
+        if (stream->pendingCount == MaxPipelined) {
+            stream->ignored = true;
+            return;
+        }
+        Request &pending = stream->pending[(stream->pendingFirst + stream->pendingCount) % MaxPipelined];
+        pending.startUs = parser->messageStartUs;
+        pending.head = method == HeadMethod;
+        pending.connect = method == ConnectMethod;
+        stream->pendingCount++;
+        m_requests.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    parser->status = quint16((line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0'));
+    parser->head = false;
+    parser->connect = false;
+    // An interim response like 100 Continue is followed by the final one
+    if ((parser->status < 200 && parser->status != 101) || stream->pendingCount == 0) {
+        return;
+    }
+    const Request answered = stream->pending[stream->pendingFirst];
+    stream->pendingFirst = quint8((stream->pendingFirst + 1) % MaxPipelined);
+    stream->pendingCount--;
+    parser->head = answered.head;
+    parser->connect = answered.connect;
+    m_responses.fetch_add(1, std::memory_order_relaxed);
+    pushTransaction(*span.key, *stream, answered, *parser);
+}
+
+void HttpLatencyTracker::endHeaders(Stream *stream, Parser *parser, bool request)
+{
+    if (request) {
+        // A request without a length has no body
+        parser->state = parser->chunked ? ChunkSize : (parser->remaining > 0 ? Body : StartLine);
+        return;
+    }
+    const quint16 status = parser->status;
+    if (status == 101 || (parser->connect && status >= 200 && status < 300)) {
+        stream->ignored = true; // Another protocol from here on
+        return;
+    }
+    if (status < 200 || status == 204 || status == 304 || parser->head) {
+        parser->state = StartLine;
+    } else if (parser->chunked) {
+        parser->state = ChunkSize;
+    } else if (parser->hasLength) {
+        parser->state = parser->remaining > 0 ? Body : StartLine;
+    } else {
+        parser->state = UntilClose;
+    }
+}
+
+void HttpLatencyTracker::pushTransaction(const FlowKey &key, const Stream &stream, const Request &request,
+                                         const Parser &response)
+{
+    const bool clientIsA = stream.clientSide == 0;
+    HttpTransaction transaction;
+    transaction.timestampUs = response.messageStartUs;
+    transaction.client = clientIsA ? key.addressA : key.addressB;
+    transaction.server = clientIsA ? key.addressB : key.addressA;
+    transaction.clientPort = clientIsA ? key.portA : key.portB;
+    transaction.serverPort = clientIsA ? key.portB : key.portA;
+    transaction.latencyUs = response.messageStartUs > request.startUs ? response.messageStartUs - request.startUs : 0;
+    transaction.statusCode = response.status;
+    transaction.hostLength = stream.hostLength;
+    std::memcpy(transaction.host, stream.host, stream.hostLength);
+    transaction.host[stream.hostLength] = 0;
+    if (!m_queue.tryPush(transaction)) {
+        m_overflows.fetch_add(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,167 @@
+#ifndef HTTPLATENCYTRACKER_H
+#define HTTPLATENCYTRACKER_H
+
+#include "flowtable.h"
+#include "ipaddress.h"
+#include "loghistogram.h"
+#include "packetdescriptor.h"
+#include "spscring.h"
+#include "tcpreassembler.h"
+#include <QtGlobal>
+#include <atomic>
+
+/**
+ * @brief The HttpTransaction struct is one HTTP/1.x request matched with its response.
+ *
+ * Fixed-size so that it can travel through an SpscRing without allocating. The latency runs
+ * from the first byte of the request to the first byte of the response, so it covers the
+ * network round trip and the server's think time but not the transfer of the response.
+ */
+struct HttpTransaction {
+    static constexpr int MaxHostLength = 253;
+
+    quint64 timestampUs;  // When the response started
+    IpAddress client;
+    IpAddress server;
+    quint16 clientPort;
+    quint16 serverPort;
+    quint64 latencyUs;
+    quint16 statusCode;
+    quint8 hostLength;
+    char host[MaxHostLength + 1]; // Host header of the request, empty without one
+
+    HttpTransaction() : timestampUs(0), clientPort(0), serverPort(0), latencyUs(0), statusCode(0), hostLength(0)
+    {
+        host[0] = 0;
+    }
+};
+
+// HTTP transactions of one host, summed off the capture thread
+struct HttpHostStatistics {
+    quint64 transactions;
+    quint64 clientErrors; // 4xx responses
+    quint64 serverErrors; // 5xx responses
+    LogHistogram<quint64> latency;
+
+    HttpHostStatistics() : transactions(0), clientErrors(0), serverErrors(0) {}
+
+    void add(const HttpTransaction &transaction)
+    {
+        transactions++;
+        if (transaction.statusCode >= 500) {
+            serverErrors++;
+        } else if (transaction.statusCode >= 400) {
+            clientErrors++;
+        }
+        latency.add(transaction.latencyUs);
+    }
+};
+
+/**
+ * @brief The HttpLatencyTracker class follows HTTP/1.x conversations in the streams of a
+ * TcpReassembler and times each request until its response starts.
+ *
+ * Messages are framed by Content-Length, chunked encoding or the end of the connection, so
+ * keep-alive and pipelined requests are matched to their responses in order. The side that
+ * sends a request is the client, whichever side opened the connection. A stream that is not
+ * HTTP/1.x, or that switches protocol, is ignored from then on. Only the lines that matter
+ * are kept, each up to LineCapacity bytes, so a stream costs a fixed amount of memory.
+ *
+ * The reassembler's handlers run on the capture thread; matched transactions are queued for
+ * the merging thread, which owns the consumer side of queue().
+ */
+class HttpLatencyTracker
+{
+public:
+    static const size_t MaxStreams = TcpReassembler::MaxStreams;
+    static const size_t QueueCapacity = 1024;
+    static const int MaxPipelined = 8;
+    static const int LineCapacity = 272; // "Host: ", the longest name and a port
+
+    struct Statistics {
+        quint64 requests;
+        quint64 responses;  // Final responses matched to a request
+        quint64 unanswered; // Requests whose stream ended before the response started
+        quint64 overflows;  // Transactions dropped because the queue was full
+
+        Statistics() : requests(0), responses(0), unanswered(0), overflows(0) {}
+    };
+
+    HttpLatencyTracker();
+
+    // TcpReassembler handlers; user is the tracker
+    static bool acceptStream(void *user, const PacketDescriptor &packet);
+    static void streamData(void *user, const TcpReassembler::Span &span);
+    static void streamClosed(void *user, const FlowKey &key);
+
+    SpscRing<HttpTransaction> *queue() { return &m_queue; }
+    Statistics statistics() const;
+    // Capture thread only, while no stream is being delivered
+    void clear();
+
+private:
+    enum State : quint8 {
+        StartLine,
+        Headers,
+        Body,
+        ChunkSize,
+        ChunkData,
+        ChunkEnd,
+        Trailers,
+        UntilClose
+    };
+
+    // Framing of the message a side is sending
+    struct Parser {
+        quint64 messageStartUs; // Capture time of the message's first byte
+        quint64 remaining;      // Bytes left in the body or chunk
+        quint16 lineLength;     // Bytes of the current line seen, only LineCapacity of them kept
+        State state;
+        bool chunked;
+        bool hasLength;
+        bool head;              // A request for the headers only, or the response to one
+        bool connect;
+        quint16 status;
+        char line[LineCapacity];
+
+        Parser() : messageStartUs(0), remaining(0), lineLength(0), state(StartLine), chunked(false),
+                   hasLength(false), head(false), connect(false), status(0) {}
+    };
+
+    struct Request {
+        quint64 startUs;
+        bool head;
+        bool connect;
+    };
+
+    struct Stream {
+        qint8 clientSide;     // Side of the flow key that sends requests, -1 until one is seen
+        bool ignored;
+        quint8 pendingFirst;  // Requests waiting for their response, a ring of MaxPipelined
+        quint8 pendingCount;
+        quint8 hostLength;
+        Request pending[MaxPipelined];
+        char host[HttpTransaction::MaxHostLength + 1]; // From the latest request that had one, which
+                                                       // pipelined requests on one connection share
+        Parser sides[2];
+
+        Stream() : clientSide(-1), ignored(false), pendingFirst(0), pendingCount(0), hostLength(0) { host[0] = 0; }
+    };
+
+    void consume(const TcpReassembler::Span &span, Stream *stream);
+    void processLine(const TcpReassembler::Span &span, Stream *stream, Parser *parser);
+    void startMessage(const TcpReassembler::Span &span, Stream *stream, Parser *parser, const char *line,
+                      int length);
+    void endHeaders(Stream *stream, Parser *parser, bool request);
+    void pushTransaction(const FlowKey &key, const Stream &stream, const Request &request, const Parser &response);
+
+    FlowHashMap<Stream> m_streams; // Capture thread only
+    SpscRing<HttpTransaction> m_queue;
+
+    std::atomic<quint64> m_requests;
+    std::atomic<quint64> m_responses;
+    std::atomic<quint64> m_unanswered;
+    std::atomic<quint64> m_overflows;
+};
+
+#endif // HTTPLATENCYTRACKER_H
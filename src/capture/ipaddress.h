@@ -0,0 +1,103 @@
+#ifndef IPADDRESS_H
+#define IPADDRESS_H
+
+#include <QtGlobal>
+#include <QHashFunctions>
+#include <QHostAddress>
+#include <QString>
+#include <cstring>
+
+/**
+ * @brief The IpAddress struct is a fixed-size binary IPv4/IPv6 address for the packet path.
+ *
+ * Addresses are kept as 16 raw bytes in network order; IPv4 addresses use the IPv4-mapped
+ * IPv6 form (::ffff:a.b.c.d) so that both families share one key layout. Conversion to text
+ * only happens at the UI boundary through toString().
+ */
+struct IpAddress {
+    quint64 words[2]; // Raw network-order bytes viewed as two machine words
+
+    IpAddress() { words[0] = 0; words[1] = 0; }
+
+    static IpAddress fromIPv4(quint32 networkOrder)
+    {
+        IpAddress address;
+        quint8 *bytes = address.bytes();
+        bytes[10] = 0xff;
+        bytes[11] = 0xff;
+        std::memcpy(bytes + 12, &networkOrder, 4);
+        return address;
+    }
+
+    static IpAddress fromIPv6(const quint8 *networkOrder)
+    {
+        IpAddress address;
+        std::memcpy(address.words, networkOrder, 16);
+        return address;
+    }
+
+    static IpAddress fromHostAddress(const QHostAddress &host)
+    {
+        if (host.protocol() == QAbstractSocket::IPv4Protocol) {
+            quint32 hostOrder = host.toIPv4Address();
+            quint8 networkOrder[4] = {quint8(hostOrder >> 24), quint8(hostOrder >> 16),
+                                      quint8(hostOrder >> 8), quint8(hostOrder)};
+            quint32 value;
+            std::memcpy(&value, networkOrder, 4);
+            return fromIPv4(value);
+        }
+        Q_IPV6ADDR ipv6 = host.toIPv6Address();
+        return fromIPv6(ipv6.c);
+    }
+
+    quint8 *bytes() { return reinterpret_cast<quint8 *>(words); }
+    const quint8 *bytes() const { return reinterpret_cast<const quint8 *>(words); }
+
+    bool isIPv4() const
+    {
+        static const quint8 mappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+        return std::memcmp(bytes(), mappedPrefix, 12) == 0;
+    }
+
+    bool isNull() const { return words[0] == 0 && words[1] == 0; }
+
+    // Network byte order, only meaningful when isIPv4()
+    quint32 toIPv4() const
+    {
+        quint32 value;
+        std::memcpy(&value, bytes() + 12, 4);
+        return value;
+    }
+
+    QHostAddress toHostAddress() const
+    {
+        if (isIPv4()) {
+            const quint8 *b = bytes() + 12;
+            return QHostAddress((quint32(b[0]) << 24) | (quint32(b[1]) << 16) |
+                                (quint32(b[2]) << 8) | quint32(b[3]));
+        }
+        return QHostAddress(bytes());
+    }
+
+    QString toString() const { return toHostAddress().toString(); }
+
+    bool operator==(const IpAddress &other) const
+    {
+        return words[0] == other.words[0] && words[1] == other.words[1];
+    }
+    bool operator!=(const IpAddress &other) const { return !(*this == other); }
+
+    // Arbitrary but consistent order, used to normalise flow direction
+    bool operator<(const IpAddress &other) const
+    {
+        return words[0] != other.words[0] ? words[0] < other.words[0] : words[1] < other.words[1];
+    }
+};
+
+// For QHash keys off the packet path
+inline size_t qHash(const IpAddress &address, size_t seed = 0) noexcept
+{
+    return qHashMulti(seed, address.words[0], address.words[1]);
+}
+
+#endif // IPADDRESS_H
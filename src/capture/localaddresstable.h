@@ -0,0 +1,59 @@
+#ifndef LOCALADDRESSTABLE_H
+#define LOCALADDRESSTABLE_H
+
+#include "ipaddress.h"
+#include <QHostAddress>
+#include <QList>
+#include <QtGlobal>
+#include <algorithm>
+#include <vector>
+
+/**
+ * @brief The LocalAddressTable class is a cached set of this host's interface addresses.
+ *
+ * It is used to tell whether a captured packet was sent or received by this machine. The
+ * addresses are kept as a sorted array of binary IpAddress values, so a lookup is a short
+ * binary search with no allocation. The owner enumerates the interfaces (which is a system
+ * call) on network change events and hands the result to refresh(); generation() only moves
+ * when the set actually changed, so cached classifications can be checked cheaply.
+ */
+class LocalAddressTable
+{
+public:
+    LocalAddressTable() : m_generation(1) {}
+
+    quint32 generation() const { return m_generation; }
+    size_t size() const { return m_addresses.size(); }
+
+    bool contains(const IpAddress &address) const
+    {
+        return std::binary_search(m_addresses.begin(), m_addresses.end(), address);
+    }
+
+    // Replaces the set, e.g. with QNetworkInterface::allAddresses(). Returns true if it changed.
+    bool refresh(const QList<QHostAddress> &addresses)
+    {
+        std::vector<IpAddress> updated;
+        updated.reserve(addresses.size());
+        for (const QHostAddress &host : addresses) {
+            if (!host.isNull()) {
+                updated.push_back(IpAddress::fromHostAddress(host));
+            }
+        }
+        std::sort(updated.begin(), updated.end());
+        updated.erase(std::unique(updated.begin(), updated.end()), updated.end());
+
+        if (updated == m_addresses) {
+            return false;
+        }
+        m_addresses.swap(updated);
+        m_generation++;
+        return true;
+    }
+
+private:
+    std::vector<IpAddress> m_addresses;
+    quint32 m_generation;
+};
+
+#endif // LOCALADDRESSTABLE_H
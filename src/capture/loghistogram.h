@@ -0,0 +1,80 @@
+#ifndef LOGHISTOGRAM_H
+#define LOGHISTOGRAM_H
+
+#include <QtGlobal>
+#include <bit>
+#include <limits>
+
+/**
+ * @brief The LogHistogram struct counts latency samples in power-of-two buckets.
+ *
+ * Bucket 0 holds samples below 64 µs, bucket i those in [2^(i+5), 2^(i+6)) µs and the last
+ * bucket everything from about 16 s up, so percentiles are accurate to within a factor of two
+ * at a fixed size. Per-flow histograms use 16-bit counters; when one would overflow, every
+ * bucket is halved, which keeps the shape of the distribution.
+ */
+template <typename Counter>
+struct LogHistogram {
+    static constexpr int BucketCount = 20;
+
+    Counter buckets[BucketCount];
+
+    LogHistogram() : buckets() {}
+
+    static int bucketOf(quint64 us)
+    {
+        const int bucket = int(std::bit_width(us >> 5)) - 1;
+        return bucket < 0 ? 0 : (bucket >= BucketCount ? BucketCount - 1 : bucket);
+    }
+
+    // Smallest sample that lands in the bucket after it
+    static quint64 bucketUpperUs(int bucket) { return quint64(64) << bucket; }
+
+    void add(quint64 us)
+    {
+        Counter &counter = buckets[bucketOf(us)];
+        if (counter == std::numeric_limits<Counter>::max()) {
+            for (Counter &c : buckets) {
+                c /= 2;
+            }
+        }
+        ++counter;
+    }
+
+    template <typename OtherCounter>
+    void merge(const LogHistogram<OtherCounter> &other)
+    {
+        for (int i = 0; i < BucketCount; ++i) {
+            buckets[i] += Counter(other.buckets[i]);
+        }
+    }
+
+    quint64 count() const
+    {
+        quint64 total = 0;
+        for (Counter c : buckets) {
+            total += c;
+        }
+        return total;
+    }
+
+    // Upper bound of the bucket that holds the given fraction of the samples, 0 if empty
+    quint64 percentileUs(double fraction) const
+    {
+        const quint64 total = count();
+        if (total == 0) {
+            return 0;
+        }
+        const quint64 rank = quint64(fraction * double(total - 1)) + 1;
+        quint64 seen = 0;
+        for (int i = 0; i < BucketCount; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return bucketUpperUs(i);
+            }
+        }
+        return bucketUpperUs(BucketCount - 1);
+    }
+};
+
+#endif // LOGHISTOGRAM_H
@@ -0,0 +1,556 @@
+#ifndef PACKETDECODER_H
+#define PACKETDECODER_H
+
+#include "packetdescriptor.h"
+#include <QtGlobal>
+#include <cstring>
+
+/**
+ * @brief The PacketDecoder class turns a raw captured frame into a PacketDescriptor.
+ *
+ * Every header is bounds-checked against the captured length before it is read, fields are
+ * loaded byte-wise so unaligned buffers are safe, and addresses are copied as binary values.
+ * Nothing here allocates or formats strings, so the decoder can run on the capture thread
+ * at line rate.
+ *
+ * The link layer is a template parameter: decoderForDataLink() picks one specialisation per
+ * capture handle from pcap_datalink(), so the per-packet path never switches on link type.
+ *
+ * So is tunnel decapsulation. With Tunnels set, VXLAN, GENEVE, GRE and IP-in-IP packets are
+ * decoded down to the inner packet, at most MaxTunnelDepth layers deep. The outermost tunnel
+ * is kept in PacketDescriptor::tunnel and its outer addresses in the TunnelEndpoints the
+ * caller passes in. An inner packet that cannot be decoded, e.g. because the capture cut it
+ * short, leaves the outer packet as it was. Without Tunnels the decoder is the same code as
+ * before, and with it a packet outside any tunnel only pays for a port or protocol comparison.
+ */
+class PacketDecoder
+{
+public:
+    enum LinkType {
+        LinkEthernet,    // DLT_EN10MB
+        LinkLinuxSll,    // DLT_LINUX_SLL, the Linux "any" device
+        LinkLinuxSll2,   // DLT_LINUX_SLL2
+        LinkNull,        // DLT_NULL, BSD loopback with a host-order address family
+        LinkLoop,        // DLT_LOOP, BSD loopback with a network-order address family
+        LinkRaw          // DLT_RAW/DLT_IPV4/DLT_IPV6, no link header
+    };
+
+    // DLT_* values as returned by pcap_datalink(); kept here so the decoder does not need pcap.h
+    enum DataLink {
+        DataLinkNull = 0,
+        DataLinkEthernet = 1,
+        DataLinkRaw = 12,
+        DataLinkRawOpenBsd = 14,
+        DataLinkRawLinkType = 101,
+        DataLinkLoop = 108,
+        DataLinkLinuxSll = 113,
+        DataLinkIPv4 = 228,
+        DataLinkIPv6 = 229,
+        DataLinkLinuxSll2 = 276
+    };
+
+    enum EtherType : quint16 {
+        EtherTypeIPv4 = 0x0800,
+        EtherTypeVlan = 0x8100,   // 802.1Q
+        EtherTypeQinQ = 0x88A8,   // 802.1ad service tag
+        EtherTypeQinQLegacy = 0x9100,
+        EtherTypeIPv6 = 0x86DD,
+        EtherTypeTransparentBridging = 0x6558 // An Ethernet frame, as GRE and GENEVE carry it
+    };
+
+    enum IpProtocol : quint8 {
+        ProtocolHopByHop = 0,
+        ProtocolIPv4Encap = 4,
+        ProtocolTcp = 6,
+        ProtocolUdp = 17,
+        ProtocolIPv6Encap = 41,
+        ProtocolIPv6Routing = 43,
+        ProtocolIPv6Fragment = 44,
+        ProtocolGre = 47,
+        ProtocolEsp = 50,
+        ProtocolAh = 51,
+        ProtocolIPv6NoNext = 59,
+        ProtocolIPv6DestOptions = 60,
+        ProtocolMobility = 135
+    };
+
+    typedef bool (*DecodeFunction)(const quint8 *frame, quint32 captureLength, PacketDescriptor *out,
+                                   TunnelEndpoints *endpoints);
+
+    static const quint32 EthernetHeaderLength = 14;
+    static const quint32 VlanTagLength = 4;
+    static const quint32 MaxVlanTags = 2;
+    static const quint32 LinuxSllHeaderLength = 16;
+    static const quint32 LinuxSll2HeaderLength = 20;
+    static const quint32 NullHeaderLength = 4;
+    static const quint32 MaxIPv6ExtensionHeaders = 8;
+    static const quint32 IPv4MinHeaderLength = 20;
+    static const quint32 IPv4MaxHeaderLength = 60;
+    static const quint32 IPv6HeaderLength = 40;
+    static const quint32 IPv6ExtensionBudget = 64;  // Extension header bytes kept in headers-only captures
+    static const quint32 TcpMinHeaderLength = 20;
+    static const quint32 TcpMaxHeaderLength = 60;
+    static const quint32 UdpHeaderLength = 8;
+    static const quint32 MaxTunnelDepth = 2;
+    static const quint16 VxlanPort = 4789;
+    static const quint16 VxlanLinuxPort = 8472; // The Linux default before 4789 was assigned
+    static const quint16 GenevePort = 6081;
+    static const quint32 VxlanHeaderLength = 8;
+    static const quint32 GeneveMinHeaderLength = 8;
+    static const quint32 GreMinHeaderLength = 4;
+
+    static quint16 readBe16(const quint8 *p)
+    {
+        return quint16((quint16(p[0]) << 8) | p[1]);
+    }
+
+    static quint32 readBe32(const quint8 *p)
+    {
+        return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | p[3];
+    }
+
+    // Returns the decoder for a pcap_datalink() value, or nullptr if the link type is unsupported
+    static DecodeFunction decoderForDataLink(int dataLink, bool decapsulateTunnels = false)
+    {
+        return decapsulateTunnels ? decoderFor<true>(dataLink) : decoderFor<false>(dataLink);
+    }
+
+    template <bool Tunnels>
+    static DecodeFunction decoderFor(int dataLink)
+    {
+        switch (dataLink) {
+        case DataLinkEthernet: return &decodeFrame<LinkEthernet, Tunnels>;
+        case DataLinkLinuxSll: return &decodeFrame<LinkLinuxSll, Tunnels>;
+        case DataLinkLinuxSll2: return &decodeFrame<LinkLinuxSll2, Tunnels>;
+        case DataLinkNull: return &decodeFrame<LinkNull, Tunnels>;
+        case DataLinkLoop: return &decodeFrame<LinkLoop, Tunnels>;
+        case DataLinkRaw:
+        case DataLinkRawOpenBsd:
+        case DataLinkRawLinkType:
+        case DataLinkIPv4:
+        case DataLinkIPv6: return &decodeFrame<LinkRaw, Tunnels>;
+        default: return nullptr;
+        }
+    }
+
+    // Most bytes of a frame the decoders read on this link: link header, VLAN tags, the largest
+    // network header and a TCP header with options. Longer IPv6 extension chains than the budget
+    // are still accounted, just without ports. Unknown link types (-1) get the largest value.
+    static quint32 headerSnapLength(int dataLink)
+    {
+        quint32 link;
+        switch (dataLink) {
+        case DataLinkEthernet: link = EthernetHeaderLength + MaxVlanTags * VlanTagLength; break;
+        case DataLinkLinuxSll: link = LinuxSllHeaderLength + MaxVlanTags * VlanTagLength; break;
+        case DataLinkNull:
+        case DataLinkLoop: link = NullHeaderLength; break;
+        case DataLinkRaw:
+        case DataLinkRawOpenBsd:
+        case DataLinkRawLinkType:
+        case DataLinkIPv4:
+        case DataLinkIPv6: link = 0; break;
+        default: link = LinuxSll2HeaderLength + MaxVlanTags * VlanTagLength; break;
+        }
+        const quint32 ipv6 = IPv6HeaderLength + IPv6ExtensionBudget;
+        const quint32 network = ipv6 > IPv4MaxHeaderLength ? ipv6 : IPv4MaxHeaderLength;
+        return link + network + TcpMaxHeaderLength;
+    }
+
+    // Payload bytes past the outer transport header that a decapsulating decoder reads of one
+    // tunnel layer: the largest tunnel header and the headers of an inner Ethernet frame
+    static quint32 tunnelSnapLength()
+    {
+        const quint32 geneve = GeneveMinHeaderLength + 63 * 4; // Options are up to 63 words
+        return geneve + headerSnapLength(DataLinkEthernet);
+    }
+
+    // Decodes one captured frame. Returns false for truncated frames and non-IP traffic.
+    template <LinkType Link, bool Tunnels = false>
+    static bool decodeFrame(const quint8 *frame, quint32 captureLength, PacketDescriptor *out,
+                            TunnelEndpoints *endpoints)
+    {
+        if constexpr (Link == LinkEthernet) {
+            if (captureLength < EthernetHeaderLength) {
+                return false;
+            }
+            return decodeEtherType<Tunnels>(readBe16(frame + 12), frame + EthernetHeaderLength,
+                                   captureLength - EthernetHeaderLength, out, endpoints);
+        } else if constexpr (Link == LinkLinuxSll) {
+            if (captureLength < LinuxSllHeaderLength) {
+                return false;
+            }
+            return decodeEtherType<Tunnels>(readBe16(frame + 14), frame + LinuxSllHeaderLength,
+                                   captureLength - LinuxSllHeaderLength, out, endpoints);
+        } else if constexpr (Link == LinkLinuxSll2) {
+            if (captureLength < LinuxSll2HeaderLength) {
+                return false;
+            }
+            return decodeEtherType<Tunnels>(readBe16(frame), frame + LinuxSll2HeaderLength,
+                                   captureLength - LinuxSll2HeaderLength, out, endpoints);
+        } else if constexpr (Link == LinkNull || Link == LinkLoop) {
+            if (captureLength < NullHeaderLength) {
+                return false;
+            }
+            quint32 family = readBe32(frame);
+            if constexpr (Link == LinkNull) {
+                // Host byte order of the machine that wrote the capture, which may not be ours
+                if (family > 0xFFFF) {
+                    family = (family >> 24) | ((family >> 8) & 0xFF00) |
+                             ((family << 8) & 0xFF0000) | (family << 24);
+                }
+            }
+            return decodeAddressFamily<Tunnels>(family, frame + NullHeaderLength,
+                                       captureLength - NullHeaderLength, out, endpoints);
+        } else {
+            return decodeRawIp<Tunnels>(frame, captureLength, out, endpoints);
+        }
+    }
+
+    // Kept for callers that know they have Ethernet frames
+    static bool decodeEthernet(const quint8 *frame, quint32 captureLength, PacketDescriptor *out)
+    {
+        return decodeFrame<LinkEthernet>(frame, captureLength, out, nullptr);
+    }
+
+    // Dispatches on an EtherType, skipping up to MaxVlanTags 802.1Q/802.1ad tags
+    template <bool Tunnels = false>
+    static bool decodeEtherType(quint16 etherType, const quint8 *data, quint32 length, PacketDescriptor *out,
+                                TunnelEndpoints *endpoints)
+    {
+        for (quint32 tags = 0; isVlanEtherType(etherType); ++tags) {
+            if (tags == MaxVlanTags || length < VlanTagLength) {
+                return false;
+            }
+            if (tags == 0) {
+                out->vlanId = readBe16(data) & 0x0FFF;
+            }
+            etherType = readBe16(data + 2);
+            data += VlanTagLength;
+            length -= VlanTagLength;
+        }
+        return decodeNetwork<Tunnels>(etherType, data, length, out, endpoints);
+    }
+
+    static bool isVlanEtherType(quint16 etherType)
+    {
+        return etherType == EtherTypeVlan || etherType == EtherTypeQinQ || etherType == EtherTypeQinQLegacy;
+    }
+
+    // Dispatches on an EtherType for a buffer that starts at the network header
+    template <bool Tunnels = false>
+    static bool decodeNetwork(quint16 etherType, const quint8 *data, quint32 length, PacketDescriptor *out,
+                              TunnelEndpoints *endpoints)
+    {
+        if (etherType == EtherTypeIPv4) {
+            return decodeIPv4<Tunnels>(data, length, out, endpoints);
+        } else if (etherType == EtherTypeIPv6) {
+            return decodeIPv6<Tunnels>(data, length, out, endpoints);
+        }
+        return false;
+    }
+
+    // BSD loopback address families: AF_INET is 2 everywhere, AF_INET6 differs per OS
+    template <bool Tunnels = false>
+    static bool decodeAddressFamily(quint32 family, const quint8 *data, quint32 length, PacketDescriptor *out,
+                                    TunnelEndpoints *endpoints)
+    {
+        switch (family) {
+        case 2:
+            return decodeIPv4<Tunnels>(data, length, out, endpoints);
+        case 10: // Linux
+        case 23: // Windows
+        case 24: // NetBSD, OpenBSD
+        case 28: // FreeBSD
+        case 30: // macOS
+            return decodeIPv6<Tunnels>(data, length, out, endpoints);
+        default:
+            return false;
+        }
+    }
+
+    template <bool Tunnels = false>
+    static bool decodeRawIp(const quint8 *data, quint32 length, PacketDescriptor *out, TunnelEndpoints *endpoints)
+    {
+        if (length == 0) {
+            return false;
+        }
+        const quint8 version = data[0] >> 4;
+        if (version == 4) {
+            return decodeIPv4<Tunnels>(data, length, out, endpoints);
+        } else if (version == 6) {
+            return decodeIPv6<Tunnels>(data, length, out, endpoints);
+        }
+        return false;
+    }
+
+    template <bool Tunnels = false>
+    static bool decodeIPv4(const quint8 *ip, quint32 length, PacketDescriptor *out, TunnelEndpoints *endpoints)
+    {
+        if (length < IPv4MinHeaderLength || (ip[0] >> 4) != 4) {
+            return false;
+        }
+        const quint32 headerLength = quint32(ip[0] & 0x0F) * 4;
+        if (headerLength < IPv4MinHeaderLength || headerLength > length) {
+            return false;
+        }
+
+        quint32 src;
+        quint32 dst;
+        std::memcpy(&src, ip + 12, 4);
+        std::memcpy(&dst, ip + 16, 4);
+        out->srcAddr = IpAddress::fromIPv4(src);
+        out->dstAddr = IpAddress::fromIPv4(dst);
+        out->ipVersion = 4;
+        out->protocol = ip[9];
+
+        const quint32 totalLength = readBe16(ip + 2);
+        const quint32 segmentLength = totalLength > headerLength ? totalLength - headerLength : 0;
+
+        // The identification also tells a packet seen on two interfaces from the flow's next one
+        out->fragmentId = readBe16(ip + 4);
+
+        // Only the first fragment starts with the transport header; the FragmentTracker
+        // gives the later ones its ports
+        const quint16 flagsAndOffset = readBe16(ip + 6);
+        if (flagsAndOffset & (PacketDescriptor::FragmentMore | PacketDescriptor::FragmentOffsetMask)) {
+            out->fragment = quint16(PacketDescriptor::Fragmented |
+                                    (flagsAndOffset & (PacketDescriptor::FragmentMore |
+                                                       PacketDescriptor::FragmentOffsetMask)));
+            out->fragmentLength = quint16(segmentLength);
+            if (out->isLaterFragment()) {
+                return true;
+            }
+        }
+        return decodeTransport<Tunnels>(out->protocol, ip + headerLength, length - headerLength, segmentLength, out,
+                                        endpoints);
+    }
+
+    template <bool Tunnels = false>
+    static bool decodeIPv6(const quint8 *ip, quint32 length, PacketDescriptor *out, TunnelEndpoints *endpoints)
+    {
+        if (length < IPv6HeaderLength || (ip[0] >> 4) != 6) {
+            return false;
+        }
+
+        out->srcAddr = IpAddress::fromIPv6(ip + 8);
+        out->dstAddr = IpAddress::fromIPv6(ip + 24);
+        out->ipVersion = 6;
+
+        // Walk the extension header chain down to the upper-layer protocol
+        quint8 nextHeader = ip[6];
+        const quint8 *header = ip + IPv6HeaderLength;
+        quint32 remaining = length - IPv6HeaderLength;
+        quint32 segmentLength = readBe16(ip + 4); // Payload length, less the extension headers walked
+        for (quint32 i = 0; i < MaxIPv6ExtensionHeaders; ++i) {
+            quint32 headerLength;
+            switch (nextHeader) {
+            case ProtocolHopByHop:
+            case ProtocolIPv6Routing:
+            case ProtocolIPv6DestOptions:
+            case ProtocolMobility:
+                if (remaining < 8) {
+                    out->protocol = nextHeader;
+                    return true;
+                }
+                headerLength = (quint32(header[1]) + 1) * 8;
+                break;
+            case ProtocolAh:
+                if (remaining < 8) {
+                    out->protocol = nextHeader;
+                    return true;
+                }
+                headerLength = (quint32(header[1]) + 2) * 4;
+                break;
+            case ProtocolIPv6Fragment: {
+                if (remaining < 8) {
+                    out->protocol = nextHeader;
+                    return true;
+                }
+                // Offset in 8-byte units, then the M flag; neither set is an atomic fragment,
+                // which is a whole datagram
+                const quint16 offsetAndMore = readBe16(header + 2);
+                if (offsetAndMore & 0xFFF9) {
+                    out->fragmentId = readBe32(header + 4);
+                    out->fragment = quint16(PacketDescriptor::Fragmented | (offsetAndMore >> 3) |
+                                            ((offsetAndMore & 1) ? PacketDescriptor::FragmentMore : 0));
+                    out->fragmentLength = quint16(segmentLength > 8 ? segmentLength - 8 : 0);
+                }
+                if (out->isLaterFragment()) {
+                    // No upper-layer header to read
+                    out->protocol = header[0];
+                    return true;
+                }
+                headerLength = 8;
+                break;
+            }
+            default:
+                // TCP, UDP, ESP, No Next Header or anything we do not walk through
+                out->protocol = nextHeader;
+                return decodeTransport<Tunnels>(nextHeader, header, remaining, segmentLength, out, endpoints);
+            }
+
+            if (headerLength > remaining) {
+                out->protocol = nextHeader;
+                return true;
+            }
+            nextHeader = header[0];
+            header += headerLength;
+            remaining -= headerLength;
+            segmentLength = segmentLength > headerLength ? segmentLength - headerLength : 0;
+        }
+
+        // Chain too long to be legitimate traffic; account for it without ports
+        out->protocol = nextHeader;
+        return true;
+    }
+
+    // Fills in ports, TCP header fields and the payload length. length is what was captured of
+    // the segment, segmentLength its size according to the IP header. A truncated transport header
+    // leaves the ports at zero but still yields a descriptor so the bytes are accounted for.
+    template <bool Tunnels = false>
+    static bool decodeTransport(quint8 protocol, const quint8 *l4, quint32 length, quint32 segmentLength,
+                                PacketDescriptor *out, TunnelEndpoints *endpoints)
+    {
+        quint32 headerLength = 0;
+        if (protocol == ProtocolTcp) {
+            if (length < TcpMinHeaderLength) {
+                return true;
+            }
+            out->srcPort = readBe16(l4);
+            out->dstPort = readBe16(l4 + 2);
+            out->tcpSeq = readBe32(l4 + 4);
+            out->tcpAck = readBe32(l4 + 8);
+            out->tcpFlags = l4[13];
+            out->tcpWindow = readBe16(l4 + 14);
+            headerLength = quint32(l4[12] >> 4) * 4;
+        } else if (protocol == ProtocolUdp) {
+            if (length < UdpHeaderLength) {
+                return true;
+            }
+            out->srcPort = readBe16(l4);
+            out->dstPort = readBe16(l4 + 2);
+            headerLength = UdpHeaderLength;
+        } else {
+            if constexpr (Tunnels) {
+                if (protocol == ProtocolGre || protocol == ProtocolIPv4Encap || protocol == ProtocolIPv6Encap) {
+                    decapsulate(protocol, l4, length, out, endpoints);
+                }
+            }
+            return true;
+        }
+        // Offloaded segments can carry a zero IP length; they count as having no payload
+        if (segmentLength > headerLength) {
+            out->payloadLength = quint16(segmentLength - headerLength);
+        }
+        if (length > headerLength) {
+            out->capturedPayloadLength = quint16(qMin(length - headerLength, quint32(0xFFFF)));
+        }
+        if constexpr (Tunnels) {
+            if (protocol == ProtocolUdp && isTunnelPort(out->dstPort)) {
+                decapsulate(protocol, l4, length, out, endpoints);
+            }
+        }
+        return true;
+    }
+
+    static bool isTunnelPort(quint16 port)
+    {
+        return port == VxlanPort || port == GenevePort || port == VxlanLinuxPort;
+    }
+
+    // Replaces the outer packet with the one inside its tunnel header if that decodes. l4 is the
+    // outer transport header, or the inner IP header for IP-in-IP.
+    static void decapsulate(quint8 protocol, const quint8 *l4, quint32 length, PacketDescriptor *out,
+                            TunnelEndpoints *endpoints)
+    {
+        // A tunnel packet split into IP fragments has only part of the inner packet
+        if (out->fragment != 0 || out->tunnel.depth >= MaxTunnelDepth) {
+            return;
+        }
+
+        TunnelInfo::Type type;
+        quint32 id = 0;
+        quint16 etherType;
+        quint32 headerLength;
+        if (protocol == ProtocolUdp) {
+            const quint8 *tunnel = l4 + UdpHeaderLength;
+            const quint32 available = length - UdpHeaderLength;
+            if (out->dstPort == GenevePort) {
+                // Version 0, option length in 4-byte words, protocol type and VNI
+                if (available < GeneveMinHeaderLength || (tunnel[0] >> 6) != 0) {
+                    return;
+                }
+                type = TunnelInfo::Geneve;
+                headerLength = GeneveMinHeaderLength + quint32(tunnel[0] & 0x3F) * 4;
+                etherType = readBe16(tunnel + 2);
+                id = readBe32(tunnel + 4) >> 8;
+            } else {
+                // The I flag says the VNI is valid; the payload is an Ethernet frame
+                if (available < VxlanHeaderLength || !(tunnel[0] & 0x08)) {
+                    return;
+                }
+                type = TunnelInfo::Vxlan;
+                headerLength = VxlanHeaderLength;
+                etherType = EtherTypeTransparentBridging;
+                id = readBe32(tunnel + 4) >> 8;
+            }
+            l4 = tunnel;
+            length = available;
+        } else if (protocol == ProtocolGre) {
+            // Version 0 only; version 1 is PPTP's, which carries PPP. No source routing.
+            if (length < GreMinHeaderLength) {
+                return;
+            }
+            const quint16 flags = readBe16(l4);
+            if ((flags & 0x0007) != 0 || (flags & 0x4000) != 0) {
+                return;
+            }
+            type = TunnelInfo::Gre;
+            etherType = readBe16(l4 + 2);
+            headerLength = GreMinHeaderLength + ((flags & 0x8000) ? 4 : 0);
+            if (flags & 0x2000) {
+                if (length < headerLength + 4) {
+                    return;
+                }
+                id = readBe32(l4 + headerLength);
+                headerLength += 4;
+            }
+            headerLength += (flags & 0x1000) ? 4 : 0;
+        } else {
+            type = TunnelInfo::IpInIp;
+            etherType = protocol == ProtocolIPv4Encap ? EtherTypeIPv4 : EtherTypeIPv6;
+            headerLength = 0;
+        }
+        if (headerLength > length) {
+            return;
+        }
+
+        // Only the outermost tunnel is kept; the depth counts the ones inside it
+        PacketDescriptor inner;
+        inner.vlanId = out->vlanId;
+        if (out->tunnel.depth == 0) {
+            endpoints->outerSrc = out->srcAddr;
+            endpoints->outerDst = out->dstAddr;
+            inner.tunnel.id = id;
+            inner.tunnel.type = type;
+        } else {
+            inner.tunnel = out->tunnel;
+        }
+        inner.tunnel.depth = quint8(out->tunnel.depth + 1);
+
+        const quint8 *data = l4 + headerLength;
+        const quint32 remaining = length - headerLength;
+        const bool decoded = etherType == EtherTypeTransparentBridging
+                                 ? decodeFrame<LinkEthernet, true>(data, remaining, &inner, endpoints)
+                                 : decodeNetwork<true>(etherType, data, remaining, &inner, endpoints);
+        // A cut-short inner TCP or UDP header would leave a packet without ports, which tells
+        // less than the outer one
+        const bool portless = (inner.protocol == ProtocolTcp || inner.protocol == ProtocolUdp) &&
+                              !inner.isLaterFragment() && inner.srcPort == 0 && inner.dstPort == 0;
+        if (decoded && !portless) {
+            *out = inner;
+        }
+    }
+};
+
+#endif // PACKETDECODER_H
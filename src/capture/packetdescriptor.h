@@ -0,0 +1,110 @@
+#ifndef PACKETDESCRIPTOR_H
+#define PACKETDESCRIPTOR_H
+
+#include "ipaddress.h"
+#include <QtGlobal>
+
+/**
+ * @brief The TunnelInfo struct records the outermost tunnel a packet was decapsulated from.
+ *
+ * The descriptor's addresses and ports are those of the inner packet. The tunnel's own
+ * addresses are numbered by a TunnelEndpointTable and only their index is kept here. All
+ * zero for a packet that was not tunnelled.
+ */
+struct TunnelInfo {
+    enum Type : quint8 {
+        None,
+        Vxlan,
+        Geneve,
+        Gre,
+        IpInIp // IPv4 or IPv6 in IPv4 or IPv6
+    };
+
+    quint32 id;         // VXLAN or GENEVE VNI, or GRE key; 0 if the tunnel has none
+    quint16 endpoints;  // TunnelEndpointTable index of the outer addresses, 0 if unknown
+    quint8 type;        // Type
+    quint8 depth;       // Tunnel layers removed, 0 if none
+
+    TunnelInfo() : id(0), endpoints(0), type(None), depth(0) {}
+
+    static const char *name(quint8 type)
+    {
+        switch (type) {
+        case Vxlan: return "VXLAN";
+        case Geneve: return "GENEVE";
+        case Gre: return "GRE";
+        case IpInIp: return "IP-in-IP";
+        default: return "";
+        }
+    }
+};
+
+// Outer addresses of the outermost tunnel, as the decoder found them
+struct TunnelEndpoints {
+    IpAddress outerSrc;
+    IpAddress outerDst;
+};
+
+/**
+ * @brief The PacketDescriptor struct is the compact per-packet record passed from the
+ * capture thread to the aggregation stage.
+ *
+ * It carries only what aggregation needs, so the capture thread never holds on to the
+ * libpcap buffer and never touches shared state beyond the ring it pushes into.
+ */
+struct PacketDescriptor {
+    // Bits of tcpFlags, as in the TCP header
+    enum TcpFlag : quint8 {
+        TcpFin = 0x01,
+        TcpSyn = 0x02,
+        TcpRst = 0x04,
+        TcpAck = 0x10
+    };
+
+    // Bits of fragment, laid out like the IPv4 flags and fragment offset
+    enum FragmentBit : quint16 {
+        FragmentOffsetMask = 0x1FFF, // In 8-byte units
+        FragmentMore = 0x2000,
+        Fragmented = 0x8000
+    };
+
+    quint64 timestampUs;  // Capture time from pcap_pkthdr::ts, microseconds since the epoch
+    IpAddress srcAddr;
+    IpAddress dstAddr;
+    quint32 wireLength;   // Original packet length (pcap_pkthdr::len)
+    quint16 srcPort;      // Host byte order, 0 when not TCP/UDP
+    quint16 dstPort;
+    quint8 protocol;      // IP protocol number, 6=TCP, 17=UDP
+    quint8 tcpFlags;
+    quint16 payloadLength; // TCP/UDP payload bytes according to the IP header, not the capture
+    quint16 capturedPayloadLength; // Payload bytes present at the end of the captured frame
+    quint16 sampleRate;   // Packets this one stands for, 1 unless sampled
+    quint32 tcpSeq;       // Host byte order
+    quint32 tcpAck;
+    quint16 tcpWindow;    // As sent, before window scaling
+    quint8 ipVersion;     // 4 or 6
+    quint8 sampling;      // PacketSampler::Mode the packet was kept under
+    quint16 vlanId;       // Outer 802.1Q VLAN ID, 0 when untagged
+    quint8 interfaceIndex; // Capture worker that saw the packet
+    quint8 appProtocol;   // ProtocolClassifier::Protocol of the payload, 0 (Unknown) if none
+    quint32 fragmentId;   // IPv4 identification, or IPv6 fragment header identification if fragmented
+    quint16 fragment;     // FragmentBits, 0 unless the packet is an IP fragment
+    quint16 fragmentLength; // Bytes of the datagram's payload this fragment carries
+    TunnelInfo tunnel;    // Outermost tunnel, when the decoder decapsulates
+
+    PacketDescriptor() : timestampUs(0), wireLength(0),
+                         srcPort(0), dstPort(0), protocol(0), tcpFlags(0), payloadLength(0),
+                         capturedPayloadLength(0), sampleRate(1),
+                         tcpSeq(0), tcpAck(0), tcpWindow(0), ipVersion(0), sampling(0),
+                         vlanId(0), interfaceIndex(0), appProtocol(0), fragmentId(0), fragment(0),
+                         fragmentLength(0) {}
+
+    // Capture thread only: where the payload starts in the frame this was decoded from
+    quint32 payloadOffset(quint32 captureLength) const { return captureLength - capturedPayloadLength; }
+    // Payload bytes that were both sent and captured; Ethernet padding is not payload
+    quint32 availablePayloadLength() const { return qMin(payloadLength, capturedPayloadLength); }
+    // A fragment after the first has no transport header; ports come from the first one
+    bool isLaterFragment() const { return (fragment & FragmentOffsetMask) != 0; }
+};
+
+#endif // PACKETDESCRIPTOR_H
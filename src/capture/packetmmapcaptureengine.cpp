@@ -0,0 +1,348 @@
+#include "packetmmapcaptureengine.h"
+#include "packetdecoder.h"
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef HAVE_PCAP
+#include <pcap.h>
+#endif
+
+// TPACKET_V3 packs variable-sized frames into each block, but the ring setup still wants a
+// nominal frame size that divides the block size
+static const unsigned int NominalFrameSize = TPACKET_ALIGNMENT << 7;
+
+#ifndef ARPHRD_RAWIP
+#define ARPHRD_RAWIP 519
+#endif
+
+// Maps an interface hardware type to the DLT_* value libpcap would report for a raw socket
+static int dataLinkForHardwareType(unsigned short hardwareType)
+{
+    switch (hardwareType) {
+    case ARPHRD_ETHER:
+    case ARPHRD_LOOPBACK: // Linux loopback frames carry a zeroed Ethernet header
+        return PacketDecoder::DataLinkEthernet;
+    case ARPHRD_NONE:     // tun devices
+    case ARPHRD_RAWIP:
+        return PacketDecoder::DataLinkRaw;
+    default:
+        return -1;
+    }
+}
+
+PacketMmapCaptureEngine::PacketMmapCaptureEngine()
+    : m_socket(-1)
+    , m_ring(nullptr)
+    , m_ringSize(0)
+    , m_blockSize(0)
+    , m_blockCount(0)
+    , m_currentBlock(0)
+    , m_dataLinkType(-1)
+    , m_snapLength(0)
+{
+}
+
+PacketMmapCaptureEngine::~PacketMmapCaptureEngine()
+{
+    close();
+}
+
+bool PacketMmapCaptureEngine::open(const Config &config)
+{
+    close();
+    m_config = config;
+    m_errorString.clear();
+    resetStatistics();
+
+    QByteArray device = config.interfaceName.toUtf8();
+    const unsigned int ifIndex = if_nametoindex(device.constData());
+    if (ifIndex == 0) {
+        // Also the case for the pseudo-device "any", which only the libpcap backend supports
+        m_errorString = QString("Unknown interface %1").arg(config.interfaceName);
+        return false;
+    }
+
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    if (config.blockSize <= 0 || config.blockSize % pageSize != 0 || config.blockSize % NominalFrameSize != 0 ||
+        config.blockCount <= 0) {
+        m_errorString = QString("Ring block size must be a positive multiple of %1 bytes").arg(pageSize);
+        return false;
+    }
+
+    // Protocol 0 receives nothing until bind(), so no frames from other interfaces reach the ring
+    m_socket = socket(AF_PACKET, SOCK_RAW, 0);
+    if (m_socket < 0) {
+        return fail("socket(AF_PACKET)");
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(m_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+        return fail("PACKET_VERSION");
+    }
+
+    struct tpacket_req3 request;
+    std::memset(&request, 0, sizeof(request));
+    request.tp_block_size = config.blockSize;
+    request.tp_block_nr = config.blockCount;
+    request.tp_frame_size = NominalFrameSize;
+    request.tp_frame_nr = (config.blockSize / NominalFrameSize) * config.blockCount;
+    request.tp_retire_blk_tov = config.blockTimeoutMs;
+    if (setsockopt(m_socket, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) != 0) {
+        return fail("PACKET_RX_RING");
+    }
+
+    m_blockSize = size_t(config.blockSize);
+    m_blockCount = size_t(config.blockCount);
+    m_ringSize = m_blockSize * m_blockCount;
+    void *ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_socket, 0);
+    if (ring == MAP_FAILED) {
+        return fail("mmap");
+    }
+    m_ring = static_cast<quint8 *>(ring);
+    m_currentBlock = 0;
+
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    std::strncpy(ifr.ifr_name, device.constData(), IFNAMSIZ - 1);
+    if (ioctl(m_socket, SIOCGIFHWADDR, &ifr) != 0) {
+        return fail("SIOCGIFHWADDR");
+    }
+    m_dataLinkType = dataLinkForHardwareType(ifr.ifr_hwaddr.sa_family);
+    m_snapLength = quint32(config.captureLength(m_dataLinkType));
+
+    // Attached before bind() so that not even the first packets bypass it
+    if (!setFilter(config.filter)) {
+        qWarning() << "Capturing on" << config.interfaceName << "without a filter:" << m_errorString;
+        m_errorString.clear();
+        if (!setFilter(QString())) {
+            close();
+            return false;
+        }
+    }
+
+    struct sockaddr_ll address;
+    std::memset(&address, 0, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    address.sll_ifindex = int(ifIndex);
+    if (bind(m_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+        return fail("bind");
+    }
+
+    // The kernel hashes each packet's flow symmetrically and always hands it to the same
+    // member of the group, so every socket sees whole flows
+    if (config.fanoutGroup >= 0) {
+        const int fanout = (config.fanoutGroup & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        if (setsockopt(m_socket, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+            return fail("PACKET_FANOUT");
+        }
+    }
+
+    // The membership is dropped by the kernel when the socket is closed
+    if (config.promiscuous) {
+        struct packet_mreq membership;
+        std::memset(&membership, 0, sizeof(membership));
+        membership.mr_ifindex = int(ifIndex);
+        membership.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(m_socket, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+            qWarning() << "Promiscuous mode not supported on" << config.interfaceName;
+        }
+    }
+
+    // Set here rather than in run(), so a stop() that lands before the capture thread starts is kept
+    m_running.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void PacketMmapCaptureEngine::close()
+{
+    stop();
+    if (m_ring) {
+        munmap(m_ring, m_ringSize);
+        m_ring = nullptr;
+        m_ringSize = 0;
+    }
+    if (m_socket >= 0) {
+        ::close(m_socket);
+        m_socket = -1;
+    }
+    m_dataLinkType = -1;
+    setInstalledFilter(QString());
+}
+
+bool PacketMmapCaptureEngine::run(FrameHandler handler, void *user)
+{
+    if (m_socket < 0) {
+        m_errorString = "Capture socket is not open";
+        return false;
+    }
+
+    bool ok = true;
+
+    struct pollfd pfd;
+    pfd.fd = m_socket;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    while (m_running.load(std::memory_order_relaxed)) {
+        quint8 *block = m_ring + m_currentBlock * m_blockSize;
+        struct tpacket_block_desc *descriptor = reinterpret_cast<struct tpacket_block_desc *>(block);
+
+        // The kernel publishes a block by setting TP_STATUS_USER after filling it
+        if ((__atomic_load_n(&descriptor->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            // Blocks for at most readTimeoutMs while idle, so stop() is noticed without a wake-up
+            int ready = poll(&pfd, 1, m_config.readTimeoutMs);
+            if (ready < 0 && errno != EINTR) {
+                m_errorString = QString("poll: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+                ok = false;
+                break;
+            }
+            if (ready > 0 && (pfd.revents & POLLERR)) {
+                // E.g. ENETDOWN when the interface goes away
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &length);
+                if (error != 0) {
+                    m_errorString = QString::fromLocal8Bit(strerror(error));
+                    qWarning() << "Capture socket error on" << m_config.interfaceName << ":" << m_errorString;
+                    ok = false;
+                    break;
+                }
+            }
+            updateStatisticsIfDue();
+            continue;
+        }
+
+        addDelivered(handleBlock(block, handler, user));
+
+        // Hand the whole block back to the kernel
+        __atomic_store_n(&descriptor->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        m_currentBlock = (m_currentBlock + 1) % m_blockCount;
+
+        updateStatisticsIfDue();
+    }
+
+    m_running.store(false, std::memory_order_relaxed);
+    return ok;
+}
+
+bool PacketMmapCaptureEngine::setFilter(const QString &expression)
+{
+    if (m_socket < 0) {
+        m_errorString = "Capture socket is not open";
+        return false;
+    }
+
+    std::vector<struct sock_filter> instructions;
+    if (expression.isEmpty()) {
+        // Accept everything, cut to the snap length
+        struct sock_filter acceptAll = BPF_STMT(BPF_RET | BPF_K, m_snapLength);
+        instructions.push_back(acceptAll);
+    } else {
+#ifdef HAVE_PCAP
+        // Compiled for the interface's link type without opening a second capture handle; the
+        // program returns the snap length for accepted packets
+        pcap_t *compiler = pcap_open_dead(m_dataLinkType, int(m_snapLength));
+        if (!compiler) {
+            m_errorString = "pcap_open_dead failed";
+            return false;
+        }
+        struct bpf_program program;
+        QByteArray text = expression.toUtf8();
+        if (pcap_compile(compiler, &program, text.constData(), 1, PCAP_NETMASK_UNKNOWN) != 0) {
+            m_errorString = QString("Invalid filter \"%1\": %2")
+                                .arg(expression, QString::fromLocal8Bit(pcap_geterr(compiler)));
+            pcap_close(compiler);
+            return false;
+        }
+        pcap_close(compiler);
+
+        // Classic BPF instructions have the same fields in both structures
+        instructions.resize(program.bf_len);
+        for (u_int i = 0; i < program.bf_len; ++i) {
+            instructions[i].code = program.bf_insns[i].code;
+            instructions[i].jt = program.bf_insns[i].jt;
+            instructions[i].jf = program.bf_insns[i].jf;
+            instructions[i].k = program.bf_insns[i].k;
+        }
+        pcap_freecode(&program);
+#else
+        m_errorString = QString("Filter expressions need libpcap, which is not in this build");
+        return false;
+#endif
+    }
+
+    struct sock_fprog kernelProgram;
+    kernelProgram.len = static_cast<unsigned short>(instructions.size());
+    kernelProgram.filter = instructions.data();
+
+    // Replaces any previous program atomically, also under a running capture
+    if (setsockopt(m_socket, SOL_SOCKET, SO_ATTACH_FILTER, &kernelProgram, sizeof(kernelProgram)) != 0) {
+        m_errorString = QString("SO_ATTACH_FILTER: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+    setInstalledFilter(expression);
+    return true;
+}
+
+size_t PacketMmapCaptureEngine::handleBlock(quint8 *block, FrameHandler handler, void *user)
+{
+    const struct tpacket_block_desc *descriptor = reinterpret_cast<const struct tpacket_block_desc *>(block);
+    const quint32 frameCount = descriptor->hdr.bh1.num_pkts;
+    const quint32 snapLength = m_snapLength;
+
+    const quint8 *position = block + descriptor->hdr.bh1.offset_to_first_pkt;
+    for (quint32 i = 0; i < frameCount; ++i) {
+        const struct tpacket3_hdr *frame = reinterpret_cast<const struct tpacket3_hdr *>(position);
+
+        FrameHeader header;
+        header.timestampUs = quint64(frame->tp_sec) * 1000000 + frame->tp_nsec / 1000;
+        header.captureLength = frame->tp_snaplen < snapLength ? frame->tp_snaplen : snapLength;
+        header.wireLength = frame->tp_len;
+        handler(user, header, position + frame->tp_mac);
+
+        position += frame->tp_next_offset;
+    }
+    return frameCount;
+}
+
+bool PacketMmapCaptureEngine::readKernelCounters(quint64 *received, quint64 *dropped, quint64 *interfaceDropped)
+{
+    // The kernel resets these counters on every read, so they are already deltas
+    struct tpacket_stats_v3 stats;
+    socklen_t length = sizeof(stats);
+    if (getsockopt(m_socket, SOL_PACKET, PACKET_STATISTICS, &stats, &length) != 0) {
+        return false;
+    }
+
+    *received = stats.tp_packets; // Includes the dropped packets, like pcap_stats()
+    *dropped = stats.tp_drops;
+    *interfaceDropped = 0;
+    return true;
+}
+
+bool PacketMmapCaptureEngine::fail(const QString &what)
+{
+    const int error = errno;
+    m_errorString = QString("%1: %2").arg(what, QString::fromLocal8Bit(strerror(error)));
+    close();
+    return false;
+}
+
+#endif // Q_OS_LINUX
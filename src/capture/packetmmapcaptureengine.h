@@ -0,0 +1,55 @@
+#ifndef PACKETMMAPCAPTUREENGINE_H
+#define PACKETMMAPCAPTUREENGINE_H
+
+#include "captureengine.h"
+
+#ifdef Q_OS_LINUX
+
+/**
+ * @brief The PacketMmapCaptureEngine class captures from a Linux AF_PACKET socket through a
+ * TPACKET_V3 memory-mapped block ring.
+ *
+ * The kernel fills whole blocks of Config::blockSize bytes and hands them over when they are
+ * full or Config::blockTimeoutMs has passed. Frames are passed to the handler straight out of
+ * the shared mapping, and each block is returned to the kernel once all of its frames have
+ * been handled, so there is no copy and no system call per packet.
+ *
+ * Filter expressions are compiled with libpcap's compiler when it is available and attached
+ * with SO_ATTACH_FILTER, which the kernel swaps atomically under a running capture. A socket
+ * filter is always attached because its return value is what limits the bytes copied per
+ * frame; without an expression it accepts everything up to the snap length.
+ */
+class PacketMmapCaptureEngine : public CaptureEngine
+{
+public:
+    PacketMmapCaptureEngine();
+    ~PacketMmapCaptureEngine() override;
+
+    Backend backend() const override { return BackendPacketMmap; }
+    bool open(const Config &config) override;
+    void close() override;
+    bool isOpen() const override { return m_socket >= 0; }
+    int dataLinkType() const override { return m_dataLinkType; }
+    bool run(FrameHandler handler, void *user) override;
+    bool setFilter(const QString &expression) override;
+
+protected:
+    bool readKernelCounters(quint64 *received, quint64 *dropped, quint64 *interfaceDropped) override;
+
+private:
+    bool fail(const QString &what);
+    size_t handleBlock(quint8 *block, FrameHandler handler, void *user);
+
+    int m_socket;
+    quint8 *m_ring;
+    size_t m_ringSize;
+    size_t m_blockSize;
+    size_t m_blockCount;
+    size_t m_currentBlock;
+    int m_dataLinkType;
+    quint32 m_snapLength; // Returned by every filter program, so the kernel copies no more
+};
+
+#endif // Q_OS_LINUX
+
+#endif // PACKETMMAPCAPTUREENGINE_H
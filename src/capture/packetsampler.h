@@ -0,0 +1,143 @@
+#ifndef PACKETSAMPLER_H
+#define PACKETSAMPLER_H
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+#include <cmath>
+
+/**
+ * @brief The PacketSampler class picks the packets a capture thread analyses when the link is
+ * too fast to look at all of them.
+ *
+ * EveryNth keeps one frame in N, counted before decoding, so the frames it skips cost next to
+ * nothing. FlowHash keeps every packet of one flow in N, picked by the symmetric flow hash,
+ * so the flows it keeps are seen whole and their TCP state, RTT and protocol stay exact.
+ * Kept packets carry N in PacketDescriptor::sampleRate and the counters downstream are scaled
+ * by it; SampleVariance says how far off the scaled counters may be.
+ *
+ * The setting may be changed from any thread and applies from the next frame; everything
+ * else is for the capture thread only.
+ */
+class PacketSampler
+{
+public:
+    enum Mode : quint8 {
+        Off,
+        EveryNth,
+        FlowHash
+    };
+
+    static constexpr int MaxRate = 65535; // Travels as a quint16
+
+    struct Setting {
+        Mode mode;
+        quint16 rate; // 1 while off
+    };
+
+    PacketSampler() : m_setting(pack(Off, 1)), m_skipped(0) {}
+
+    // A rate of 1 is the same as Off
+    void configure(Mode mode, int rate)
+    {
+        rate = qBound(1, rate, MaxRate);
+        if (mode == Off || rate == 1) {
+            mode = Off;
+            rate = 1;
+        }
+        m_setting.store(pack(mode, quint16(rate)), std::memory_order_relaxed);
+    }
+
+    Setting setting() const
+    {
+        const quint32 packed = m_setting.load(std::memory_order_relaxed);
+        return Setting{Mode(packed >> 16), quint16(packed)};
+    }
+
+    // Before decoding. Keeps the last frame of every N.
+    bool keepFrame(const Setting &setting)
+    {
+        if (setting.mode != EveryNth) {
+            return true;
+        }
+        if (++m_skipped < setting.rate) {
+            return false;
+        }
+        m_skipped = 0;
+        return true;
+    }
+
+    // Once the flow is known. The hash's high half already picks the shard and its low bits
+    // the table slot, so it is remixed first and the flows kept spread over all of them.
+    static bool keepFlow(const Setting &setting, quint64 flowHash)
+    {
+        return setting.mode != FlowHash || sampleHash(flowHash) % quint32(setting.rate) == 0;
+    }
+
+    static QString describe(Mode mode, int rate)
+    {
+        switch (mode) {
+        case EveryNth: return QString("1 in %1 packets").arg(rate);
+        case FlowHash: return QString("1 in %1 flows").arg(rate);
+        default: return QString("Off");
+        }
+    }
+
+private:
+    static quint32 pack(Mode mode, quint16 rate) { return quint32(mode) << 16 | rate; }
+
+    // Final step of splitmix64; every output bit depends on every bit of the flow hash
+    static quint32 sampleHash(quint64 hash)
+    {
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        return quint32((hash ^ (hash >> 31)) >> 32);
+    }
+
+    std::atomic<quint32> m_setting; // Mode and rate together, so a switch is never seen half done
+    quint32 m_skipped;              // Frames since the last one kept
+};
+
+/**
+ * @brief The SampleVariance struct sums the variance of packet and byte counts that were
+ * scaled up from samples, so that each estimate can carry a confidence interval.
+ *
+ * Horvitz-Thompson: a unit of size y kept with probability 1/w adds y^2 w (w - 1). Under
+ * EveryNth the unit is the packet. Under FlowHash it is one side of a flow, which grows
+ * while the flow runs; adding the growth of y^2 with each packet keeps the sum exact without
+ * knowing the final size. Zero while nothing was sampled.
+ */
+struct SampleVariance {
+    static constexpr double ConfidenceZ = 1.96; // Two-sided 95%
+
+    double packets;
+    double bytes;
+
+    SampleVariance() : packets(0), bytes(0) {}
+
+    // A kept packet of the given size; unitPackets and unitBytes are what its unit held
+    // before it, 0 when the unit is the packet
+    void add(quint16 weight, quint64 packetBytes, quint64 unitPackets = 0, quint64 unitBytes = 0)
+    {
+        if (weight <= 1) {
+            return;
+        }
+        const double factor = double(weight) * double(weight - 1);
+        packets += factor * double(2 * unitPackets + 1);
+        bytes += factor * (2.0 * double(unitBytes) + double(packetBytes)) * double(packetBytes);
+    }
+
+    void merge(const SampleVariance &other)
+    {
+        packets += other.packets;
+        bytes += other.bytes;
+    }
+
+    bool isEmpty() const { return packets == 0; }
+
+    // Half width of the 95% confidence interval around the scaled count
+    quint64 packetMargin() const { return quint64(ConfidenceZ * std::sqrt(packets) + 0.5); }
+    quint64 byteMargin() const { return quint64(ConfidenceZ * std::sqrt(bytes) + 0.5); }
+};
+
+#endif // PACKETSAMPLER_H
@@ -0,0 +1,171 @@
+#include "passivedns.h"
+
+PassiveDns::PassiveDns(int maxNames)
+    : m_maxNames(qMax(maxNames, 1))
+    , m_sequence(0)
+    , m_unmatchedResponses(0)
+    , m_nowUs(0)
+    , m_lastSweepUs(0)
+{
+}
+
+void PassiveDns::process(const DnsMessage &message)
+{
+    m_nowUs = qMax(m_nowUs, message.timestampUs);
+    if (m_nowUs - m_lastSweepUs >= SweepIntervalUs) {
+        sweep();
+    }
+
+    QueryKey key;
+    key.client = message.client;
+    key.server = message.server;
+    key.clientPort = message.clientPort;
+    key.id = message.id;
+
+    if (!message.response) {
+        // A query seen again, on a second interface or as a retry, is still one query
+        if (m_pendingQueries.contains(key) || m_pendingQueries.size() >= MaxPendingQueries) {
+            return;
+        }
+        m_pendingQueries.insert(key, PendingQuery{message.timestampUs, questionHash(message)});
+        if (ResolverStatistics *stats = resolver(message.server)) {
+            stats->queries++;
+        }
+        return;
+    }
+
+    // Only responses to a query we saw count or name anything, which also drops duplicates.
+    // A response to another question is left for the real answer to the query.
+    auto pending = m_pendingQueries.find(key);
+    if (pending == m_pendingQueries.end() || pending.value().questionHash != questionHash(message)) {
+        m_unmatchedResponses++;
+        return;
+    }
+    const quint64 queryUs = pending.value().timestampUs;
+    m_pendingQueries.erase(pending);
+    if (ResolverStatistics *stats = resolver(message.server)) {
+        stats->responses++;
+        if (message.timestampUs >= queryUs) {
+            stats->latency.add(message.timestampUs - queryUs);
+        }
+        if (message.responseCode == DnsParser::NameError) {
+            stats->nxdomain++;
+        } else if (message.responseCode == DnsParser::ServerFailure) {
+            stats->serverFailures++;
+        }
+    }
+
+    if (message.responseCode != DnsParser::NoError || message.addressCount == 0 || message.nameLength == 0) {
+        return;
+    }
+    // One string shared by all the addresses of the answer
+    const QString name = QString::fromLatin1(message.name, message.nameLength);
+    for (int i = 0; i < message.addressCount; ++i) {
+        addName(message.addresses[i], name, message.ttls[i]);
+    }
+}
+
+QString PassiveDns::lookup(const IpAddress &address) const
+{
+    auto it = m_names.constFind(address);
+    if (it == m_names.constEnd() || it.value().expiresUs <= m_nowUs) {
+        return QString();
+    }
+    return it.value().name;
+}
+
+void PassiveDns::clear()
+{
+    m_names.clear();
+    m_order.clear();
+    m_pendingQueries.clear();
+    m_resolvers.clear();
+    m_unmatchedResponses = 0;
+    m_sequence = 0;
+    m_nowUs = 0;
+    m_lastSweepUs = 0;
+}
+
+// The parser lower-cases names, so a resolver echoing the question in another case still matches
+size_t PassiveDns::questionHash(const DnsMessage &message)
+{
+    return qHashBits(message.name, message.nameLength, message.questionType);
+}
+
+void PassiveDns::addName(const IpAddress &address, const QString &name, quint32 ttl)
+{
+    Entry &entry = m_names[address];
+    entry.name = name;
+    entry.expiresUs = m_nowUs + quint64(qMin(ttl, MaxTtlSeconds) + StaleGraceSeconds) * 1000000;
+    entry.sequence = ++m_sequence;
+    m_order.push_back(OrderEntry{address, entry.sequence});
+
+    // Evict the oldest insertions; order entries left behind by a refresh are skipped
+    while (m_names.size() > m_maxNames && !m_order.empty()) {
+        const OrderEntry oldest = m_order.front();
+        m_order.pop_front();
+        auto it = m_names.find(oldest.address);
+        if (it != m_names.end() && it.value().sequence == oldest.sequence) {
+            m_names.erase(it);
+        }
+    }
+    if (m_order.size() > 2 * size_t(m_maxNames)) {
+        compactOrder();
+    }
+}
+
+PassiveDns::ResolverStatistics *PassiveDns::resolver(const IpAddress &server)
+{
+    auto it = m_resolvers.find(server);
+    if (it != m_resolvers.end()) {
+        return &it.value();
+    }
+    // Anything answering on port 53 shows up here, so the count is capped
+    if (m_resolvers.size() >= MaxResolvers) {
+        return nullptr;
+    }
+    return &m_resolvers[server];
+}
+
+void PassiveDns::sweep()
+{
+    m_lastSweepUs = m_nowUs;
+
+    for (auto it = m_pendingQueries.begin(); it != m_pendingQueries.end();) {
+        if (m_nowUs - it.value().timestampUs < QueryTimeoutUs) {
+            ++it;
+            continue;
+        }
+        auto stats = m_resolvers.find(it.key().server);
+        if (stats != m_resolvers.end()) {
+            stats.value().unanswered++;
+        }
+        it = m_pendingQueries.erase(it);
+    }
+
+    bool removed = false;
+    for (auto it = m_names.begin(); it != m_names.end();) {
+        if (it.value().expiresUs <= m_nowUs) {
+            it = m_names.erase(it);
+            removed = true;
+        } else {
+            ++it;
+        }
+    }
+    if (removed) {
+        compactOrder();
+    }
+}
+
+// Drops the order entries of names that were refreshed or removed since
+void PassiveDns::compactOrder()
+{
+    std::deque<OrderEntry> live;
+    for (const OrderEntry &entry : m_order) {
+        auto it = m_names.constFind(entry.address);
+        if (it != m_names.constEnd() && it.value().sequence == entry.sequence) {
+            live.push_back(entry);
+        }
+    }
+    m_order.swap(live);
+}
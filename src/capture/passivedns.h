@@ -0,0 +1,120 @@
+#ifndef PASSIVEDNS_H
+#define PASSIVEDNS_H
+
+#include "dnsparser.h"
+#include "ipaddress.h"
+#include "loghistogram.h"
+#include <QHash>
+#include <QString>
+#include <QtGlobal>
+#include <deque>
+
+/**
+ * @brief The PassiveDns class learns host names from the DNS traffic seen on the wire.
+ *
+ * Each answered A/AAAA record maps its address to the question name, so connections get a
+ * name without a single lookup of our own. The table is bounded: past maxNames the oldest
+ * insertions go first, and a name is dropped StaleGraceSeconds after its TTL ran out, since
+ * connections routinely outlive the TTL of the record that started them.
+ *
+ * Queries are matched to their responses by client, resolver, port, ID and question to time
+ * each resolver and count its NXDOMAIN and SERVFAIL answers. Names are only learnt from a
+ * response that matched a query, so a spoofed or unsolicited answer cannot name an address;
+ * such responses are counted instead. Time is packet time, so a replayed file ages the table
+ * as it was recorded. Not thread-safe; the owner serialises access.
+ */
+class PassiveDns
+{
+public:
+    static constexpr int DefaultMaxNames = 65536;
+    static constexpr int MaxResolvers = 256;
+    static constexpr int MaxPendingQueries = 4096;
+    static constexpr quint32 MaxTtlSeconds = 86400;
+    static constexpr quint32 StaleGraceSeconds = 3600;
+    static constexpr quint64 QueryTimeoutUs = 5000000;  // Unanswered after this long
+    static constexpr quint64 SweepIntervalUs = 10000000;
+
+    struct ResolverStatistics {
+        quint64 queries;
+        quint64 responses;      // Responses that matched a query
+        quint64 nxdomain;
+        quint64 serverFailures;
+        quint64 unanswered;     // Queries without a response within QueryTimeoutUs
+        LogHistogram<quint64> latency;
+
+        ResolverStatistics() : queries(0), responses(0), nxdomain(0), serverFailures(0), unanswered(0) {}
+
+        // Share of the matched responses that were NXDOMAIN, in percent
+        double nxdomainRate() const
+        {
+            return responses == 0 ? 0.0 : 100.0 * double(nxdomain) / double(responses);
+        }
+    };
+
+    explicit PassiveDns(int maxNames = DefaultMaxNames);
+
+    void process(const DnsMessage &message);
+
+    // Empty if the address was not seen in an answer or its entry expired
+    QString lookup(const IpAddress &address) const;
+    int size() const { return m_names.size(); }
+    QHash<IpAddress, ResolverStatistics> resolverStatistics() const { return m_resolvers; }
+    // Responses without a pending query of the same ID, endpoints and question, including
+    // duplicates and answers that came after the query timed out
+    quint64 unmatchedResponses() const { return m_unmatchedResponses; }
+    void clear();
+
+private:
+    struct Entry {
+        QString name;
+        quint64 expiresUs;
+        quint64 sequence; // Matches the latest OrderEntry for this address
+    };
+
+    struct OrderEntry {
+        IpAddress address;
+        quint64 sequence;
+    };
+
+    struct QueryKey {
+        IpAddress client;
+        IpAddress server;
+        quint16 clientPort;
+        quint16 id;
+
+        bool operator==(const QueryKey &other) const
+        {
+            return client == other.client && server == other.server && clientPort == other.clientPort &&
+                   id == other.id;
+        }
+    };
+
+    friend size_t qHash(const QueryKey &key, size_t seed) noexcept
+    {
+        return qHashMulti(seed, key.client, key.server, key.clientPort, key.id);
+    }
+
+    struct PendingQuery {
+        quint64 timestampUs;
+        size_t questionHash; // Of the name and type, which the response must repeat
+    };
+
+    static size_t questionHash(const DnsMessage &message);
+
+    void addName(const IpAddress &address, const QString &name, quint32 ttl);
+    ResolverStatistics *resolver(const IpAddress &server);
+    void sweep();
+    void compactOrder();
+
+    int m_maxNames;
+    QHash<IpAddress, Entry> m_names;
+    std::deque<OrderEntry> m_order; // Insertion order, with stale entries for refreshed names
+    quint64 m_sequence;
+    QHash<QueryKey, PendingQuery> m_pendingQueries;
+    QHash<IpAddress, ResolverStatistics> m_resolvers;
+    quint64 m_unmatchedResponses;
+    quint64 m_nowUs;       // Latest packet time seen
+    quint64 m_lastSweepUs;
+};
+
+#endif // PASSIVEDNS_H
@@ -0,0 +1,295 @@
+#include "pcapcaptureengine.h"
+#include <QDebug>
+
+#ifdef HAVE_PCAP
+
+// How long setFilter() waits for the capture loop beyond one read timeout; a paced replay can
+// spend longer than that in one batch
+static const int FilterInstallGraceMs = 2000;
+
+PcapCaptureEngine::PcapCaptureEngine()
+    : m_handle(nullptr)
+    , m_handler(nullptr)
+    , m_handlerUser(nullptr)
+    , m_filterPending(false)
+    , m_lastReceived(0)
+    , m_lastDropped(0)
+    , m_lastInterfaceDropped(0)
+    , m_hasPendingFilter(false)
+    , m_inCaptureLoop(false)
+{
+}
+
+PcapCaptureEngine::~PcapCaptureEngine()
+{
+    close();
+}
+
+bool PcapCaptureEngine::open(const Config &config)
+{
+    close();
+    m_config = config;
+    m_errorString.clear();
+    resetStatistics();
+    m_lastReceived = 0;
+    m_lastDropped = 0;
+    m_lastInterfaceDropped = 0;
+
+    char errbuf[PCAP_ERRBUF_SIZE];
+    QByteArray device = config.interfaceName.toUtf8();
+
+    m_handle = pcap_create(device.constData(), errbuf);
+    if (!m_handle) {
+        m_errorString = QString::fromLocal8Bit(errbuf);
+        return false;
+    }
+
+    // Options must be set before activation; failures here leave libpcap defaults in place
+    // The link type is only known after activation, so headers-only mode sizes for the largest
+    pcap_set_snaplen(m_handle, config.captureLength(-1));
+    pcap_set_promisc(m_handle, config.promiscuous ? 1 : 0);
+    pcap_set_timeout(m_handle, config.readTimeoutMs);
+    if (config.bufferSize > 0 && pcap_set_buffer_size(m_handle, config.bufferSize) != 0) {
+        qWarning() << "Failed to set capture buffer size to" << config.bufferSize;
+    }
+    if (pcap_set_immediate_mode(m_handle, config.immediateMode ? 1 : 0) != 0) {
+        qWarning() << "Immediate mode not supported on" << config.interfaceName;
+    }
+
+    int status = pcap_activate(m_handle);
+    if (status < 0) {
+        m_errorString = QString::fromLocal8Bit(pcap_geterr(m_handle));
+        if (m_errorString.isEmpty()) {
+            m_errorString = QString::fromLocal8Bit(pcap_statustostr(status));
+        }
+        pcap_close(m_handle);
+        m_handle = nullptr;
+        return false;
+    } else if (status > 0) {
+        // Warnings such as PCAP_WARNING_PROMISC_NOTSUP do not prevent capturing
+        qWarning() << "pcap_activate warning on" << config.interfaceName << ":"
+                   << pcap_statustostr(status);
+    }
+
+    installInitialFilter();
+    m_running.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void PcapCaptureEngine::installInitialFilter()
+{
+    // Nothing is dispatching yet, so the filter can go in straight away. A bad expression
+    // from the settings should not stop the capture; it runs unfiltered instead.
+    if (m_config.filter.isEmpty()) {
+        return;
+    }
+    if (!setFilter(m_config.filter)) {
+        qWarning() << "Capturing on" << m_config.interfaceName << "without a filter:" << m_errorString;
+        m_errorString.clear();
+    }
+}
+
+void PcapCaptureEngine::close()
+{
+    stop();
+    discardPendingFilter();
+    if (m_handle) {
+        pcap_close(m_handle);
+        m_handle = nullptr;
+    }
+    setInstalledFilter(QString());
+}
+
+int PcapCaptureEngine::dataLinkType() const
+{
+    return m_handle ? pcap_datalink(m_handle) : -1;
+}
+
+bool PcapCaptureEngine::run(FrameHandler handler, void *user)
+{
+    if (!m_handle) {
+        m_errorString = "Capture handle is not open";
+        return false;
+    }
+
+    m_handler = handler;
+    m_handlerUser = user;
+    setInCaptureLoop(true);
+    bool ok = true;
+
+    while (m_running.load(std::memory_order_relaxed)) {
+        if (m_filterPending.load(std::memory_order_acquire)) {
+            installPendingFilter();
+        }
+
+        // Blocks for at most readTimeoutMs while idle, so there is no need to sleep here
+        int count = pcap_dispatch(m_handle, m_config.batchSize, &PcapCaptureEngine::dispatchFrame,
+                                  reinterpret_cast<u_char *>(this));
+        if (count == PCAP_ERROR_BREAK) {
+            break;
+        } else if (count == PCAP_ERROR) {
+            m_errorString = QString::fromLocal8Bit(pcap_geterr(m_handle));
+            qWarning() << "pcap_dispatch failed:" << m_errorString;
+            ok = false;
+            break;
+        } else if (count > 0) {
+            addDelivered(static_cast<quint64>(count));
+        }
+
+        updateStatisticsIfDue();
+    }
+
+    setInCaptureLoop(false);
+    m_running.store(false, std::memory_order_relaxed);
+    return ok;
+}
+
+void PcapCaptureEngine::stop()
+{
+    CaptureEngine::stop();
+    if (m_handle) {
+        pcap_breakloop(m_handle);
+    }
+}
+
+bool PcapCaptureEngine::setFilter(const QString &expression)
+{
+    if (!m_handle) {
+        m_errorString = "Capture handle is not open";
+        return false;
+    }
+    std::lock_guard<std::mutex> callerLock(m_setFilterMutex);
+
+    // Compiled on a dead handle, as the live one may be inside pcap_dispatch(). Optimised, and
+    // with an unknown netmask since only "ip broadcast" would need it.
+    pcap_t *compiler = pcap_open_dead(pcap_datalink(m_handle), pcap_snapshot(m_handle));
+    if (!compiler) {
+        m_errorString = "pcap_open_dead failed";
+        return false;
+    }
+    struct bpf_program program;
+    QByteArray text = expression.toUtf8();
+    const bool compiled = pcap_compile(compiler, &program, text.constData(), 1, PCAP_NETMASK_UNKNOWN) == 0;
+    if (!compiled) {
+        m_errorString = QString("Invalid filter \"%1\": %2")
+                            .arg(expression, QString::fromLocal8Bit(pcap_geterr(compiler)));
+    }
+    pcap_close(compiler);
+    if (!compiled) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(m_pendingFilterMutex);
+    if (!m_inCaptureLoop) {
+        // Nothing is dispatching, so it can go in straight away
+        const bool installed = installFilter(&program, expression, &m_errorString);
+        pcap_freecode(&program);
+        return installed;
+    }
+
+    m_pendingFilter = program;
+    m_pendingFilterExpression = expression;
+    m_pendingFilterError.clear();
+    m_hasPendingFilter = true;
+    m_filterPending.store(true, std::memory_order_release);
+
+    // The loop gets to it after the batch in progress
+    const auto timeout = std::chrono::milliseconds(m_config.readTimeoutMs + FilterInstallGraceMs);
+    if (!m_filterInstalled.wait_for(lock, timeout, [this]() { return !m_hasPendingFilter; })) {
+        // Withdrawn, so the filter in place stays the one filter() reports
+        pcap_freecode(&m_pendingFilter);
+        m_hasPendingFilter = false;
+        m_filterPending.store(false, std::memory_order_relaxed);
+        m_errorString = QString("Filter \"%1\" was not installed in time").arg(expression);
+        return false;
+    }
+    if (!m_pendingFilterError.isEmpty()) {
+        m_errorString = m_pendingFilterError;
+        return false;
+    }
+    return true;
+}
+
+bool PcapCaptureEngine::installFilter(struct bpf_program *program, const QString &expression, QString *error)
+{
+    // libpcap keeps its own copy of the program
+    if (pcap_setfilter(m_handle, program) != 0) {
+        *error = QString("pcap_setfilter failed on %1: %2")
+                     .arg(m_config.interfaceName, QString::fromLocal8Bit(pcap_geterr(m_handle)));
+        return false;
+    }
+    setInstalledFilter(expression);
+    return true;
+}
+
+void PcapCaptureEngine::installPendingFilter()
+{
+    std::lock_guard<std::mutex> lock(m_pendingFilterMutex);
+    installPendingFilterLocked();
+}
+
+void PcapCaptureEngine::installPendingFilterLocked()
+{
+    m_filterPending.store(false, std::memory_order_relaxed);
+    if (!m_hasPendingFilter) {
+        return;
+    }
+    if (!installFilter(&m_pendingFilter, m_pendingFilterExpression, &m_pendingFilterError)) {
+        qWarning() << m_pendingFilterError;
+    }
+    pcap_freecode(&m_pendingFilter);
+    m_hasPendingFilter = false;
+    m_filterInstalled.notify_all();
+}
+
+void PcapCaptureEngine::setInCaptureLoop(bool inLoop)
+{
+    std::lock_guard<std::mutex> lock(m_pendingFilterMutex);
+    m_inCaptureLoop = inLoop;
+    // A filter requested while the loop was ending goes in now rather than timing out
+    if (!inLoop) {
+        installPendingFilterLocked();
+    }
+}
+
+void PcapCaptureEngine::discardPendingFilter()
+{
+    std::lock_guard<std::mutex> lock(m_pendingFilterMutex);
+    if (m_hasPendingFilter) {
+        pcap_freecode(&m_pendingFilter);
+        m_hasPendingFilter = false;
+        m_pendingFilterError = "Capture handle was closed";
+        m_filterInstalled.notify_all();
+    }
+    m_filterPending.store(false, std::memory_order_relaxed);
+}
+
+void PcapCaptureEngine::dispatchFrame(u_char *context, const struct pcap_pkthdr *pkthdr, const u_char *packet)
+{
+    PcapCaptureEngine *engine = reinterpret_cast<PcapCaptureEngine *>(context);
+    FrameHeader header;
+    header.timestampUs = quint64(pkthdr->ts.tv_sec) * 1000000 + pkthdr->ts.tv_usec;
+    header.captureLength = pkthdr->caplen;
+    // Some writers store len < caplen; never account for less than was captured
+    header.wireLength = pkthdr->len > pkthdr->caplen ? pkthdr->len : pkthdr->caplen;
+    engine->m_handler(engine->m_handlerUser, header, packet);
+}
+
+bool PcapCaptureEngine::readKernelCounters(quint64 *received, quint64 *dropped, quint64 *interfaceDropped)
+{
+    struct pcap_stat ps;
+    if (pcap_stats(m_handle, &ps) != 0) {
+        return false;
+    }
+
+    // The kernel counters are 32-bit and wrap; unsigned subtraction handles that
+    *received = quint32(ps.ps_recv - m_lastReceived);
+    *dropped = quint32(ps.ps_drop - m_lastDropped);
+    *interfaceDropped = quint32(ps.ps_ifdrop - m_lastInterfaceDropped);
+    m_lastReceived = ps.ps_recv;
+    m_lastDropped = ps.ps_drop;
+    m_lastInterfaceDropped = ps.ps_ifdrop;
+    return true;
+}
+
+#endif // HAVE_PCAP
@@ -0,0 +1,74 @@
+#ifndef PCAPCAPTUREENGINE_H
+#define PCAPCAPTUREENGINE_H
+
+#include "captureengine.h"
+
+#ifdef HAVE_PCAP
+#include <condition_variable>
+#include <pcap.h>
+
+/**
+ * @brief The PcapCaptureEngine class captures through a libpcap/Npcap handle.
+ *
+ * The handle is created with pcap_create()/pcap_activate() so that the kernel buffer size,
+ * read timeout and immediate mode can be tuned, and packets are pulled with pcap_dispatch()
+ * in batches of Config::batchSize.
+ *
+ * pcap_setfilter() must not race pcap_dispatch() on the same handle. setFilter() compiles the
+ * program against a dead handle of the same link type and, while run() is looping, has the
+ * loop install it between two batches and waits for the outcome.
+ */
+class PcapCaptureEngine : public CaptureEngine
+{
+public:
+    PcapCaptureEngine();
+    ~PcapCaptureEngine() override;
+
+    Backend backend() const override { return BackendPcap; }
+    bool open(const Config &config) override;
+    void close() override;
+    bool isOpen() const override { return m_handle != nullptr; }
+    int dataLinkType() const override;
+    bool run(FrameHandler handler, void *user) override;
+    void stop() override;
+    bool setFilter(const QString &expression) override;
+
+protected:
+    bool readKernelCounters(quint64 *received, quint64 *dropped, quint64 *interfaceDropped) override;
+
+    // Installs config.filter on a freshly opened handle, warning instead of failing
+    void installInitialFilter();
+    void installPendingFilter();
+    // Called by run() around its loop; while it loops, filters are installed by the loop
+    void setInCaptureLoop(bool inLoop);
+
+    pcap_t *m_handle;
+    FrameHandler m_handler;
+    void *m_handlerUser;
+    std::atomic<bool> m_filterPending; // Checked by the capture loop before every batch
+
+private:
+    static void dispatchFrame(u_char *context, const struct pcap_pkthdr *pkthdr, const u_char *packet);
+    bool installFilter(struct bpf_program *program, const QString &expression, QString *error);
+    void installPendingFilterLocked();
+    void discardPendingFilter();
+
+    // Capture-thread only bookkeeping for the pcap_stats() deltas
+    quint32 m_lastReceived;
+    quint32 m_lastDropped;
+    quint32 m_lastInterfaceDropped;
+
+    // Compiled by setFilter(), installed by the capture loop, which signals m_filterInstalled
+    std::mutex m_setFilterMutex; // One setFilter() at a time
+    std::mutex m_pendingFilterMutex;
+    std::condition_variable m_filterInstalled;
+    struct bpf_program m_pendingFilter;
+    QString m_pendingFilterExpression;
+    QString m_pendingFilterError; // Empty once the pending filter is installed
+    bool m_hasPendingFilter;
+    bool m_inCaptureLoop;
+};
+
+#endif // HAVE_PCAP
+
+#endif // PCAPCAPTUREENGINE_H
@@ -0,0 +1,126 @@
+#include "pcapfilecaptureengine.h"
+#include <QDebug>
+#include <thread>
+
+#ifdef HAVE_PCAP
+
+PcapFileCaptureEngine::PcapFileCaptureEngine()
+    : m_snapLength(0)
+    , m_lastDelivered(0)
+    , m_paceStarted(false)
+    , m_firstTimestampUs(0)
+{
+}
+
+bool PcapFileCaptureEngine::open(const Config &config)
+{
+    close();
+    m_config = config;
+    m_errorString.clear();
+    resetStatistics();
+    m_lastDelivered = 0;
+    m_paceStarted = false;
+
+    // Reads both pcap and pcapng; nanosecond files are scaled to microseconds by libpcap
+    char errbuf[PCAP_ERRBUF_SIZE];
+    QByteArray path = config.interfaceName.toLocal8Bit();
+    m_handle = pcap_open_offline_with_tstamp_precision(path.constData(), PCAP_TSTAMP_PRECISION_MICRO, errbuf);
+    if (!m_handle) {
+        m_errorString = QString::fromLocal8Bit(errbuf);
+        return false;
+    }
+
+    m_snapLength = quint32(config.captureLength(pcap_datalink(m_handle)));
+    installInitialFilter();
+    m_running.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+bool PcapFileCaptureEngine::run(FrameHandler handler, void *user)
+{
+    if (!m_handle) {
+        m_errorString = "Capture file is not open";
+        return false;
+    }
+
+    m_handler = handler;
+    m_handlerUser = user;
+    setInCaptureLoop(true);
+    bool ok = true;
+
+    while (m_running.load(std::memory_order_relaxed)) {
+        if (m_filterPending.load(std::memory_order_acquire)) {
+            installPendingFilter();
+        }
+
+        // Filtered-out frames do not count towards the batch, so 0 only happens at the end
+        int count = pcap_dispatch(m_handle, m_config.batchSize, &PcapFileCaptureEngine::replayFrame,
+                                  reinterpret_cast<u_char *>(this));
+        if (count == 0 || count == PCAP_ERROR_BREAK) {
+            break;
+        } else if (count == PCAP_ERROR) {
+            m_errorString = QString::fromLocal8Bit(pcap_geterr(m_handle));
+            qWarning() << "Reading" << m_config.interfaceName << "failed:" << m_errorString;
+            ok = false;
+            break;
+        }
+        addDelivered(static_cast<quint64>(count));
+
+        updateStatisticsIfDue();
+    }
+
+    setInCaptureLoop(false);
+    m_running.store(false, std::memory_order_relaxed);
+    return ok;
+}
+
+void PcapFileCaptureEngine::replayFrame(u_char *context, const struct pcap_pkthdr *pkthdr, const u_char *packet)
+{
+    PcapFileCaptureEngine *engine = reinterpret_cast<PcapFileCaptureEngine *>(context);
+    FrameHeader header;
+    header.timestampUs = quint64(pkthdr->ts.tv_sec) * 1000000 + pkthdr->ts.tv_usec;
+    header.captureLength = pkthdr->caplen < engine->m_snapLength ? pkthdr->caplen : engine->m_snapLength;
+    header.wireLength = pkthdr->len > pkthdr->caplen ? pkthdr->len : pkthdr->caplen;
+
+    if (engine->m_config.replaySpeed > 0) {
+        engine->waitForTimestamp(header.timestampUs);
+    }
+    engine->m_handler(engine->m_handlerUser, header, packet);
+}
+
+void PcapFileCaptureEngine::waitForTimestamp(quint64 timestampUs)
+{
+    if (!m_paceStarted) {
+        m_paceStarted = true;
+        m_firstTimestampUs = timestampUs;
+        m_replayStart = std::chrono::steady_clock::now();
+        return;
+    }
+
+    // Frames recorded out of order are sent straight away rather than stepping the clock back
+    if (timestampUs <= m_firstTimestampUs) {
+        return;
+    }
+    const double offsetUs = double(timestampUs - m_firstTimestampUs) / m_config.replaySpeed;
+    const auto due = m_replayStart + std::chrono::microseconds(qint64(offsetUs));
+
+    // Sleep in slices so that stop() is noticed during long gaps in the recording
+    const auto slice = std::chrono::milliseconds(m_config.readTimeoutMs > 0 ? m_config.readTimeoutMs : 100);
+    for (auto now = std::chrono::steady_clock::now(); now < due && m_running.load(std::memory_order_relaxed);
+         now = std::chrono::steady_clock::now()) {
+        std::this_thread::sleep_for(due - now < slice ? due - now : slice);
+        updateStatisticsIfDue();
+    }
+}
+
+bool PcapFileCaptureEngine::readKernelCounters(quint64 *received, quint64 *dropped, quint64 *interfaceDropped)
+{
+    const quint64 delivered = statistics().totalDelivered;
+    *received = delivered - m_lastDelivered;
+    *dropped = 0;
+    *interfaceDropped = 0;
+    m_lastDelivered = delivered;
+    return true;
+}
+
+#endif // HAVE_PCAP
@@ -0,0 +1,200 @@
+#include "protocolclassifier.h"
+#include <map>
+#include <string>
+#include <utility>
+
+// A payload byte b matches position i when (b & masks[i]) == bytes[i]
+struct ProtocolClassifier::Pattern {
+    Protocol protocol;
+    quint16 port; // Only trusted on this port, 0 for any
+    int length;
+    const char *bytes;
+    const char *masks; // nullptr to match every bit
+};
+
+namespace {
+
+// Keeps the lengths right for patterns with embedded zero bytes
+#define TEXT_PATTERN(protocol, bytes) { ProtocolClassifier::protocol, 0, int(sizeof(bytes) - 1), bytes, nullptr }
+#define MASKED_PATTERN(protocol, port, bytes, masks) \
+    { ProtocolClassifier::protocol, port, int(sizeof(bytes) - 1), bytes, masks }
+
+// Earlier patterns win when several match
+const ProtocolClassifier::Pattern TcpPatterns[] = {
+    TEXT_PATTERN(Http2, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"),
+    TEXT_PATTERN(Http, "GET "),
+    TEXT_PATTERN(Http, "POST "),
+    TEXT_PATTERN(Http, "HEAD "),
+    TEXT_PATTERN(Http, "PUT "),
+    TEXT_PATTERN(Http, "DELETE "),
+    TEXT_PATTERN(Http, "OPTIONS "),
+    TEXT_PATTERN(Http, "PATCH "),
+    TEXT_PATTERN(Http, "CONNECT "),
+    TEXT_PATTERN(Http, "HTTP/1."),
+    // Record types 20-23 (change cipher spec to application data), versions SSL 3.0 to TLS 1.2
+    MASKED_PATTERN(Tls, 0, "\x14\x03\x00", "\xfc\xff\xfc"),
+    TEXT_PATTERN(Ssh, "SSH-"),
+    // TPKT header, then an X.224 connection request or confirm
+    MASKED_PATTERN(Rdp, 0, "\x03\x00\x00\x00\x00\xe0", "\xff\xff\x00\x00\x00\xf0"),
+    MASKED_PATTERN(Rdp, 0, "\x03\x00\x00\x00\x00\xd0", "\xff\xff\x00\x00\x00\xf0"),
+    // NetBIOS session header, then the SMB1 (0xFF) or SMB2/3 (0xFE) protocol ID
+    MASKED_PATTERN(Smb, 0, "\x00\x00\x00\x00\xfe" "SMB", "\xff\x00\x00\x00\xfe\xff\xff\xff"),
+    TEXT_PATTERN(BitTorrent, "\x13" "BitTorrent protocol"),
+    // Length prefix, ID, a standard query or response with one question
+    MASKED_PATTERN(Dns, 53, "\x00\x00\x00\x00\x00\x00\x00\x01", "\x00\x00\x00\x00\x78\x00\xff\xff"),
+};
+
+const ProtocolClassifier::Pattern UdpPatterns[] = {
+    // Long header packets of QUIC v1 and v2, which every connection starts with
+    MASKED_PATTERN(Quic, 0, "\xc0\x00\x00\x00\x01", "\xc0\xff\xff\xff\xff"),
+    MASKED_PATTERN(Quic, 0, "\xc0\x6b\x33\x43\xcf", "\xc0\xff\xff\xff\xff"),
+    // Record types 20-23, DTLS 1.0 (0xfeff) or 1.2 (0xfefd)
+    MASKED_PATTERN(Dtls, 0, "\x14\xfe\xfd", "\xfc\xff\xfd"),
+    // Message type, length, then the RFC 5389 magic cookie
+    MASKED_PATTERN(Stun, 0, "\x00\x00\x00\x00\x21\x12\xa4\x42", "\xc0\x00\x00\x00\xff\xff\xff\xff"),
+    MASKED_PATTERN(Dns, 53, "\x00\x00\x00\x00\x00\x01", "\x00\x00\x78\x00\xff\xff"),
+    MASKED_PATTERN(Dns, 5353, "\x00\x00\x00\x00\x00\x01", "\x00\x00\x78\x00\xff\xff"),
+};
+
+#undef TEXT_PATTERN
+#undef MASKED_PATTERN
+
+} // namespace
+
+ProtocolClassifier::ProtocolClassifier()
+{
+    compile(TcpPatterns, int(sizeof(TcpPatterns) / sizeof(TcpPatterns[0])), &m_tcp);
+    compile(UdpPatterns, int(sizeof(UdpPatterns) / sizeof(UdpPatterns[0])), &m_udp);
+}
+
+ProtocolClassifier::Protocol ProtocolClassifier::classify(const quint8 *data, quint32 length, quint8 transport,
+                                                          quint16 srcPort, quint16 dstPort) const
+{
+    const Automaton *automaton = transport == 6 ? &m_tcp : transport == 17 ? &m_udp : nullptr;
+    if (!automaton) {
+        return Unknown;
+    }
+
+    // Collect every pattern that ends along the way until no pattern can match any more
+    quint32 matched = 0;
+    quint32 state = 1;
+    const quint32 depth = qMin(length, quint32(MaxDepth));
+    for (quint32 i = 0; i < depth; ++i) {
+        state = automaton->next[state * automaton->classCount + automaton->byteClass[data[i]]];
+        if (state == 0) {
+            break;
+        }
+        matched |= automaton->accepted[state];
+    }
+
+    for (int pattern = 0; matched != 0; ++pattern, matched >>= 1) {
+        if (!(matched & 1)) {
+            continue;
+        }
+        const quint16 port = automaton->ports[pattern];
+        if (port == 0 || srcPort == port || dstPort == port) {
+            return automaton->protocols[pattern];
+        }
+    }
+    return Unknown;
+}
+
+const char *ProtocolClassifier::name(Protocol protocol)
+{
+    switch (protocol) {
+    case Http: return "HTTP";
+    case Http2: return "HTTP/2";
+    case Tls: return "TLS";
+    case Dtls: return "DTLS";
+    case Quic: return "QUIC";
+    case Ssh: return "SSH";
+    case Dns: return "DNS";
+    case Rdp: return "RDP";
+    case Smb: return "SMB";
+    case BitTorrent: return "BitTorrent";
+    case Stun: return "STUN";
+    default: return "Unknown";
+    }
+}
+
+// Subset construction over the anchored patterns. An NFA position is an element index into
+// the concatenated patterns; a DFA state is the set of positions still alive plus the
+// patterns that just ended, so a state that only accepts is not confused with the dead one.
+void ProtocolClassifier::compile(const Pattern *patterns, int count, Automaton *automaton)
+{
+    Q_ASSERT(count <= 32);
+
+    std::vector<int> elementPattern;
+    std::vector<int> patternStart(count);
+    for (int p = 0; p < count; ++p) {
+        Q_ASSERT(patterns[p].length > 0 && patterns[p].length <= MaxDepth);
+        patternStart[p] = int(elementPattern.size());
+        for (int i = 0; i < patterns[p].length; ++i) {
+            elementPattern.push_back(p);
+        }
+        automaton->protocols.push_back(patterns[p].protocol);
+        automaton->ports.push_back(patterns[p].port);
+    }
+    auto matches = [&](int element, quint8 byte) {
+        const Pattern &pattern = patterns[elementPattern[element]];
+        const int i = element - patternStart[elementPattern[element]];
+        const quint8 mask = pattern.masks ? quint8(pattern.masks[i]) : quint8(0xFF);
+        return (byte & mask) == quint8(pattern.bytes[i]);
+    };
+
+    // Bytes that every element treats alike share a class
+    std::map<std::string, int> classes;
+    std::vector<quint8> representative;
+    for (int byte = 0; byte < 256; ++byte) {
+        std::string signature(elementPattern.size(), '0');
+        for (size_t element = 0; element < elementPattern.size(); ++element) {
+            if (matches(int(element), quint8(byte))) {
+                signature[element] = '1';
+            }
+        }
+        auto it = classes.find(signature);
+        if (it == classes.end()) {
+            it = classes.insert(std::make_pair(signature, int(representative.size()))).first;
+            representative.push_back(quint8(byte));
+        }
+        automaton->byteClass[byte] = quint8(it->second);
+    }
+    automaton->classCount = int(representative.size());
+
+    typedef std::pair<std::vector<int>, quint32> StateKey;
+    std::map<StateKey, quint16> stateIds;
+    std::vector<StateKey> states;
+    states.push_back(StateKey());                    // Dead
+    states.push_back(StateKey(patternStart, 0));     // Start
+    stateIds[states[1]] = 1;
+
+    for (size_t state = 0; state < states.size(); ++state) {
+        const StateKey current = states[state]; // states grows below
+        automaton->accepted.push_back(current.second);
+        for (int byteClass = 0; byteClass < automaton->classCount; ++byteClass) {
+            StateKey target;
+            for (int element : current.first) {
+                if (!matches(element, representative[byteClass])) {
+                    continue;
+                }
+                const int p = elementPattern[element];
+                if (element + 1 == patternStart[p] + patterns[p].length) {
+                    target.second |= 1u << p;
+                } else {
+                    target.first.push_back(element + 1);
+                }
+            }
+
+            quint16 targetId = 0;
+            if (!target.first.empty() || target.second != 0) {
+                auto it = stateIds.find(target);
+                if (it == stateIds.end()) {
+                    it = stateIds.insert(std::make_pair(target, quint16(states.size()))).first;
+                    states.push_back(target);
+                }
+                targetId = it->second;
+            }
+            automaton->next.push_back(targetId);
+        }
+    }
+}
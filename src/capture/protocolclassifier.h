@@ -0,0 +1,73 @@
+#ifndef PROTOCOLCLASSIFIER_H
+#define PROTOCOLCLASSIFIER_H
+
+#include <QtGlobal>
+#include <vector>
+
+/**
+ * @brief The ProtocolClassifier class names the application protocol from the first payload
+ * bytes of a packet.
+ *
+ * The signatures are anchored byte patterns where each byte is matched under a mask. They
+ * are compiled once into one DFA per transport; bytes that no pattern tells apart share an
+ * input class, which keeps the transition table small enough to stay in L1. Classifying is
+ * then one table step per byte, and a payload that matches nothing usually dies on the first
+ * or second byte. Some patterns, like DNS, are too loose to trust anywhere and only count on
+ * their well-known port.
+ *
+ * Immutable once constructed, so any number of threads may classify concurrently.
+ */
+class ProtocolClassifier
+{
+public:
+    enum Protocol : quint8 {
+        Unknown,
+        Http,
+        Http2,       // Prior-knowledge HTTP/2, i.e. cleartext; over TLS it is ALPN "h2"
+        Tls,
+        Dtls,
+        Quic,
+        Ssh,
+        Dns,
+        Rdp,
+        Smb,
+        BitTorrent,
+        Stun,
+        ProtocolCount
+    };
+
+    static const int MaxDepth = 24;      // Payload bytes the longest pattern looks at
+    static const int CaptureLength = 64; // Payload bytes to capture, with room to spare
+    // A flow whose first payload packets match no signature stays unclassified; later packets
+    // start mid-stream and would only produce false matches
+    static const quint8 MaxPayloadPackets = 4;
+
+    ProtocolClassifier();
+
+    Protocol classify(const quint8 *data, quint32 length, quint8 transport, quint16 srcPort,
+                      quint16 dstPort) const;
+
+    static const char *name(Protocol protocol);
+
+    // One signature, defined with the tables in the source file
+    struct Pattern;
+
+private:
+    struct Automaton {
+        quint8 byteClass[256];
+        int classCount;
+        std::vector<quint16> next;      // State * classCount + class, state 0 is dead
+        std::vector<quint32> accepted;  // By state: bit per pattern that ends on entering it
+        std::vector<Protocol> protocols; // By pattern, in priority order
+        std::vector<quint16> ports;      // By pattern, 0 if it counts on any port
+
+        Automaton() : classCount(0) {}
+    };
+
+    static void compile(const Pattern *patterns, int count, Automaton *automaton);
+
+    Automaton m_tcp;
+    Automaton m_udp;
+};
+
+#endif // PROTOCOLCLASSIFIER_H
@@ -0,0 +1,71 @@
+#include "rateengine.h"
+
+void RateEngine::addProcess(qint64 processId, quint64 timeUs, quint64 received, quint64 sent)
+{
+    add(&m_processes[processId], timeUs, received, sent);
+}
+
+void RateEngine::addInterface(int index, quint64 timeUs, quint64 received, quint64 sent)
+{
+    if (index < 0 || index >= MaxInterfaces) {
+        return;
+    }
+    add(&m_interfaces[index], timeUs, received, sent);
+    add(&m_total, timeUs, received, sent);
+}
+
+RateEngine::Rates RateEngine::processRates(qint64 processId, quint64 nowUs) const
+{
+    auto it = m_processes.constFind(processId);
+    return it == m_processes.constEnd() ? Rates() : rates(it.value(), nowUs);
+}
+
+RateEngine::Rates RateEngine::interfaceRates(int index, quint64 nowUs) const
+{
+    if (index < 0 || index >= MaxInterfaces) {
+        return Rates();
+    }
+    return rates(m_interfaces[index], nowUs);
+}
+
+void RateEngine::prune(quint64 nowUs)
+{
+    for (auto it = m_processes.begin(); it != m_processes.end();) {
+        if (it.value().isIdle(nowUs)) {
+            it = m_processes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void RateEngine::clear()
+{
+    m_processes.clear();
+    for (Window &window : m_interfaces) {
+        window = Window();
+    }
+    m_total = Window();
+}
+
+RateEngine::Rates RateEngine::rates(const Window &window, quint64 nowUs)
+{
+    Rates rates;
+    rates.download = window.rate(nowUs, 0);
+    rates.upload = window.rate(nowUs, 1);
+    rates.smoothedDownload = quint64(window.smoothedRate(nowUs, 0) + 0.5);
+    rates.smoothedUpload = quint64(window.smoothedRate(nowUs, 1) + 0.5);
+    rates.averageDownload = window.averageRate(nowUs, 0);
+    rates.averageUpload = window.averageRate(nowUs, 1);
+    return rates;
+}
+
+void RateEngine::add(Window *window, quint64 timeUs, quint64 received, quint64 sent)
+{
+    if (received > 0) {
+        window->add(timeUs, 0, received);
+    }
+    if (sent > 0) {
+        window->add(timeUs, 1, sent);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef RATEENGINE_H
+#define RATEENGINE_H
+
+#include "ratewindow.h"
+#include <QHash>
+#include <QtGlobal>
+
+/**
+ * @brief The RateEngine class keeps the download and upload rates per process and interface.
+ *
+ * Each process and interface has a RateWindow over the last WindowSeconds, fed with the
+ * byte counts of every merged FlowShard delta at the capture time the delta ends. Deltas are
+ * published about every FlowShard::PublishIntervalMs, so a second's bytes can land up to that
+ * much late. Per-flow rates are kept in FlowEntry by the shards themselves.
+ *
+ * Time is capture time, as everywhere in the capture path. Not thread-safe; the owner
+ * serialises access.
+ */
+class RateEngine
+{
+public:
+    static constexpr int WindowSeconds = 60;
+    static constexpr int MaxInterfaces = 32;
+
+    // Direction 0 is received, 1 is sent
+    typedef RateWindow<quint64, WindowSeconds + 1> Window;
+
+    // Bytes/s: the last complete second, its EWMA and the average over the window
+    struct Rates {
+        quint64 download;
+        quint64 upload;
+        quint64 smoothedDownload;
+        quint64 smoothedUpload;
+        quint64 averageDownload;
+        quint64 averageUpload;
+
+        Rates() : download(0), upload(0), smoothedDownload(0), smoothedUpload(0), averageDownload(0),
+                  averageUpload(0) {}
+    };
+
+    void addProcess(qint64 processId, quint64 timeUs, quint64 received, quint64 sent);
+    void addInterface(int index, quint64 timeUs, quint64 received, quint64 sent);
+
+    Rates processRates(qint64 processId, quint64 nowUs) const;
+    Rates interfaceRates(int index, quint64 nowUs) const;
+    Rates totalRates(quint64 nowUs) const { return rates(m_total, nowUs); }
+
+    // Forgets processes that were silent for the whole window
+    void prune(quint64 nowUs);
+    void clear();
+
+    static Rates rates(const Window &window, quint64 nowUs);
+
+private:
+    static void add(Window *window, quint64 timeUs, quint64 received, quint64 sent);
+
+    QHash<qint64, Window> m_processes;
+    Window m_interfaces[MaxInterfaces];
+    Window m_total; // All interfaces
+};
+
+#endif // RATEENGINE_H
@@ -0,0 +1,112 @@
+#ifndef RATEWINDOW_H
+#define RATEWINDOW_H
+
+#include <QtGlobal>
+#include <cmath>
+
+/**
+ * @brief The RateWindow struct turns byte counts into rates over a sliding window.
+ *
+ * Bytes go into a ring of BucketCount one-second buckets by capture time; buckets that slide
+ * out of the window are reused, so adding never allocates. The newest bucket is still open,
+ * rates are read from the complete ones before it. Each bucket that closes is also folded
+ * into an EWMA of the per-second rate, and silent seconds count as zero.
+ *
+ * Bytes that arrive for a bucket that already closed still count towards the window but not
+ * the EWMA; bytes older than the window are dropped. Index 0 and 1 are the two directions,
+ * whichever way round the owner defines them.
+ */
+template <typename Counter, int BucketCount>
+struct RateWindow {
+    static_assert(BucketCount >= 2, "RateWindow needs an open and a complete bucket");
+
+    static constexpr quint64 BucketUs = 1000000;
+    static constexpr double SmoothingFactor = 0.3; // Weight of the newest second, about a 3 s time constant
+
+    Counter bytes[BucketCount][2];
+    quint64 newestBucket; // Capture time / BucketUs of the open bucket, 0 before the first add
+    double smoothed[2];   // Bytes/s, as of the last bucket that closed
+
+    RateWindow() : bytes(), newestBucket(0), smoothed() {}
+
+    void add(quint64 timeUs, int direction, quint64 count)
+    {
+        const quint64 bucket = timeUs / BucketUs;
+        if (bucket > newestBucket) {
+            roll(bucket);
+        } else if (newestBucket - bucket >= quint64(BucketCount)) {
+            return;
+        }
+        bytes[bucket % BucketCount][direction] += Counter(count);
+    }
+
+    // Bytes/s in the last complete second before nowUs
+    quint64 rate(quint64 nowUs, int direction) const
+    {
+        const quint64 bucket = nowUs / BucketUs;
+        return bucket == 0 ? 0 : bucketBytes(bucket - 1, direction);
+    }
+
+    // The EWMA brought forward to nowUs: the bucket still open at the last add has closed
+    // since, and the seconds after it were silent
+    double smoothedRate(quint64 nowUs, int direction) const
+    {
+        const quint64 bucket = nowUs / BucketUs;
+        if (bucket <= newestBucket) {
+            return smoothed[direction];
+        }
+        const double folded = smoothed[direction] +
+                              SmoothingFactor * (double(bytes[newestBucket % BucketCount][direction]) -
+                                                 smoothed[direction]);
+        return folded * std::pow(1.0 - SmoothingFactor, double(bucket - newestBucket - 1));
+    }
+
+    // Bytes/s over the complete seconds of the window before nowUs
+    quint64 averageRate(quint64 nowUs, int direction) const
+    {
+        const quint64 bucket = nowUs / BucketUs;
+        quint64 total = 0;
+        for (int i = 1; i < BucketCount && quint64(i) <= bucket; ++i) {
+            total += bucketBytes(bucket - i, direction);
+        }
+        return total / (BucketCount - 1);
+    }
+
+    // Nothing in the window and the EWMA has decayed to below a byte per second
+    bool isIdle(quint64 nowUs) const
+    {
+        // Once the window has moved past every bucket their contents are stale, not pending
+        const bool windowPassed = nowUs / BucketUs >= newestBucket + BucketCount;
+        for (int i = 0; i < BucketCount && !windowPassed; ++i) {
+            if (bytes[i][0] != 0 || bytes[i][1] != 0) {
+                return false;
+            }
+        }
+        return smoothedRate(nowUs, 0) < 1.0 && smoothedRate(nowUs, 1) < 1.0;
+    }
+
+private:
+    quint64 bucketBytes(quint64 bucket, int direction) const
+    {
+        if (bucket > newestBucket || newestBucket - bucket >= quint64(BucketCount)) {
+            return 0;
+        }
+        return quint64(bytes[bucket % BucketCount][direction]);
+    }
+
+    void roll(quint64 bucket)
+    {
+        for (int direction = 0; direction < 2; ++direction) {
+            smoothed[direction] = smoothedRate(bucket * BucketUs, direction);
+        }
+        // Clear the buckets the window moves over, the new open one included
+        const quint64 reused = qMin(bucket - newestBucket, quint64(BucketCount));
+        for (quint64 i = 0; i < reused; ++i) {
+            Counter *slot = bytes[(bucket - i) % BucketCount];
+            slot[0] = slot[1] = 0;
+        }
+        newestBucket = bucket;
+    }
+};
+
+#endif // RATEWINDOW_H
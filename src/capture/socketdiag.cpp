@@ -0,0 +1,246 @@
+#include "socketdiag.h"
+
+#ifdef Q_OS_LINUX
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Larger than any batch the kernel puts in one dump message, which is at most a page or 8 KB
+static const size_t ReceiveBufferSize = 65536;
+
+// A dump answers at once; this only keeps a wedged kernel module from hanging the caller
+static const int ReceiveTimeoutMs = 1000;
+
+SocketDiag::SocketDiag()
+    : m_socket(-1)
+    , m_sequence(0)
+{
+}
+
+SocketDiag::~SocketDiag()
+{
+    close();
+}
+
+bool SocketDiag::open()
+{
+    if (m_socket >= 0) {
+        return true;
+    }
+    m_socket = ::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (m_socket < 0) {
+        return fail("socket(NETLINK_SOCK_DIAG)", errno);
+    }
+    timeval timeout;
+    timeout.tv_sec = ReceiveTimeoutMs / 1000;
+    timeout.tv_usec = (ReceiveTimeoutMs % 1000) * 1000;
+    if (::setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        const int error = errno;
+        close();
+        return fail("setsockopt(SO_RCVTIMEO)", error);
+    }
+    m_buffer.resize(ReceiveBufferSize);
+    return true;
+}
+
+void SocketDiag::close()
+{
+    if (m_socket >= 0) {
+        ::close(m_socket);
+        m_socket = -1;
+    }
+}
+
+bool SocketDiag::fail(const QString &what, int error)
+{
+    m_errorString = QString("%1: %2").arg(what, QString::fromLocal8Bit(strerror(error)));
+    return false;
+}
+
+bool SocketDiag::dump(quint8 protocol, quint32 states, std::vector<Socket> *out)
+{
+    if (!open()) {
+        return false;
+    }
+    // All or nothing, so a caller that falls back never sees a protocol listed twice
+    const size_t start = out->size();
+    if (!dumpFamily(AF_INET, protocol, states, out) || !dumpFamily(AF_INET6, protocol, states, out)) {
+        out->resize(start);
+        return false;
+    }
+    return true;
+}
+
+bool SocketDiag::dumpFamily(quint8 family, quint8 protocol, quint32 states, std::vector<Socket> *out)
+{
+    struct {
+        nlmsghdr header;
+        inet_diag_req_v2 request;
+    } message;
+    std::memset(&message, 0, sizeof(message));
+    message.header.nlmsg_len = sizeof(message);
+    message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    message.header.nlmsg_seq = ++m_sequence;
+    message.request.sdiag_family = family;
+    message.request.sdiag_protocol = protocol;
+    message.request.idiag_states = states;
+
+    sockaddr_nl kernel;
+    std::memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    ssize_t sent;
+    do {
+        sent = ::sendto(m_socket, &message, sizeof(message), 0, reinterpret_cast<sockaddr *>(&kernel),
+                        sizeof(kernel));
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        return fail("sock_diag request", errno);
+    }
+
+    // The dump arrives as a run of multipart messages ending in NLMSG_DONE
+    while (true) {
+        const ssize_t received = ::recv(m_socket, m_buffer.data(), m_buffer.size(), 0);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN once the timeout passed; the rest of this dump is skipped by its sequence
+            return fail("sock_diag dump", errno);
+        }
+        if (received == 0) {
+            return fail("sock_diag dump", ECONNRESET);
+        }
+
+        int error = 0;
+        switch (parseDump(m_buffer.data(), size_t(received), m_sequence, protocol, out, &error)) {
+        case ParseMore:
+            break;
+        case ParseDone:
+            return true;
+        case ParseFailed:
+            // ENOENT: no diag handler for the protocol, e.g. udp_diag is not loaded
+            return fail(QString("sock_diag dump of protocol %1").arg(protocol), error);
+        }
+    }
+}
+
+SocketDiag::ParseResult SocketDiag::parseDump(const quint8 *data, size_t length, quint32 sequence,
+                                              quint8 protocol, std::vector<Socket> *out, int *error)
+{
+    int remaining = int(length);
+    for (const nlmsghdr *header = reinterpret_cast<const nlmsghdr *>(data); NLMSG_OK(header, remaining);
+         header = NLMSG_NEXT(header, remaining)) {
+        // Left over from a dump that an earlier error abandoned
+        if (header->nlmsg_seq != sequence) {
+            continue;
+        }
+        if (header->nlmsg_type == NLMSG_DONE) {
+            return ParseDone;
+        }
+        if (header->nlmsg_type == NLMSG_ERROR) {
+            if (header->nlmsg_len < NLMSG_LENGTH(sizeof(nlmsgerr))) {
+                *error = EBADMSG;
+            } else {
+                *error = -static_cast<const nlmsgerr *>(NLMSG_DATA(header))->error;
+            }
+            return ParseFailed;
+        }
+        if (header->nlmsg_type != SOCK_DIAG_BY_FAMILY || header->nlmsg_len < NLMSG_LENGTH(sizeof(inet_diag_msg))) {
+            continue;
+        }
+
+        const inet_diag_msg *diag = static_cast<const inet_diag_msg *>(NLMSG_DATA(header));
+        Socket socket;
+        if (diag->idiag_family == AF_INET) {
+            socket.localAddress = diag->id.idiag_src[0] ? IpAddress::fromIPv4(diag->id.idiag_src[0]) : IpAddress();
+            socket.remoteAddress = diag->id.idiag_dst[0] ? IpAddress::fromIPv4(diag->id.idiag_dst[0]) : IpAddress();
+        } else {
+            socket.localAddress = IpAddress::fromIPv6(reinterpret_cast<const quint8 *>(diag->id.idiag_src));
+            socket.remoteAddress = IpAddress::fromIPv6(reinterpret_cast<const quint8 *>(diag->id.idiag_dst));
+        }
+        socket.localPort = ntohs(diag->id.idiag_sport);
+        socket.remotePort = ntohs(diag->id.idiag_dport);
+        socket.protocol = protocol;
+        socket.ipVersion = diag->idiag_family == AF_INET ? 4 : 6;
+        socket.state = diag->idiag_state;
+        socket.uid = diag->idiag_uid;
+        socket.inode = diag->idiag_inode;
+        out->push_back(socket);
+    }
+    return ParseMore;
+}
+
+const char *SocketDiag::stateName(quint8 state)
+{
+    switch (state) {
+    case Established: return "ESTABLISHED";
+    case SynSent: return "SYN_SENT";
+    case SynReceived:
+    case NewSynReceived: return "SYN_RECEIVED";
+    case FinWait1: return "FIN_WAIT1";
+    case FinWait2: return "FIN_WAIT2";
+    case TimeWait: return "TIME_WAIT";
+    case Close: return "CLOSED";
+    case CloseWait: return "CLOSE_WAIT";
+    case LastAck: return "LAST_ACK";
+    case Listen: return "LISTENING";
+    case Closing: return "CLOSING";
+    default: return "UNKNOWN";
+    }
+}
+
+void SocketDiag::socketOwners(QHash<quint32, qint64> *owners)
+{
+    owners->clear();
+    DIR *proc = ::opendir("/proc");
+    if (!proc) {
+        return;
+    }
+    char path[32 + sizeof(dirent::d_name)];
+    char link[64];
+    while (const dirent *process = ::readdir(proc)) {
+        // Processes are the all-digit entries; threads share their process's descriptors
+        char *end = nullptr;
+        const long pid = std::strtol(process->d_name, &end, 10);
+        if (pid <= 0 || *end != 0) {
+            continue;
+        }
+        std::snprintf(path, sizeof(path), "/proc/%ld/fd", pid);
+        DIR *fds = ::opendir(path);
+        if (!fds) {
+            continue; // Exited meanwhile, or not ours to inspect
+        }
+        while (const dirent *fd = ::readdir(fds)) {
+            if (fd->d_name[0] == '.') {
+                continue;
+            }
+            std::snprintf(path, sizeof(path), "/proc/%ld/fd/%s", pid, fd->d_name);
+            const ssize_t length = ::readlink(path, link, sizeof(link) - 1);
+            // "socket:[12345]"
+            if (length <= 9 || std::memcmp(link, "socket:[", 8) != 0) {
+                continue;
+            }
+            link[length] = 0;
+            const quint32 inode = quint32(std::strtoul(link + 8, nullptr, 10));
+            // A socket passed between processes goes to the first one found
+            if (inode != 0 && !owners->contains(inode)) {
+                owners->insert(inode, qint64(pid));
+            }
+        }
+        ::closedir(fds);
+    }
+    ::closedir(proc);
+}
+
+#endif // Q_OS_LINUX
@@ -0,0 +1,106 @@
+#ifndef SOCKETDIAG_H
+#define SOCKETDIAG_H
+
+#include "ipaddress.h"
+#include <QHash>
+#include <QString>
+#include <QtGlobal>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+
+/**
+ * @brief The SocketDiag class lists the host's TCP and UDP sockets with a NETLINK_SOCK_DIAG
+ * dump, the interface ss(8) uses.
+ *
+ * The kernel sends each socket as a fixed binary record, so there is no text to split and no
+ * address to parse, and a state mask makes the kernel skip unwanted sockets before they are
+ * copied out at all. Both IPv4 and IPv6 sockets are listed; an IPv6 socket bound to an
+ * IPv4-mapped address comes out with the same IpAddress as its IPv4 packets.
+ *
+ * Kernels without the inet_diag modules, or sandboxes that deny netlink, make dump() fail;
+ * callers fall back to /proc/net for that protocol. The records carry the socket's inode but
+ * not its process; socketOwners() finds the processes the way ss -p does.
+ */
+class SocketDiag
+{
+public:
+    // Kernel TCP states, as in include/net/tcp_states.h. UDP sockets are Established once
+    // connected and Close otherwise.
+    enum State : quint8 {
+        Established = 1,
+        SynSent,
+        SynReceived,
+        FinWait1,
+        FinWait2,
+        TimeWait,
+        Close,
+        CloseWait,
+        LastAck,
+        Listen,
+        Closing,
+        NewSynReceived
+    };
+
+    static const quint32 AllStates = 0xFFFFFFFF;
+    static constexpr quint32 stateBit(State state) { return quint32(1) << state; }
+
+    struct Socket {
+        IpAddress localAddress;   // Null for a wildcard
+        IpAddress remoteAddress;  // Null when not connected
+        quint16 localPort;        // Host byte order
+        quint16 remotePort;
+        quint8 protocol;          // 6=TCP, 17=UDP
+        quint8 ipVersion;         // Of the socket: 6 for a dual-stack socket talking IPv4
+        quint8 state;             // State
+        quint32 uid;
+        quint32 inode;            // 0 once the socket has no file, e.g. in TIME_WAIT
+    };
+
+    SocketDiag();
+    ~SocketDiag();
+
+    SocketDiag(const SocketDiag &) = delete;
+    SocketDiag &operator=(const SocketDiag &) = delete;
+
+    // Appends the IPv4 and IPv6 sockets of a protocol whose state bit is set in states.
+    // Opens the netlink socket on first use; false with errorString() set if the kernel
+    // refused, in which case nothing is appended.
+    bool dump(quint8 protocol, quint32 states, std::vector<Socket> *out);
+    void close();
+
+    QString errorString() const { return m_errorString; }
+
+    // "ESTABLISHED", "LISTENING" and so on, as the other platforms name them
+    static const char *stateName(quint8 state);
+
+    // Replaces owners with the process holding each socket inode, from the /proc/<pid>/fd
+    // links. Processes the caller may not inspect, those of other users unless it is root,
+    // are left out. Reads a link per open file on the system, so call it sparingly.
+    static void socketOwners(QHash<quint32, qint64> *owners);
+
+    enum ParseResult {
+        ParseMore,   // The dump goes on in the next receive
+        ParseDone,   // NLMSG_DONE of this dump reached
+        ParseFailed  // The kernel answered with an error, in *error
+    };
+
+    // Appends the sockets in one receive of the dump with the given sequence number. Messages
+    // of other dumps and records too short for their type are skipped.
+    static ParseResult parseDump(const quint8 *data, size_t length, quint32 sequence, quint8 protocol,
+                                 std::vector<Socket> *out, int *error);
+
+private:
+    bool open();
+    bool dumpFamily(quint8 family, quint8 protocol, quint32 states, std::vector<Socket> *out);
+    bool fail(const QString &what, int error);
+
+    int m_socket;
+    quint32 m_sequence;
+    std::vector<quint8> m_buffer; // One receive of the dump, reused
+    QString m_errorString;
+};
+
+#endif // Q_OS_LINUX
+
+#endif // SOCKETDIAG_H
@@ -0,0 +1,172 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief The RingDoorbell class lets one consumer sleep until any of several rings has data.
+ *
+ * Producers only pay for a wake-up when the consumer is actually parked. Each SpscRing has a
+ * doorbell of its own; a consumer that drains several rings shares one between them.
+ */
+class RingDoorbell
+{
+public:
+    RingDoorbell() : m_parked(false) {}
+
+    RingDoorbell(const RingDoorbell &) = delete;
+    RingDoorbell &operator=(const RingDoorbell &) = delete;
+
+    // Consumer side. Blocks until hasData() holds, ring()/wakeUp() is called or the timeout expires.
+    template <typename Predicate>
+    void wait(Predicate hasData, int timeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_parked.store(true, std::memory_order_relaxed);
+        // Pairs with the fence in ring(): either the producer sees the flag, or this check
+        // sees the item it published
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!hasData()) {
+            m_condition.wait_for(lock, std::chrono::milliseconds(timeoutMs));
+        }
+        m_parked.store(false, std::memory_order_relaxed);
+    }
+
+    // Producer side, after publishing an item
+    void ring()
+    {
+        // Orders the producer's index store before the flag load; see wait()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_parked.load(std::memory_order_relaxed)) {
+            wakeUp();
+        }
+    }
+
+    // Wakes a parked consumer, e.g. so that it can observe a shutdown request
+    void wakeUp()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_condition.notify_all();
+    }
+
+private:
+    alignas(64) std::atomic<bool> m_parked;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+};
+
+/**
+ * @brief The SpscRing class is a bounded lock-free single-producer/single-consumer queue.
+ *
+ * The producer and consumer indices live on separate cache lines and each side keeps a
+ * cached copy of the other side's index, so the common case touches no shared cache line
+ * that the other thread is writing. The capacity is rounded up to a power of two.
+ *
+ * A consumer that finds the ring empty can park in waitForData(), or on a shared RingDoorbell
+ * passed to the constructor when it drains several rings.
+ */
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity, RingDoorbell *doorbell = nullptr)
+        : m_head(0)
+        , m_cachedTail(0)
+        , m_tail(0)
+        , m_cachedHead(0)
+        , m_doorbell(doorbell ? doorbell : &m_ownDoorbell)
+    {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_buffer.resize(size);
+        m_mask = size - 1;
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // Approximate number of queued items; exact when called from either endpoint
+    size_t size() const
+    {
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        return head - tail;
+    }
+
+    bool isEmpty() const { return size() == 0; }
+
+    // Producer side. Returns false without blocking when the ring is full.
+    bool tryPush(const T &item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_cachedTail > m_mask) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head - m_cachedTail > m_mask) {
+                return false;
+            }
+        }
+
+        m_buffer[head & m_mask] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        m_doorbell->ring();
+        return true;
+    }
+
+    // Consumer side. Moves up to maxItems into out and returns how many were taken.
+    size_t popBatch(T *out, size_t maxItems)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t available = m_cachedHead - tail;
+        if (available == 0) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            available = m_cachedHead - tail;
+            if (available == 0) {
+                return 0;
+            }
+        }
+
+        const size_t count = available < maxItems ? available : maxItems;
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = m_buffer[(tail + i) & m_mask];
+        }
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side. Blocks until the ring is non-empty, wakeUp() is called or the timeout expires.
+    void waitForData(int timeoutMs)
+    {
+        m_doorbell->wait([this]() { return !isEmpty(); }, timeoutMs);
+    }
+
+    // Wakes a parked consumer, e.g. so that it can observe a shutdown request
+    void wakeUp() { m_doorbell->wakeUp(); }
+
+private:
+    static constexpr size_t CacheLineSize = 64;
+
+    // Producer cache line
+    alignas(CacheLineSize) std::atomic<size_t> m_head;
+    size_t m_cachedTail;
+
+    // Consumer cache line
+    alignas(CacheLineSize) std::atomic<size_t> m_tail;
+    size_t m_cachedHead;
+
+    RingDoorbell m_ownDoorbell;
+    RingDoorbell *m_doorbell;
+
+    std::vector<T> m_buffer;
+    size_t m_mask;
+};
+
+#endif // SPSCRING_H
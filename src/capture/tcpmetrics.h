@@ -0,0 +1,81 @@
+#ifndef TCPMETRICS_H
+#define TCPMETRICS_H
+
+#include "loghistogram.h"
+#include <QtGlobal>
+
+/**
+ * @brief The TcpFlowMetrics struct holds the passive TCP measurements of one flow.
+ *
+ * Sequence numbers are followed per direction to spot retransmissions and gaps. One RTT probe
+ * at a time times a data segment from the measured side until the other side acknowledges it,
+ * so with capture on this host the samples are network round trips; retransmitted probes are
+ * discarded (Karn's rule).
+ */
+struct TcpFlowMetrics {
+    LogHistogram<quint16> rtt;  // Data/ACK round trips
+    quint32 handshakeRttUs;     // SYN to the ACK completing the handshake, 0 if not seen
+    quint32 smoothedRttUs;      // As in RFC 6298, 0 before the first sample
+    quint32 minRttUs;
+    quint32 dataSegments;
+    quint32 retransmissions;
+    quint32 outOfOrder;         // Segments that skipped ahead of the data seen so far
+    quint32 zeroWindows;        // Times a side started advertising a zero window
+    quint32 nextSeq[2];         // By sending side: sequence number after the highest data seen
+    quint32 probeAck;           // Acknowledgement that completes the RTT probe
+    quint64 probeUs;            // When the probe segment was seen, 0 if none is outstanding
+    quint8 seqValid;            // Bit per side: nextSeq is known
+    quint8 zeroWindowSides;     // Bit per side: the last segment advertised a zero window
+
+    TcpFlowMetrics() : handshakeRttUs(0), smoothedRttUs(0), minRttUs(0), dataSegments(0),
+                       retransmissions(0), outOfOrder(0), zeroWindows(0), probeAck(0), probeUs(0),
+                       seqValid(0), zeroWindowSides(0)
+    {
+        nextSeq[0] = nextSeq[1] = 0;
+    }
+
+    void addRttSample(quint32 us)
+    {
+        rtt.add(us);
+        smoothedRttUs = smoothedRttUs == 0 ? us : smoothedRttUs - smoothedRttUs / 8 + us / 8;
+        minRttUs = minRttUs == 0 ? us : qMin(minRttUs, us);
+    }
+};
+
+/**
+ * @brief The TcpStatistics struct sums TCP measurements over many flows, e.g. per process.
+ */
+struct TcpStatistics {
+    LogHistogram<quint64> rtt;
+    LogHistogram<quint64> handshakeRtt;
+    quint64 dataSegments;
+    quint64 retransmissions;
+    quint64 outOfOrder;
+    quint64 zeroWindows;
+
+    TcpStatistics() : dataSegments(0), retransmissions(0), outOfOrder(0), zeroWindows(0) {}
+
+    void merge(const TcpStatistics &other)
+    {
+        rtt.merge(other.rtt);
+        handshakeRtt.merge(other.handshakeRtt);
+        dataSegments += other.dataSegments;
+        retransmissions += other.retransmissions;
+        outOfOrder += other.outOfOrder;
+        zeroWindows += other.zeroWindows;
+    }
+
+    bool isEmpty() const
+    {
+        return dataSegments == 0 && retransmissions == 0 && zeroWindows == 0 && rtt.count() == 0 &&
+               handshakeRtt.count() == 0;
+    }
+
+    // Share of data segments that were sent again, in percent
+    double retransmissionRate() const
+    {
+        return dataSegments == 0 ? 0.0 : 100.0 * double(retransmissions) / double(dataSegments);
+    }
+};
+
+#endif // TCPMETRICS_H
@@ -0,0 +1,309 @@
+#include "tcpreassembler.h"
+#include "packetdecoder.h"
+#include <cstring>
+
+// Idle streams are looked for at most this often; a full table is the same sweep
+static const quint64 ExpiryIntervalUs = 1000000;
+
+TcpReassembler::TcpReassembler()
+    : m_consumerCount(0)
+    , m_depth(DefaultDepth)
+    , m_streams(MaxStreams)
+    , m_candidates(CandidateBits / 64)
+    , m_buffers(MaxSegmentBuffers * SegmentBufferSize)
+    , m_segments(MaxSegmentBuffers)
+    , m_opened(0)
+    , m_bytes(0)
+    , m_outOfOrder(0)
+    , m_gaps(0)
+    , m_overflows(0)
+{
+    clear();
+}
+
+void TcpReassembler::addConsumer(AcceptHandler accept, DataHandler data, CloseHandler close, void *user)
+{
+    if (m_consumerCount >= MaxConsumers) {
+        return;
+    }
+    m_consumers[m_consumerCount++] = Consumer{accept, data, close, user};
+}
+
+void TcpReassembler::clear()
+{
+    m_streams.clear();
+    m_candidates.assign(m_candidates.size(), 0);
+    for (size_t i = 0; i < MaxSegmentBuffers; ++i) {
+        m_segments[i].next = i + 1 < MaxSegmentBuffers ? qint32(i + 1) : -1;
+    }
+    m_freeHead = 0;
+    m_nextExpiryUs = 0;
+    m_opened.store(0, std::memory_order_relaxed);
+    m_bytes.store(0, std::memory_order_relaxed);
+    m_outOfOrder.store(0, std::memory_order_relaxed);
+    m_gaps.store(0, std::memory_order_relaxed);
+    m_overflows.store(0, std::memory_order_relaxed);
+}
+
+TcpReassembler::Statistics TcpReassembler::statistics() const
+{
+    Statistics stats;
+    stats.streams = m_opened.load(std::memory_order_relaxed);
+    stats.bytes = m_bytes.load(std::memory_order_relaxed);
+    stats.outOfOrder = m_outOfOrder.load(std::memory_order_relaxed);
+    stats.gaps = m_gaps.load(std::memory_order_relaxed);
+    stats.overflows = m_overflows.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void TcpReassembler::process(const PacketDescriptor &packet, const quint8 *payload)
+{
+    if (m_consumerCount == 0 || packet.protocol != PacketDecoder::ProtocolTcp || packet.isLaterFragment()) {
+        return;
+    }
+
+    // Most TCP traffic is of no interest to any consumer; it stops here, before the flow key
+    quint8 consumers = 0;
+    for (int i = 0; i < m_consumerCount; ++i) {
+        if (m_consumers[i].accept(m_consumers[i].user, packet)) {
+            consumers |= quint8(1 << i);
+        }
+    }
+    if (consumers == 0 &&
+        (m_streams.size() == 0 ||
+         !isCandidate(candidateBit(packet.srcAddr, packet.srcPort, packet.dstAddr, packet.dstPort)))) {
+        return;
+    }
+
+    bool reversed = false;
+    const FlowKey key = FlowKey::make(packet.srcAddr, packet.srcPort, packet.dstAddr, packet.dstPort,
+                                      packet.protocol, &reversed);
+    Stream *stream = m_streams.find(key);
+    if (!stream) {
+        // A stream starts at its SYN, or mid-connection at the first segment with data
+        const bool opens = (packet.tcpFlags & PacketDescriptor::TcpSyn) || packet.payloadLength > 0;
+        if (consumers == 0 || !opens || (packet.tcpFlags & (PacketDescriptor::TcpFin | PacketDescriptor::TcpRst))) {
+            return;
+        }
+        stream = open(key, packet, consumers);
+        if (!stream) {
+            return;
+        }
+    }
+    stream->lastSeenUs = packet.timestampUs;
+
+    const quint8 sender = reversed ? 1 : 0;
+    if (!stream->finished) {
+        receive(key, stream, sender, packet, payload, packet.availablePayloadLength());
+    }
+
+    if (packet.tcpFlags & PacketDescriptor::TcpRst) {
+        finish(key, stream);
+        m_streams.remove(key);
+    } else if (packet.tcpFlags & PacketDescriptor::TcpFin) {
+        stream->sides[sender].fin = true;
+        if (stream->sides[1 - sender].fin) {
+            finish(key, stream);
+            m_streams.remove(key);
+        }
+    }
+}
+
+TcpReassembler::Stream *TcpReassembler::open(const FlowKey &key, const PacketDescriptor &packet, quint8 consumers)
+{
+    const quint32 depth = m_depth.load(std::memory_order_relaxed);
+    if (depth == 0) {
+        return nullptr;
+    }
+
+    Stream *stream = m_streams.findOrInsert(key);
+    if (!stream) {
+        // Make room from streams that went quiet, then give up on this one
+        expire(packet.timestampUs);
+        stream = m_streams.findOrInsert(key);
+        if (!stream) {
+            m_overflows.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+    stream->depth = depth;
+    stream->consumers = consumers;
+    setCandidate(candidateBit(key.addressA, key.portA, key.addressB, key.portB));
+    m_opened.fetch_add(1, std::memory_order_relaxed);
+    return stream;
+}
+
+void TcpReassembler::receive(const FlowKey &key, Stream *stream, quint8 sender, const PacketDescriptor &packet,
+                             const quint8 *payload, quint32 length)
+{
+    Direction *direction = &stream->sides[sender];
+    const bool syn = packet.tcpFlags & PacketDescriptor::TcpSyn;
+    if (!direction->synchronized) {
+        if (!syn && length == 0) {
+            return;
+        }
+        direction->nextSeq = syn ? packet.tcpSeq + 1 : packet.tcpSeq;
+        direction->synchronized = true;
+    }
+    if (syn || packet.payloadLength == 0) {
+        return;
+    }
+
+    // Bytes that were sent but not captured, or that travel in later IP fragments
+    const bool truncated = length < packet.payloadLength || packet.fragment != 0;
+    const qint32 ahead = qint32(packet.tcpSeq - direction->nextSeq);
+    if (ahead > 0) {
+        if (truncated || !hold(stream, direction, packet.tcpSeq, payload, length)) {
+            (truncated ? m_gaps : m_overflows).fetch_add(1, std::memory_order_relaxed);
+            finish(key, stream);
+            return;
+        }
+        m_outOfOrder.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // In order, possibly overlapping what was delivered already: straight from the frame
+    const quint32 skip = quint32(-ahead);
+    if (skip >= packet.payloadLength) {
+        return; // A retransmission
+    }
+    if (skip < length) {
+        deliver(key, stream, sender, packet.timestampUs, payload + skip, length - skip);
+        direction->nextSeq += length - skip;
+    }
+    if (truncated) {
+        m_gaps.fetch_add(1, std::memory_order_relaxed);
+        finish(key, stream);
+        return;
+    }
+
+    // Then whatever was waiting for these bytes. A buffer goes back to the pool before its
+    // bytes are delivered, since delivering can finish the stream and release its list.
+    while (direction->waitingHead >= 0 && !stream->finished) {
+        const qint32 index = direction->waitingHead;
+        const Segment segment = m_segments[index];
+        const qint32 overlap = qint32(direction->nextSeq - segment.seq);
+        if (overlap < 0) {
+            break;
+        }
+        direction->waitingHead = segment.next;
+        m_segments[index].next = m_freeHead;
+        m_freeHead = index;
+        stream->waitingBuffers--;
+        if (quint32(overlap) < segment.length) {
+            deliver(key, stream, sender, packet.timestampUs, bufferOf(index) + overlap, segment.length - overlap);
+            direction->nextSeq = segment.seq + segment.length;
+        }
+    }
+}
+
+// Copies an early segment into pooled buffers, in sequence order on the direction's list
+bool TcpReassembler::hold(Stream *stream, Direction *direction, quint32 seq, const quint8 *data, quint32 length)
+{
+    const quint32 ahead = seq - direction->nextSeq;
+    const quint32 room = stream->depth - qMin(direction->delivered, stream->depth);
+    if (ahead >= room) {
+        return true; // Past the depth, it would never be delivered anyway
+    }
+    length = qMin(length, room - ahead);
+
+    while (length > 0) {
+        if (m_freeHead < 0 || stream->waitingBuffers >= MaxSegmentBuffersPerStream) {
+            return false;
+        }
+        const qint32 index = m_freeHead;
+        m_freeHead = m_segments[index].next;
+        const quint32 chunk = qMin(length, quint32(SegmentBufferSize));
+        std::memcpy(bufferOf(index), data, chunk);
+        m_segments[index].seq = seq;
+        m_segments[index].length = quint16(chunk);
+
+        qint32 *link = &direction->waitingHead;
+        while (*link >= 0 && qint32(m_segments[*link].seq - seq) <= 0) {
+            link = &m_segments[*link].next;
+        }
+        m_segments[index].next = *link;
+        *link = index;
+        stream->waitingBuffers++;
+
+        seq += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+void TcpReassembler::deliver(const FlowKey &key, Stream *stream, quint8 sender, quint64 timestampUs,
+                             const quint8 *data, quint32 length)
+{
+    Direction *direction = &stream->sides[sender];
+    if (direction->delivered >= stream->depth) {
+        return;
+    }
+    length = qMin(length, stream->depth - direction->delivered);
+
+    const Span span{&key, sender, timestampUs, direction->delivered, data, length};
+    for (int i = 0; i < m_consumerCount; ++i) {
+        if (stream->consumers & (1 << i)) {
+            m_consumers[i].data(m_consumers[i].user, span);
+        }
+    }
+    direction->delivered += length;
+    m_bytes.fetch_add(length, std::memory_order_relaxed);
+
+    if (stream->sides[0].delivered >= stream->depth && stream->sides[1].delivered >= stream->depth) {
+        finish(key, stream);
+    }
+}
+
+void TcpReassembler::finish(const FlowKey &key, Stream *stream)
+{
+    if (stream->finished) {
+        return;
+    }
+    stream->finished = true;
+    release(stream);
+    for (int i = 0; i < m_consumerCount; ++i) {
+        if (stream->consumers & (1 << i)) {
+            m_consumers[i].close(m_consumers[i].user, key);
+        }
+    }
+}
+
+void TcpReassembler::release(Stream *stream)
+{
+    for (Direction &direction : stream->sides) {
+        while (direction.waitingHead >= 0) {
+            const qint32 index = direction.waitingHead;
+            direction.waitingHead = m_segments[index].next;
+            m_segments[index].next = m_freeHead;
+            m_freeHead = index;
+        }
+    }
+    stream->waitingBuffers = 0;
+}
+
+void TcpReassembler::expire(quint64 nowUs)
+{
+    if (m_streams.size() == 0 || nowUs < m_nextExpiryUs) {
+        return;
+    }
+    m_nextExpiryUs = nowUs + ExpiryIntervalUs;
+    // The bitmap is rebuilt from the streams that stay, dropping the bits of closed ones
+    m_candidates.assign(m_candidates.size(), 0);
+    m_streams.removeIf([this, nowUs](const FlowKey &key, Stream &stream) {
+        if (nowUs <= stream.lastSeenUs || nowUs - stream.lastSeenUs <= IdleTimeoutUs) {
+            setCandidate(candidateBit(key.addressA, key.portA, key.addressB, key.portB));
+            return false;
+        }
+        finish(key, &stream);
+        return true;
+    });
+}
+
+// XOR leaves the order of the two ends out, so a packet finds its flow's bit without the key
+quint32 TcpReassembler::candidateBit(const IpAddress &a, quint16 portA, const IpAddress &b, quint16 portB)
+{
+    const quint64 mixed = a.words[0] ^ a.words[1] ^ b.words[0] ^ b.words[1] ^ (quint64(portA ^ portB) << 32);
+    return quint32((mixed * 0x9E3779B97F4A7C15ULL) >> 48) % CandidateBits;
+}
@@ -0,0 +1,158 @@
+#ifndef TCPREASSEMBLER_H
+#define TCPREASSEMBLER_H
+
+#include "flowtable.h"
+#include "packetdescriptor.h"
+#include <QtGlobal>
+#include <atomic>
+#include <vector>
+
+/**
+ * @brief The TcpReassembler class turns the TCP segments of selected flows into in-order byte
+ * streams for payload analysis.
+ *
+ * Consumers register an accept handler, which picks the flows they want, and a data handler,
+ * which receives each direction of those flows as contiguous spans in sequence order. The
+ * accept handlers see every packet before anything else is done with it; a packet that none
+ * of them accepts is only looked up when a bitmap of the open streams says its flow may have
+ * one, so the TCP traffic that nobody asked for costs no flow key and no table lookup.
+ * Segments that arrive in order are handed on straight from the captured frame without a
+ * copy. Segments that arrive early wait in pooled fixed-size buffers until the gap before
+ * them is filled, and are then handed on from those buffers.
+ *
+ * Only the first depth bytes of each direction are delivered. Memory is bounded by the stream
+ * table, the buffer pool shared by all streams and a per-stream share of that pool. A stream
+ * that loses bytes, because a segment was not captured whole or could not be buffered, is
+ * closed for its consumers rather than handed on with a hole in it; a closed stream stays
+ * ignored until its connection ends or goes idle.
+ *
+ * Capture thread only, apart from setDepth() and statistics().
+ */
+class TcpReassembler
+{
+public:
+    static const quint32 DefaultDepth = 65536;
+    static const int CaptureLength = 1460;         // Payload bytes to capture, a full Ethernet TCP segment
+    static const size_t MaxStreams = 4096;
+    static const size_t SegmentBufferSize = 2048;  // Bytes per pooled buffer; larger segments take several
+    static const size_t MaxSegmentBuffers = 2048;  // 4 MB waiting out of order, for all streams together
+    static const quint16 MaxSegmentBuffersPerStream = 48;
+    static const quint64 IdleTimeoutUs = 60000000;
+    static const int MaxConsumers = 8;
+    static const quint32 CandidateBits = 65536;    // Bitmap of open streams, 8 KB
+
+    // Bytes of one direction, valid only for the duration of the call
+    struct Span {
+        const FlowKey *key;
+        quint8 sender;        // Side of the key that sent the bytes, 0 for A
+        quint64 timestampUs;  // Capture time of the segment that completed the span
+        quint32 offset;       // Stream offset of data[0], from the first byte seen in that direction
+        const quint8 *data;
+        quint32 length;
+    };
+
+    // Called for every packet, so it has to be cheap; a stream opens on the first packet that
+    // some consumer accepts, and only the consumers that accepted that packet get its data
+    typedef bool (*AcceptHandler)(void *user, const PacketDescriptor &packet);
+    typedef void (*DataHandler)(void *user, const Span &span);
+    // The stream will deliver nothing more; its consumer state can go
+    typedef void (*CloseHandler)(void *user, const FlowKey &key);
+
+    struct Statistics {
+        quint64 streams;        // Streams opened for a consumer
+        quint64 bytes;          // Bytes delivered to consumers
+        quint64 outOfOrder;     // Segments that had to wait for the gap before them
+        quint64 gaps;           // Streams closed early because bytes were missing
+        quint64 overflows;      // Packets of new streams turned away by a full table, and streams closed
+                                // for lack of buffers
+
+        Statistics() : streams(0), bytes(0), outOfOrder(0), gaps(0), overflows(0) {}
+    };
+
+    TcpReassembler();
+
+    // Before the first packet; at most MaxConsumers
+    void addConsumer(AcceptHandler accept, DataHandler data, CloseHandler close, void *user);
+
+    // Bytes per direction, 0 turns reassembly off. Any thread; streams already open keep
+    // the depth they were opened with.
+    void setDepth(quint32 bytes) { m_depth.store(bytes, std::memory_order_relaxed); }
+    quint32 depth() const { return m_depth.load(std::memory_order_relaxed); }
+
+    // Every TCP packet, with or without payload; payload is what was captured of it
+    void process(const PacketDescriptor &packet, const quint8 *payload);
+    // Closes streams that went idle; cheap to call on every packet
+    void expire(quint64 nowUs);
+    // Forgets every stream without telling the consumers
+    void clear();
+
+    Statistics statistics() const;
+
+private:
+    struct Direction {
+        quint32 nextSeq;     // Sequence number of the next byte to deliver
+        quint32 delivered;   // Bytes delivered so far, up to the depth
+        qint32 waitingHead;  // Buffers that arrived early, by sequence number, -1 if none
+        bool synchronized;   // nextSeq is known
+        bool fin;
+
+        Direction() : nextSeq(0), delivered(0), waitingHead(-1), synchronized(false), fin(false) {}
+    };
+
+    struct Stream {
+        quint64 lastSeenUs;
+        quint32 depth;
+        quint16 waitingBuffers;
+        quint8 consumers;    // Bit per consumer that accepted the stream
+        bool finished;       // Nothing more will be delivered
+        Direction sides[2];
+
+        Stream() : lastSeenUs(0), depth(0), waitingBuffers(0), consumers(0), finished(false) {}
+    };
+
+    struct Consumer {
+        AcceptHandler accept;
+        DataHandler data;
+        CloseHandler close;
+        void *user;
+    };
+
+    // One pooled buffer holding part of an early segment
+    struct Segment {
+        quint32 seq;
+        quint16 length;
+        qint32 next;
+    };
+
+    Stream *open(const FlowKey &key, const PacketDescriptor &packet, quint8 consumers);
+    void receive(const FlowKey &key, Stream *stream, quint8 sender, const PacketDescriptor &packet,
+                 const quint8 *payload, quint32 length);
+    bool hold(Stream *stream, Direction *direction, quint32 seq, const quint8 *data, quint32 length);
+    void deliver(const FlowKey &key, Stream *stream, quint8 sender, quint64 timestampUs, const quint8 *data,
+                 quint32 length);
+    void finish(const FlowKey &key, Stream *stream);
+    void release(Stream *stream);
+    quint8 *bufferOf(qint32 segment) { return m_buffers.data() + size_t(segment) * SegmentBufferSize; }
+    // Bit of a flow in m_candidates, alike for both directions
+    static quint32 candidateBit(const IpAddress &a, quint16 portA, const IpAddress &b, quint16 portB);
+    bool isCandidate(quint32 bit) const { return m_candidates[bit / 64] & (quint64(1) << (bit % 64)); }
+    void setCandidate(quint32 bit) { m_candidates[bit / 64] |= quint64(1) << (bit % 64); }
+
+    Consumer m_consumers[MaxConsumers];
+    int m_consumerCount;
+    std::atomic<quint32> m_depth;
+    FlowHashMap<Stream> m_streams;
+    std::vector<quint64> m_candidates; // Set for every open stream; stale bits clear at each expiry sweep
+    std::vector<quint8> m_buffers;   // MaxSegmentBuffers of SegmentBufferSize
+    std::vector<Segment> m_segments;
+    qint32 m_freeHead;
+    quint64 m_nextExpiryUs;
+
+    std::atomic<quint64> m_opened;
+    std::atomic<quint64> m_bytes;
+    std::atomic<quint64> m_outOfOrder;
+    std::atomic<quint64> m_gaps;
+    std::atomic<quint64> m_overflows;
+};
+
+#endif // TCPREASSEMBLER_H
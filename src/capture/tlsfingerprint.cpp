@@ -0,0 +1,142 @@
+#include "tlsfingerprint.h"
+#include <QCryptographicHash>
+#include <QStringList>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// JA4 hashes are the first 12 hex digits of a SHA-256
+const int Ja4HashLength = 12;
+
+QString hex16(quint16 value)
+{
+    return QString("%1").arg(value, 4, 16, QChar('0'));
+}
+
+template <typename T>
+QString joinDecimal(const T *values, int count, bool skipGrease)
+{
+    QStringList parts;
+    for (int i = 0; i < count; ++i) {
+        if (!skipGrease || !TlsClientHello::isGrease(quint16(values[i]))) {
+            parts.append(QString::number(values[i]));
+        }
+    }
+    return parts.join('-');
+}
+
+QString truncatedSha256(const QString &input)
+{
+    if (input.isEmpty()) {
+        return QString(Ja4HashLength, QChar('0'));
+    }
+    const QByteArray digest = QCryptographicHash::hash(input.toLatin1(), QCryptographicHash::Sha256);
+    return QString::fromLatin1(digest.toHex().left(Ja4HashLength));
+}
+
+QString ja4Version(quint16 version)
+{
+    switch (version) {
+    case 0x0304: return "13";
+    case 0x0303: return "12";
+    case 0x0302: return "11";
+    case 0x0301: return "10";
+    case 0x0300: return "s3";
+    case 0x0002: return "s2";
+    case 0xFEFF: return "d1";
+    case 0xFEFD: return "d2";
+    case 0xFEFC: return "d3";
+    default: return "00";
+    }
+}
+
+bool isAlphanumeric(quint8 c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+} // namespace
+
+TlsFingerprint TlsFingerprint::fromClientHello(const TlsClientHello &hello)
+{
+    TlsFingerprint fingerprint;
+    fingerprint.serverName = QString::fromLatin1(hello.serverName, hello.serverNameLength);
+    fingerprint.alpn = QString::fromLatin1(hello.alpn, hello.alpnLength);
+    const QByteArray ja3 = QCryptographicHash::hash(ja3String(hello).toLatin1(), QCryptographicHash::Md5);
+    fingerprint.ja3 = QString::fromLatin1(ja3.toHex());
+    fingerprint.ja4 = ja4String(hello);
+    fingerprint.timestampUs = hello.timestampUs;
+    return fingerprint;
+}
+
+// SSLVersion,Ciphers,Extensions,EllipticCurves,EllipticCurvePointFormats without GREASE values
+QString TlsFingerprint::ja3String(const TlsClientHello &hello)
+{
+    return QString("%1,%2,%3,%4,%5")
+        .arg(hello.legacyVersion)
+        .arg(joinDecimal(hello.cipherSuites, hello.cipherSuiteCount, true),
+             joinDecimal(hello.extensions, hello.extensionCount, true),
+             joinDecimal(hello.groups, hello.groupCount, true),
+             joinDecimal(hello.pointFormats, hello.pointFormatCount, false));
+}
+
+// ja4_a: transport, version, SNI, cipher and extension counts and ALPN; ja4_b: the sorted
+// cipher suites; ja4_c: the sorted extensions without SNI and ALPN, then the signature
+// algorithms in the order sent
+QString TlsFingerprint::ja4String(const TlsClientHello &hello)
+{
+    std::vector<quint16> ciphers;
+    for (int i = 0; i < hello.cipherSuiteCount; ++i) {
+        if (!TlsClientHello::isGrease(hello.cipherSuites[i])) {
+            ciphers.push_back(hello.cipherSuites[i]);
+        }
+    }
+    int extensionCount = 0;
+    std::vector<quint16> extensions;
+    for (int i = 0; i < hello.extensionCount; ++i) {
+        const quint16 type = hello.extensions[i];
+        if (TlsClientHello::isGrease(type)) {
+            continue;
+        }
+        ++extensionCount;
+        if (type != TlsParser::ExtensionServerName && type != TlsParser::ExtensionAlpn) {
+            extensions.push_back(type);
+        }
+    }
+    std::sort(ciphers.begin(), ciphers.end());
+    std::sort(extensions.begin(), extensions.end());
+
+    QString alpn = "00";
+    if (hello.alpnLength > 0) {
+        if (isAlphanumeric(hello.alpnFirst) && isAlphanumeric(hello.alpnLast)) {
+            alpn = QString(QChar(hello.alpnFirst)) + QChar(hello.alpnLast);
+        } else {
+            alpn = QString("%1%2").arg(hello.alpnFirst >> 4, 1, 16).arg(hello.alpnLast & 0x0F, 1, 16);
+        }
+    }
+    const QString a = QString("t%1%2%3%4%5")
+                          .arg(ja4Version(hello.supportedVersion ? hello.supportedVersion : hello.legacyVersion),
+                               hello.hasServerName ? "d" : "i")
+                          .arg(qMin(int(ciphers.size()), 99), 2, 10, QChar('0'))
+                          .arg(qMin(extensionCount, 99), 2, 10, QChar('0'))
+                          .arg(alpn);
+
+    QStringList cipherList;
+    for (quint16 cipher : ciphers) {
+        cipherList.append(hex16(cipher));
+    }
+    QStringList extensionList;
+    for (quint16 extension : extensions) {
+        extensionList.append(hex16(extension));
+    }
+    QStringList signatureList;
+    for (int i = 0; i < hello.signatureAlgorithmCount; ++i) {
+        signatureList.append(hex16(hello.signatureAlgorithms[i]));
+    }
+    QString c = extensionList.join(',');
+    if (!c.isEmpty() && !signatureList.isEmpty()) {
+        c += '_' + signatureList.join(',');
+    }
+    return QString("%1_%2_%3").arg(a, truncatedSha256(cipherList.join(',')), truncatedSha256(c));
+}
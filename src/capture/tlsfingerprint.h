@@ -0,0 +1,31 @@
+#ifndef TLSFINGERPRINT_H
+#define TLSFINGERPRINT_H
+
+#include "tlsparser.h"
+#include <QString>
+
+/**
+ * @brief The TlsFingerprint struct identifies the TLS client behind a connection.
+ *
+ * Built once per flow from its ClientHello, off the capture thread. ja3 is the MD5 of the
+ * classic JA3 string; ja4 is the JA4 fingerprint (FoxIO), which sorts cipher suites and
+ * extensions and so stays stable when a browser shuffles its extension order. Both are
+ * lower case, ready to be used as hash keys.
+ */
+struct TlsFingerprint {
+    QString serverName; // SNI, empty if the client sent none
+    QString alpn;       // First protocol offered, e.g. "h2"
+    QString ja3;
+    QString ja4;
+    quint64 timestampUs; // Capture time of the ClientHello
+
+    TlsFingerprint() : timestampUs(0) {}
+
+    bool isEmpty() const { return ja3.isEmpty() && ja4.isEmpty(); }
+
+    static TlsFingerprint fromClientHello(const TlsClientHello &hello);
+    static QString ja3String(const TlsClientHello &hello);
+    static QString ja4String(const TlsClientHello &hello);
+};
+
+#endif // TLSFINGERPRINT_H
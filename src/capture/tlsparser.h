@@ -0,0 +1,264 @@
+#ifndef TLSPARSER_H
+#define TLSPARSER_H
+
+#include "ipaddress.h"
+#include <QtGlobal>
+
+/**
+ * @brief The TlsClientHello struct is what the capture path keeps of a TLS ClientHello.
+ *
+ * Fixed-size so that it can travel through an SpscRing without allocating: the fields the
+ * JA3 and JA4 fingerprints are built from, in wire order and with GREASE values still in,
+ * plus the server name and the first ALPN protocol.
+ */
+struct TlsClientHello {
+    static constexpr int MaxCipherSuites = 128;
+    static constexpr int MaxExtensions = 64;
+    static constexpr int MaxGroups = 32;
+    static constexpr int MaxPointFormats = 8;
+    static constexpr int MaxSignatureAlgorithms = 32;
+    static constexpr int MaxServerNameLength = 253;
+    static constexpr int MaxAlpnLength = 32;
+
+    quint64 timestampUs;
+    IpAddress client;
+    IpAddress server;
+    quint16 clientPort;
+    quint16 serverPort;
+
+    quint16 legacyVersion;
+    quint16 supportedVersion; // Highest non-GREASE supported_versions entry, 0 without the extension
+    quint8 cipherSuiteCount;
+    quint8 extensionCount;
+    quint8 groupCount;
+    quint8 pointFormatCount;
+    quint8 signatureAlgorithmCount;
+    bool hasServerName;
+    quint8 serverNameLength;
+    quint8 alpnLength;        // Of the first protocol, as far as it was kept
+    quint8 alpnFirst;         // First and last byte of the first protocol, which JA4 uses
+    quint8 alpnLast;
+    quint16 cipherSuites[MaxCipherSuites];
+    quint16 extensions[MaxExtensions];
+    quint16 groups[MaxGroups];
+    quint8 pointFormats[MaxPointFormats];
+    quint16 signatureAlgorithms[MaxSignatureAlgorithms];
+    char serverName[MaxServerNameLength + 1];
+    char alpn[MaxAlpnLength + 1];
+
+    TlsClientHello() : timestampUs(0), clientPort(0), serverPort(0), legacyVersion(0), supportedVersion(0),
+                       cipherSuiteCount(0), extensionCount(0), groupCount(0), pointFormatCount(0),
+                       signatureAlgorithmCount(0), hasServerName(false), serverNameLength(0), alpnLength(0),
+                       alpnFirst(0), alpnLast(0)
+    {
+        serverName[0] = 0;
+        alpn[0] = 0;
+    }
+
+    // RFC 8701 reserves 0x0a0a, 0x1a1a, ... 0xfafa so that peers must ignore unknown values
+    static bool isGrease(quint16 value) { return (value & 0x0F0F) == 0x0A0A && (value >> 8) == (value & 0xFF); }
+};
+
+/**
+ * @brief The TlsParser class decodes a TLS ClientHello straight from the captured bytes.
+ *
+ * Like PacketDecoder it is bounds-checked, reads byte-wise and never allocates, so it can run
+ * on the capture thread. Nothing is copied unless the hello spans several segments, which is
+ * up to the caller. Lists longer than TlsClientHello keeps are rejected rather than cut,
+ * since a fingerprint over part of a list would match nothing.
+ */
+class TlsParser
+{
+public:
+    static const quint32 RecordHeaderLength = 5;
+    static const quint32 HandshakeHeaderLength = 4;
+    static const quint8 ContentTypeHandshake = 22;
+    static const quint8 HandshakeClientHello = 1;
+    static const quint32 MaxHelloLength = 8192;     // Larger hellos are not reassembled
+    static const int CaptureLength = 1460;          // Payload bytes to capture, a full Ethernet TCP segment
+
+    enum Extension : quint16 {
+        ExtensionServerName = 0x0000,
+        ExtensionSupportedGroups = 0x000A,
+        ExtensionPointFormats = 0x000B,
+        ExtensionSignatureAlgorithms = 0x000D,
+        ExtensionAlpn = 0x0010,
+        ExtensionSupportedVersions = 0x002B
+    };
+
+    // Cheap enough for every TCP payload: a handshake record that carries a ClientHello
+    static bool isClientHelloStart(const quint8 *data, quint32 length)
+    {
+        return length >= RecordHeaderLength + 1 && data[0] == ContentTypeHandshake && data[1] == 0x03 &&
+               data[RecordHeaderLength] == HandshakeClientHello;
+    }
+
+    // Bytes from the record header to the end of the ClientHello, once isClientHelloStart()
+    static quint32 helloLength(const quint8 *data, quint32 length)
+    {
+        if (length < RecordHeaderLength + HandshakeHeaderLength) {
+            return RecordHeaderLength + HandshakeHeaderLength;
+        }
+        const quint32 body = (quint32(data[6]) << 16) | (quint32(data[7]) << 8) | data[8];
+        return RecordHeaderLength + HandshakeHeaderLength + body;
+    }
+
+    // Fills in everything but the timestamp and the endpoints. data must hold the whole hello
+    // from the record header on. Hellos split over several records are not supported.
+    static bool parse(const quint8 *data, quint32 length, TlsClientHello *out)
+    {
+        if (!isClientHelloStart(data, length)) {
+            return false;
+        }
+        const quint32 total = helloLength(data, length);
+        const quint32 recordLength = readBe16(data + 3);
+        if (total > length || total > RecordHeaderLength + recordLength) {
+            return false;
+        }
+
+        quint32 offset = RecordHeaderLength + HandshakeHeaderLength;
+        if (offset + 35 > total) {
+            return false;
+        }
+        out->legacyVersion = readBe16(data + offset);
+        offset += 34; // Version and random
+        offset += 1 + data[offset]; // Session ID
+
+        if (offset + 2 > total) {
+            return false;
+        }
+        const quint32 cipherBytes = readBe16(data + offset);
+        offset += 2;
+        if (offset + cipherBytes > total || cipherBytes % 2 != 0 ||
+            cipherBytes / 2 > quint32(TlsClientHello::MaxCipherSuites)) {
+            return false;
+        }
+        out->cipherSuiteCount = quint8(cipherBytes / 2);
+        for (quint32 i = 0; i < cipherBytes / 2; ++i) {
+            out->cipherSuites[i] = readBe16(data + offset + 2 * i);
+        }
+        offset += cipherBytes;
+
+        if (offset + 1 > total) {
+            return false;
+        }
+        offset += 1 + data[offset]; // Compression methods
+        out->extensionCount = 0;
+        if (offset + 2 > total) {
+            return offset == total; // No extensions at all
+        }
+        const quint32 extensionsEnd = offset + 2 + readBe16(data + offset);
+        offset += 2;
+        if (extensionsEnd > total) {
+            return false;
+        }
+
+        while (offset + 4 <= extensionsEnd) {
+            const quint16 type = readBe16(data + offset);
+            const quint32 extensionLength = readBe16(data + offset + 2);
+            offset += 4;
+            if (offset + extensionLength > extensionsEnd || out->extensionCount >= TlsClientHello::MaxExtensions) {
+                return false;
+            }
+            out->extensions[out->extensionCount++] = type;
+            if (!parseExtension(type, data + offset, extensionLength, out)) {
+                return false;
+            }
+            offset += extensionLength;
+        }
+        return offset == extensionsEnd;
+    }
+
+private:
+    static quint16 readBe16(const quint8 *p)
+    {
+        return quint16((quint16(p[0]) << 8) | p[1]);
+    }
+
+    // A list of 16-bit values behind a 16-bit byte count, as used by several extensions
+    static bool readList16(const quint8 *data, quint32 length, quint16 *values, int maxValues, quint8 *count)
+    {
+        if (length < 2) {
+            return false;
+        }
+        const quint32 bytes = readBe16(data);
+        if (bytes + 2 > length || bytes % 2 != 0 || bytes / 2 > quint32(maxValues)) {
+            return false;
+        }
+        for (quint32 i = 0; i < bytes / 2; ++i) {
+            values[i] = readBe16(data + 2 + 2 * i);
+        }
+        *count = quint8(bytes / 2);
+        return true;
+    }
+
+    static bool parseExtension(quint16 type, const quint8 *data, quint32 length, TlsClientHello *out)
+    {
+        switch (type) {
+        case ExtensionServerName: {
+            // The list holds one host_name entry in practice
+            if (length < 5 || data[2] != 0) {
+                return length == 0;
+            }
+            const quint32 nameLength = readBe16(data + 3);
+            if (nameLength + 5 > length || nameLength > quint32(TlsClientHello::MaxServerNameLength)) {
+                return false;
+            }
+            for (quint32 i = 0; i < nameLength; ++i) {
+                const char c = char(data[5 + i]);
+                out->serverName[i] = (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+            }
+            out->serverName[nameLength] = 0;
+            out->serverNameLength = quint8(nameLength);
+            out->hasServerName = true;
+            return true;
+        }
+        case ExtensionSupportedGroups:
+            return readList16(data, length, out->groups, TlsClientHello::MaxGroups, &out->groupCount);
+        case ExtensionSignatureAlgorithms:
+            return readList16(data, length, out->signatureAlgorithms, TlsClientHello::MaxSignatureAlgorithms,
+                              &out->signatureAlgorithmCount);
+        case ExtensionPointFormats: {
+            if (length < 1 || quint32(data[0]) + 1 > length || data[0] > TlsClientHello::MaxPointFormats) {
+                return false;
+            }
+            for (quint8 i = 0; i < data[0]; ++i) {
+                out->pointFormats[i] = data[1 + i];
+            }
+            out->pointFormatCount = data[0];
+            return true;
+        }
+        case ExtensionAlpn: {
+            if (length < 3 || data[2] == 0 || quint32(data[2]) + 3 > length) {
+                return false;
+            }
+            const quint8 protocolLength = data[2];
+            const quint8 kept = qMin(protocolLength, quint8(TlsClientHello::MaxAlpnLength));
+            for (quint8 i = 0; i < kept; ++i) {
+                out->alpn[i] = char(data[3 + i]);
+            }
+            out->alpn[kept] = 0;
+            out->alpnLength = kept;
+            out->alpnFirst = data[3];
+            out->alpnLast = data[3 + protocolLength - 1];
+            return true;
+        }
+        case ExtensionSupportedVersions: {
+            if (length < 1 || quint32(data[0]) + 1 > length || data[0] % 2 != 0) {
+                return false;
+            }
+            for (quint32 i = 0; i < data[0]; i += 2) {
+                const quint16 version = readBe16(data + 1 + i);
+                if (!TlsClientHello::isGrease(version) && version > out->supportedVersion) {
+                    out->supportedVersion = version;
+                }
+            }
+            return true;
+        }
+        default:
+            return true;
+        }
+    }
+};
+
+#endif // TLSPARSER_H
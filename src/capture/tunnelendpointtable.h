@@ -0,0 +1,80 @@
+#ifndef TUNNELENDPOINTTABLE_H
+#define TUNNELENDPOINTTABLE_H
+
+#include "flowtable.h"
+#include "packetdescriptor.h"
+#include <QtGlobal>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief The TunnelEndpointTable class numbers the outer address pairs of decapsulated tunnels.
+ *
+ * A PacketDescriptor carries the index in TunnelInfo::endpoints instead of two full outer
+ * addresses, which would make every descriptor half as large again for a pair that hardly
+ * ever changes. Entries are only ever added, so an index stays valid for the table's
+ * lifetime; once MaxEndpoints pairs are known, new ones get index 0, which has no addresses.
+ *
+ * Capture threads keep their own FlowHashMap of the pairs they have seen and only come here,
+ * under the lock, for a pair that is new to them.
+ */
+class TunnelEndpointTable
+{
+public:
+    static constexpr size_t MaxEndpoints = 4096;
+
+    TunnelEndpointTable() : m_indices(MaxEndpoints) { m_endpoints.resize(1); }
+
+    TunnelEndpointTable(const TunnelEndpointTable &) = delete;
+    TunnelEndpointTable &operator=(const TunnelEndpointTable &) = delete;
+
+    // A pair as a FlowHashMap key; the direction is kept, not normalised
+    static FlowKey key(const TunnelEndpoints &endpoints)
+    {
+        FlowKey key;
+        key.addressA = endpoints.outerSrc;
+        key.addressB = endpoints.outerDst;
+        return key;
+    }
+
+    // Any thread. The pair's index, added if new; 0 when the table is full.
+    quint16 intern(const TunnelEndpoints &endpoints)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_endpoints.size() >= MaxEndpoints) {
+            const quint16 *index = m_indices.find(key(endpoints));
+            return index ? *index : 0;
+        }
+        bool inserted = false;
+        quint16 *index = m_indices.findOrInsert(key(endpoints), &inserted);
+        if (inserted) {
+            *index = quint16(m_endpoints.size());
+            m_endpoints.push_back(endpoints);
+        }
+        return *index;
+    }
+
+    // Any thread. False for index 0 and for indices this table never handed out.
+    bool lookup(quint16 index, TunnelEndpoints *endpoints) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (index == 0 || index >= m_endpoints.size()) {
+            return false;
+        }
+        *endpoints = m_endpoints[index];
+        return true;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_endpoints.size() - 1;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<TunnelEndpoints> m_endpoints; // By index; entry 0 is unused
+    FlowHashMap<quint16> m_indices;
+};
+
+#endif // TUNNELENDPOINTTABLE_H
@@ -31,6 +31,7 @@ IntrusionDetectionManager::IntrusionDetectionManager(QObject *parent)
     QString configDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
     QDir().mkpath(configDir);
     m_signaturesFilePath = configDir + "/signatures.json";
+    m_tlsFingerprintsFilePath = configDir + "/tls_fingerprints.json";
     m_threatIntelFilePath = configDir + "/threat_intelligence.json";
     
     // Set up timers
@@ -42,6 +43,7 @@ IntrusionDetectionManager::IntrusionDetectionManager(QObject *parent)
     
     // Load configurations
     loadSignatures();
+    loadTlsFingerprints();
     loadThreatIntelligence();
     
     // Initialize with default signatures
@@ -56,6 +58,7 @@ IntrusionDetectionManager::~IntrusionDetectionManager()
 {
     LOG_FUNCTION_ENTRY();
     saveSignatures();
+    saveTlsFingerprints();
     saveThreatIntelligence();
 }
 
@@ -106,10 +109,19 @@ void IntrusionDetectionManager::processConnection(const NetworkMonitor::Connecti
     // Perform heuristic detection
     performHeuristicDetection(conn);
     
+    // Match the TLS client fingerprint, if the handshake was seen
+    performFingerprintDetection(conn);
+    
     // Check threat intelligence
     checkThreatIntelligence(conn.remoteAddress);
 }
 
+void IntrusionDetectionManager::processTlsHandshake(const NetworkMonitor::ConnectionInfo &conn)
+{
+    // Called for every ClientHello, so only the hash lookups run here
+    performFingerprintDetection(conn);
+}
+
 void IntrusionDetectionManager::performSignatureDetection(const NetworkMonitor::ConnectionInfo &conn)
 {
     LOG_FUNCTION_ENTRY();
@@ -252,6 +264,46 @@ void IntrusionDetectionManager::performHeuristicDetection(const NetworkMonitor::
     }
 }
 
+void IntrusionDetectionManager::performFingerprintDetection(const NetworkMonitor::ConnectionInfo &conn)
+{
+    if (m_tlsFingerprintRules.isEmpty()) {
+        return;
+    }
+    
+    // JA4 first: it survives the extension order shuffling that changes JA3
+    TlsFingerprintRule rule;
+    QString fingerprint = conn.ja4;
+    if (!matchTlsFingerprint(fingerprint, &rule)) {
+        fingerprint = conn.ja3;
+        if (!matchTlsFingerprint(fingerprint, &rule)) {
+            return;
+        }
+    }
+    
+    SecurityEvent event;
+    event.id = generateEventId();
+    event.type = SignatureBased;
+    event.level = rule.level;
+    event.title = QString("TLS Fingerprint Match: %1").arg(rule.name);
+    event.description = rule.description;
+    event.sourceIP = conn.localAddress;
+    event.destinationIP = conn.remoteAddress;
+    event.sourcePort = conn.localPort;
+    event.destinationPort = conn.remotePort;
+    event.protocol = "TCP";
+    event.bytesTransferred = conn.bytesReceived + conn.bytesSent;
+    event.timestamp = QDateTime::currentDateTime();
+    event.blocked = false;
+    event.signature = fingerprint;
+    event.additionalInfo = QString("Category: %1, Server name: %2")
+                               .arg(rule.category, conn.tlsServerName.isEmpty() ? "-" : conn.tlsServerName);
+    
+    m_recentEvents.append(event);
+    emit securityEventDetected(event);
+    
+    LOG_WARNING(QString("TLS fingerprint match: %1 (%2) to %3").arg(rule.name, fingerprint, conn.remoteAddress));
+}
+
 void IntrusionDetectionManager::checkThreatIntelligence(const QString &ipAddress)
 {
     LOG_FUNCTION_ENTRY();
@@ -467,6 +519,43 @@ void IntrusionDetectionManager::enableSignature(const QString &signatureId, bool
     saveSignatures();
 }
 
+QList<IntrusionDetectionManager::TlsFingerprintRule> IntrusionDetectionManager::tlsFingerprintRules() const
+{
+    return m_tlsFingerprintRules.values();
+}
+
+void IntrusionDetectionManager::addTlsFingerprintRule(const TlsFingerprintRule &rule)
+{
+    TlsFingerprintRule normalized = rule;
+    normalized.fingerprint = rule.fingerprint.trimmed().toLower();
+    if (normalized.fingerprint.isEmpty()) {
+        return;
+    }
+    m_tlsFingerprintRules.insert(normalized.fingerprint, normalized);
+    saveTlsFingerprints();
+}
+
+void IntrusionDetectionManager::removeTlsFingerprintRule(const QString &fingerprint)
+{
+    m_tlsFingerprintRules.remove(fingerprint.trimmed().toLower());
+    saveTlsFingerprints();
+}
+
+bool IntrusionDetectionManager::matchTlsFingerprint(const QString &fingerprint, TlsFingerprintRule *rule) const
+{
+    if (fingerprint.isEmpty()) {
+        return false;
+    }
+    auto it = m_tlsFingerprintRules.constFind(fingerprint);
+    if (it == m_tlsFingerprintRules.constEnd() || !it.value().enabled) {
+        return false;
+    }
+    if (rule) {
+        *rule = it.value();
+    }
+    return true;
+}
+
 QList<IntrusionDetectionManager::ThreatIntel> IntrusionDetectionManager::threatIntelligence() const
 {
     return m_threatIntelligence;
@@ -649,6 +738,61 @@ void IntrusionDetectionManager::saveSignatures()
     }
 }
 
+void IntrusionDetectionManager::loadTlsFingerprints()
+{
+    LOG_FUNCTION_ENTRY();
+    
+    QFile file(m_tlsFingerprintsFilePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        LOG_DEBUG("No TLS fingerprints file found");
+        return;
+    }
+    
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+    QJsonArray rulesArray = doc.array();
+    
+    m_tlsFingerprintRules.clear();
+    for (const auto &ruleValue : rulesArray) {
+        QJsonObject ruleObj = ruleValue.toObject();
+        TlsFingerprintRule rule;
+        rule.fingerprint = ruleObj["fingerprint"].toString().trimmed().toLower();
+        rule.name = ruleObj["name"].toString();
+        rule.description = ruleObj["description"].toString();
+        rule.level = static_cast<ThreatLevel>(ruleObj["level"].toInt());
+        rule.enabled = ruleObj["enabled"].toBool(true);
+        rule.category = ruleObj["category"].toString();
+        if (!rule.fingerprint.isEmpty()) {
+            m_tlsFingerprintRules.insert(rule.fingerprint, rule);
+        }
+    }
+    
+    LOG_DEBUG(QString("Loaded %1 TLS fingerprints").arg(m_tlsFingerprintRules.size()));
+}
+
+void IntrusionDetectionManager::saveTlsFingerprints()
+{
+    LOG_FUNCTION_ENTRY();
+    
+    QJsonArray rulesArray;
+    for (const auto &rule : m_tlsFingerprintRules) {
+        QJsonObject ruleObj;
+        ruleObj["fingerprint"] = rule.fingerprint;
+        ruleObj["name"] = rule.name;
+        ruleObj["description"] = rule.description;
+        ruleObj["level"] = static_cast<int>(rule.level);
+        ruleObj["enabled"] = rule.enabled;
+        ruleObj["category"] = rule.category;
+        rulesArray.append(ruleObj);
+    }
+    
+    QJsonDocument doc(rulesArray);
+    QFile file(m_tlsFingerprintsFilePath);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(doc.toJson());
+        LOG_DEBUG(QString("Saved %1 TLS fingerprints").arg(m_tlsFingerprintRules.size()));
+    }
+}
+
 void IntrusionDetectionManager::loadThreatIntelligence()
 {
     LOG_FUNCTION_ENTRY();
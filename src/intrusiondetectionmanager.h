@@ -76,6 +76,16 @@ public:
         QString category;
     };
 
+    // Known TLS client fingerprint, a JA3 hash or a JA4 string
+    struct TlsFingerprintRule {
+        QString fingerprint;
+        QString name;
+        QString description;
+        ThreatLevel level;
+        bool enabled;
+        QString category;
+    };
+
     static IntrusionDetectionManager* instance();
     ~IntrusionDetectionManager();
 
@@ -90,6 +100,12 @@ public:
     void addSignature(const DetectionSignature &signature);
     void removeSignature(const QString &signatureId);
     void enableSignature(const QString &signatureId, bool enabled = true);
+    
+    // TLS fingerprints, looked up by hash so every handshake costs one lookup per fingerprint
+    QList<TlsFingerprintRule> tlsFingerprintRules() const;
+    void addTlsFingerprintRule(const TlsFingerprintRule &rule);
+    void removeTlsFingerprintRule(const QString &fingerprint);
+    bool matchTlsFingerprint(const QString &fingerprint, TlsFingerprintRule *rule = nullptr) const;
 
     // Threat intelligence
     QList<ThreatIntel> threatIntelligence() const;
@@ -115,6 +131,7 @@ public slots:
     void startMonitoring();
     void stopMonitoring();
     void processConnection(const NetworkMonitor::ConnectionInfo &conn);
+    void processTlsHandshake(const NetworkMonitor::ConnectionInfo &conn);
     void processTrafficData(quint64 download, quint64 upload);
     void runSecurityScan();
 
@@ -135,6 +152,7 @@ private:
     void performSignatureDetection(const NetworkMonitor::ConnectionInfo &conn);
     void performAnomalyDetection(const NetworkMonitor::ConnectionInfo &conn);
     void performHeuristicDetection(const NetworkMonitor::ConnectionInfo &conn);
+    void performFingerprintDetection(const NetworkMonitor::ConnectionInfo &conn);
     void checkThreatIntelligence(const QString &ipAddress);
 
     // Privacy protection methods
@@ -152,6 +170,8 @@ private:
     // Configuration
     void loadSignatures();
     void saveSignatures();
+    void loadTlsFingerprints();
+    void saveTlsFingerprints();
     void loadThreatIntelligence();
     void saveThreatIntelligence();
     void initializeDefaultSignatures();
@@ -164,6 +184,7 @@ private:
     QList<SecurityEvent> m_recentEvents;
     QList<SecurityEvent> m_blockedEvents;
     QList<DetectionSignature> m_signatures;
+    QHash<QString, TlsFingerprintRule> m_tlsFingerprintRules; // Key: lower-case fingerprint
     QList<ThreatIntel> m_threatIntelligence;
     QSet<QString> m_blockedIPs;
     QSet<quint16> m_blockedPorts;
@@ -179,6 +200,7 @@ private:
     QNetworkAccessManager *m_networkManager;
     
     QString m_signaturesFilePath;
+    QString m_tlsFingerprintsFilePath;
     QString m_threatIntelFilePath;
 };
 
@@ -1,4 +1,5 @@
 #include "mainwindow.h"
+#include "networkmonitor.h"
 #include "globallogger.h"
 #include "alertmanager.h"
 #include <QApplication>
@@ -49,6 +50,30 @@ bool loadStyleSheet(QApplication &app) {
     return true;
 }
 
+// Replays a capture file through the analysis without a window and prints the throughput, so
+// the same file can be used as a repeatable performance workload
+int runReplay(const QString &fileName, double speed)
+{
+    NetworkMonitor monitor;
+    QObject::connect(&monitor, &NetworkMonitor::replayFinished, qApp, &QCoreApplication::quit);
+    if (!monitor.startReplay(fileName, speed)) {
+        LOG_ERROR(QString("Could not replay %1").arg(fileName));
+        return 1;
+    }
+    
+    int result = QApplication::exec();
+    
+    const NetworkMonitor::ReplayStatistics stats = monitor.getReplayStatistics();
+    QTextStream out(stdout);
+    out << QString("Replayed %1 packets, %2 bytes, %3 s of traffic in %4 ms: %5 packets/s\n")
+               .arg(stats.packets)
+               .arg(stats.bytes)
+               .arg(double(stats.lastPacketUs - stats.firstPacketUs) / 1e6, 0, 'f', 3)
+               .arg(stats.elapsedMs)
+               .arg(qRound64(stats.packetsPerSecond));
+    return result;
+}
+
 int main(int argc, char *argv[])
 {
     // Initialize global logger first
@@ -73,6 +98,16 @@ int main(int argc, char *argv[])
     // app.setWindowIcon(QIcon(":/resources/icons/app.ico"));
     LOG_INFO("Application icon set (skipped due to empty icon file)");
     
+    // Headless replay: NetWire --replay <file> [--speed <multiple, 0 = as fast as possible>]
+    const QStringList arguments = QApplication::arguments();
+    const int replayIndex = arguments.indexOf("--replay");
+    if (replayIndex >= 0 && replayIndex + 1 < arguments.size()) {
+        const int speedIndex = arguments.indexOf("--speed");
+        const double speed = speedIndex >= 0 && speedIndex + 1 < arguments.size()
+                                 ? arguments.at(speedIndex + 1).toDouble() : 0.0;
+        return runReplay(arguments.at(replayIndex + 1), speed);
+    }
+    
     // Load and apply style sheet
     if (!loadStyleSheet(app)) {
         LOG_WARNING("Failed to load style sheet");
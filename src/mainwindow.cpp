@@ -12,6 +12,13 @@
 #include <QCheckBox>
 #include <QProgressDialog>
 #include <QStatusBar>
+#include <QInputDialog>
+#include <QFileInfo>
+#include <QDir>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QVBoxLayout>
+#include <QStandardPaths>
 
 #include <QtCharts/QChart>
 #include <QtCharts/QLineSeries>
@@ -81,6 +88,9 @@ MainWindow::MainWindow(QWidget *parent)
     setupTables();
     loadSettings();
     
+    m_captureStatsLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(m_captureStatsLabel);
+    
     // Initialize IP2Location
     initializeIP2Location();
     
@@ -176,10 +186,18 @@ void MainWindow::setupConnections()
             this, &MainWindow::onConnectionEstablished);
     connect(m_networkMonitor, &NetworkMonitor::statsUpdated, 
             this, &MainWindow::onStatsUpdated);
+    connect(m_networkMonitor, &NetworkMonitor::tlsHandshakeSeen,
+            m_intrusionDetectionManager, &IntrusionDetectionManager::processTlsHandshake);
     
     // Menu connections
     connect(ui->actionExit, &QAction::triggered, this, &MainWindow::onExitAction);
     connect(ui->actionAbout, &QAction::triggered, this, &MainWindow::onAboutAction);
+    connect(ui->actionCaptureFilter, &QAction::triggered, this, &MainWindow::onCaptureFilterAction);
+    connect(ui->actionPacketSampling, &QAction::triggered, this, &MainWindow::onPacketSamplingAction);
+    connect(ui->actionHttpLatency, &QAction::triggered, this, &MainWindow::onHttpLatencyAction);
+    connect(ui->actionRecordCaptures, &QAction::triggered, this, &MainWindow::onRecordCapturesAction);
+    connect(ui->actionReplayCapture, &QAction::triggered, this, &MainWindow::onReplayCaptureAction);
+    connect(m_networkMonitor, &NetworkMonitor::replayFinished, this, &MainWindow::onReplayFinished);
 }
 
 void MainWindow::setupSystemTray()
@@ -309,6 +327,76 @@ void MainWindow::loadSettings()
     m_autoStartCheckBox->setChecked(m_settings->value("autoStart", true).toBool());
     m_settings->endGroup();
     
+    // Capture backend and ring tuning, applied the next time monitoring starts
+    m_settings->beginGroup("Capture");
+    CaptureEngine::Config captureConfig = m_networkMonitor->captureConfig();
+    if (m_settings->value("backend", "pcap").toString() == "mmap") {
+        captureConfig.backend = CaptureEngine::BackendPacketMmap;
+    }
+    captureConfig.blockSize = m_settings->value("blockSize", captureConfig.blockSize).toInt();
+    captureConfig.blockCount = m_settings->value("blockCount", captureConfig.blockCount).toInt();
+    captureConfig.blockTimeoutMs = m_settings->value("blockTimeoutMs", captureConfig.blockTimeoutMs).toInt();
+    captureConfig.filter = m_settings->value("filter", captureConfig.filter).toString();
+    captureConfig.headersOnly = m_settings->value("headersOnly", captureConfig.headersOnly).toBool();
+    captureConfig.snapLength = m_settings->value("snapLength", captureConfig.snapLength).toInt();
+    m_networkMonitor->setCaptureConfig(captureConfig);
+    m_captureInterfaces = m_settings->value("interfaces").toStringList();
+    m_settings->endGroup();
+    
+    // Rolling pcapng files of the live capture
+    m_settings->beginGroup("Recording");
+    CaptureRecorder::Config recordingConfig = m_networkMonitor->recordingConfig();
+    recordingConfig.enabled = m_settings->value("enabled", recordingConfig.enabled).toBool();
+    recordingConfig.directory = m_settings->value("directory",
+        QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/recordings").toString();
+    recordingConfig.maxFileBytes = m_settings->value("maxFileBytes", recordingConfig.maxFileBytes).toLongLong();
+    recordingConfig.maxFileSeconds = m_settings->value("maxFileSeconds", recordingConfig.maxFileSeconds).toInt();
+    recordingConfig.maxFiles = m_settings->value("maxFiles", recordingConfig.maxFiles).toInt();
+    recordingConfig.snapLength = m_settings->value("snapLength", recordingConfig.snapLength).toInt();
+    m_networkMonitor->setRecordingConfig(recordingConfig);
+    ui->actionRecordCaptures->setChecked(recordingConfig.enabled);
+    m_settings->endGroup();
+    
+    // Packet processing threads, also applied the next time monitoring starts
+    m_settings->beginGroup("Processing");
+    NetworkMonitor::ProcessingConfig processingConfig = m_networkMonitor->processingConfig();
+    processingConfig.workers = m_settings->value("workers", processingConfig.workers).toInt();
+    processingConfig.kernelFanout = m_settings->value("kernelFanout", processingConfig.kernelFanout).toBool();
+    m_networkMonitor->setProcessingConfig(processingConfig);
+    m_settings->endGroup();
+    
+    // Packet sampling on fast links, applied straight away
+    m_settings->beginGroup("Sampling");
+    NetworkMonitor::SamplingConfig samplingConfig = m_networkMonitor->samplingConfig();
+    const QString samplingMode = m_settings->value("mode", "off").toString();
+    samplingConfig.mode = samplingMode == "packet" ? PacketSampler::EveryNth
+                        : samplingMode == "flow" ? PacketSampler::FlowHash : PacketSampler::Off;
+    samplingConfig.rate = m_settings->value("rate", samplingConfig.rate).toInt();
+    m_networkMonitor->setSamplingConfig(samplingConfig);
+    m_settings->endGroup();
+    
+    // Payload analysis, each part of which widens headers-only captures; all off by default
+    m_settings->beginGroup("Inspection");
+    NetworkMonitor::InspectionConfig inspectionConfig = m_networkMonitor->inspectionConfig();
+    inspectionConfig.dns = m_settings->value("dns", inspectionConfig.dns).toBool();
+    inspectionConfig.tls = m_settings->value("tls", inspectionConfig.tls).toBool();
+    inspectionConfig.protocol = m_settings->value("protocol", inspectionConfig.protocol).toBool();
+    inspectionConfig.streams = m_settings->value("streams", inspectionConfig.streams).toBool();
+    m_networkMonitor->setInspectionConfig(inspectionConfig);
+    m_settings->endGroup();
+    
+    // How much of each TCP stream is reassembled when stream inspection is on; 0 turns it off
+    m_settings->beginGroup("Reassembly");
+    m_networkMonitor->setStreamReassemblyDepth(
+        m_settings->value("depth", m_networkMonitor->streamReassemblyDepth()).toUInt());
+    m_settings->endGroup();
+    
+    // Flows inside VXLAN, GENEVE, GRE and IP-in-IP tunnels by their inner headers
+    m_settings->beginGroup("Decoding");
+    m_networkMonitor->setTunnelDecapsulation(
+        m_settings->value("tunnels", m_networkMonitor->tunnelDecapsulation()).toBool());
+    m_settings->endGroup();
+    
     m_settings->beginGroup("Display");
     QString theme = m_settings->value("theme", "Light").toString();
     int themeIndex = m_themeCombo->findText(theme);
@@ -331,6 +419,57 @@ void MainWindow::saveSettings()
     m_settings->setValue("autoStart", m_autoStartCheckBox->isChecked());
     m_settings->endGroup();
     
+    CaptureEngine::Config captureConfig = m_networkMonitor->captureConfig();
+    m_settings->beginGroup("Capture");
+    m_settings->setValue("backend", captureConfig.backend == CaptureEngine::BackendPacketMmap ? "mmap" : "pcap");
+    m_settings->setValue("blockSize", captureConfig.blockSize);
+    m_settings->setValue("blockCount", captureConfig.blockCount);
+    m_settings->setValue("blockTimeoutMs", captureConfig.blockTimeoutMs);
+    m_settings->setValue("filter", captureConfig.filter);
+    m_settings->setValue("headersOnly", captureConfig.headersOnly);
+    m_settings->setValue("snapLength", captureConfig.snapLength);
+    m_settings->setValue("interfaces", m_captureInterfaces);
+    m_settings->endGroup();
+    
+    CaptureRecorder::Config recordingConfig = m_networkMonitor->recordingConfig();
+    m_settings->beginGroup("Recording");
+    m_settings->setValue("enabled", recordingConfig.enabled);
+    m_settings->setValue("directory", recordingConfig.directory);
+    m_settings->setValue("maxFileBytes", recordingConfig.maxFileBytes);
+    m_settings->setValue("maxFileSeconds", recordingConfig.maxFileSeconds);
+    m_settings->setValue("maxFiles", recordingConfig.maxFiles);
+    m_settings->setValue("snapLength", recordingConfig.snapLength);
+    m_settings->endGroup();
+    
+    const NetworkMonitor::ProcessingConfig processingConfig = m_networkMonitor->processingConfig();
+    m_settings->beginGroup("Processing");
+    m_settings->setValue("workers", processingConfig.workers);
+    m_settings->setValue("kernelFanout", processingConfig.kernelFanout);
+    m_settings->endGroup();
+    
+    const NetworkMonitor::SamplingConfig samplingConfig = m_networkMonitor->samplingConfig();
+    m_settings->beginGroup("Sampling");
+    m_settings->setValue("mode", samplingConfig.mode == PacketSampler::EveryNth ? "packet"
+                               : samplingConfig.mode == PacketSampler::FlowHash ? "flow" : "off");
+    m_settings->setValue("rate", samplingConfig.rate);
+    m_settings->endGroup();
+    
+    const NetworkMonitor::InspectionConfig inspectionConfig = m_networkMonitor->inspectionConfig();
+    m_settings->beginGroup("Inspection");
+    m_settings->setValue("dns", inspectionConfig.dns);
+    m_settings->setValue("tls", inspectionConfig.tls);
+    m_settings->setValue("protocol", inspectionConfig.protocol);
+    m_settings->setValue("streams", inspectionConfig.streams);
+    m_settings->endGroup();
+    
+    m_settings->beginGroup("Reassembly");
+    m_settings->setValue("depth", m_networkMonitor->streamReassemblyDepth());
+    m_settings->endGroup();
+    
+    m_settings->beginGroup("Decoding");
+    m_settings->setValue("tunnels", m_networkMonitor->tunnelDecapsulation());
+    m_settings->endGroup();
+    
     m_settings->beginGroup("Display");
     m_settings->setValue("theme", m_themeCombo->currentText());
     m_settings->endGroup();
@@ -343,9 +482,13 @@ void MainWindow::setMonitoring(bool enabled)
     m_isMonitoring = enabled;
     
     if (enabled) {
-        QStringList interfaces = m_networkMonitor->getAvailableInterfaces();
-        if (!interfaces.isEmpty()) {
-            m_networkMonitor->startCapture(interfaces.first());
+        if (!m_captureInterfaces.isEmpty()) {
+            m_networkMonitor->startCapture(m_captureInterfaces);
+        } else {
+            QStringList interfaces = m_networkMonitor->getAvailableInterfaces();
+            if (!interfaces.isEmpty()) {
+                m_networkMonitor->startCapture(interfaces.first());
+            }
         }
         m_startStopButton->setText("Stop Monitoring");
         ui->statusbar->showMessage("Monitoring active");
@@ -447,14 +590,18 @@ void MainWindow::onThemeChanged(const QString &theme)
 // Network monitoring slots
 void MainWindow::onConnectionEstablished(const NetworkMonitor::ConnectionInfo &connection)
 {
+    // Arrives for every connection seen on the wire; the table itself refreshes on its timer
     m_connections.append(connection);
-    updateConnectionsTable();
+    if (m_connections.size() > 1000) {
+        m_connections.removeFirst();
+    }
 }
 
-void MainWindow::onStatsUpdated(quint64 download, quint64 upload)
+void MainWindow::onStatsUpdated(quint64 download, quint64 upload, quint64 smoothedDownload, quint64 smoothedUpload)
 {
-    m_currentDownloadRate = download;
-    m_currentUploadRate = upload;
+    // The totals add up whole seconds; the labels show the steadier smoothed rate
+    m_currentDownloadRate = smoothedDownload;
+    m_currentUploadRate = smoothedUpload;
     m_totalDownload += download;
     m_totalUpload += upload;
     
@@ -472,7 +619,24 @@ void MainWindow::onStatsUpdated(quint64 download, quint64 upload)
 void MainWindow::updateTrafficSummary()
 {
     // This is called by timer to update summary periodically
-    // Could add additional calculations here
+    CaptureEngine::Statistics captureStats = m_networkMonitor->getCaptureStatistics();
+    NetworkMonitor::QueueStatistics queueStats = m_networkMonitor->getQueueStatistics();
+    const QString filtered = captureStats.filteredAvailable ? QString::number(captureStats.filteredPerSecond)
+                                                            : QString("n/a");
+    QString text = QString("Capture: %1 pkt/s, %2 filtered/s, %3 dropped/s | Queue: %4/%5, %6 overflowed")
+                       .arg(captureStats.packetsPerSecond)
+                       .arg(filtered)
+                       .arg(captureStats.dropsPerSecond + captureStats.interfaceDropsPerSecond)
+                       .arg(queueStats.depth)
+                       .arg(queueStats.capacity)
+                       .arg(queueStats.overflows);
+    
+    // Traffic figures are estimates while sampling, which must not pass for exact counts
+    const NetworkMonitor::SamplingConfig sampling = m_networkMonitor->samplingConfig();
+    if (sampling.mode != PacketSampler::Off) {
+        text += QString(" | Sampling: %1, totals are estimates").arg(sampling.description());
+    }
+    m_captureStatsLabel->setText(text);
 }
 
 void MainWindow::updateDownloadSummary(qint64 total, qint64 rate)
@@ -734,6 +898,150 @@ void MainWindow::onAboutAction()
         "© 2025 NetWire");
 }
 
+void MainWindow::onCaptureFilterAction()
+{
+    // Applied to the running capture straight away; an empty filter captures everything
+    QString filter = m_networkMonitor->captureFilter();
+    const QString defaultFilter = CaptureEngine::defaultFilter(m_networkMonitor->tunnelDecapsulation());
+    while (true) {
+        bool ok = false;
+        filter = QInputDialog::getText(this, "Capture Filter",
+                                       QString("BPF filter expression (default: %1):").arg(defaultFilter),
+                                       QLineEdit::Normal, filter, &ok).trimmed();
+        if (!ok) {
+            return;
+        }
+        QString error;
+        if (m_networkMonitor->setCaptureFilter(filter, &error)) {
+            break;
+        }
+        QMessageBox::warning(this, "Capture Filter", QString("The filter was not applied.\n\n%1").arg(error));
+    }
+    saveSettings();
+}
+
+void MainWindow::onPacketSamplingAction()
+{
+    // Applied to the running capture straight away
+    NetworkMonitor::SamplingConfig config = m_networkMonitor->samplingConfig();
+    const QStringList modes = {"Off (analyse every packet)", "1 in N packets", "1 in N flows (keeps whole connections)"};
+    bool ok = false;
+    const QString mode = QInputDialog::getItem(this, "Packet Sampling", "Sampling mode:", modes,
+                                               int(config.mode), false, &ok);
+    if (!ok) {
+        return;
+    }
+    config.mode = PacketSampler::Mode(modes.indexOf(mode));
+    if (config.mode != PacketSampler::Off) {
+        config.rate = QInputDialog::getInt(this, "Packet Sampling", "Analyse one in N (counters are scaled by N):",
+                                           qMax(config.rate, 2), 2, PacketSampler::MaxRate, 1, &ok);
+        if (!ok) {
+            return;
+        }
+    }
+    m_networkMonitor->setSamplingConfig(config);
+    saveSettings();
+    updateTrafficSummary();
+}
+
+void MainWindow::onHttpLatencyAction()
+{
+    // A snapshot of the per-host table; latency runs from the request to the start of the response
+    const QMap<QString, HttpHostStatistics> hosts = m_networkMonitor->getHttpHostStatistics();
+    if (hosts.isEmpty()) {
+        QMessageBox::information(this, "HTTP Latency",
+                                 "No HTTP transactions yet. They are timed when stream inspection is on.");
+        return;
+    }
+    
+    QDialog dialog(this);
+    dialog.setWindowTitle("HTTP Latency");
+    dialog.resize(700, 400);
+    QTableWidget *table = new QTableWidget(0, 6, &dialog);
+    table->setHorizontalHeaderLabels({"Host", "Transactions", "4xx", "5xx", "Median (ms)", "99th Percentile (ms)"});
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+    for (auto it = hosts.constBegin(); it != hosts.constEnd(); ++it) {
+        const HttpHostStatistics &stats = it.value();
+        const int row = table->rowCount();
+        table->insertRow(row);
+        table->setItem(row, 0, new QTableWidgetItem(it.key()));
+        // Numbers as data so that the columns sort numerically
+        const QVariant values[] = {stats.transactions, stats.clientErrors, stats.serverErrors,
+                                   stats.latency.percentileUs(0.5) / 1000.0,
+                                   stats.latency.percentileUs(0.99) / 1000.0};
+        for (int column = 1; column < 6; ++column) {
+            QTableWidgetItem *item = new QTableWidgetItem();
+            item->setData(Qt::DisplayRole, values[column - 1]);
+            table->setItem(row, column, item);
+        }
+    }
+    table->setSortingEnabled(true);
+    table->sortByColumn(1, Qt::DescendingOrder);
+    
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dialog);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    QVBoxLayout *layout = new QVBoxLayout(&dialog);
+    layout->addWidget(table);
+    layout->addWidget(buttons);
+    dialog.exec();
+}
+
+void MainWindow::onRecordCapturesAction(bool checked)
+{
+    CaptureRecorder::Config config = m_networkMonitor->recordingConfig();
+    config.enabled = checked;
+    m_networkMonitor->setRecordingConfig(config);
+    saveSettings();
+    
+    // The recorder is set up when the capture starts, so a running live capture is restarted
+    if (m_isMonitoring && !m_networkMonitor->isReplaying()) {
+        setMonitoring(true);
+    }
+    if (!checked) {
+        ui->statusbar->showMessage("Recording stopped");
+    } else if (m_networkMonitor->getRecordingStatistics().recording) {
+        ui->statusbar->showMessage(QString("Recording to %1").arg(QDir::toNativeSeparators(config.directory)));
+    } else {
+        ui->statusbar->showMessage(QString("Recording starts with the next live capture, to %1")
+                                       .arg(QDir::toNativeSeparators(config.directory)));
+    }
+}
+
+void MainWindow::onReplayCaptureAction()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, "Replay Capture File", QString(),
+                                                    "Capture files (*.pcap *.pcapng *.cap);;All files (*)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+    bool ok = false;
+    double speed = QInputDialog::getDouble(this, "Replay Capture File",
+                                           "Speed as a multiple of the recorded rate (0 = as fast as possible):",
+                                           1.0, 0.0, 1000.0, 1, &ok);
+    if (!ok) {
+        return;
+    }
+    
+    // The replay takes over the analysis, so live monitoring stops first
+    setMonitoring(false);
+    if (!m_networkMonitor->startReplay(fileName, speed)) {
+        QMessageBox::warning(this, "Replay Capture File", QString("Could not replay %1.").arg(fileName));
+        return;
+    }
+    ui->statusbar->showMessage(QString("Replaying %1").arg(QFileInfo(fileName).fileName()));
+}
+
+void MainWindow::onReplayFinished()
+{
+    NetworkMonitor::ReplayStatistics stats = m_networkMonitor->getReplayStatistics();
+    ui->statusbar->showMessage(QString("Replay of %1 finished: %2 packets in %3 s, %4 packets/s")
+                               .arg(QFileInfo(stats.fileName).fileName())
+                               .arg(stats.packets)
+                               .arg(stats.elapsedMs / 1000.0, 0, 'f', 1)
+                               .arg(qRound64(stats.packetsPerSecond)));
+}
+
 void MainWindow::closeEvent(QCloseEvent *event)
 {
     if (m_minimizeToTray && m_trayIcon->isVisible()) {
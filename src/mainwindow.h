@@ -56,7 +56,7 @@ private slots:
     
     // Network monitoring
     void onConnectionEstablished(const NetworkMonitor::ConnectionInfo &connection);
-    void onStatsUpdated(quint64 download, quint64 upload);
+    void onStatsUpdated(quint64 download, quint64 upload, quint64 smoothedDownload, quint64 smoothedUpload);
     
     // Traffic summary updates
     void updateTrafficSummary();
@@ -81,6 +81,12 @@ private slots:
     // Menu actions
     void onExitAction();
     void onAboutAction();
+    void onCaptureFilterAction();
+    void onPacketSamplingAction();
+    void onHttpLatencyAction();
+    void onRecordCapturesAction(bool checked);
+    void onReplayCaptureAction();
+    void onReplayFinished();
     
     // IP2Location download progress slots
     void onIP2LocationDownloadStarted();
@@ -176,6 +182,7 @@ private:
     // Settings
     QSettings *m_settings;
     bool m_isMonitoring;
+    QStringList m_captureInterfaces; // Interfaces to capture on; empty means the first available
     bool m_minimizeToTray;
     
     // UI state
@@ -185,6 +192,9 @@ private:
     // IP2Location progress dialog
     QProgressDialog *m_downloadProgressDialog;
     QLabel *m_ip2LocationStatusLabel;
+    
+    // Capture engine throughput (packets/s and drops/s)
+    QLabel *m_captureStatsLabel;
 };
 
 #endif // MAINWINDOW_H
@@ -1,13 +1,13 @@
 #include "networkmonitor.h"
 #include <QDebug>
 #include <QNetworkInterface>
+#include <QNetworkInformation>
 #include <QThread>
 #include <QDateTime>
 #include <QFileInfo>
 #include <QDir>
 #include <QApplication>
 #include <QProcess>
-#include <QRegularExpression>
 #include <QStandardPaths>
 #include <QFileIconProvider>
 #include <QProcess>
@@ -25,6 +25,10 @@
 #include <QUrl>
 #include <QUrlQuery>
 
+#ifdef HAVE_PCAP
+#include <pcap.h>
+#endif
+
 // Platform-specific includes
 #ifdef Q_OS_WIN
 #include <winsock2.h>
@@ -51,54 +55,113 @@
 #include <libproc.h>
 #endif
 
-// Structure to store IP header information
-#pragma pack(push, 1)
-typedef struct ip_header {
-    unsigned char  ver_ihl;        // Version (4 bits) + Internet header length (4 bits)
-    unsigned char  tos;            // Type of service
-    unsigned short tlen;           // Total length
-    unsigned short identification; // Identification
-    unsigned short flags_fo;       // Flags (3 bits) + Fragment offset (13 bits)
-    unsigned char  ttl;            // Time to live
-    unsigned char  proto;          // Protocol
-    unsigned short crc;            // Header checksum
-    unsigned int   saddr;          // Source address
-    unsigned int   daddr;          // Destination address
-} ip_header;
-#pragma pack(pop)
-
-// Structure to store TCP header
-#pragma pack(push, 1)
-typedef struct tcp_header {
-    unsigned short sport;  // Source port
-    unsigned short dport;  // Destination port
-    unsigned int   seq;    // Sequence number
-    unsigned int   ack;    // Acknowledgment number
-    unsigned char  len_res;// Data offset + Reserved
-    unsigned char  flags;  // Control bits
-    unsigned short win;    // Window
-    unsigned short sum;    // Checksum
-    unsigned short urp;    // Urgent pointer
-} tcp_header;
-#pragma pack(pop)
-
-// Structure to store UDP header
-#pragma pack(push, 1)
-typedef struct udp_header {
-    unsigned short sport;  // Source port
-    unsigned short dport;  // Destination port
-    unsigned short len;    // Length
-    unsigned short crc;    // Checksum
-} udp_header;
-#pragma pack(pop)
+// Ring between a capture thread and a processing worker; roughly one second of
+// traffic on a busy gigabit link
+static const size_t PacketQueueCapacity = 65536;
+
+// Interface indices travel in PacketDescriptor::interfaceIndex
+static const int MaxCaptureInterfaces = FlowShard::MaxInterfaces;
+
+// Packet processing threads; the flow table limit is split between them
+static const int MaxProcessingWorkers = 16;
+static const size_t MaxTrackedFlows = 1 << 20;
+
+// Address changes are normally picked up from QNetworkInformation; this catches the rest
+static const int LocalAddressRefreshMs = 30000;
+
+// Traffic pattern analysis period, in wall time live and in packet time during a replay
+static const int AnalysisIntervalMs = 10000;
+
+// Shortest gap between two networkDataUpdated signals
+static const int DataUpdateIntervalMs = 1000;
+
+// DNS messages taken from a capture worker's queue at a time
+static const size_t DnsBatchSize = 64;
+
+// A TLS fingerprint whose flow is no longer in the flow table, e.g. because it never made it
+// past a full table, is dropped this long after its ClientHello; the table is swept this often
+static const quint64 TlsFingerprintTimeoutUs = 120ull * 1000000;
+static const quint64 TlsFingerprintSweepUs = 10ull * 1000000;
+
+// Hosts with HTTP latency kept apart; the rest are summed under OtherHttpHosts
+static const int MaxHttpHosts = 4096;
+static const char *const OtherHttpHosts = "(other hosts)";
+
+#ifdef Q_OS_LINUX
+// TCP states the kernel includes in a socket dump. TIME_WAIT and pending connection requests
+// belong to no process and can outnumber the real sockets many times over on a busy server.
+static const quint32 ListedTcpStates = SocketDiag::AllStates &
+                                       ~(SocketDiag::stateBit(SocketDiag::TimeWait) |
+                                         SocketDiag::stateBit(SocketDiag::NewSynReceived));
+
+// Sockets whose owner is unknown trigger a scan of /proc/*/fd at most this often; the scan
+// reads a link per open file on the system
+static const qint64 SocketOwnerRescanMs = 2000;
+
+// A dumped socket address as the connection list shows it; the kernel gives wildcards as zero
+static QString socketAddressString(const IpAddress &address, quint8 ipVersion)
+{
+    if (address.isNull()) {
+        return ipVersion == 4 ? QString("0.0.0.0") : QString("::");
+    }
+    return address.toString();
+}
+#endif
+
+// "VXLAN 42 10.0.0.1 -> 10.0.0.2" for a flow seen inside a tunnel, empty for any other. The
+// addresses are left out if the endpoint table was full when the tunnel was first seen.
+static QString tunnelDescription(const TunnelInfo &tunnel, const TunnelEndpointTable &endpointTable)
+{
+    if (tunnel.type == TunnelInfo::None) {
+        return QString();
+    }
+    QString description = QString::fromLatin1(TunnelInfo::name(tunnel.type));
+    if (tunnel.id != 0) {
+        description += QString(" %1").arg(tunnel.id);
+    }
+    TunnelEndpoints endpoints;
+    if (endpointTable.lookup(tunnel.endpoints, &endpoints)) {
+        description += QString(" %1 -> %2").arg(endpoints.outerSrc.toString(), endpoints.outerDst.toString());
+    }
+    if (tunnel.depth > 1) {
+        description += QString(" (%1 layers)").arg(tunnel.depth);
+    }
+    return description;
+}
+
+// The capture-thread side of an InspectionConfig; stream reassembly is set by its depth
+static quint8 workerInspection(const NetworkMonitor::InspectionConfig &config)
+{
+    return (config.dns ? CaptureWorker::InspectDns : 0) | (config.tls ? CaptureWorker::InspectTls : 0) |
+           (config.protocol ? CaptureWorker::InspectProtocol : 0);
+}
 
 NetworkMonitor::NetworkMonitor(QObject *parent)
     : QObject(parent)
-#ifdef HAVE_PCAP
-    , m_pcapHandle(nullptr)
-#endif
+    , m_captureFanout(false)
     , m_isCapturing(false)
-    , m_captureWatcher(new QFutureWatcher<void>(this))
+    , m_streamDepth(TcpReassembler::DefaultDepth)
+    , m_decapsulateTunnels(false)
+    , m_aggregating(false)
+    , m_runningShards(0)
+    , m_mergeRequested(false)
+    , m_replaying(false)
+    , m_replayGeneration(0)
+    , m_nextReplayAnalysisUs(0)
+    , m_flowTable(MaxTrackedFlows)
+    , m_socketTable(MaxTrackedFlows)
+    , m_socketGeneration(1)
+#ifdef Q_OS_LINUX
+    , m_socketOwnersScanning(false)
+    , m_socketOwnersScanMs(0)
+    , m_socketDiagFailed(false)
+#endif
+    , m_flowTableOverflows(0)
+    , m_duplicatePackets(0)
+    , m_tunnelledPackets(0)
+    , m_tlsFingerprints(MaxTrackedFlows)
+    , m_tlsFingerprintOverflows(0)
+    , m_nextTlsSweepUs(0)
     , m_networkManager(new QNetworkAccessManager(this))
     , m_ipLookup(new IPLookup())
     , m_ip2Location(new IP2Location(this))
@@ -116,14 +179,25 @@ NetworkMonitor::NetworkMonitor(QObject *parent)
     m_updateTimer->setInterval(3000); // Update every 3 seconds (reduced from 1 second)
     connect(m_updateTimer, &QTimer::timeout, this, &NetworkMonitor::updateActiveConnections);
     
+    // Folds what the processing workers counted into the statistics the UI reads
+    m_mergeTimer = new QTimer(this);
+    m_mergeTimer->setInterval(FlowShard::PublishIntervalMs);
+    connect(m_mergeTimer, &QTimer::timeout, this, [this]() { mergeShards(); });
+    
     m_analysisTimer = new QTimer(this);
-    m_analysisTimer->setInterval(10000); // Analyze every 10 seconds (reduced frequency)
+    m_analysisTimer->setInterval(AnalysisIntervalMs);
     connect(m_analysisTimer, &QTimer::timeout, this, &NetworkMonitor::analyzeTrafficPatterns);
     
-    // Connect capture watcher
-    connect(m_captureWatcher, &QFutureWatcher<void>::finished, this, [this]() {
-        qDebug() << "Packet capture finished";
-    });
+    // Packet direction is classified against this host's addresses, which are cached and
+    // only re-read when the network changes, never per packet
+    refreshLocalAddresses();
+    m_addressTimer = new QTimer(this);
+    m_addressTimer->setInterval(LocalAddressRefreshMs);
+    connect(m_addressTimer, &QTimer::timeout, this, &NetworkMonitor::refreshLocalAddresses);
+    if (QNetworkInformation::loadBackendByFeatures(QNetworkInformation::Feature::Reachability)) {
+        connect(QNetworkInformation::instance(), &QNetworkInformation::reachabilityChanged,
+                this, &NetworkMonitor::refreshLocalAddresses);
+    }
     
     // Initialize connection tracking
     m_activeConnections.clear();
@@ -135,6 +209,7 @@ NetworkMonitor::NetworkMonitor(QObject *parent)
     // Start timers
     m_updateTimer->start();
     m_analysisTimer->start();
+    m_addressTimer->start();
     
     // Connect IP2Location signals and forward them
     connect(m_ip2Location, &IP2Location::databaseDownloadStarted, this, [this]() {
@@ -173,19 +248,18 @@ NetworkMonitor::~NetworkMonitor()
     if (m_analysisTimer) {
         m_analysisTimer->stop();
     }
-    
-    // Stop capture and wait for background thread to finish
-    stopCapture();
-    
-    // Wait for the background thread to finish if it's running
-    if (m_captureFuture.isRunning()) {
-        m_captureFuture.waitForFinished();
+    if (m_addressTimer) {
+        m_addressTimer->stop();
     }
     
-#ifdef HAVE_PCAP
-    if (m_pcapHandle) {
-        pcap_close(m_pcapHandle);
-    }
+    // Stop capture and wait for the background threads to finish
+    stopCapture();
+    qDeleteAll(m_captureWorkers);
+    m_captureWorkers.clear();
+    qDeleteAll(m_flowShards);
+    m_flowShards.clear();
+#ifdef Q_OS_LINUX
+    m_socketOwnersScan.waitForFinished();
 #endif
     
     // Clear caches to free memory
@@ -264,74 +338,563 @@ QStringList NetworkMonitor::getAvailableInterfaces() const
 
 bool NetworkMonitor::startCapture(const QString &interfaceName)
 {
-    if (m_isCapturing) {
-        stopCapture();
-    }
+    return startCapture(QStringList() << interfaceName);
+}
+
+bool NetworkMonitor::startCapture(const QStringList &interfaceNames)
+{
+    // Also reaps threads left behind by a capture that ended on an error
+    stopCapture();
     
-#ifdef HAVE_PCAP
-    char errbuf[PCAP_ERRBUF_SIZE];
+    // Live numbers should not start from what a replayed file left behind
+    bool replayed;
+    {
+        QMutexLocker locker(&m_mutex);
+        replayed = !m_replayStats.fileName.isEmpty();
+    }
+    if (replayed) {
+        resetAnalysis();
+    }
     
-    // Convert QString to char* for pcap
-    QByteArray interfaceNameBytes = interfaceName.toUtf8();
-    const char *device = interfaceNameBytes.constData();
+    return startSources(interfaceNames, m_captureConfig);
+}
+
+bool NetworkMonitor::startReplay(const QString &fileName, double speed)
+{
+    stopCapture();
     
-    // Open the network interface for packet capture
-    m_pcapHandle = pcap_open_live(device, BUFSIZ, 1, 1000, errbuf);
-    if (!m_pcapHandle) {
-        qWarning() << "Couldn't open device" << interfaceName << ":" << errbuf;
+    // Every replay starts from a clean slate so that runs over the same file are comparable
+    resetAnalysis();
+    {
+        QMutexLocker locker(&m_mutex);
+        m_replayStats.fileName = fileName;
+        m_replayStats.speed = speed;
+        m_replayStats.running = true;
+    }
+    
+    CaptureEngine::Config config = m_captureConfig;
+    config.backend = CaptureEngine::BackendPcapFile;
+    config.interfaceName = fileName;
+    config.replaySpeed = speed > 0 ? speed : 0;
+    
+    m_replayGeneration++;
+    m_replaying.store(true, std::memory_order_relaxed);
+    m_analysisTimer->stop();
+    m_replayTimer.start();
+    if (!startSources(QStringList() << fileName, config)) {
+        m_replaying.store(false, std::memory_order_relaxed);
+        m_analysisTimer->start();
+        QMutexLocker locker(&m_mutex);
+        m_replayStats.running = false;
         return false;
     }
+    return true;
+}
+
+bool NetworkMonitor::isReplaying() const
+{
+    return m_replaying.load(std::memory_order_relaxed);
+}
+
+NetworkMonitor::ReplayStatistics NetworkMonitor::getReplayStatistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    ReplayStatistics stats = m_replayStats;
+    if (stats.running) {
+        stats.elapsedMs = m_replayTimer.elapsed();
+    }
+    if (stats.elapsedMs > 0) {
+        stats.packetsPerSecond = double(stats.packets) * 1000.0 / double(stats.elapsedMs);
+    }
+    return stats;
+}
+
+// Runs on the GUI thread once the aggregation thread has drained the end of the file
+void NetworkMonitor::finishReplay(quint32 generation)
+{
+    if (generation != m_replayGeneration || !m_replaying.load(std::memory_order_relaxed)) {
+        return;
+    }
+    stopCapture();
+    
+    // One last pass so the analysis covers the tail of the file
+    analyzeTrafficPatterns();
+    
+    const ReplayStatistics stats = getReplayStatistics();
+    qDebug() << "Replay of" << stats.fileName << "finished:" << stats.packets << "packets in"
+             << stats.elapsedMs << "ms," << qRound64(stats.packetsPerSecond) << "packets/s";
+    emit replayFinished();
+}
+
+void NetworkMonitor::resetAnalysis()
+{
+    QMutexLocker locker(&m_mutex);
+    m_flowTable.clear();
+    m_processStats.clear();
+    m_interfaceStats.clear();
+    m_flowTableOverflows = 0;
+    m_duplicatePackets = 0;
+    m_tunnelledPackets = 0;
+    m_tcpStats = TcpStatistics();
+    m_processTcpStats.clear();
+    m_passiveDns.clear();
+    m_rates.clear();
+    m_tlsFingerprints.clear();
+    m_tlsFingerprintOverflows = 0;
+    m_nextTlsSweepUs = 0;
+    m_httpHosts.clear();
+    m_nextReplayAnalysisUs = 0;
+    m_replayStats = ReplayStatistics();
+    
+    // The processing threads are stopped whenever the analysis is reset
+    for (FlowShard *shard : m_flowShards) {
+        shard->clear();
+    }
+}
+
+bool NetworkMonitor::startSources(const QStringList &sources, const CaptureEngine::Config &config)
+{
+    QStringList names = sources;
+    names.removeDuplicates();
+    if (names.size() > MaxCaptureInterfaces) {
+        qWarning() << "Capturing on the first" << MaxCaptureInterfaces << "of" << names.size() << "interfaces";
+        names = names.mid(0, MaxCaptureInterfaces);
+    }
+    
+    // Flow state lives in the shards, so they are only rebuilt when the worker count changes
+    const int shardCount = qBound(1, m_processingConfig.workers, MaxProcessingWorkers);
+    if (m_flowShards.size() != shardCount) {
+        qDeleteAll(m_captureWorkers);
+        m_captureWorkers.clear();
+        qDeleteAll(m_flowShards);
+        m_flowShards.clear();
+        for (int i = 0; i < shardCount; ++i) {
+            m_flowShards.append(new FlowShard(i, MaxTrackedFlows / size_t(shardCount)));
+        }
+        m_processingPool.setMaxThreadCount(shardCount);
+        QMutexLocker locker(&m_mutex);
+        m_flowTable.clear();
+        publishAttribution();
+    }
     
-    // Set non-blocking mode
-    if (pcap_setnonblock(m_pcapHandle, 1, errbuf) == -1) {
-        qWarning() << "Failed to set non-blocking mode:" << errbuf;
-        pcap_close(m_pcapHandle);
-        m_pcapHandle = nullptr;
+    // With kernel fanout every interface gets one socket per shard and the kernel picks the
+    // socket by flow hash; otherwise each capture thread hashes into one ring per shard
+    bool fanout = false;
+#ifdef Q_OS_LINUX
+    fanout = m_processingConfig.kernelFanout && shardCount > 1 && config.backend == CaptureEngine::BackendPacketMmap;
+#endif
+    const int socketsPerInterface = fanout ? shardCount : 1;
+    QList<RingDoorbell *> doorbells;
+    for (FlowShard *shard : m_flowShards) {
+        doorbells.append(shard->doorbell());
+    }
+    
+    // Workers are reused across captures so an unchanged backend keeps its engine
+    if (fanout != m_captureFanout) {
+        qDeleteAll(m_captureWorkers);
+        m_captureWorkers.clear();
+        m_captureFanout = fanout;
+    }
+    while (m_captureWorkers.size() < names.size() * socketsPerInterface) {
+        const int position = m_captureWorkers.size();
+        m_captureWorkers.append(new CaptureWorker(quint8(position / socketsPerInterface), PacketQueueCapacity,
+                                                  fanout ? QList<RingDoorbell *>() << doorbells.at(position % shardCount)
+                                                         : doorbells));
+    }
+    while (m_captureWorkers.size() > names.size() * socketsPerInterface) {
+        delete m_captureWorkers.takeLast();
+    }
+    
+    // Replays are not recorded again; recording may need more of each packet than analysis
+    const bool recording = m_recordingConfig.enabled && config.backend != CaptureEngine::BackendPcapFile;
+    
+    // An interface that fails to open is skipped; the others still capture
+    QList<CaptureWorker *> opened;
+    for (int i = 0; i < m_captureWorkers.size(); ++i) {
+        CaptureWorker *worker = m_captureWorkers.at(i);
+        const int interfaceIndex = i / socketsPerInterface;
+        CaptureEngine::Config sourceConfig = config;
+        sourceConfig.interfaceName = names.at(interfaceIndex);
+        sourceConfig.recordLength = recording ? m_recordingConfig.snapLength : 0;
+        sourceConfig.fanoutGroup = fanout ? int((QCoreApplication::applicationPid() + interfaceIndex) & 0xffff) : -1;
+        worker->setRecorder(nullptr, 0);
+        worker->setSampling(m_samplingConfig.mode, m_samplingConfig.rate);
+        worker->setInspection(workerInspection(m_inspectionConfig));
+        worker->setStreamDepth(activeStreamDepth());
+        worker->setTunnelDecapsulation(m_decapsulateTunnels);
+        worker->setTunnelEndpoints(&m_tunnelEndpoints);
+        if (worker->open(sourceConfig)) {
+            opened.append(worker);
+        } else {
+            qWarning() << "Couldn't open device" << names.at(interfaceIndex) << ":" << worker->errorString();
+        }
+    }
+    if (opened.isEmpty()) {
         return false;
     }
     
-    // Start capturing in a separate thread
-    m_isCapturing = true;
-    m_captureFuture = QtConcurrent::run([this]() {
-        struct pcap_pkthdr header;
-        const u_char *packet;
-        
-        while (m_isCapturing) {
-            // Process available packets
-            while ((packet = pcap_next(m_pcapHandle, &header)) != nullptr) {
-                processPacket(&header, packet);
+    // A fanout socket feeds the one shard its kernel group member stands for
+    for (FlowShard *shard : m_flowShards) {
+        QList<SpscRing<PacketDescriptor> *> inputs;
+        for (CaptureWorker *worker : opened) {
+            if (!fanout) {
+                inputs.append(worker->queue(shard->index()));
+            } else if (m_captureWorkers.indexOf(worker) % shardCount == shard->index()) {
+                inputs.append(worker->queue(0));
             }
-            
-            // Small delay to prevent high CPU usage
-            QThread::msleep(10);
         }
-    });
+        shard->setInputs(inputs);
+    }
     
-    // Connect the future to the watcher for monitoring
-    m_captureWatcher->setFuture(m_captureFuture);
+    {
+        QMutexLocker locker(&m_mutex);
+        m_interfaceNames = names;
+    }
+    
+    // The capture still runs if the recording can't be started
+    if (recording) {
+        // One pcapng interface per interface; its fanout sockets, opened one after the other,
+        // each record to a spool of their own, so a worker's spool is its place in opened
+        QList<CaptureRecorder::Source> recordSources;
+        for (int i = 0; i < opened.size(); ++i) {
+            const CaptureWorker *worker = opened.at(i);
+            if (i > 0 && opened.at(i - 1)->interfaceName() == worker->interfaceName()) {
+                ++recordSources.last().captureThreads;
+            } else {
+                recordSources.append(CaptureRecorder::Source(worker->interfaceName(), worker->dataLinkType()));
+            }
+        }
+        if (m_recorder.start(m_recordingConfig, recordSources)) {
+            for (int i = 0; i < opened.size(); ++i) {
+                opened.at(i)->setRecorder(&m_recorder, i);
+            }
+        } else {
+            qWarning() << "Couldn't start recording:" << m_recorder.errorString();
+        }
+    }
+    
+    // Each processing thread drains its shard's rings; none of them takes a lock per packet
+    m_aggregating.store(true, std::memory_order_relaxed);
+    m_runningShards.store(shardCount, std::memory_order_relaxed);
+    for (FlowShard *shard : m_flowShards) {
+        m_processingFutures.append(QtConcurrent::run(&m_processingPool, [this, shard, opened]() {
+            runShard(shard, opened);
+        }));
+    }
+    m_mergeTimer->start();
+    
+    // One capture thread per interface, or per fanout socket
+    m_isCapturing = true;
+    for (CaptureWorker *worker : opened) {
+        worker->start();
+        qDebug() << "Capturing on" << worker->interfaceName() << "with"
+                 << CaptureEngine::backendName(config.backend);
+    }
+    qDebug() << "Processing packets on" << shardCount << (fanout ? "threads with kernel fanout" : "threads");
     
     return true;
-#else
-    qWarning() << "libpcap not available - cannot start capture";
-    return false;
-#endif
 }
 
 void NetworkMonitor::stopCapture()
 {
-#ifdef HAVE_PCAP
     m_isCapturing = false;
-    if (m_pcapHandle) {
-        pcap_breakloop(m_pcapHandle);
+    
+    // Wait for the capture threads first so nothing is pushed after processing drains
+    for (CaptureWorker *worker : m_captureWorkers) {
+        worker->stop();
     }
-#endif
     
-    // Wait for the background thread to finish if it's running
-    if (m_captureFuture.isRunning()) {
-        m_captureFuture.waitForFinished();
+    // The capture threads are gone, so the processing threads can drain what is left and exit
+    m_aggregating.store(false, std::memory_order_relaxed);
+    for (FlowShard *shard : m_flowShards) {
+        shard->doorbell()->wakeUp();
+    }
+    for (QFuture<void> &future : m_processingFutures) {
+        future.waitForFinished();
+    }
+    m_processingFutures.clear();
+    m_mergeTimer->stop();
+    mergeShards(true);
+    
+    for (CaptureWorker *worker : m_captureWorkers) {
+        worker->close();
+    }
+    
+    // Nothing is spooled any more; write out the rest and close the file
+    m_recorder.stop();
+    
+    if (m_replaying.exchange(false, std::memory_order_relaxed)) {
+        QMutexLocker locker(&m_mutex);
+        m_replayStats.running = false;
+        m_replayStats.elapsedMs = m_replayTimer.elapsed();
+        locker.unlock();
+        m_analysisTimer->start();
     }
 }
 
+QStringList NetworkMonitor::capturingInterfaces() const
+{
+    QStringList interfaces;
+    for (const CaptureWorker *worker : m_captureWorkers) {
+        // Fanout sockets of one interface are listed once
+        if (worker->isRunning() && !interfaces.contains(worker->interfaceName())) {
+            interfaces.append(worker->interfaceName());
+        }
+    }
+    return interfaces;
+}
+
+void NetworkMonitor::setCaptureConfig(const CaptureEngine::Config &config)
+{
+    // The payload length is owned by setPayloadCaptureLength()
+    const int payloadLength = m_captureConfig.payloadLength;
+    m_captureConfig = config;
+    m_captureConfig.payloadLength = payloadLength;
+}
+
+void NetworkMonitor::setPayloadCaptureLength(const QString &feature, int bytes)
+{
+    requestPayload(feature, bytes);
+    applyPayloadCaptureLength();
+}
+
+void NetworkMonitor::requestPayload(const QString &feature, int bytes)
+{
+    if (bytes > 0) {
+        m_payloadCaptureLengths.insert(feature, bytes);
+    } else {
+        m_payloadCaptureLengths.remove(feature);
+    }
+}
+
+void NetworkMonitor::applyPayloadCaptureLength()
+{
+    int payloadLength = 0;
+    for (auto it = m_payloadCaptureLengths.constBegin(); it != m_payloadCaptureLengths.constEnd(); ++it) {
+        payloadLength = qMax(payloadLength, it.value());
+    }
+    if (payloadLength == m_captureConfig.payloadLength) {
+        return;
+    }
+    m_captureConfig.payloadLength = payloadLength;
+    
+    // The snap length is fixed when a handle is opened, so reopen to apply it
+    if (m_isCapturing && !isReplaying() && m_captureConfig.headersOnly) {
+        const QStringList interfaces = capturingInterfaces();
+        qDebug() << "Capturing" << payloadLength << "payload bytes per packet, restarting capture";
+        startCapture(interfaces);
+    }
+}
+
+CaptureEngine::Config NetworkMonitor::captureConfig() const
+{
+    return m_captureConfig;
+}
+
+bool NetworkMonitor::setCaptureFilter(const QString &expression, QString *errorString)
+{
+    // Swap the program under the running capture; all interfaces keep the same filter
+    for (int i = 0; i < m_captureWorkers.size(); ++i) {
+        CaptureWorker *worker = m_captureWorkers[i];
+        if (!worker->isRunning() || worker->setFilter(expression)) {
+            continue;
+        }
+        const QString error = QString("%1: %2").arg(worker->interfaceName(), worker->errorString());
+        qWarning() << "Failed to set capture filter:" << error;
+        if (errorString) {
+            *errorString = error;
+        }
+        for (int j = 0; j < i; ++j) {
+            if (m_captureWorkers[j]->isRunning()) {
+                m_captureWorkers[j]->setFilter(m_captureConfig.filter);
+            }
+        }
+        return false;
+    }
+    
+    m_captureConfig.filter = expression;
+    return true;
+}
+
+QString NetworkMonitor::captureFilter() const
+{
+    return m_captureConfig.filter;
+}
+
+void NetworkMonitor::setRecordingConfig(const CaptureRecorder::Config &config)
+{
+    m_recordingConfig = config;
+}
+
+CaptureRecorder::Config NetworkMonitor::recordingConfig() const
+{
+    return m_recordingConfig;
+}
+
+CaptureRecorder::Statistics NetworkMonitor::getRecordingStatistics() const
+{
+    return m_recorder.statistics();
+}
+
+void NetworkMonitor::setProcessingConfig(const ProcessingConfig &config)
+{
+    m_processingConfig = config;
+}
+
+NetworkMonitor::ProcessingConfig NetworkMonitor::processingConfig() const
+{
+    return m_processingConfig;
+}
+
+void NetworkMonitor::setSamplingConfig(const SamplingConfig &config)
+{
+    // Off keeps its rate for the next time sampling is switched on
+    m_samplingConfig = config;
+    m_samplingConfig.rate = qBound(1, config.rate, PacketSampler::MaxRate);
+    if (m_samplingConfig.rate == 1) {
+        m_samplingConfig.mode = PacketSampler::Off;
+    }
+    
+    // The capture threads pick the new setting up with their next frame
+    for (CaptureWorker *worker : m_captureWorkers) {
+        worker->setSampling(m_samplingConfig.mode, m_samplingConfig.rate);
+    }
+    qDebug() << "Packet sampling:" << m_samplingConfig.description();
+}
+
+NetworkMonitor::SamplingConfig NetworkMonitor::samplingConfig() const
+{
+    return m_samplingConfig;
+}
+
+void NetworkMonitor::setInspectionConfig(const InspectionConfig &config)
+{
+    m_inspectionConfig = config;
+    
+    // The capture threads pick the new setting up with their next frame
+    for (CaptureWorker *worker : m_captureWorkers) {
+        worker->setInspection(workerInspection(config));
+        worker->setStreamDepth(activeStreamDepth());
+    }
+    
+    // Passive DNS reads the answers, so it needs a DNS message's worth of payload
+    requestPayload("dns", config.dns ? DnsParser::CaptureLength : 0);
+    // ClientHellos that span segments are reassembled, which needs whole segments
+    requestPayload("tls", config.tls ? TlsParser::CaptureLength : 0);
+    // Application protocols are recognised from the first payload bytes
+    requestPayload("protocol", config.protocol ? ProtocolClassifier::CaptureLength : 0);
+    // Reassembled streams would have a hole wherever a segment was cut short
+    requestPayload("streams", activeStreamDepth() > 0 ? TcpReassembler::CaptureLength : 0);
+    applyPayloadCaptureLength();
+}
+
+NetworkMonitor::InspectionConfig NetworkMonitor::inspectionConfig() const
+{
+    return m_inspectionConfig;
+}
+
+quint32 NetworkMonitor::activeStreamDepth() const
+{
+    return m_inspectionConfig.streams ? m_streamDepth : 0;
+}
+
+void NetworkMonitor::setStreamReassemblyDepth(quint32 bytes)
+{
+    m_streamDepth = bytes;
+    for (CaptureWorker *worker : m_captureWorkers) {
+        worker->setStreamDepth(activeStreamDepth());
+    }
+    setPayloadCaptureLength("streams", activeStreamDepth() > 0 ? TcpReassembler::CaptureLength : 0);
+}
+
+quint32 NetworkMonitor::streamReassemblyDepth() const
+{
+    return m_streamDepth;
+}
+
+void NetworkMonitor::setTunnelDecapsulation(bool enabled)
+{
+    m_decapsulateTunnels = enabled;
+    for (CaptureWorker *worker : m_captureWorkers) {
+        worker->setTunnelDecapsulation(enabled);
+    }
+    // Headers-only captures keep the tunnel headers and the inner headers behind them
+    setPayloadCaptureLength("tunnels", enabled ? int(PacketDecoder::tunnelSnapLength()) : 0);
+    // The default filter would drop GRE and IP-in-IP before they are decoded; a filter of the
+    // user's own is left as it is
+    if (m_captureConfig.filter == CaptureEngine::defaultFilter(!enabled)) {
+        setCaptureFilter(CaptureEngine::defaultFilter(enabled));
+    }
+    qDebug() << "Tunnel decapsulation:" << (enabled ? "on" : "off");
+}
+
+bool NetworkMonitor::tunnelDecapsulation() const
+{
+    return m_decapsulateTunnels;
+}
+
+CaptureEngine::Statistics NetworkMonitor::getCaptureStatistics() const
+{
+    CaptureEngine::Statistics total;
+    const QMap<QString, CaptureEngine::Statistics> byInterface = getCaptureStatisticsByInterface();
+    for (const CaptureEngine::Statistics &stats : byInterface) {
+        total.packetsPerSecond += stats.packetsPerSecond;
+        total.dropsPerSecond += stats.dropsPerSecond;
+        total.interfaceDropsPerSecond += stats.interfaceDropsPerSecond;
+        total.filteredPerSecond += stats.filteredPerSecond;
+        total.totalPackets += stats.totalPackets;
+        total.totalDropped += stats.totalDropped;
+        total.totalInterfaceDropped += stats.totalInterfaceDropped;
+        total.totalFiltered += stats.totalFiltered;
+        total.totalDelivered += stats.totalDelivered;
+        total.filteredAvailable = total.filteredAvailable || stats.filteredAvailable;
+    }
+    return total;
+}
+
+QMap<QString, CaptureEngine::Statistics> NetworkMonitor::getCaptureStatisticsByInterface() const
+{
+    QMap<QString, CaptureEngine::Statistics> stats;
+    for (const CaptureWorker *worker : m_captureWorkers) {
+        // Fanout sockets each count their share of the interface
+        const CaptureEngine::Statistics socketStats = worker->captureStatistics();
+        CaptureEngine::Statistics &total = stats[worker->interfaceName()];
+        total.packetsPerSecond += socketStats.packetsPerSecond;
+        total.dropsPerSecond += socketStats.dropsPerSecond;
+        total.interfaceDropsPerSecond = qMax(total.interfaceDropsPerSecond, socketStats.interfaceDropsPerSecond);
+        total.filteredPerSecond += socketStats.filteredPerSecond;
+        total.totalPackets += socketStats.totalPackets;
+        total.totalDropped += socketStats.totalDropped;
+        total.totalInterfaceDropped = qMax(total.totalInterfaceDropped, socketStats.totalInterfaceDropped);
+        total.totalFiltered += socketStats.totalFiltered;
+        total.totalDelivered += socketStats.totalDelivered;
+        total.filteredAvailable = total.filteredAvailable || socketStats.filteredAvailable;
+    }
+    return stats;
+}
+
+NetworkMonitor::QueueStatistics NetworkMonitor::getQueueStatistics() const
+{
+    QueueStatistics total;
+    for (const CaptureWorker *worker : m_captureWorkers) {
+        QueueStatistics stats = worker->queueStatistics();
+        total.depth += stats.depth;
+        total.capacity += stats.capacity;
+        total.highWatermark = qMax(total.highWatermark, stats.highWatermark);
+        total.enqueued += stats.enqueued;
+        total.overflows += stats.overflows;
+        total.dnsOverflows += stats.dnsOverflows;
+        total.tlsOverflows += stats.tlsOverflows;
+    }
+    return total;
+}
+
+QMap<QString, NetworkMonitor::NetworkStats> NetworkMonitor::getInterfaceStats() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_interfaceStats;
+}
+
 QMap<qint64, NetworkMonitor::NetworkStats> NetworkMonitor::getStats() const
 {
     QMutexLocker locker(&m_mutex);
@@ -346,22 +909,52 @@ QList<NetworkMonitor::ConnectionInfo> NetworkMonitor::getActiveConnections() con
 
 void NetworkMonitor::updateNetworkStats()
 {
-    QMutexLocker locker(&m_mutex);
-    
-    // Calculate total download and upload rates
-    quint64 totalDownload = 0;
-    quint64 totalUpload = 0;
-    
-    for (const auto &stats : m_processStats) {
-        totalDownload += stats.downloadRate;
-        totalUpload += stats.uploadRate;
+    // All captured traffic, whether or not it was attributed to a process
+    RateEngine::Rates total;
+    int connectionCount = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        total = m_rates.totalRates(rateClockUs());
+        connectionCount = m_activeConnections.size();
+    }
+    
+    // Outside the lock, since receivers call back into the monitor
+    emit statsUpdated(total.download, total.upload, total.smoothedDownload, total.smoothedUpload);
+    emit connectionCountChanged(connectionCount);
+}
+
+// Caller must hold m_mutex. Rates are read in capture time: packet time during a replay, and
+// live the wall clock less one publish interval, which is how late a delta can be merged.
+quint64 NetworkMonitor::rateClockUs() const
+{
+    if (m_replaying.load(std::memory_order_relaxed)) {
+        return m_replayStats.lastPacketUs;
     }
+    const quint64 nowUs = quint64(QDateTime::currentMSecsSinceEpoch()) * 1000;
+    return nowUs - quint64(FlowShard::PublishIntervalMs) * 1000;
+}
+
+// Caller must hold m_mutex. Copies the current rates into the process and interface stats.
+void NetworkMonitor::publishRates()
+{
+    const quint64 nowUs = rateClockUs();
+    auto apply = [](const RateEngine::Rates &rates, NetworkStats *stats) {
+        stats->downloadRate = rates.download;
+        stats->uploadRate = rates.upload;
+        stats->smoothedDownloadRate = rates.smoothedDownload;
+        stats->smoothedUploadRate = rates.smoothedUpload;
+    };
     
-    // Emit the statsUpdated signal with the aggregated data
-    emit statsUpdated(totalDownload, totalUpload);
-    
-    // Emit connection count changed signal
-    emit connectionCountChanged(m_activeConnections.size());
+    for (auto it = m_processStats.begin(); it != m_processStats.end(); ++it) {
+        apply(m_rates.processRates(it.key(), nowUs), &it.value());
+    }
+    for (int i = 0; i < m_interfaceNames.size(); ++i) {
+        auto it = m_interfaceStats.find(m_interfaceNames.at(i));
+        if (it != m_interfaceStats.end()) {
+            apply(m_rates.interfaceRates(i, nowUs), &it.value());
+        }
+    }
+    m_rates.prune(nowUs);
 }
 
 QMap<QString, NetworkMonitor::NetworkStats> NetworkMonitor::getStatsByApplication() const
@@ -375,6 +968,8 @@ QMap<QString, NetworkMonitor::NetworkStats> NetworkMonitor::getStatsByApplicatio
             appStats[stats.processName].bytesSent += stats.bytesSent;
             appStats[stats.processName].packetsReceived += stats.packetsReceived;
             appStats[stats.processName].packetsSent += stats.packetsSent;
+            appStats[stats.processName].receivedVariance.merge(stats.receivedVariance);
+            appStats[stats.processName].sentVariance.merge(stats.sentVariance);
             
             // Only set process name and icon once
             if (appStats[stats.processName].processName.isEmpty()) {
@@ -645,72 +1240,78 @@ void NetworkMonitor::updateActiveConnections()
         }
     }
 #elif defined(Q_OS_LINUX) || defined(Q_OS_ANDROID)
-    // Linux implementation using /proc/net/tcp and /proc/net/udp
-    QFile tcpFile("/proc/net/tcp");
-    if (tcpFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QTextStream in(&tcpFile);
-        in.readLine(); // Skip header line
-        while (!in.atEnd()) {
-            QString line = in.readLine().trimmed();
-            QStringList parts = line.split(' ', Qt::SkipEmptyParts);
-            if (parts.size() >= 10) {
-                ConnectionInfo info;
-                
-                // Parse local and remote addresses
-                QStringList local = parts[1].split(':');
-                QStringList remote = parts[2].split(':');
-                
-                if (local.size() == 2 && remote.size() == 2) {
-                    bool ok;
-                    info.localAddress = QHostAddress(local[0].toUInt(&ok, 16)).toString();
-                    info.localPort = local[1].toUShort(&ok, 16);
-                    info.remoteAddress = QHostAddress(remote[0].toUInt(&ok, 16)).toString();
-                    info.remotePort = remote[1].toUShort(&ok, 16);
-                    info.protocol = 6; // TCP
+    // The kernel's binary socket dump where it allows one; /proc/net/tcp and /proc/net/udp,
+    // which only have IPv4 sockets, for a protocol it will not dump
+    const bool tcpListed = listDiagSockets(PacketDecoder::ProtocolTcp);
+    const bool udpListed = listDiagSockets(PacketDecoder::ProtocolUdp);
+    if (!tcpListed) {
+        QFile tcpFile("/proc/net/tcp");
+        if (tcpFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            QTextStream in(&tcpFile);
+            in.readLine(); // Skip header line
+            while (!in.atEnd()) {
+                QString line = in.readLine().trimmed();
+                QStringList parts = line.split(' ', Qt::SkipEmptyParts);
+                if (parts.size() >= 10) {
+                    ConnectionInfo info;
                     
-                    // On Linux, getting the process ID requires additional steps (e.g., using lsof or ss)
-                    // This is a simplified example
-                    info.processId = -1;
-                    info.processName = "";
+                    // Parse local and remote addresses
+                    QStringList local = parts[1].split(':');
+                    QStringList remote = parts[2].split(':');
                     
-                    m_activeConnections.append(info);
+                    if (local.size() == 2 && remote.size() == 2) {
+                        bool ok;
+                        info.localAddress = QHostAddress(local[0].toUInt(&ok, 16)).toString();
+                        info.localPort = local[1].toUShort(&ok, 16);
+                        info.remoteAddress = QHostAddress(remote[0].toUInt(&ok, 16)).toString();
+                        info.remotePort = remote[1].toUShort(&ok, 16);
+                        info.protocol = 6; // TCP
+                        
+                        // On Linux, getting the process ID requires additional steps (e.g., using lsof or ss)
+                        // This is a simplified example
+                        info.processId = -1;
+                        info.processName = "";
+                        
+                        m_activeConnections.append(info);
+                    }
                 }
             }
+            tcpFile.close();
         }
-        tcpFile.close();
-    }
-    
-    // Similar implementation for UDP
-    QFile udpFile("/proc/net/udp");
-    if (udpFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QTextStream in(&udpFile);
-        in.readLine(); // Skip header line
-        while (!in.atEnd()) {
-            QString line = in.readLine().trimmed();
-            QStringList parts = line.split(' ', Qt::SkipEmptyParts);
-            if (parts.size() >= 10) {
-                ConnectionInfo info;
-                
-                // Parse local address
-                QStringList local = parts[1].split(':');
-                
-                if (local.size() == 2) {
-                    bool ok;
-                    info.localAddress = QHostAddress(local[0].toUInt(&ok, 16)).toString();
-                    info.localPort = local[1].toUShort(&ok, 16);
-                    info.remoteAddress = "*";
-                    info.remotePort = 0;
-                    info.protocol = 17; // UDP
+    }
+    
+    if (!udpListed) {
+        QFile udpFile("/proc/net/udp");
+        if (udpFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            QTextStream in(&udpFile);
+            in.readLine(); // Skip header line
+            while (!in.atEnd()) {
+                QString line = in.readLine().trimmed();
+                QStringList parts = line.split(' ', Qt::SkipEmptyParts);
+                if (parts.size() >= 10) {
+                    ConnectionInfo info;
                     
-                    // On Linux, getting the process ID requires additional steps
-                    info.processId = -1;
-                    info.processName = "";
+                    // Parse local address
+                    QStringList local = parts[1].split(':');
                     
-                    m_activeConnections.append(info);
+                    if (local.size() == 2) {
+                        bool ok;
+                        info.localAddress = QHostAddress(local[0].toUInt(&ok, 16)).toString();
+                        info.localPort = local[1].toUShort(&ok, 16);
+                        info.remoteAddress = "*";
+                        info.remotePort = 0;
+                        info.protocol = 17; // UDP
+                        
+                        // On Linux, getting the process ID requires additional steps
+                        info.processId = -1;
+                        info.processName = "";
+                        
+                        m_activeConnections.append(info);
+                    }
                 }
             }
+            udpFile.close();
         }
-        udpFile.close();
     }
 #elif defined(Q_OS_MACOS)
     // macOS implementation using netstat
@@ -780,76 +1381,596 @@ void NetworkMonitor::updateActiveConnections()
     // Fallback implementation for other platforms
     qWarning() << "Network connection monitoring not implemented for this platform";
 #endif
+    
+    rebuildSocketTable();
 }
 
-#ifdef HAVE_PCAP
-void NetworkMonitor::processPacket(const struct pcap_pkthdr *pkthdr, const u_char *packet)
+#ifdef Q_OS_LINUX
+// Caller must hold m_mutex. Appends the protocol's IPv4 and IPv6 sockets to
+// m_activeConnections straight from the kernel's binary records; false if the kernel would
+// not list them, e.g. without the inet_diag modules, and nothing was appended.
+bool NetworkMonitor::listDiagSockets(quint8 protocol)
 {
-    QMutexLocker locker(&m_mutex);
+    m_diagSockets.clear();
+    const quint32 states = protocol == PacketDecoder::ProtocolTcp ? ListedTcpStates : SocketDiag::AllStates;
+    if (!m_socketDiag.dump(protocol, states, &m_diagSockets)) {
+        if (!m_socketDiagFailed) {
+            qWarning() << "Listing sockets from /proc/net instead:" << m_socketDiag.errorString();
+            m_socketDiagFailed = true;
+        }
+        return false;
+    }
     
-    // Parse Ethernet header (assuming Ethernet)
-    const u_char *ip_packet = packet + 14; // Skip Ethernet header (14 bytes)
-    ip_header *ip_hdr = (ip_header*)ip_packet;
+    // Owners come from the inode; a socket that is new since the last scan, and that belongs
+    // to a process this user may inspect, asks for a fresh one. The scan reads a link per open
+    // file on the system, so it runs on the global pool rather than under the lock here; its
+    // sockets get their owners from the first listing after it finishes.
+    if (m_socketOwnersScanning && m_socketOwnersScan.isFinished()) {
+        m_socketOwners = m_socketOwnersScan.result();
+        m_socketOwnersScanning = false;
+    }
+    const quint32 euid = geteuid();
+    bool unknownOwner = false;
+    for (const SocketDiag::Socket &socket : m_diagSockets) {
+        if (socket.inode != 0 && (euid == 0 || socket.uid == euid) && !m_socketOwners.contains(socket.inode)) {
+            unknownOwner = true;
+            break;
+        }
+    }
+    const qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+    if (unknownOwner && !m_socketOwnersScanning &&
+        (m_socketOwnersScanMs == 0 || nowMs - m_socketOwnersScanMs >= SocketOwnerRescanMs)) {
+        m_socketOwnersScan = QtConcurrent::run([]() {
+            QHash<quint32, qint64> owners;
+            SocketDiag::socketOwners(&owners);
+            return owners;
+        });
+        m_socketOwnersScanning = true;
+        m_socketOwnersScanMs = nowMs;
+    }
     
-    // Check if this is an IP packet
-    if ((ip_hdr->ver_ihl >> 4) != 4) {
-        return; // Not IPv4
+    QHash<qint64, QPair<QString, QString>> processes; // PID -> name and path, for this listing
+    m_activeConnections.reserve(m_activeConnections.size() + qsizetype(m_diagSockets.size()));
+    for (const SocketDiag::Socket &socket : m_diagSockets) {
+        ConnectionInfo info;
+        if (socket.inode != 0) {
+            info.processId = m_socketOwners.value(socket.inode, -1);
+        }
+        if (info.processId > 0) {
+            auto process = processes.find(info.processId);
+            if (process == processes.end()) {
+                process = processes.insert(info.processId, qMakePair(getProcessNameFromPid(info.processId),
+                                                                     getProcessPathFromPid(info.processId)));
+            }
+            info.processName = process->first;
+            info.processPath = process->second;
+        }
+        info.localAddr = socket.localAddress;
+        info.remoteAddr = socket.remoteAddress;
+        info.hasBinaryAddresses = true;
+        info.localAddress = socketAddressString(socket.localAddress, socket.ipVersion);
+        info.localPort = socket.localPort;
+        info.protocol = protocol;
+        
+        // An unconnected UDP socket is shown like a listening one, as on the other platforms
+        if (protocol == PacketDecoder::ProtocolUdp && socket.remoteAddress.isNull()) {
+            info.remoteAddress = "*";
+            info.remotePort = 0;
+            info.connectionState = "LISTENING";
+            info.serviceName = getTrafficType(info.localPort, info.protocol);
+        } else {
+            info.remoteAddress = socketAddressString(socket.remoteAddress, socket.ipVersion);
+            info.remotePort = socket.remotePort;
+            info.connectionState = QString::fromLatin1(SocketDiag::stateName(socket.state));
+            info.serviceName = getTrafficType(socket.state == SocketDiag::Listen ? info.localPort : info.remotePort,
+                                              info.protocol);
+        }
+        m_activeConnections.append(info);
+    }
+    return true;
+}
+#endif
+
+void NetworkMonitor::runShard(FlowShard *shard, const QList<CaptureWorker *> &workers)
+{
+    RingDoorbell *doorbell = shard->doorbell();
+    
+    while (true) {
+        if (shard->processInputs() > 0) {
+            if (shard->publish()) {
+                requestMerge();
+            }
+            continue;
+        }
+        if (shard->publish()) {
+            requestMerge();
+        }
+        
+        // Only exit once the rings are drained so nothing the capture threads pushed is lost;
+        // stopCapture() merges what was not published
+        if (!m_aggregating.load(std::memory_order_relaxed)) {
+            break;
+        }
+        
+        // Every source has ended on its own, e.g. a replayed file was read to the end
+        bool finished = true;
+        for (const CaptureWorker *worker : workers) {
+            finished = finished && worker->hasFinished();
+        }
+        if (finished && !shard->hasInput()) {
+            // The last shard to finish reports the end of a replay
+            if (m_runningShards.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+                m_replaying.load(std::memory_order_relaxed)) {
+                const quint32 generation = m_replayGeneration;
+                QMetaObject::invokeMethod(this, [this, generation]() {
+                    finishReplay(generation);
+                }, Qt::QueuedConnection);
+            }
+            break;
+        }
+        doorbell->wait([shard]() { return shard->hasInput(); }, 100);
+    }
+}
+
+// Processing threads. Connection events are merged right away rather than on the next
+// m_mergeTimer tick; requests made while one is already queued fold into it.
+void NetworkMonitor::requestMerge()
+{
+    if (!m_mergeRequested.exchange(true, std::memory_order_acq_rel)) {
+        QMetaObject::invokeMethod(this, [this]() {
+            mergeShards();
+        }, Qt::QueuedConnection);
+    }
+}
+
+// GUI thread. With final set the processing threads must be stopped, and what they have not
+// published yet is merged too.
+void NetworkMonitor::mergeShards(bool final)
+{
+    m_mergeRequested.store(false, std::memory_order_release);
+    quint64 lastPacketUs = 0;
+    bool merged = false;
+    QList<ConnectionInfo> established;
+    QList<ConnectionHistory> terminated;
+    QList<ConnectionInfo> handshakes;
+    QList<qint64> newProcesses;
+    {
+        QMutexLocker locker(&m_mutex);
+        mergeDnsMessages();
+        mergeTlsHellos(&handshakes);
+        mergeHttpTransactions();
+        for (FlowShard *shard : m_flowShards) {
+            while (FlowShard::Delta *delta = shard->takeDelta()) {
+                lastPacketUs = qMax(lastPacketUs, delta->lastPacketUs);
+                mergeDelta(*delta, &established, &terminated, &newProcesses);
+                delete delta;
+                merged = true;
+            }
+            if (final) {
+                FlowShard::Delta *delta = shard->takeUnpublished();
+                lastPacketUs = qMax(lastPacketUs, delta->lastPacketUs);
+                mergeDelta(*delta, &established, &terminated, &newProcesses);
+                delete delta;
+                merged = true;
+            }
+        }
     }
     
-    // Get protocol type
-    int protocol = ip_hdr->proto;
+    // A new process's icon takes a path lookup and a file read, so it is found without the lock
+    // and filled in afterwards, in its connection events too. Processes share icons by path.
+    if (!newProcesses.isEmpty()) {
+        QHash<qint64, QIcon> icons;
+        for (qint64 pid : newProcesses) {
+            const QString path = getProcessPathFromPid(pid);
+            if (!m_processIcons.contains(path)) {
+                m_processIcons.insert(path, getProcessIcon(path));
+            }
+            icons.insert(pid, m_processIcons.value(path));
+        }
+        {
+            QMutexLocker locker(&m_mutex);
+            for (auto it = icons.constBegin(); it != icons.constEnd(); ++it) {
+                auto stats = m_processStats.find(it.key());
+                if (stats != m_processStats.end()) {
+                    stats->processIcon = it.value();
+                }
+            }
+        }
+        for (ConnectionInfo &connection : established) {
+            if (connection.processIcon.isNull()) {
+                connection.processIcon = icons.value(connection.processId);
+            }
+        }
+    }
     
-    // Get source and destination IPs
-    struct in_addr src_addr, dst_addr;
-    src_addr.s_addr = ip_hdr->saddr;
-    dst_addr.s_addr = ip_hdr->daddr;
+    // Outside the lock, since receivers call back into the monitor
+    for (const ConnectionInfo &connection : handshakes) {
+        emit tlsHandshakeSeen(connection);
+    }
     
-    char src_ip[INET_ADDRSTRLEN];
-    char dst_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(src_addr), src_ip, INET_ADDRSTRLEN);
-    inet_ntop(AF_INET, &(dst_addr), dst_ip, INET_ADDRSTRLEN);
+    // Rates keep moving while nothing is captured, down to zero
+    if (!m_rateUpdateTimer.isValid() || m_rateUpdateTimer.elapsed() >= DataUpdateIntervalMs) {
+        m_rateUpdateTimer.start();
+        {
+            QMutexLocker locker(&m_mutex);
+            publishRates();
+        }
+        updateNetworkStats();
+    }
+    if (!merged) {
+        return;
+    }
+    for (const ConnectionInfo &connection : established) {
+        emit connectionEstablished(connection);
+    }
+    for (const ConnectionHistory &history : terminated) {
+        emit connectionTerminated(history);
+    }
     
-    quint16 src_port = 0;
-    quint16 dst_port = 0;
+    // A replay runs its timed analysis on packet time, however fast the file is read
+    if (m_replaying.load(std::memory_order_relaxed) && lastPacketUs > 0 && !final) {
+        const quint64 analysisIntervalUs = quint64(AnalysisIntervalMs) * 1000;
+        bool analyze = false;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_nextReplayAnalysisUs == 0) {
+                m_nextReplayAnalysisUs = lastPacketUs + analysisIntervalUs;
+            } else if (lastPacketUs >= m_nextReplayAnalysisUs) {
+                m_nextReplayAnalysisUs = lastPacketUs + analysisIntervalUs;
+                analyze = true;
+            }
+        }
+        if (analyze) {
+            analyzeTrafficPatterns();
+        }
+    }
     
-    // Parse TCP or UDP headers to get ports
-    if (protocol == 6 || protocol == 17) { // TCP or UDP
-        const u_char *transport_packet = ip_packet + ((ip_hdr->ver_ihl & 0x0F) * 4);
+    // Emit signal to update UI periodically, timed on the monotonic clock so that a step of
+    // the wall clock neither floods nor starves the UI
+    if (!m_dataUpdateTimer.isValid() || m_dataUpdateTimer.elapsed() >= DataUpdateIntervalMs) {
+        m_dataUpdateTimer.start();
+        emit networkDataUpdated();
+    }
+}
+
+// Caller must hold m_mutex. The capture threads queue DNS messages directly, so they reach
+// the table before the deltas of the connections they name.
+void NetworkMonitor::mergeDnsMessages()
+{
+    DnsMessage messages[DnsBatchSize];
+    for (CaptureWorker *worker : m_captureWorkers) {
+        SpscRing<DnsMessage> *queue = worker->dnsQueue();
+        while (size_t count = queue->popBatch(messages, DnsBatchSize)) {
+            for (size_t i = 0; i < count; ++i) {
+                m_passiveDns.process(messages[i]);
+            }
+        }
+    }
+}
+
+// Caller must hold m_mutex. The first ClientHello of a flow is returned as a connection for
+// the caller to emit; retransmissions and renegotiations are not. The flow may not have
+// reached m_flowTable yet, in which case the client is taken as the local end.
+void NetworkMonitor::mergeTlsHellos(QList<ConnectionInfo> *handshakes)
+{
+    TlsClientHello hello;
+    for (CaptureWorker *worker : m_captureWorkers) {
+        SpscRing<TlsClientHello> *queue = worker->tlsQueue();
+        while (queue->popBatch(&hello, 1) == 1) {
+            bool reversed = false;
+            const FlowKey key = FlowKey::make(hello.client, hello.clientPort, hello.server, hello.serverPort,
+                                              PacketDecoder::ProtocolTcp, &reversed);
+            if (hello.timestampUs >= m_nextTlsSweepUs) {
+                m_nextTlsSweepUs = hello.timestampUs + TlsFingerprintSweepUs;
+                expireTlsFingerprints(hello.timestampUs);
+            }
+            bool inserted = false;
+            TlsFingerprint *fingerprint = m_tlsFingerprints.findOrInsert(key, &inserted);
+            if (!fingerprint) {
+                m_tlsFingerprintOverflows++;
+                continue;
+            }
+            if (!inserted) {
+                continue;
+            }
+            *fingerprint = TlsFingerprint::fromClientHello(hello);
+            
+            FlowEntry entry;
+            if (const FlowEntry *flow = m_flowTable.find(key)) {
+                entry = *flow;
+            } else {
+                entry.tcpClient = reversed ? 1 : 0;
+                entry.firstSeenUs = hello.timestampUs;
+                entry.lastSeenUs = hello.timestampUs;
+            }
+            handshakes->append(connectionFromFlow(key, entry));
+        }
+    }
+}
+
+// Caller must hold m_mutex. Fingerprints normally go with their flow's expiry; this catches
+// the ones whose flow never reached m_flowTable.
+void NetworkMonitor::expireTlsFingerprints(quint64 nowUs)
+{
+    m_tlsFingerprints.removeIf([this, nowUs](const FlowKey &key, TlsFingerprint &fingerprint) {
+        return nowUs > fingerprint.timestampUs && nowUs - fingerprint.timestampUs > TlsFingerprintTimeoutUs &&
+               !m_flowTable.find(key);
+    });
+}
+
+// Caller must hold m_mutex. Transactions are summed per host; a request without a Host
+// header counts under its server's address.
+void NetworkMonitor::mergeHttpTransactions()
+{
+    HttpTransaction transaction;
+    for (CaptureWorker *worker : m_captureWorkers) {
+        SpscRing<HttpTransaction> *queue = worker->httpQueue();
+        while (queue->popBatch(&transaction, 1) == 1) {
+            QString host = transaction.hostLength > 0
+                               ? QString::fromLatin1(transaction.host, transaction.hostLength).toLower()
+                               : transaction.server.toString();
+            if (m_httpHosts.size() >= MaxHttpHosts && !m_httpHosts.contains(host)) {
+                host = OtherHttpHosts;
+            }
+            m_httpHosts[host].add(transaction);
+        }
+    }
+}
+
+// Caller must hold m_mutex. Connection events are added to the history and returned for
+// the caller to emit; so are processes seen for the first time, whose icons the caller finds.
+void NetworkMonitor::mergeDelta(const FlowShard::Delta &delta, QList<ConnectionInfo> *established,
+                                QList<ConnectionHistory> *terminated, QList<qint64> *newProcesses)
+{
+    for (auto it = delta.processes.constBegin(); it != delta.processes.constEnd(); ++it) {
+        const qint64 pid = it.key();
+        const FlowShard::ProcessCounters &counters = it.value();
+        NetworkStats &stats = m_processStats[pid];
+        stats.bytesSent += counters.bytesSent;
+        stats.packetsSent += counters.packetsSent;
+        stats.totalUploaded += counters.bytesSent;
+        stats.bytesReceived += counters.bytesReceived;
+        stats.packetsReceived += counters.packetsReceived;
+        stats.totalDownloaded += counters.bytesReceived;
+        stats.sentVariance.merge(counters.sentVariance);
+        stats.receivedVariance.merge(counters.receivedVariance);
         
-        if (protocol == 6) { // TCP
-            tcp_header *tcp_hdr = (tcp_header*)transport_packet;
-            src_port = ntohs(tcp_hdr->sport);
-            dst_port = ntohs(tcp_hdr->dport);
-        } else { // UDP
-            udp_header *udp_hdr = (udp_header*)transport_packet;
-            src_port = ntohs(udp_hdr->sport);
-            dst_port = ntohs(udp_hdr->dport);
+        if (stats.processName.isEmpty()) {
+            stats.processName = m_processNames.value(pid);
+            stats.processId = pid;
+            newProcesses->append(pid);
+        }
+        if (!counters.tcp.isEmpty()) {
+            m_processTcpStats[pid].merge(counters.tcp);
+        }
+        m_rates.addProcess(pid, delta.lastPacketUs, counters.bytesReceived, counters.bytesSent);
+    }
+    m_tcpStats.merge(delta.tcp);
+    
+    for (int i = 0; i < m_interfaceNames.size(); ++i) {
+        const FlowShard::InterfaceCounters &counters = delta.interfaces[i];
+        if (counters.packets[0] == 0 && counters.packets[1] == 0) {
+            continue;
+        }
+        NetworkStats &stats = m_interfaceStats[m_interfaceNames.at(i)];
+        stats.packetsReceived += counters.packets[0];
+        stats.bytesReceived += counters.bytes[0];
+        stats.totalDownloaded += counters.bytes[0];
+        stats.packetsSent += counters.packets[1];
+        stats.bytesSent += counters.bytes[1];
+        stats.totalUploaded += counters.bytes[1];
+        stats.receivedVariance.merge(counters.variance[0]);
+        stats.sentVariance.merge(counters.variance[1]);
+        m_rates.addInterface(i, delta.lastPacketUs, counters.bytes[0], counters.bytes[1]);
+    }
+    
+    // The shards report the current state of the flows they touched
+    for (const FlowShard::FlowUpdate &update : delta.flows) {
+        if (FlowEntry *flow = m_flowTable.findOrInsert(update.key)) {
+            *flow = update.entry;
+        }
+    }
+    for (const FlowKey &key : delta.expiredFlows) {
+        m_flowTable.remove(key);
+        m_tlsFingerprints.remove(key);
+    }
+    m_flowTableOverflows += delta.flowTableOverflows;
+    m_duplicatePackets += delta.duplicatePackets;
+    m_tunnelledPackets += delta.tunnelledPackets;
+    
+    for (const FlowShard::ConnectionEvent &event : delta.connectionEvents) {
+        const ConnectionInfo connection = connectionFromFlow(event.key, event.entry);
+        switch (event.type) {
+            case FlowShard::ConnectionEvent::Established:
+                established->append(connection);
+                break;
+            case FlowShard::ConnectionEvent::Closed:
+                terminated->append(addToConnectionHistory(connection, "Normal", connection.lastActivity));
+                break;
+            case FlowShard::ConnectionEvent::Reset:
+                terminated->append(addToConnectionHistory(connection, "Reset", connection.lastActivity));
+                break;
+            case FlowShard::ConnectionEvent::TimedOut:
+                terminated->append(addToConnectionHistory(connection, "Timeout", connection.lastActivity));
+                break;
+        }
+    }
+    
+    if (m_replaying.load(std::memory_order_relaxed) && delta.packets > 0) {
+        m_replayStats.packets += delta.packets;
+        m_replayStats.bytes += delta.bytes;
+        if (m_replayStats.firstPacketUs == 0 || delta.firstPacketUs < m_replayStats.firstPacketUs) {
+            m_replayStats.firstPacketUs = delta.firstPacketUs;
+        }
+        m_replayStats.lastPacketUs = qMax(m_replayStats.lastPacketUs, delta.lastPacketUs);
+    }
+}
+
+// Caller must hold m_mutex. Times and byte counts are the flow's as of the event; the local
+// end is the one on this host, or the client if neither is.
+NetworkMonitor::ConnectionInfo NetworkMonitor::connectionFromFlow(const FlowKey &key, const FlowEntry &flow) const
+{
+    const int local = flow.localSide >= 0 ? flow.localSide : qMax(int(flow.tcpClient), 0);
+    ConnectionInfo info;
+    info.localAddress = (local == 0 ? key.addressA : key.addressB).toString();
+    info.localPort = local == 0 ? key.portA : key.portB;
+    info.remoteAddress = (local == 0 ? key.addressB : key.addressA).toString();
+    info.remotePort = local == 0 ? key.portB : key.portA;
+    info.protocol = key.protocol;
+    info.processId = flow.processId;
+    if (flow.processId > 0) {
+        info.processName = m_processNames.value(flow.processId);
+        info.processIcon = m_processStats.value(flow.processId).processIcon;
+    }
+    info.connectionTime = QDateTime::fromMSecsSinceEpoch(qint64(flow.firstSeenUs / 1000));
+    info.lastActivity = QDateTime::fromMSecsSinceEpoch(qint64(flow.lastSeenUs / 1000));
+    info.bytesSent = flow.bytes[local];
+    info.bytesReceived = flow.bytes[1 - local];
+    info.sentVariance = flow.variance[local];
+    info.receivedVariance = flow.variance[1 - local];
+    info.rttUs = flow.tcp.smoothedRttUs;
+    info.retransmissions = flow.tcp.retransmissions;
+    const quint64 nowUs = rateClockUs();
+    info.uploadRate = flow.rate.rate(nowUs, local);
+    info.downloadRate = flow.rate.rate(nowUs, 1 - local);
+    info.connectionState = flow.isTcpOpen() ? "ESTABLISHED" : "CLOSED";
+    info.remoteHostname = m_passiveDns.lookup(local == 0 ? key.addressB : key.addressA);
+    if (info.remoteHostname.isEmpty()) {
+        info.remoteHostname = m_hostnameCache.value(info.remoteAddress);
+    }
+    info.appProtocol = flow.appProtocol;
+    info.serviceName = getTrafficType(info.remotePort, info.protocol, flow.appProtocol);
+    info.tunnel = tunnelDescription(flow.tunnel, m_tunnelEndpoints);
+    if (const TlsFingerprint *fingerprint = m_tlsFingerprints.find(key)) {
+        applyTlsFingerprint(*fingerprint, &info);
+    }
+    return info;
+}
+
+// The SNI names this connection's server exactly, where an address shared by many names
+// only gets the last one DNS answered with
+void NetworkMonitor::applyTlsFingerprint(const TlsFingerprint &fingerprint, ConnectionInfo *connection) const
+{
+    connection->tlsServerName = fingerprint.serverName;
+    connection->tlsAlpn = fingerprint.alpn;
+    connection->ja3 = fingerprint.ja3;
+    connection->ja4 = fingerprint.ja4;
+    if (!fingerprint.serverName.isEmpty()) {
+        connection->remoteHostname = fingerprint.serverName;
+    }
+    
+    // An unknown port becomes "TLS"; the offered application protocol is added, e.g. "HTTPS (h2)"
+    QString service = connection->serviceName;
+    if (service.isEmpty()) {
+        service = getTrafficType(connection->remotePort, connection->protocol);
+    }
+    if (service.startsWith("TCP-")) {
+        service = "TLS";
+    }
+    if (!fingerprint.alpn.isEmpty()) {
+        service = QString("%1 (%2)").arg(service, fingerprint.alpn);
+    }
+    connection->serviceName = service;
+}
+
+// Caller must hold m_mutex. The shards attribute flows against the published copy.
+void NetworkMonitor::publishAttribution()
+{
+    std::shared_ptr<FlowShard::Attribution> attribution = std::make_shared<FlowShard::Attribution>(MaxTrackedFlows);
+    attribution->sockets = m_socketTable;
+    attribution->localAddresses = m_localAddresses;
+    attribution->socketGeneration = m_socketGeneration;
+    for (FlowShard *shard : m_flowShards) {
+        shard->setAttribution(attribution);
+    }
+}
+
+// Caller must hold m_mutex. Also fills in each connection's byte counters from its flow.
+void NetworkMonitor::rebuildSocketTable()
+{
+    m_socketTable.clear();
+    m_processNames.clear();
+    const quint64 nowUs = rateClockUs();
+    
+    for (auto &conn : m_activeConnections) {
+        // Unspecified addresses ("*", 0.0.0.0, ::) become the wildcard address. Sockets from
+        // the kernel's binary dump come with their addresses already parsed.
+        IpAddress localAddr = conn.localAddr;
+        IpAddress remoteAddr = conn.remoteAddr;
+        if (!conn.hasBinaryAddresses) {
+            QHostAddress local(conn.localAddress);
+            QHostAddress remote(conn.remoteAddress);
+            if (!local.isNull() && local != QHostAddress::AnyIPv4 && local != QHostAddress::AnyIPv6) {
+                localAddr = IpAddress::fromHostAddress(local);
+            }
+            if (!remote.isNull() && remote != QHostAddress::AnyIPv4 && remote != QHostAddress::AnyIPv6) {
+                remoteAddr = IpAddress::fromHostAddress(remote);
+            }
         }
         
-        // Get process information for this connection
-        ConnectionInfo connInfo = getConnectionDetails(src_ip, src_port, dst_ip, dst_port, protocol);
-        if (connInfo.processId > 0) {
-            // Update statistics for this process
-            NetworkStats &stats = m_processStats[connInfo.processId];
-            stats.bytesReceived += pkthdr->len;
-            stats.packetsReceived++;
-            
-            if (stats.processName.isEmpty() && !connInfo.processName.isEmpty()) {
-                stats.processName = connInfo.processName;
-                stats.processId = connInfo.processId;
-                stats.processIcon = getProcessIcon(getProcessPathFromPid(connInfo.processId));
+        // The socket knows which end is local, so this does not depend on m_localAddresses
+        bool reversed = false;
+        FlowKey key = FlowKey::make(localAddr, conn.localPort, remoteAddr, conn.remotePort, conn.protocol,
+                                    &reversed);
+        if (!remoteAddr.isNull()) {
+            // Names come from the DNS answers seen on the wire
+            const QString hostname = m_passiveDns.lookup(remoteAddr);
+            if (!hostname.isEmpty()) {
+                conn.remoteHostname = hostname;
+                m_hostnameCache[conn.remoteAddress] = hostname;
+            }
+            if (const FlowEntry *flow = m_flowTable.find(key)) {
+                conn.bytesSent = flow->bytes[reversed ? 1 : 0];
+                conn.bytesReceived = flow->bytes[reversed ? 0 : 1];
+                conn.sentVariance = flow->variance[reversed ? 1 : 0];
+                conn.receivedVariance = flow->variance[reversed ? 0 : 1];
+                conn.rttUs = flow->tcp.smoothedRttUs;
+                conn.retransmissions = flow->tcp.retransmissions;
+                conn.appProtocol = flow->appProtocol;
+                conn.serviceName = getTrafficType(conn.remotePort, conn.protocol, flow->appProtocol);
+                conn.tunnel = tunnelDescription(flow->tunnel, m_tunnelEndpoints);
+                conn.uploadRate = flow->rate.rate(nowUs, reversed ? 1 : 0);
+                conn.downloadRate = flow->rate.rate(nowUs, reversed ? 0 : 1);
+                // Flows keep capture timestamps; they only become QDateTime here for display.
+                // A replayed file's packet times say nothing about this host's sockets.
+                if (!m_replaying.load(std::memory_order_relaxed)) {
+                    conn.connectionTime = QDateTime::fromMSecsSinceEpoch(qint64(flow->firstSeenUs / 1000));
+                    conn.lastActivity = QDateTime::fromMSecsSinceEpoch(qint64(flow->lastSeenUs / 1000));
+                }
+            }
+            // After the service name is settled, which this adds the ALPN to
+            if (const TlsFingerprint *fingerprint = m_tlsFingerprints.find(key)) {
+                applyTlsFingerprint(*fingerprint, &conn);
             }
         }
+        
+        if (conn.processId <= 0) {
+            continue;
+        }
+        if (qint64 *pid = m_socketTable.findOrInsert(key)) {
+            *pid = conn.processId;
+        }
+        if (!m_processNames.contains(conn.processId)) {
+            m_processNames.insert(conn.processId, conn.processName);
+        }
     }
     
-    // Emit signal to update UI periodically
-    static QDateTime lastUpdate = QDateTime::currentDateTime();
-    if (lastUpdate.msecsTo(QDateTime::currentDateTime()) >= 1000) {
-        emit networkDataUpdated();
-        lastUpdate = QDateTime::currentDateTime();
+    // Flows that are still unattributed get another chance against the new sockets
+    m_socketGeneration++;
+    publishAttribution();
+}
+
+void NetworkMonitor::refreshLocalAddresses()
+{
+    // Enumerate outside the lock; only the swap happens under m_mutex
+    QList<QHostAddress> addresses = QNetworkInterface::allAddresses();
+    
+    QMutexLocker locker(&m_mutex);
+    if (m_localAddresses.refresh(addresses)) {
+        qDebug() << "Local addresses changed," << m_localAddresses.size() << "addresses now local";
+        publishAttribution();
     }
 }
-#endif
 
 QString NetworkMonitor::getApplicationPath(const QString &appName) const
 {
@@ -927,15 +2048,23 @@ NetworkMonitor::ConnectionInfo NetworkMonitor::getConnectionDetails(const QStrin
 {
     QMutexLocker locker(&m_mutex);
     
+    const ConnectionInfo *conn = findConnection(localAddr, localPort, remoteAddr, remotePort, protocol);
+    return conn ? *conn : ConnectionInfo();
+}
+
+// Caller must hold m_mutex
+const NetworkMonitor::ConnectionInfo *NetworkMonitor::findConnection(const QString &localAddr, quint16 localPort,
+                                                                     const QString &remoteAddr, quint16 remotePort, int protocol) const
+{
     for (const auto &conn : m_activeConnections) {
         if (conn.localAddress == localAddr && conn.localPort == localPort &&
             conn.remoteAddress == remoteAddr && conn.remotePort == remotePort &&
             conn.protocol == protocol) {
-            return conn;
+            return &conn;
         }
     }
     
-    return ConnectionInfo();
+    return nullptr;
 }
 
 bool NetworkMonitor::terminateConnection(const QString &localAddr, quint16 localPort, 
@@ -988,11 +2117,13 @@ void NetworkMonitor::exportConnectionData(const QString &filename, const Connect
     }
     
     QTextStream out(&file);
-    out << "Local Address,Local Port,Remote Address,Remote Port,Protocol,Process Name,Process ID,Connection Time,Last Activity,Bytes Received,Bytes Sent,Connection State\n";
+    out << "Local Address,Local Port,Remote Address,Remote Port,Protocol,Process Name,Process ID,Connection Time,Last Activity,Bytes Received,Bytes Sent,Connection State,Bytes Received 95% Margin,Bytes Sent 95% Margin,Sampling\n";
     
+    // Sampled byte counts are estimates; say so on every row so they are not taken as exact
+    const QString sampling = m_samplingConfig.description();
     QList<ConnectionInfo> connections = filterConnections(m_activeConnections, filter);
     for (const auto &conn : connections) {
-        out << QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,%12\n")
+        out << QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,%12,%13,%14,%15\n")
                .arg(conn.localAddress)
                .arg(conn.localPort)
                .arg(conn.remoteAddress)
@@ -1004,7 +2135,10 @@ void NetworkMonitor::exportConnectionData(const QString &filename, const Connect
                .arg(conn.lastActivity.toString("yyyy-MM-dd hh:mm:ss"))
                .arg(conn.bytesReceived)
                .arg(conn.bytesSent)
-               .arg(conn.connectionState);
+               .arg(conn.connectionState)
+               .arg(conn.receivedVariance.byteMargin())
+               .arg(conn.sentVariance.byteMargin())
+               .arg(sampling);
     }
     
     file.close();
@@ -1020,6 +2154,73 @@ QMap<QString, quint64> NetworkMonitor::getConnectionStatistics() const
     stats["UDP Connections"] = 0;
     stats["Total Bytes Received"] = 0;
     stats["Total Bytes Sent"] = 0;
+    stats["Tracked Flows"] = m_flowTable.size();
+    stats["Flow Table Overflows"] = m_flowTableOverflows;
+    stats["Duplicate Packets"] = m_duplicatePackets;
+    stats["Tunnelled Packets"] = m_tunnelledPackets;
+    stats["Sampling Rate"] = m_samplingConfig.mode == PacketSampler::Off ? 1 : quint64(m_samplingConfig.rate);
+    
+    // Later fragments left without ports are counted on a portless flow between their hosts
+    FragmentTracker::Statistics fragments;
+    for (const CaptureWorker *worker : m_captureWorkers) {
+        const FragmentTracker::Statistics workerFragments = worker->fragmentStatistics();
+        fragments.fragments += workerFragments.fragments;
+        fragments.unattributed += workerFragments.unattributed;
+        fragments.overflows += workerFragments.overflows;
+    }
+    stats["IP Fragments"] = fragments.fragments;
+    stats["Unattributed Fragments"] = fragments.unattributed;
+    stats["Fragment Table Overflows"] = fragments.overflows;
+    
+    // What the kernel filter kept away from userspace versus what it passed to the capture loop
+    const CaptureEngine::Statistics captureStats = getCaptureStatistics();
+    stats["Kernel Filtered Packets"] = captureStats.totalFiltered;
+    stats["Kernel Delivered Packets"] = captureStats.totalDelivered;
+    
+    const CaptureRecorder::Statistics recordingStats = m_recorder.statistics();
+    stats["Recorded Packets"] = recordingStats.packetsWritten;
+    stats["Recording Drops"] = recordingStats.packetsDropped;
+    
+    stats["TCP Retransmissions"] = m_tcpStats.retransmissions;
+    stats["TCP Out Of Order"] = m_tcpStats.outOfOrder;
+    stats["TCP Zero Windows"] = m_tcpStats.zeroWindows;
+    stats["TCP Median RTT (us)"] = m_tcpStats.rtt.percentileUs(0.5);
+    
+    quint64 dnsQueries = 0;
+    quint64 dnsNxdomain = 0;
+    const QHash<IpAddress, PassiveDns::ResolverStatistics> resolvers = m_passiveDns.resolverStatistics();
+    for (auto it = resolvers.constBegin(); it != resolvers.constEnd(); ++it) {
+        dnsQueries += it.value().queries;
+        dnsNxdomain += it.value().nxdomain;
+    }
+    stats["Passive DNS Names"] = quint64(m_passiveDns.size());
+    stats["DNS Queries"] = dnsQueries;
+    stats["DNS NXDOMAIN"] = dnsNxdomain;
+    stats["DNS Unmatched Responses"] = m_passiveDns.unmatchedResponses();
+    stats["TLS Fingerprinted Flows"] = m_tlsFingerprints.size();
+    stats["TLS Fingerprint Overflows"] = m_tlsFingerprintOverflows;
+    
+    TcpReassembler::Statistics reassembly;
+    HttpLatencyTracker::Statistics http;
+    for (const CaptureWorker *worker : m_captureWorkers) {
+        const TcpReassembler::Statistics workerReassembly = worker->reassemblyStatistics();
+        reassembly.streams += workerReassembly.streams;
+        reassembly.gaps += workerReassembly.gaps;
+        reassembly.overflows += workerReassembly.overflows;
+        const HttpLatencyTracker::Statistics workerHttp = worker->httpStatistics();
+        http.responses += workerHttp.responses;
+        http.unanswered += workerHttp.unanswered;
+    }
+    LogHistogram<quint64> httpLatency;
+    for (auto it = m_httpHosts.constBegin(); it != m_httpHosts.constEnd(); ++it) {
+        httpLatency.merge(it.value().latency);
+    }
+    stats["Reassembled TCP Streams"] = reassembly.streams;
+    stats["Reassembly Gaps"] = reassembly.gaps;
+    stats["Reassembly Overflows"] = reassembly.overflows;
+    stats["HTTP Transactions"] = http.responses;
+    stats["HTTP Unanswered Requests"] = http.unanswered;
+    stats["HTTP Median Latency (us)"] = httpLatency.percentileUs(0.5);
     
     for (const auto &conn : m_activeConnections) {
         if (conn.protocol == 6) {
@@ -1051,8 +2252,12 @@ QMap<QString, NetworkMonitor::NetworkStats> NetworkMonitor::getApplicationProfil
                 profile.bytesSent += stats.bytesSent;
                 profile.packetsReceived += stats.packetsReceived;
                 profile.packetsSent += stats.packetsSent;
+                profile.receivedVariance.merge(stats.receivedVariance);
+                profile.sentVariance.merge(stats.sentVariance);
                 profile.downloadRate += stats.downloadRate;
                 profile.uploadRate += stats.uploadRate;
+                profile.smoothedDownloadRate += stats.smoothedDownloadRate;
+                profile.smoothedUploadRate += stats.smoothedUploadRate;
                 profile.downloadTotal += stats.downloadTotal;
                 profile.uploadTotal += stats.uploadTotal;
                 profile.totalDownloaded += stats.totalDownloaded;
@@ -1181,40 +2386,96 @@ QList<QString> NetworkMonitor::getTopListeners() const
 
 double NetworkMonitor::getNetworkLatency(const QString &host) const
 {
-    // Simple ping implementation for latency measurement
-    QProcess pingProcess;
-    pingProcess.start("ping", QStringList() << "-n" << "1" << host);
-    pingProcess.waitForFinished(5000); // 5 second timeout
-    
-    QString output = pingProcess.readAllStandardOutput();
-    QRegularExpression timeRegex(R"(time[=<](\d+)ms)");
-    QRegularExpressionMatch match = timeRegex.match(output);
-    
-    if (match.hasMatch()) {
-        return match.captured(1).toDouble();
+    // Round trips measured on the TCP flows to the host; no probe is sent. A name is
+    // matched against the addresses it resolved to.
+    QMutexLocker locker(&m_mutex);
+    QList<IpAddress> addresses;
+    const QHostAddress hostAddress(host);
+    if (!hostAddress.isNull()) {
+        addresses.append(IpAddress::fromHostAddress(hostAddress));
+    } else {
+        for (auto it = m_hostnameCache.constBegin(); it != m_hostnameCache.constEnd(); ++it) {
+            if (it.value() == host && !QHostAddress(it.key()).isNull()) {
+                addresses.append(IpAddress::fromHostAddress(QHostAddress(it.key())));
+            }
+        }
+    }
+    if (addresses.isEmpty()) {
+        return -1.0;
     }
     
-    return -1.0; // Failed to measure
+    LogHistogram<quint64> rtt;
+    m_flowTable.forEach([&addresses, &rtt](const FlowKey &key, const FlowEntry &flow) {
+        if (key.protocol != 6 || flow.localSide < 0) {
+            return;
+        }
+        const IpAddress &remote = flow.localSide == 0 ? key.addressB : key.addressA;
+        if (addresses.contains(remote)) {
+            rtt.merge(flow.tcp.rtt);
+        }
+    });
+    if (rtt.count() == 0) {
+        return -1.0; // Nothing measured yet
+    }
+    return double(rtt.percentileUs(0.5)) / 1000.0;
 }
 
 quint64 NetworkMonitor::getPacketLossRate() const
 {
-    // Calculate packet loss rate based on captured packets
+    // Retransmitted share of the TCP data segments seen on the wire
     QMutexLocker locker(&m_mutex);
-    
-    quint64 totalPackets = 0;
-    quint64 lostPackets = 0;
-    
-    for (const auto &stats : m_processStats) {
-        totalPackets += stats.packetsReceived + stats.packetsSent;
-        // Estimate lost packets (this is a simplified calculation)
-        if (stats.packetsReceived > 0) {
-            lostPackets += stats.packetsReceived * 0.01; // Assume 1% loss rate
-        }
+    return quint64(m_tcpStats.retransmissionRate() + 0.5);
+}
+
+QMap<QString, PassiveDns::ResolverStatistics> NetworkMonitor::getDnsResolverStatistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    QMap<QString, PassiveDns::ResolverStatistics> resolvers;
+    const QHash<IpAddress, PassiveDns::ResolverStatistics> stats = m_passiveDns.resolverStatistics();
+    for (auto it = stats.constBegin(); it != stats.constEnd(); ++it) {
+        resolvers.insert(it.key().toString(), it.value());
     }
-    
-    if (totalPackets == 0) return 0;
-    return (lostPackets * 100) / totalPackets; // Return as percentage
+    return resolvers;
+}
+
+QMap<QString, HttpHostStatistics> NetworkMonitor::getHttpHostStatistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    QMap<QString, HttpHostStatistics> hosts;
+    for (auto it = m_httpHosts.constBegin(); it != m_httpHosts.constEnd(); ++it) {
+        hosts.insert(it.key(), it.value());
+    }
+    return hosts;
+}
+
+TcpStatistics NetworkMonitor::getTcpStatistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_tcpStats;
+}
+
+QMap<qint64, TcpStatistics> NetworkMonitor::getTcpStatisticsByProcess() const
+{
+    QMutexLocker locker(&m_mutex);
+    QMap<qint64, TcpStatistics> stats;
+    for (auto it = m_processTcpStats.constBegin(); it != m_processTcpStats.constEnd(); ++it) {
+        stats.insert(it.key(), it.value());
+    }
+    return stats;
+}
+
+TcpFlowMetrics NetworkMonitor::getConnectionTcpMetrics(const ConnectionInfo &connection) const
+{
+    QMutexLocker locker(&m_mutex);
+    const QHostAddress local(connection.localAddress);
+    const QHostAddress remote(connection.remoteAddress);
+    if (connection.protocol != 6 || local.isNull() || remote.isNull()) {
+        return TcpFlowMetrics();
+    }
+    const FlowKey key = FlowKey::make(IpAddress::fromHostAddress(local), connection.localPort,
+                                      IpAddress::fromHostAddress(remote), connection.remotePort, 6);
+    const FlowEntry *flow = m_flowTable.find(key);
+    return flow ? flow->tcp : TcpFlowMetrics();
 }
 
 // Private helper methods
@@ -1244,7 +2505,11 @@ void NetworkMonitor::analyzeTrafficPatterns()
     m_portStats.clear();
     
     for (const auto &conn : m_activeConnections) {
+        // By application protocol where the payload was recognised, else by transport
         QString protocol = conn.protocol == 6 ? "TCP" : "UDP";
+        if (conn.appProtocol != ProtocolClassifier::Unknown) {
+            protocol = QString::fromLatin1(ProtocolClassifier::name(ProtocolClassifier::Protocol(conn.appProtocol)));
+        }
         m_protocolStats[protocol] += conn.bytesReceived + conn.bytesSent;
         
         QString portKey = QString("%1").arg(conn.localPort);
@@ -1318,7 +2583,9 @@ bool NetworkMonitor::isConnectionSuspicious(const ConnectionInfo &connection) co
     return false;
 }
 
-void NetworkMonitor::addToConnectionHistory(const ConnectionInfo &connection, const QString &reason)
+NetworkMonitor::ConnectionHistory NetworkMonitor::addToConnectionHistory(const ConnectionInfo &connection,
+                                                                         const QString &reason,
+                                                                         const QDateTime &endTime)
 {
     ConnectionHistory history;
     history.localAddress = connection.localAddress;
@@ -1329,7 +2596,7 @@ void NetworkMonitor::addToConnectionHistory(const ConnectionInfo &connection, co
     history.processId = connection.processId;
     history.processName = connection.processName;
     history.startTime = connection.connectionTime;
-    history.endTime = QDateTime::currentDateTime();
+    history.endTime = endTime;
     history.totalBytesReceived = connection.bytesReceived;
     history.totalBytesSent = connection.bytesSent;
     history.terminationReason = reason;
@@ -1340,6 +2607,7 @@ void NetworkMonitor::addToConnectionHistory(const ConnectionInfo &connection, co
     if (m_connectionHistory.size() > 1000) {
         m_connectionHistory.removeFirst();
     }
+    return history;
 }
 
 QList<NetworkMonitor::ConnectionInfo> NetworkMonitor::filterConnections(const QList<ConnectionInfo> &connections, 
@@ -1387,7 +2655,7 @@ QList<NetworkMonitor::ConnectionInfo> NetworkMonitor::filterConnections(const QL
 QString NetworkMonitor::getTrafficType(quint16 port, int protocol) const
 {
     // Common port mappings for traffic type identification
-    static const QMap<quint16, QString> tcpPorts = {
+    static const QHash<quint16, QString> tcpPorts = {
         {20, "FTP-Data"}, {21, "FTP"}, {22, "SSH"}, {23, "Telnet"},
         {25, "SMTP"}, {53, "DNS"}, {80, "HTTP"}, {110, "POP3"},
         {143, "IMAP"}, {443, "HTTPS"}, {993, "IMAPS"}, {995, "POP3S"},
@@ -1399,7 +2667,7 @@ QString NetworkMonitor::getTrafficType(quint16 port, int protocol) const
         {1935, "RTMP"}, {554, "RTSP"}, {5060, "SIP"}, {5061, "SIP-TLS"}
     };
     
-    static const QMap<quint16, QString> udpPorts = {
+    static const QHash<quint16, QString> udpPorts = {
         {53, "DNS"}, {67, "DHCP-Server"}, {68, "DHCP-Client"},
         {69, "TFTP"}, {123, "NTP"}, {161, "SNMP"}, {162, "SNMP-Trap"},
         {514, "Syslog"}, {1194, "OpenVPN"}, {1701, "L2TP"},
@@ -1408,15 +2676,34 @@ QString NetworkMonitor::getTrafficType(quint16 port, int protocol) const
         {137, "NetBIOS-NS"}, {138, "NetBIOS-DGM"}, {139, "NetBIOS-SSN"}
     };
     
+    // The fallback name is only built on a miss
     if (protocol == 6) { // TCP
-        return tcpPorts.value(port, QString("TCP-%1").arg(port));
+        auto it = tcpPorts.constFind(port);
+        return it != tcpPorts.constEnd() ? it.value() : QString("TCP-%1").arg(port);
     } else if (protocol == 17) { // UDP
-        return udpPorts.value(port, QString("UDP-%1").arg(port));
+        auto it = udpPorts.constFind(port);
+        return it != udpPorts.constEnd() ? it.value() : QString("UDP-%1").arg(port);
     }
     
     return QString("Unknown-%1").arg(port);
 }
 
+QString NetworkMonitor::getTrafficType(quint16 port, int protocol, quint8 appProtocol) const
+{
+    if (appProtocol == ProtocolClassifier::Unknown || appProtocol >= ProtocolClassifier::ProtocolCount) {
+        return getTrafficType(port, protocol);
+    }
+    
+    // TLS and DTLS only wrap the real protocol, which a well-known port still names ("HTTPS", "IMAPS")
+    if (appProtocol == ProtocolClassifier::Tls || appProtocol == ProtocolClassifier::Dtls) {
+        const QString service = getTrafficType(port, protocol);
+        if (!service.startsWith("TCP-") && !service.startsWith("UDP-")) {
+            return service;
+        }
+    }
+    return QString::fromLatin1(ProtocolClassifier::name(ProtocolClassifier::Protocol(appProtocol)));
+}
+
 QString NetworkMonitor::getCountryFromIP(const QString &ip) const
 {
     // Check cache first
@@ -1454,22 +2741,19 @@ QString NetworkMonitor::getCountryFromIP(const QString &ip) const
 
 void NetworkMonitor::resolveHostname(const QString &ip)
 {
-    // Check cache first
-    if (m_hostnameCache.contains(ip)) {
-        return;
-    }
-    
-    // Don't resolve local IPs
+    // Caller must hold m_mutex. No lookup is ever sent: names are learnt passively from the
+    // DNS answers captured on the wire, and an address stays its own name until one is seen.
     QHostAddress addr(ip);
-    if (addr.isLoopback() || addr.toString().startsWith("192.168.") || 
-        addr.toString().startsWith("10.") || addr.toString().startsWith("172.")) {
+    if (!addr.isNull()) {
+        const QString hostname = m_passiveDns.lookup(IpAddress::fromHostAddress(addr));
+        if (!hostname.isEmpty()) {
+            m_hostnameCache[ip] = hostname;
+            return;
+        }
+    }
+    if (!m_hostnameCache.contains(ip)) {
         m_hostnameCache[ip] = ip;
-        return;
     }
-    
-    // Disable hostname resolution to prevent crashes and improve performance
-    // TODO: Re-enable with proper error handling and rate limiting
-    m_hostnameCache[ip] = ip;
 }
 
 QMap<QString, QString> NetworkMonitor::getHostnameCache() const
@@ -16,6 +16,7 @@
 #include <QFuture>
 #include <QFutureWatcher>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QQueue>
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
@@ -24,10 +25,26 @@
 #include <QUrlQuery>
 #include "iplookup.h"
 #include "ip2location.h"
-
-#ifdef HAVE_PCAP
-#include <pcap.h>
-#endif
+#include "capture/captureengine.h"
+#include "capture/capturerecorder.h"
+#include "capture/captureworker.h"
+#include "capture/flowshard.h"
+#include "capture/flowtable.h"
+#include "capture/localaddresstable.h"
+#include "capture/packetdecoder.h"
+#include "capture/packetdescriptor.h"
+#include "capture/packetsampler.h"
+#include "capture/passivedns.h"
+#include "capture/protocolclassifier.h"
+#include "capture/rateengine.h"
+#include "capture/socketdiag.h"
+#include "capture/spscring.h"
+#include "capture/tcpmetrics.h"
+#include "capture/tlsfingerprint.h"
+#include "capture/tunnelendpointtable.h"
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
 
 class NetworkMonitor : public QObject
 {
@@ -42,8 +59,12 @@ public:
         QString processName;
         QIcon processIcon;
         qint64 processId;
-        quint64 downloadRate;
+        quint64 downloadRate; // Bytes/s in the last complete second
         quint64 uploadRate;
+        quint64 smoothedDownloadRate; // EWMA of the per-second rates
+        quint64 smoothedUploadRate;
+        SampleVariance receivedVariance; // Of the counts scaled up by sampling, zero if exact
+        SampleVariance sentVariance;
         quint64 downloadTotal;
         quint64 uploadTotal;
         quint64 totalDownloaded;
@@ -52,7 +73,8 @@ public:
         NetworkStats() : bytesReceived(0), bytesSent(0), 
                         packetsReceived(0), packetsSent(0), 
                         processId(-1), downloadRate(0), 
-                        uploadRate(0), downloadTotal(0),
+                        uploadRate(0), smoothedDownloadRate(0),
+                        smoothedUploadRate(0), downloadTotal(0),
                         uploadTotal(0), totalDownloaded(0),
                         totalUploaded(0) {}
     };
@@ -74,9 +96,28 @@ public:
         QString connectionState; // ESTABLISHED, LISTENING, TIME_WAIT, etc.
         QString remoteHostname;
         QString serviceName;
+        quint32 rttUs; // Smoothed round trip measured on the wire, 0 if unknown
+        quint32 retransmissions;
+        QString tlsServerName; // From the ClientHello, if one was seen
+        QString tlsAlpn;
+        QString ja3;
+        QString ja4;
+        QString tunnel; // Outer tunnel the flow was decoded from, e.g. "VXLAN 42 10.0.0.1 -> 10.0.0.2"
+        quint8 appProtocol; // ProtocolClassifier::Protocol seen in the payload, Unknown if none
+        quint64 downloadRate; // Bytes/s of the flow in the last complete second
+        quint64 uploadRate;
+        SampleVariance receivedVariance; // Of bytesReceived and bytesSent under packet sampling
+        SampleVariance sentVariance;
+        // The addresses in binary, null for a wildcard, where the socket list provided them;
+        // otherwise only the strings above are set
+        IpAddress localAddr;
+        IpAddress remoteAddr;
+        bool hasBinaryAddresses;
         
         ConnectionInfo() : localPort(0), remotePort(0), protocol(0), 
-                          processId(-1), bytesReceived(0), bytesSent(0) {}
+                          processId(-1), bytesReceived(0), bytesSent(0),
+                          rttUs(0), retransmissions(0), appProtocol(ProtocolClassifier::Unknown),
+                          downloadRate(0), uploadRate(0), hasBinaryAddresses(false) {}
     };
     
     struct ConnectionHistory {
@@ -91,7 +132,7 @@ public:
         QDateTime endTime;
         quint64 totalBytesReceived;
         quint64 totalBytesSent;
-        QString terminationReason; // "Normal", "Timeout", "Error", "User"
+        QString terminationReason; // "Normal", "Reset", "Timeout", "Error", "User"
         
         ConnectionHistory() : localPort(0), remotePort(0), protocol(0), 
                             processId(-1), totalBytesReceived(0), totalBytesSent(0) {}
@@ -109,6 +150,55 @@ public:
         
         ConnectionFilter() : protocol(-1), showActiveOnly(true) {}
     };
+    
+    // Backpressure between the capture threads and the aggregation thread
+    typedef CaptureWorker::QueueStatistics QueueStatistics;
+    
+    // Progress of an offline replay; packets and bytes are counted after the whole pipeline
+    struct ReplayStatistics {
+        QString fileName;
+        double speed;           // Multiple of the recorded rate, 0 for as fast as possible
+        bool running;
+        quint64 packets;
+        quint64 bytes;
+        quint64 firstPacketUs;  // Capture time of the first and latest packet aggregated
+        quint64 lastPacketUs;
+        qint64 elapsedMs;       // Wall time since the replay started
+        double packetsPerSecond; // End-to-end throughput in wall time
+        
+        ReplayStatistics() : speed(0), running(false), packets(0), bytes(0),
+                            firstPacketUs(0), lastPacketUs(0), elapsedMs(0),
+                            packetsPerSecond(0) {}
+    };
+
+    // How packet processing is spread over threads, applied the next time capture starts
+    struct ProcessingConfig {
+        int workers;        // Processing threads; packets are spread over them by flow hash
+        bool kernelFanout;  // Let PACKET_FANOUT_HASH spread flows over one socket per worker (mmap, Linux)
+        
+        ProcessingConfig() : workers(1), kernelFanout(false) {}
+    };
+    
+    // Which packets are analysed on links too fast for all of them; counters are scaled back up
+    struct SamplingConfig {
+        PacketSampler::Mode mode;
+        int rate; // One packet or flow in rate is analysed
+        
+        SamplingConfig() : mode(PacketSampler::Off), rate(1) {}
+        
+        QString description() const { return PacketSampler::describe(mode, rate); }
+    };
+    
+    // Payload consumers. Headers-only captures keep the payload bytes of those that are on,
+    // so with all of them off nothing past the headers is copied.
+    struct InspectionConfig {
+        bool dns;      // Passive DNS names for remote addresses
+        bool tls;      // TLS ClientHello fingerprints
+        bool protocol; // Application protocol from the first payload bytes
+        bool streams;  // TCP stream reassembly to streamReassemblyDepth(), for HTTP latency
+        
+        InspectionConfig() : dns(false), tls(false), protocol(false), streams(false) {}
+    };
 
     explicit NetworkMonitor(QObject *parent = nullptr);
     ~NetworkMonitor();
@@ -116,7 +206,45 @@ public:
     bool initialize();
     QStringList getAvailableInterfaces() const;
     bool startCapture(const QString &interfaceName);
+    bool startCapture(const QStringList &interfaceNames);
     void stopCapture();
+    QStringList capturingInterfaces() const;
+    // Runs a pcap/pcapng file through the same analysis as a live capture, on packet time.
+    // speed is a multiple of the recorded rate; 0 replays as fast as possible.
+    bool startReplay(const QString &fileName, double speed = 1.0);
+    bool isReplaying() const;
+    ReplayStatistics getReplayStatistics() const;
+    void setCaptureConfig(const CaptureEngine::Config &config);
+    CaptureEngine::Config captureConfig() const;
+    bool setCaptureFilter(const QString &expression, QString *errorString = nullptr);
+    // Payload bytes a payload-inspecting feature needs; 0 withdraws the request. Headers-only
+    // captures keep the largest requested payload.
+    void setPayloadCaptureLength(const QString &feature, int bytes);
+    QString captureFilter() const;
+    // Rolling pcapng recording of live captures, applied the next time capture starts
+    void setRecordingConfig(const CaptureRecorder::Config &config);
+    CaptureRecorder::Config recordingConfig() const;
+    CaptureRecorder::Statistics getRecordingStatistics() const;
+    void setProcessingConfig(const ProcessingConfig &config);
+    ProcessingConfig processingConfig() const;
+    // Applied to the running capture straight away
+    void setSamplingConfig(const SamplingConfig &config);
+    SamplingConfig samplingConfig() const;
+    // Applied to the running capture straight away, restarting it if the snap length changes
+    void setInspectionConfig(const InspectionConfig &config);
+    InspectionConfig inspectionConfig() const;
+    // Bytes per direction of each TCP stream reassembled for payload analysis, 0 for none,
+    // while InspectionConfig::streams is on. Applied to streams opened from then on.
+    void setStreamReassemblyDepth(quint32 bytes);
+    quint32 streamReassemblyDepth() const;
+    // Decode VXLAN, GENEVE, GRE and IP-in-IP packets by their inner headers, so flows are the
+    // tunnelled ones rather than the tunnel's. Applied to the running capture straight away.
+    void setTunnelDecapsulation(bool enabled);
+    bool tunnelDecapsulation() const;
+    CaptureEngine::Statistics getCaptureStatistics() const; // Summed over all interfaces
+    QMap<QString, CaptureEngine::Statistics> getCaptureStatisticsByInterface() const;
+    QueueStatistics getQueueStatistics() const;
+    QMap<QString, NetworkStats> getInterfaceStats() const;
     void updateNetworkStats();
     QMap<qint64, NetworkStats> getStats() const;
     QList<ConnectionInfo> getActiveConnections() const;
@@ -146,11 +274,23 @@ public:
     QMap<QString, quint64> getPortStatistics() const;
     QList<QString> getTopTalkers() const;
     QList<QString> getTopListeners() const;
-    double getNetworkLatency(const QString &host) const;
-    quint64 getPacketLossRate() const;
+    double getNetworkLatency(const QString &host) const; // Median RTT in ms, -1 if none measured
+    quint64 getPacketLossRate() const; // TCP retransmissions, in percent of data segments
+    
+    // Passive TCP measurements from the captured packets
+    TcpStatistics getTcpStatistics() const;
+    QMap<qint64, TcpStatistics> getTcpStatisticsByProcess() const; // Key: process ID
+    TcpFlowMetrics getConnectionTcpMetrics(const ConnectionInfo &connection) const;
+    // Query latency and answers per resolver seen in the passive DNS traffic; key: resolver address
+    QMap<QString, PassiveDns::ResolverStatistics> getDnsResolverStatistics() const;
+    // HTTP/1.x request to response latency from the reassembled streams; key: Host header,
+    // or the server address for requests without one
+    QMap<QString, HttpHostStatistics> getHttpHostStatistics() const;
     
     // Enhanced monitoring features
     QString getTrafficType(quint16 port, int protocol) const;
+    // What the payload was recognised as, falling back to the port
+    QString getTrafficType(quint16 port, int protocol, quint8 appProtocol) const;
     QString getCountryFromIP(const QString &ip) const;
     void resolveHostname(const QString &ip);
     QMap<QString, QString> getHostnameCache() const;
@@ -163,10 +303,13 @@ public:
 
 signals:
     void networkDataUpdated();
-    void statsUpdated(quint64 download, quint64 upload);
+    // Bytes/s over all interfaces once a second: the last complete second and its EWMA
+    void statsUpdated(quint64 download, quint64 upload, quint64 smoothedDownload, quint64 smoothedUpload);
     void connectionCountChanged(int count);
     void connectionEstablished(const ConnectionInfo &connection);
     void connectionTerminated(const ConnectionHistory &connection);
+    // A TLS ClientHello was seen; the connection carries its server name and fingerprints
+    void tlsHandshakeSeen(const ConnectionInfo &connection);
     void suspiciousActivityDetected(const QString &appName, const QString &reason);
     void protocolAnomalyDetected(const QString &protocol, const QString &details);
     
@@ -175,30 +318,85 @@ signals:
     void databaseDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
     void databaseDownloadFinished(bool success);
     void databaseReady();
+    
+    // The replayed file has been fully analysed; see getReplayStatistics()
+    void replayFinished();
 
 private:
-#ifdef HAVE_PCAP
-    static void packetHandler(u_char *user, const struct pcap_pkthdr *pkthdr, const u_char *packet);
-    
-    pcap_t *m_pcapHandle;
-#endif
+    QList<CaptureWorker *> m_captureWorkers; // One per captured interface, or per fanout socket of each
+    bool m_captureFanout; // m_captureWorkers are laid out for kernel fanout
+    CaptureEngine::Config m_captureConfig; // Tuning applied on the next startCapture()
+    QMap<QString, int> m_payloadCaptureLengths; // Feature -> payload bytes it inspects
+    CaptureRecorder m_recorder; // Spools live captures to disk when enabled
+    CaptureRecorder::Config m_recordingConfig;
     bool m_isCapturing;
     QMap<qint64, NetworkStats> m_processStats; // Key: Process ID
-    QMap<QString, NetworkStats> m_interfaceStats;
+    QMap<QString, NetworkStats> m_interfaceStats; // Key: interface name, before de-duplication
     QList<ConnectionInfo> m_activeConnections;
     QList<ConnectionHistory> m_connectionHistory;
     QMap<QString, bool> m_monitoredApplications;
     QMap<QString, quint64> m_protocolStats;
     QMap<QString, quint64> m_portStats;
-    QMap<QString, QDateTime> m_lastActivity;
     QQueue<ConnectionInfo> m_recentConnections; // Keep last 1000 connections
-    QString m_currentInterface; // Current interface being monitored
+    QStringList m_interfaceNames; // Interface index -> name for the running capture, guarded by m_mutex
     
     mutable QMutex m_mutex; // For thread safety
-    QFuture<void> m_captureFuture; // Store the background thread
-    QFutureWatcher<void> *m_captureWatcher; // Monitor the background thread
+    // Packet processing. Each shard owns the flows that hash to it and is drained by its own
+    // thread; what they counted is merged into the members below on the GUI thread.
+    ProcessingConfig m_processingConfig;
+    SamplingConfig m_samplingConfig;
+    InspectionConfig m_inspectionConfig;
+    quint32 m_streamDepth;
+    bool m_decapsulateTunnels;
+    QList<FlowShard *> m_flowShards;
+    QThreadPool m_processingPool; // One thread per shard, apart from the global pool
+    QList<QFuture<void>> m_processingFutures;
+    std::atomic<bool> m_aggregating;
+    std::atomic<int> m_runningShards; // Shards whose sources have not all ended yet
+    QTimer *m_mergeTimer;
+    std::atomic<bool> m_mergeRequested; // A merge for connection events is queued on the GUI thread
+    QElapsedTimer m_dataUpdateTimer; // Throttles networkDataUpdated
+    QElapsedTimer m_rateUpdateTimer; // Paces publishRates, also while nothing is captured
+    
+    // Offline replay. Timed analysis follows packet time instead of m_analysisTimer.
+    std::atomic<bool> m_replaying;
+    quint32 m_replayGeneration; // Tells a stale end-of-file notification from the current replay
+    ReplayStatistics m_replayStats; // Guarded by m_mutex
+    QElapsedTimer m_replayTimer;
+    quint64 m_nextReplayAnalysisUs; // Guarded by m_mutex
+    
+    // Per-packet process attribution, guarded by m_mutex. The shards work on snapshots of
+    // the socket table and local addresses published by publishAttribution().
+    FlowTable m_flowTable; // Flows seen on the wire with their counters, merged from the shards
+    FlowHashMap<qint64> m_socketTable; // Socket 5-tuple -> PID, rebuilt from m_activeConnections
+    quint32 m_socketGeneration; // Bumped on every socket table rebuild
+    QHash<qint64, QString> m_processNames; // PID -> name for the sockets in m_socketTable
+    QHash<QString, QIcon> m_processIcons; // Executable path -> icon, GUI thread only
+#ifdef Q_OS_LINUX
+    SocketDiag m_socketDiag; // Binary socket dumps, instead of parsing /proc/net where it works
+    std::vector<SocketDiag::Socket> m_diagSockets; // Reused between dumps
+    QHash<quint32, qint64> m_socketOwners; // Socket inode -> PID, from the last /proc scan
+    QFuture<QHash<quint32, qint64>> m_socketOwnersScan; // The /proc scan running in the background
+    bool m_socketOwnersScanning; // m_socketOwnersScan has not been taken up yet
+    qint64 m_socketOwnersScanMs; // When the last scan started, 0 before the first
+    bool m_socketDiagFailed; // Warned about already
+#endif
+    LocalAddressTable m_localAddresses; // Classifies packets as sent or received
+    quint64 m_flowTableOverflows;
+    quint64 m_duplicatePackets; // Copies of a packet already counted on another interface
+    quint64 m_tunnelledPackets;
+    TunnelEndpointTable m_tunnelEndpoints; // Outer address pairs of tunnelled flows, shared with the capture workers
+    TcpStatistics m_tcpStats; // All TCP flows
+    QHash<qint64, TcpStatistics> m_processTcpStats; // Key: process ID
+    PassiveDns m_passiveDns; // IP -> name from captured DNS answers, fills m_hostnameCache
+    FlowHashMap<TlsFingerprint> m_tlsFingerprints; // TCP flow -> its first ClientHello, dropped with the flow
+    quint64 m_tlsFingerprintOverflows; // ClientHellos not kept because m_tlsFingerprints was full
+    quint64 m_nextTlsSweepUs; // Capture time of the next expireTlsFingerprints()
+    QHash<QString, HttpHostStatistics> m_httpHosts; // Host -> HTTP transactions, at most MaxHttpHosts
+    RateEngine m_rates; // Per-process and per-interface rates; per-flow ones are in m_flowTable
     QTimer *m_updateTimer; // Timer for updating active connections
     QTimer *m_analysisTimer; // Timer for traffic analysis
+    QTimer *m_addressTimer; // Fallback refresh of m_localAddresses
     
     // Enhanced features
     QNetworkAccessManager *m_networkManager; // For API calls
@@ -207,10 +405,34 @@ private:
     IPLookup *m_ipLookup; // Local IP geolocation database
     IP2Location *m_ip2Location; // Advanced IP geolocation with city/region info
     
-#ifdef HAVE_PCAP
-    void processPacket(const struct pcap_pkthdr *pkthdr, const u_char *packet);
-#endif
+    bool startSources(const QStringList &sources, const CaptureEngine::Config &config);
+    void requestPayload(const QString &feature, int bytes);
+    void applyPayloadCaptureLength();
+    quint32 activeStreamDepth() const; // m_streamDepth while stream inspection is on, else 0
+    void finishReplay(quint32 generation);
+    void resetAnalysis();
+    void runShard(FlowShard *shard, const QList<CaptureWorker *> &workers);
+    void requestMerge();
+    void mergeShards(bool final = false);
+    void mergeDnsMessages();
+    void mergeTlsHellos(QList<ConnectionInfo> *handshakes);
+    void expireTlsFingerprints(quint64 nowUs);
+    void mergeHttpTransactions();
+    void mergeDelta(const FlowShard::Delta &delta, QList<ConnectionInfo> *established,
+                    QList<ConnectionHistory> *terminated, QList<qint64> *newProcesses);
+    ConnectionInfo connectionFromFlow(const FlowKey &key, const FlowEntry &flow) const;
+    void applyTlsFingerprint(const TlsFingerprint &fingerprint, ConnectionInfo *connection) const;
+    quint64 rateClockUs() const;
+    void publishRates();
+    void publishAttribution();
+    void rebuildSocketTable();
+    void refreshLocalAddresses();
+    const ConnectionInfo *findConnection(const QString &localAddr, quint16 localPort,
+                                         const QString &remoteAddr, quint16 remotePort, int protocol) const;
     void updateActiveConnections();
+#ifdef Q_OS_LINUX
+    bool listDiagSockets(quint8 protocol);
+#endif
     void updateConnectionHistory();
     void analyzeTrafficPatterns();
     void detectSuspiciousActivity();
@@ -220,7 +442,8 @@ private:
     QString getServiceName(quint16 port) const;
     QString getHostnameFromIP(const QString &ip) const;
     bool isConnectionSuspicious(const ConnectionInfo &connection) const;
-    void addToConnectionHistory(const ConnectionInfo &connection, const QString &reason);
+    ConnectionHistory addToConnectionHistory(const ConnectionInfo &connection, const QString &reason,
+                                             const QDateTime &endTime = QDateTime::currentDateTime());
     QList<ConnectionInfo> filterConnections(const QList<ConnectionInfo> &connections, 
                                           const ConnectionFilter &filter) const;
 };
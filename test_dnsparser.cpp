@@ -0,0 +1,186 @@
+#include "src/capture/dnsparser.h"
+#include "src/capture/passivedns.h"
+#include "test_harness.h"
+#include <cstring>
+#include <vector>
+
+// Tests for DnsParser and PassiveDns: compressed names, pointer loops, messages cut short by
+// the snap length, and names learnt only from responses that answer a query that was seen.
+
+static void appendName(std::vector<quint8> *message, const char *dotted)
+{
+    const char *label = dotted;
+    while (*label) {
+        const char *dot = std::strchr(label, '.');
+        const size_t length = dot ? size_t(dot - label) : std::strlen(label);
+        message->push_back(quint8(length));
+        message->insert(message->end(), label, label + length);
+        label += length + (dot ? 1 : 0);
+    }
+    message->push_back(0);
+}
+
+static std::vector<quint8> header(quint16 id, quint16 flags, quint16 answers)
+{
+    std::vector<quint8> message;
+    appendBe16(&message, id);
+    appendBe16(&message, flags);
+    appendBe16(&message, 1); // Questions
+    appendBe16(&message, answers);
+    appendBe16(&message, 0);
+    appendBe16(&message, 0);
+    return message;
+}
+
+// Question for name, then answers of type A whose owner name points back at the question
+static std::vector<quint8> response(quint16 id, const char *name, int answers)
+{
+    std::vector<quint8> message = header(id, 0x8180, quint16(answers));
+    appendName(&message, name);
+    appendBe16(&message, DnsParser::TypeA);
+    appendBe16(&message, DnsParser::ClassIn);
+    for (int i = 0; i < answers; ++i) {
+        appendBe16(&message, 0xC000 | DnsParser::HeaderLength);
+        appendBe16(&message, DnsParser::TypeA);
+        appendBe16(&message, DnsParser::ClassIn);
+        appendBe16(&message, 0);
+        appendBe16(&message, quint16(300 + i));
+        appendBe16(&message, 4);
+        message.push_back(192);
+        message.push_back(0);
+        message.push_back(2);
+        message.push_back(quint8(1 + i));
+    }
+    return message;
+}
+
+static void testCompressedResponse()
+{
+    const std::vector<quint8> message = response(0x1234, "WWW.Example.com", 2);
+    DnsMessage out;
+    check(DnsParser::parse(message.data(), quint32(message.size()), &out), "response parses");
+    check(out.response && out.id == 0x1234 && out.responseCode == DnsParser::NoError, "header fields");
+    check(std::strcmp(out.name, "www.example.com") == 0 && out.nameLength == 15, "question name lower-cased");
+    check(out.questionType == DnsParser::TypeA, "question type");
+    check(out.addressCount == 2, "both answers read through the compression pointer");
+    check(out.addresses[1] == ipv4(192, 0, 2, 2) && out.ttls[1] == 301, "second address and TTL");
+}
+
+static void testPointerLoops()
+{
+    // The question name is a pointer to itself
+    std::vector<quint8> selfLoop = header(1, 0x0100, 0);
+    appendBe16(&selfLoop, 0xC000 | DnsParser::HeaderLength);
+    appendBe16(&selfLoop, DnsParser::TypeA);
+    appendBe16(&selfLoop, DnsParser::ClassIn);
+    DnsMessage out;
+    check(!DnsParser::parse(selfLoop.data(), quint32(selfLoop.size()), &out), "pointer to itself rejected");
+
+    // Two pointers pointing at each other
+    std::vector<quint8> pingPong = header(2, 0x0100, 0);
+    appendBe16(&pingPong, 0xC000 | (DnsParser::HeaderLength + 2));
+    appendBe16(&pingPong, 0xC000 | DnsParser::HeaderLength);
+    check(!DnsParser::parse(pingPong.data(), quint32(pingPong.size()), &out), "pointer cycle rejected");
+
+    // A chain of MaxPointerJumps pointers is still followed, one more is not
+    for (int jumps = DnsParser::MaxPointerJumps; jumps <= DnsParser::MaxPointerJumps + 1; ++jumps) {
+        std::vector<quint8> chain = header(3, 0x0100, 0);
+        for (int i = 0; i < jumps; ++i) {
+            appendBe16(&chain, quint16(0xC000 | (DnsParser::HeaderLength + 2 * (i + 1))));
+        }
+        appendName(&chain, "a.test");
+        appendBe16(&chain, DnsParser::TypeA);
+        appendBe16(&chain, DnsParser::ClassIn);
+        // The question ends after the first pointer, so its type and class follow it there;
+        // parse() only needs four bytes after the name, which the chain provides
+        const bool parsed = DnsParser::parse(chain.data(), quint32(chain.size()), &out);
+        if (jumps == DnsParser::MaxPointerJumps) {
+            check(parsed && std::strcmp(out.name, "a.test") == 0, "pointer chain at the jump limit followed");
+        } else {
+            check(!parsed, "pointer chain past the jump limit rejected");
+        }
+    }
+}
+
+static void testTruncation()
+{
+    const std::vector<quint8> message = response(7, "example.org", 3);
+    DnsMessage out;
+
+    // Every cut inside the header or the question fails cleanly
+    const quint32 questionEnd = DnsParser::HeaderLength + 13 + 4;
+    bool allRejected = true;
+    for (quint32 length = 0; length < questionEnd; ++length) {
+        allRejected = allRejected && !DnsParser::parse(message.data(), length, &out);
+    }
+    check(allRejected, "cut in the header or question rejected");
+
+    // A cut in the answers keeps the records that fit
+    const quint32 answerLength = 2 + 10 + 4;
+    check(DnsParser::parse(message.data(), questionEnd + answerLength + 5, &out) && out.addressCount == 1,
+          "cut after the first answer keeps it");
+    check(DnsParser::parse(message.data(), questionEnd, &out) && out.addressCount == 0,
+          "snap length at the end of the question gives no addresses");
+
+    // A label running past the end, and a label length with the reserved bits set
+    std::vector<quint8> longLabel = header(8, 0x0100, 0);
+    longLabel.push_back(60);
+    longLabel.insert(longLabel.end(), 10, 'a');
+    check(!DnsParser::parse(longLabel.data(), quint32(longLabel.size()), &out), "label past the end rejected");
+    std::vector<quint8> reserved = header(9, 0x0100, 0);
+    reserved.push_back(0x40);
+    reserved.push_back(0);
+    appendBe16(&reserved, DnsParser::TypeA);
+    appendBe16(&reserved, DnsParser::ClassIn);
+    check(!DnsParser::parse(reserved.data(), quint32(reserved.size()), &out), "reserved label type rejected");
+}
+
+static DnsMessage passiveMessage(quint16 id, const char *name, bool isResponse, quint8 host)
+{
+    DnsMessage message;
+    message.timestampUs = isResponse ? 2000 : 1000;
+    message.client = ipv4(10, 0, 0, 1);
+    message.server = ipv4(10, 0, 0, 53);
+    message.clientPort = 40000;
+    message.id = id;
+    message.response = isResponse;
+    message.questionType = DnsParser::TypeA;
+    std::strcpy(message.name, name);
+    message.nameLength = quint8(std::strlen(name));
+    if (isResponse) {
+        message.addressCount = 1;
+        message.addresses[0] = ipv4(198, 51, 100, host);
+        message.ttls[0] = 60;
+    }
+    return message;
+}
+
+static void testPassiveDnsMatching()
+{
+    PassiveDns dns;
+    const DnsMessage unsolicited = passiveMessage(1, "bank.example", true, 1);
+    dns.process(unsolicited);
+    check(dns.lookup(unsolicited.addresses[0]).isEmpty(), "unsolicited response names nothing");
+
+    const DnsMessage query = passiveMessage(2, "www.example", false, 0);
+    const DnsMessage otherQuestion = passiveMessage(2, "bank.example", true, 2);
+    const DnsMessage answer = passiveMessage(2, "www.example", true, 3);
+    dns.process(query);
+    dns.process(otherQuestion);
+    check(dns.lookup(otherQuestion.addresses[0]).isEmpty(), "response to another question names nothing");
+    dns.process(answer);
+    check(dns.lookup(answer.addresses[0]) == QString("www.example"), "matched response names its address");
+    dns.process(answer);
+    check(dns.unmatchedResponses() == 3, "unsolicited, mismatched and duplicate responses counted");
+    check(dns.resolverStatistics().value(query.server).responses == 1, "only the match counts as a response");
+}
+
+int main()
+{
+    testCompressedResponse();
+    testPointerLoops();
+    testTruncation();
+    testPassiveDnsMatching();
+
+    return testSummary("DNS");
+}
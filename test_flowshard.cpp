@@ -0,0 +1,133 @@
+#include "src/capture/flowshard.h"
+#include "src/capture/packetdecoder.h"
+#include "test_harness.h"
+#include <vector>
+
+// Tests for FlowShard's duplicate suppression across capture interfaces: the same packets
+// seen on a bridge and its member port in interleaved batches count once, while different
+// packets of one flow on two interfaces, replies that reuse the request's numbers, and
+// packets seen again after the window all count.
+
+// 192.0.2.1:40000 -> 198.51.100.7:443, or the other way round when reply is set
+static PacketDescriptor segment(quint8 interfaceIndex, quint32 seq, quint64 timestampUs, bool reply = false)
+{
+    PacketDescriptor descriptor;
+    descriptor.timestampUs = timestampUs;
+    descriptor.srcAddr = reply ? ipv4(198, 51, 100, 7) : ipv4(192, 0, 2, 1);
+    descriptor.dstAddr = reply ? ipv4(192, 0, 2, 1) : ipv4(198, 51, 100, 7);
+    descriptor.srcPort = reply ? 443 : 40000;
+    descriptor.dstPort = reply ? 40000 : 443;
+    descriptor.protocol = PacketDecoder::ProtocolTcp;
+    descriptor.ipVersion = 4;
+    descriptor.tcpFlags = PacketDescriptor::TcpAck;
+    descriptor.tcpSeq = seq;
+    descriptor.tcpAck = 5000;
+    descriptor.fragmentId = quint16(seq);
+    descriptor.wireLength = 1500;
+    descriptor.payloadLength = 1448;
+    descriptor.interfaceIndex = interfaceIndex;
+    return descriptor;
+}
+
+// Runs the batches through a fresh shard and returns what it counted
+struct Counted {
+    quint64 duplicates;
+    quint64 flowPackets;
+};
+
+static Counted run(const std::vector<std::vector<PacketDescriptor>> &batches)
+{
+    FlowShard shard(0, 1024);
+    // Duplicates are only looked for when more than one interface feeds the shard
+    SpscRing<PacketDescriptor> bridge(16);
+    SpscRing<PacketDescriptor> port(16);
+    shard.setInputs(QList<SpscRing<PacketDescriptor> *>() << &bridge << &port);
+    for (const std::vector<PacketDescriptor> &batch : batches) {
+        shard.process(batch.data(), batch.size());
+    }
+    shard.publish(true);
+    Counted counted = {0, 0};
+    while (FlowShard::Delta *delta = shard.takeDelta()) {
+        counted.duplicates += delta->duplicatePackets;
+        for (const FlowShard::FlowUpdate &update : delta->flows) {
+            counted.flowPackets += update.entry.packets[0] + update.entry.packets[1];
+        }
+        delete delta;
+    }
+    return counted;
+}
+
+static void testInterleavedCopies()
+{
+    // Each ring hands over a batch in turn, so a copy arrives a batch behind the original
+    std::vector<std::vector<PacketDescriptor>> batches(4);
+    for (quint32 i = 0; i < 8; ++i) {
+        const quint64 timestampUs = 1000000 + i * 100;
+        batches[i / 4 * 2].push_back(segment(0, 1000 + i * 1448, timestampUs));
+        batches[i / 4 * 2 + 1].push_back(segment(1, 1000 + i * 1448, timestampUs + 20));
+    }
+    const Counted counted = run(batches);
+    check(counted.duplicates == 8, "copies on the second interface are duplicates");
+    check(counted.flowPackets == 8, "flow counts each packet once");
+}
+
+static void testDistinctPackets()
+{
+    // One flow spread over two links: every packet is different
+    std::vector<std::vector<PacketDescriptor>> batches(2);
+    for (quint32 i = 0; i < 8; ++i) {
+        batches[i % 2].push_back(segment(quint8(i % 2), 1000 + i * 1448, 1000000 + i * 100));
+    }
+    const Counted counted = run(batches);
+    check(counted.duplicates == 0, "different packets of a flow on two interfaces are not duplicates");
+    check(counted.flowPackets == 8, "flow counts every packet on both interfaces");
+}
+
+static void testOtherDirection()
+{
+    PacketDescriptor request = segment(0, 1000, 1000000);
+    PacketDescriptor reply = segment(1, 1000, 1000050, true);
+    const Counted counted = run({{request}, {reply}});
+    check(counted.duplicates == 0 && counted.flowPackets == 2, "same numbers in the other direction are not a copy");
+}
+
+static void testOutsideWindow()
+{
+    PacketDescriptor first = segment(0, 1000, 1000000);
+    PacketDescriptor late = segment(1, 1000, 1000000 + 50000);
+    const Counted counted = run({{first}, {late}});
+    check(counted.duplicates == 0 && counted.flowPackets == 2, "copy seen after the window counts again");
+}
+
+static void testSameInterface()
+{
+    // A retransmission on the same interface is traffic, not a capture duplicate
+    PacketDescriptor first = segment(0, 1000, 1000000);
+    PacketDescriptor retransmission = segment(0, 1000, 1000200);
+    const Counted counted = run({{first, retransmission}});
+    check(counted.duplicates == 0 && counted.flowPackets == 2, "retransmission on one interface counts");
+}
+
+static void testUnidentifiedUdp()
+{
+    // Without an IP identification two UDP packets of the same length look alike
+    PacketDescriptor first = segment(0, 0, 1000000);
+    first.protocol = PacketDecoder::ProtocolUdp;
+    first.fragmentId = 0;
+    PacketDescriptor second = first;
+    second.interfaceIndex = 1;
+    second.timestampUs += 10;
+    const Counted counted = run({{first}, {second}});
+    check(counted.duplicates == 0 && counted.flowPackets == 2, "UDP without identification is never a duplicate");
+}
+
+int main()
+{
+    testInterleavedCopies();
+    testDistinctPackets();
+    testOtherDirection();
+    testOutsideWindow();
+    testSameInterface();
+    testUnidentifiedUdp();
+    return testSummary("flow shard");
+}
@@ -0,0 +1,147 @@
+#include "src/capture/flowtable.h"
+#include "test_harness.h"
+#include <map>
+#include <vector>
+
+// Tests for FlowHashMap's backward-shift deletion: removals in a probe run that wraps past the
+// end of the slot array, lookups along probe chains after removals, and a long mix of inserts
+// and removals checked against a std::map.
+
+// The map starts with 1024 slots and doubles once half of them are used
+static const size_t InitialSlots = 1024;
+
+static FlowKey keyFor(quint32 n)
+{
+    return FlowKey::make(ipv4(10, 0, quint8(n >> 8), quint8(n)), quint16(1024 + n), ipv4(192, 0, 2, 1), 443,
+                         6);
+}
+
+static size_t homeSlot(const FlowKey &key)
+{
+    return key.hash() & (InitialSlots - 1);
+}
+
+// The first count keys, in order of n, whose home slot is home
+static std::vector<FlowKey> keysAt(size_t home, size_t count)
+{
+    std::vector<FlowKey> keys;
+    for (quint32 n = 0; keys.size() < count; ++n) {
+        const FlowKey key = keyFor(n);
+        if (homeSlot(key) == home) {
+            keys.push_back(key);
+        }
+    }
+    return keys;
+}
+
+static bool holds(FlowHashMap<int> &map, const FlowKey &key, int value)
+{
+    const int *found = map.find(key);
+    return found && *found == value;
+}
+
+static void testWrapAround()
+{
+    // Four keys from the second-to-last slot run over the end into slots 0 and 1, and a key
+    // whose home is slot 0 follows them into slot 2
+    const std::vector<FlowKey> tail = keysAt(InitialSlots - 2, 4);
+    const FlowKey wrapped = keysAt(0, 1).front();
+    FlowHashMap<int> map;
+    for (int i = 0; i < 4; ++i) {
+        *map.findOrInsert(tail[i]) = i;
+    }
+    *map.findOrInsert(wrapped) = 4;
+    check(map.size() == 5, "five keys in one wrapping probe run");
+
+    check(map.remove(tail[1]), "remove from the middle of the run");
+    check(!map.find(tail[1]), "removed key is gone");
+    check(holds(map, tail[0], 0) && holds(map, tail[2], 2) && holds(map, tail[3], 3) && holds(map, wrapped, 4),
+          "keys past the end of the array shift back across the wrap");
+
+    check(map.remove(tail[0]) && map.remove(tail[3]), "remove at the start and past the wrap");
+    check(holds(map, tail[2], 2) && holds(map, wrapped, 4) && map.size() == 2,
+          "remaining keys found after more removals");
+
+    bool inserted = false;
+    int *again = map.findOrInsert(tail[1], &inserted);
+    check(again && inserted && *again == 0, "removed key inserts again with a fresh value");
+    *again = 11;
+    check(holds(map, tail[1], 11) && holds(map, tail[2], 2) && holds(map, wrapped, 4),
+          "reinserted key shares the run with the others");
+}
+
+static void testProbeChains()
+{
+    // Two runs that merge: keys from slot 100 spill into slot 103 and push slot 103's own keys on
+    const std::vector<FlowKey> first = keysAt(100, 4);
+    const std::vector<FlowKey> second = keysAt(103, 3);
+    FlowHashMap<int> map;
+    for (int i = 0; i < 4; ++i) {
+        *map.findOrInsert(first[i]) = i;
+    }
+    for (int i = 0; i < 3; ++i) {
+        *map.findOrInsert(second[i]) = 10 + i;
+    }
+    check(map.remove(first[0]) && map.remove(first[2]), "remove two keys of the first run");
+    bool allFound = holds(map, first[1], 1) && holds(map, first[3], 3);
+    for (int i = 0; i < 3; ++i) {
+        allFound = allFound && holds(map, second[i], 10 + i);
+    }
+    check(allFound, "keys of both runs found after removals in the first");
+    check(!map.find(first[0]) && !map.find(first[2]) && map.size() == 5, "removed keys stay gone");
+
+    check(map.remove(second[0]), "remove the key that sat at its home slot");
+    check(holds(map, second[1], 11) && holds(map, second[2], 12) && holds(map, first[3], 3),
+          "the rest of the merged run is still reachable");
+}
+
+static void testAgainstModel()
+{
+    FlowHashMap<int> map;
+    std::map<quint32, int> model;
+    quint64 state = 12345;
+    bool consistent = true;
+    for (int step = 0; step < 200000; ++step) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        // Few enough keys that the map stays dense and collides often
+        const quint32 n = quint32(state >> 33) % 900;
+        const FlowKey key = keyFor(n);
+        if ((state >> 20) & 1) {
+            *map.findOrInsert(key) = step;
+            model[n] = step;
+        } else {
+            consistent = consistent && map.remove(key) == (model.erase(n) == 1);
+        }
+        if (step % 1000 == 999) {
+            for (quint32 k = 0; k < 900; ++k) {
+                const auto it = model.find(k);
+                const int *found = map.find(keyFor(k));
+                consistent = consistent && (it == model.end() ? !found : found && *found == it->second);
+            }
+            consistent = consistent && map.size() == model.size();
+        }
+    }
+    check(consistent, "random inserts and removals match a std::map");
+
+    const size_t removed = map.removeIf([](const FlowKey &key, int &) { return key.portA % 3 == 0; });
+    size_t expected = 0;
+    bool rest = true;
+    for (const auto &entry : model) {
+        const FlowKey key = keyFor(entry.first);
+        if (key.portA % 3 == 0) {
+            ++expected;
+            rest = rest && !map.find(key);
+        } else {
+            rest = rest && holds(map, key, entry.second);
+        }
+    }
+    check(removed == expected && rest, "removeIf leaves every other key reachable");
+}
+
+int main()
+{
+    testWrapAround();
+    testProbeChains();
+    testAgainstModel();
+    return testSummary("flow table");
+}
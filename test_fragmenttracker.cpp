@@ -0,0 +1,155 @@
+#include "src/capture/fragmenttracker.h"
+#include "src/capture/packetdecoder.h"
+#include "test_harness.h"
+
+// Tests for FragmentTracker: port attribution in order and in reverse order, the per-datagram
+// and pool limits on held fragments, and a flood of datagrams that never complete filling the
+// table without any fragment being given another datagram's ports.
+
+// A UDP fragment of datagram id; offset is in 8-byte units. Only the first one has ports.
+static PacketDescriptor fragment(quint32 id, quint16 offset, bool more, quint16 length, quint64 timestampUs = 1000)
+{
+    PacketDescriptor descriptor;
+    descriptor.timestampUs = timestampUs;
+    descriptor.srcAddr = ipv4(192, 0, 2, 1);
+    descriptor.dstAddr = ipv4(198, 51, 100, 7);
+    descriptor.protocol = PacketDecoder::ProtocolUdp;
+    descriptor.ipVersion = 4;
+    descriptor.fragmentId = id;
+    descriptor.fragment = PacketDescriptor::Fragmented | (more ? PacketDescriptor::FragmentMore : 0) | offset;
+    descriptor.fragmentLength = length;
+    if (offset == 0) {
+        descriptor.srcPort = quint16(5000 + id % 1000);
+        descriptor.dstPort = 4789;
+    }
+    return descriptor;
+}
+
+static void testInOrder()
+{
+    FragmentTracker tracker;
+    PacketDescriptor first = fragment(1, 0, true, 1480);
+    PacketDescriptor last = fragment(1, 185, false, 520);
+    check(tracker.track(&first) && tracker.track(&last), "in-order fragments pass straight through");
+    check(last.srcPort == 5001 && last.dstPort == 4789, "later fragment gets the first fragment's ports");
+    check(tracker.isEmpty(), "complete datagram is forgotten");
+    const FragmentTracker::Statistics stats = tracker.statistics();
+    check(stats.fragments == 2 && stats.datagrams == 1 && stats.attributed == 1 && stats.unattributed == 0,
+          "in-order statistics");
+}
+
+static void testReverseOrder()
+{
+    FragmentTracker tracker;
+    PacketDescriptor last = fragment(2, 370, false, 100);
+    PacketDescriptor middle = fragment(2, 185, true, 1480);
+    PacketDescriptor first = fragment(2, 0, true, 1480);
+    check(!tracker.track(&last) && !tracker.track(&middle), "later fragments held until the first");
+    PacketDescriptor released;
+    check(!tracker.takeReleased(&released), "nothing released before the first fragment");
+    check(tracker.track(&first), "first fragment passes through");
+
+    check(tracker.takeReleased(&released) && released.fragment == last.fragment && released.srcPort == 5002,
+          "held fragments released in arrival order with ports");
+    check(tracker.takeReleased(&released) && released.fragment == middle.fragment && released.dstPort == 4789,
+          "second held fragment released with ports");
+    check(!tracker.takeReleased(&released) && tracker.isEmpty(), "reverse-order datagram completes");
+    check(tracker.statistics().attributed == 2, "held fragments counted as attributed");
+}
+
+static void testHeldLimit()
+{
+    FragmentTracker tracker;
+    int held = 0;
+    for (quint16 i = 1; i <= FragmentTracker::MaxHeldPerDatagram + 6; ++i) {
+        PacketDescriptor later = fragment(3, quint16(i * 185), true, 1480);
+        if (!tracker.track(&later)) {
+            ++held;
+        } else if (later.srcPort != 0) {
+            held = -1000;
+        }
+    }
+    check(held == FragmentTracker::MaxHeldPerDatagram, "one datagram holds at most MaxHeldPerDatagram fragments");
+    check(tracker.statistics().unattributed == 6, "fragments past the limit go on without ports");
+
+    // The first fragment still releases what was held
+    PacketDescriptor first = fragment(3, 0, true, 1480);
+    tracker.track(&first);
+    int released = 0;
+    PacketDescriptor out;
+    while (tracker.takeReleased(&out)) {
+        released += out.srcPort == 5003 ? 1 : 0;
+    }
+    check(released == FragmentTracker::MaxHeldPerDatagram, "held fragments released once the first arrives");
+}
+
+static void testFlood()
+{
+    FragmentTracker tracker;
+    const quint32 flood = 2000;
+    quint32 passed = 0;
+    bool portsLeaked = false;
+    for (quint32 id = 100; id < 100 + flood; ++id) {
+        // Later fragments only, whose first fragment never comes
+        PacketDescriptor later = fragment(id, 185, false, 200);
+        if (tracker.track(&later)) {
+            ++passed;
+            portsLeaked = portsLeaked || later.srcPort != 0 || later.dstPort != 0;
+        }
+    }
+    FragmentTracker::Statistics stats = tracker.statistics();
+    check(flood - passed == FragmentTracker::MaxHeldFragments, "the pool holds MaxHeldFragments and no more");
+    check(stats.overflows == flood - FragmentTracker::MaxDatagrams, "datagrams past the table size overflow");
+    check(!portsLeaked, "flooded fragments pass without ports");
+
+    // A real datagram while the table is full is not tracked, and its later fragment gets no
+    // ports rather than the ports of some other datagram
+    PacketDescriptor first = fragment(9000, 0, true, 1480, 1500);
+    PacketDescriptor last = fragment(9000, 185, false, 100, 1500);
+    check(tracker.track(&first) && tracker.track(&last) && last.srcPort == 0,
+          "full table passes fragments untracked");
+
+    // Timing out hands back every held fragment, without ports
+    tracker.expire(1000 + FragmentTracker::TimeoutUs + 1);
+    quint32 released = 0;
+    PacketDescriptor out;
+    while (tracker.takeReleased(&out)) {
+        portsLeaked = portsLeaked || out.srcPort != 0;
+        ++released;
+    }
+    check(released == FragmentTracker::MaxHeldFragments && !portsLeaked,
+          "timed-out fragments released without ports");
+
+    // Room again once the flood expired
+    const quint64 later = 1000 + 2 * FragmentTracker::TimeoutUs;
+    tracker.expire(later);
+    check(tracker.isEmpty(), "flood forgotten after the timeout");
+    first = fragment(9001, 0, true, 1480, later);
+    last = fragment(9001, 185, false, 100, later);
+    check(tracker.track(&first) && tracker.track(&last) && last.srcPort == 5001, "attribution works again");
+}
+
+static void testDistinctDatagrams()
+{
+    // Same endpoints, different identification: each later fragment keeps to its own datagram
+    FragmentTracker tracker;
+    PacketDescriptor firstA = fragment(10, 0, true, 1480);
+    PacketDescriptor laterB = fragment(11, 185, false, 100);
+    tracker.track(&firstA);
+    check(!tracker.track(&laterB), "fragment of another datagram is held, not attributed");
+    PacketDescriptor firstB = fragment(11, 0, true, 1480);
+    tracker.track(&firstB);
+    PacketDescriptor out;
+    check(tracker.takeReleased(&out) && out.srcPort == 5011, "and released with its own datagram's ports");
+}
+
+int main()
+{
+    testInOrder();
+    testReverseOrder();
+    testHeldLimit();
+    testFlood();
+    testDistinctDatagrams();
+
+    return testSummary("fragment");
+}
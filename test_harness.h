@@ -0,0 +1,58 @@
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include "src/capture/ipaddress.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Shared by the test_*.cpp programs built from tests_CMakeLists.txt. Every check prints a
+// PASS or FAIL line; main() returns testSummary(), so ctest sees any failure.
+
+inline int &testFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+inline void check(bool condition, const char *what)
+{
+    std::printf("%s: %s\n", condition ? "PASS" : "FAIL", what);
+    if (!condition) {
+        ++testFailures();
+    }
+}
+
+// Prints the closing line for the named suite and returns the exit status of the program
+inline int testSummary(const char *suite)
+{
+    const int failures = testFailures();
+    if (failures == 0) {
+        std::printf("All %s tests passed (0 failed)\n", suite);
+    } else {
+        std::printf("%s tests FAILED (%d failed)\n", suite, failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+inline IpAddress ipv4(quint8 a, quint8 b, quint8 c, quint8 d)
+{
+    const quint8 bytes[4] = {a, b, c, d};
+    quint32 networkOrder;
+    std::memcpy(&networkOrder, bytes, 4);
+    return IpAddress::fromIPv4(networkOrder);
+}
+
+inline void appendBe16(std::vector<quint8> *bytes, quint16 value)
+{
+    bytes->push_back(quint8(value >> 8));
+    bytes->push_back(quint8(value));
+}
+
+inline void putBe16(std::vector<quint8> *bytes, size_t offset, quint16 value)
+{
+    (*bytes)[offset] = quint8(value >> 8);
+    (*bytes)[offset + 1] = quint8(value);
+}
+
+#endif // TEST_HARNESS_H
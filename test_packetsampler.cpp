@@ -0,0 +1,90 @@
+#include "src/capture/packetsampler.h"
+#include "test_harness.h"
+#include <cmath>
+
+// Tests for SampleVariance: with each packet kept independently with probability 1/w the
+// scaled count w K is binomial, K ~ B(N, 1/w), with variance N (w - 1). The estimate from the
+// kept packets must match that, and the 95% interval must cover the true count in about 95%
+// of runs. Per-flow units must sum to the same variance however their packets arrive.
+
+// Deterministic, so the coverage check cannot flake
+static quint64 nextRandom(quint64 *state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *state >> 33;
+}
+
+static void testKnownBinomial()
+{
+    // N = 10000 packets at 1 in 10: variance N (w - 1) = 90000, margin 1.96 * 300
+    SampleVariance variance;
+    for (int kept = 0; kept < 1000; ++kept) {
+        variance.add(10, 100);
+    }
+    check(variance.packets == 90000, "packet variance of the expected sample is N (w - 1)");
+    check(variance.packetMargin() == 588, "packet margin is 1.96 standard deviations");
+    check(variance.bytes == 90000.0 * 100 * 100, "byte variance scales with the packet size squared");
+    check(variance.byteMargin() == 58800, "byte margin scales with the packet size");
+}
+
+static void testCoverage()
+{
+    const int Packets = 10000;
+    const quint16 Weight = 10;
+    const int Runs = 2000;
+    quint64 state = 42;
+    int covered = 0;
+    double varianceSum = 0;
+    for (int run = 0; run < Runs; ++run) {
+        SampleVariance variance;
+        quint64 kept = 0;
+        for (int i = 0; i < Packets; ++i) {
+            if (nextRandom(&state) % Weight == 0) {
+                ++kept;
+                variance.add(Weight, 1);
+            }
+        }
+        const qint64 error = qint64(kept * Weight) - Packets;
+        covered += quint64(std::llabs(error)) <= variance.packetMargin() ? 1 : 0;
+        varianceSum += variance.packets;
+    }
+    const double coverage = double(covered) / Runs;
+    std::printf("coverage %.3f, mean variance %.0f\n", coverage, varianceSum / Runs);
+    check(coverage > 0.93 && coverage < 0.97, "95% interval covers the true count in about 95% of runs");
+    check(std::fabs(varianceSum / Runs - double(Packets) * (Weight - 1)) < 0.02 * Packets * (Weight - 1),
+          "estimated variance averages to the binomial variance");
+}
+
+static void testFlowUnits()
+{
+    // A flow side kept with probability 1/w contributes y^2 w (w - 1), added packet by packet
+    SampleVariance variance;
+    const quint64 sizes[3] = {100, 200, 1500};
+    quint64 unitPackets = 0;
+    quint64 unitBytes = 0;
+    for (quint64 size : sizes) {
+        variance.add(4, size, unitPackets, unitBytes);
+        ++unitPackets;
+        unitBytes += size;
+    }
+    check(variance.packets == 3.0 * 3 * 4 * 3, "flow packet variance is the square of its packet count");
+    check(variance.bytes == 1800.0 * 1800 * 4 * 3, "flow byte variance is the square of its byte count");
+
+    SampleVariance exact;
+    exact.add(1, 1500);
+    check(exact.isEmpty() && exact.packetMargin() == 0, "unsampled packets add no variance");
+
+    SampleVariance merged;
+    merged.merge(variance);
+    merged.merge(variance);
+    check(merged.packets == 2 * variance.packets && merged.bytes == 2 * variance.bytes,
+          "independent units merge by adding variances");
+}
+
+int main()
+{
+    testKnownBinomial();
+    testCoverage();
+    testFlowUnits();
+    return testSummary("packet sampler");
+}
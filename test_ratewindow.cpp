@@ -0,0 +1,104 @@
+#include "src/capture/ratewindow.h"
+#include "test_harness.h"
+#include <cmath>
+
+// Tests for RateWindow: the per-second rate and window average, the EWMA folding each closed
+// second in and decaying by the same factor over silent ones whether or not anything is
+// added, and late or too-old bytes staying out of it.
+
+typedef RateWindow<quint64, 6> Window;
+
+static const quint64 Second = Window::BucketUs;
+static const double Decay = 1.0 - Window::SmoothingFactor;
+
+static bool near(double value, double expected)
+{
+    return std::fabs(value - expected) <= 1e-6 * qMax(1.0, std::fabs(expected));
+}
+
+static void testRates()
+{
+    Window window;
+    window.add(10 * Second + 100, 0, 1000);
+    window.add(10 * Second + 900000, 0, 500);
+    window.add(11 * Second, 1, 300);
+    check(window.rate(11 * Second + 5, 0) == 1500, "rate is the last complete second");
+    check(window.rate(11 * Second + 5, 1) == 0, "open second does not count yet");
+    check(window.rate(12 * Second, 1) == 300, "second counts once it closes");
+    check(window.averageRate(12 * Second, 0) == 1500 / 5, "average spreads over the complete buckets");
+    check(window.rate(13 * Second, 0) == 0, "silent second has no rate");
+}
+
+static void testEwmaDecay()
+{
+    Window window;
+    window.add(10 * Second, 0, 1000);
+    check(window.smoothedRate(10 * Second + 500000, 0) == 0, "open second is not in the EWMA");
+    const double first = Window::SmoothingFactor * 1000;
+    check(near(window.smoothedRate(11 * Second, 0), first), "closed second folds in with the smoothing factor");
+
+    bool decays = true;
+    for (int silent = 1; silent <= 20; ++silent) {
+        const double expected = first * std::pow(Decay, double(silent));
+        decays = decays && near(window.smoothedRate((11 + silent) * Second, 0), expected);
+    }
+    check(decays, "each silent second multiplies the EWMA by one minus the factor");
+
+    // Adding after a gap folds the silent seconds in the same way as reading across it
+    Window rolled = window;
+    const double projected = window.smoothedRate(15 * Second, 0);
+    rolled.add(15 * Second, 1, 1);
+    check(near(rolled.smoothed[0], projected), "roll across silent seconds matches the projection");
+    rolled.add(15 * Second + 10, 0, 2000);
+    const double next = projected * Decay + Window::SmoothingFactor * 2000;
+    check(near(rolled.smoothedRate(16 * Second, 0), next), "new second folds in on top of the decayed value");
+    check(near(rolled.smoothedRate(16 * Second, 1), Window::SmoothingFactor), "directions decay separately");
+}
+
+static void testSteadyRate()
+{
+    // A constant rate converges on itself
+    Window window;
+    for (quint64 second = 1; second <= 60; ++second) {
+        window.add(second * Second + 1, 0, 4000);
+    }
+    check(std::fabs(window.smoothedRate(61 * Second, 0) - 4000) < 1, "steady traffic converges to its rate");
+    check(!window.isIdle(61 * Second), "window with traffic is not idle");
+}
+
+static void testLateAndOld()
+{
+    Window window;
+    window.add(20 * Second, 0, 100);
+    window.add(21 * Second, 0, 100);
+    const double before = window.smoothed[0];
+    window.add(20 * Second + 5, 0, 700);
+    check(window.rate(22 * Second, 0) == 100 && window.averageRate(22 * Second, 0) == 900 / 5,
+          "late bytes count in the window");
+    check(window.smoothed[0] == before, "late bytes stay out of the EWMA");
+    window.add(10 * Second, 0, 5000);
+    // Second 10 would share its bucket with second 16, which is still in the window
+    check(window.rate(17 * Second, 0) == 0 && window.averageRate(22 * Second, 0) == 900 / 5,
+          "bytes older than the window are dropped");
+}
+
+static void testIdle()
+{
+    Window window;
+    check(window.isIdle(0), "new window is idle");
+    window.add(5 * Second, 0, 10000);
+    check(!window.isIdle(8 * Second), "window with bytes is not idle");
+    // 0.3 * 10000 * 0.7^n falls below 1 after 23 silent seconds
+    check(!window.isIdle(20 * Second), "decaying EWMA keeps the window busy");
+    check(window.isIdle(40 * Second), "window is idle once the EWMA decays below a byte");
+}
+
+int main()
+{
+    testRates();
+    testEwmaDecay();
+    testSteadyRate();
+    testLateAndOld();
+    testIdle();
+    return testSummary("rate window");
+}
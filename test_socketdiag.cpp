@@ -0,0 +1,214 @@
+#include "src/capture/socketdiag.h"
+#include "test_harness.h"
+#include <cstdio>
+
+#ifdef Q_OS_LINUX
+
+#include <cerrno>
+#include <cstring>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// Tests for SocketDiag: the records of a sock_diag dump read into sockets, messages of other
+// dumps and short records skipped, kernel errors reported, and, where the kernel allows a
+// dump, a listening socket of this process found with its owner.
+
+static const quint32 Sequence = 7;
+
+// A receive buffer of netlink messages, each aligned as the kernel aligns them
+struct Dump {
+    std::vector<quint8> bytes;
+
+    void append(quint16 type, quint32 sequence, const void *payload, quint32 payloadLength)
+    {
+        const size_t start = bytes.size();
+        bytes.resize(start + NLMSG_ALIGN(NLMSG_LENGTH(payloadLength)), 0);
+        nlmsghdr header;
+        std::memset(&header, 0, sizeof(header));
+        header.nlmsg_len = NLMSG_LENGTH(payloadLength);
+        header.nlmsg_type = type;
+        header.nlmsg_flags = NLM_F_MULTI;
+        header.nlmsg_seq = sequence;
+        std::memcpy(bytes.data() + start, &header, sizeof(header));
+        if (payloadLength > 0) {
+            std::memcpy(bytes.data() + start + NLMSG_HDRLEN, payload, payloadLength);
+        }
+    }
+
+    void appendSocket(const inet_diag_msg &diag, quint32 sequence = Sequence)
+    {
+        append(SOCK_DIAG_BY_FAMILY, sequence, &diag, sizeof(diag));
+    }
+
+    void appendDone() { append(NLMSG_DONE, Sequence, nullptr, 0); }
+
+    SocketDiag::ParseResult parse(std::vector<SocketDiag::Socket> *out, int *error) const
+    {
+        return SocketDiag::parseDump(bytes.data(), bytes.size(), Sequence, IPPROTO_TCP, out, error);
+    }
+};
+
+static inet_diag_msg ipv4Socket(quint32 local, quint16 localPort, quint32 remote, quint16 remotePort, quint8 state)
+{
+    inet_diag_msg diag;
+    std::memset(&diag, 0, sizeof(diag));
+    diag.idiag_family = AF_INET;
+    diag.idiag_state = state;
+    diag.id.idiag_sport = htons(localPort);
+    diag.id.idiag_dport = htons(remotePort);
+    diag.id.idiag_src[0] = htonl(local);
+    diag.id.idiag_dst[0] = htonl(remote);
+    diag.idiag_uid = 1000;
+    diag.idiag_inode = 4242;
+    return diag;
+}
+
+static void testRecords()
+{
+    Dump dump;
+    dump.appendSocket(ipv4Socket(0x0A000001, 40000, 0xC0000201, 443, SocketDiag::Established));
+    dump.appendSocket(ipv4Socket(0, 22, 0, 0, SocketDiag::Listen));
+
+    // ::ffff:192.0.2.9 on a dual-stack socket
+    inet_diag_msg mapped;
+    std::memset(&mapped, 0, sizeof(mapped));
+    mapped.idiag_family = AF_INET6;
+    mapped.idiag_state = SocketDiag::Established;
+    mapped.id.idiag_sport = htons(8080);
+    quint8 *local = reinterpret_cast<quint8 *>(mapped.id.idiag_src);
+    local[10] = 0xff;
+    local[11] = 0xff;
+    local[12] = 192;
+    local[15] = 9;
+    dump.appendSocket(mapped);
+    dump.appendDone();
+
+    std::vector<SocketDiag::Socket> sockets;
+    int error = 0;
+    check(dump.parse(&sockets, &error) == SocketDiag::ParseDone && sockets.size() == 3, "three records, then done");
+    if (sockets.size() != 3) {
+        return;
+    }
+    const SocketDiag::Socket &connected = sockets[0];
+    check(connected.localAddress.bytes()[12] == 10 && connected.localAddress.bytes()[15] == 1 &&
+              connected.remoteAddress.bytes()[12] == 192 && connected.remoteAddress.bytes()[15] == 1,
+          "IPv4 addresses in network order");
+    check(connected.localPort == 40000 && connected.remotePort == 443, "ports in host byte order");
+    check(connected.protocol == IPPROTO_TCP && connected.ipVersion == 4 && connected.uid == 1000 &&
+              connected.inode == 4242,
+          "protocol, version, uid and inode");
+    check(sockets[1].localAddress.isNull() && sockets[1].remoteAddress.isNull() &&
+              sockets[1].state == SocketDiag::Listen,
+          "wildcard addresses are null");
+    check(sockets[2].ipVersion == 6 && sockets[2].localAddress.isIPv4() && sockets[2].localAddress.bytes()[15] == 9,
+          "IPv4-mapped address of a dual-stack socket");
+}
+
+static void testSkipped()
+{
+    Dump dump;
+    dump.appendSocket(ipv4Socket(1, 1, 2, 2, SocketDiag::Established), Sequence - 1); // An abandoned dump
+    dump.append(SOCK_DIAG_BY_FAMILY, Sequence, "short", 5);                         // Shorter than a record
+    dump.append(NLMSG_NOOP, Sequence, nullptr, 0);
+    dump.appendSocket(ipv4Socket(3, 3, 4, 4, SocketDiag::Established));
+
+    std::vector<SocketDiag::Socket> sockets;
+    int error = 0;
+    check(dump.parse(&sockets, &error) == SocketDiag::ParseMore, "dump without NLMSG_DONE goes on");
+    check(sockets.size() == 1 && sockets[0].localPort == 3, "other dumps and short records skipped");
+
+    // A message whose length runs past the buffer ends the receive
+    Dump cut;
+    cut.appendSocket(ipv4Socket(5, 5, 6, 6, SocketDiag::Established));
+    cut.bytes.resize(cut.bytes.size() - 8);
+    sockets.clear();
+    check(cut.parse(&sockets, &error) == SocketDiag::ParseMore && sockets.empty(), "message cut short not read");
+}
+
+static void testErrors()
+{
+    Dump dump;
+    nlmsgerr refused;
+    std::memset(&refused, 0, sizeof(refused));
+    refused.error = -ENOENT;
+    dump.appendSocket(ipv4Socket(1, 1, 2, 2, SocketDiag::Established));
+    dump.append(NLMSG_ERROR, Sequence, &refused, sizeof(refused));
+
+    std::vector<SocketDiag::Socket> sockets;
+    int error = 0;
+    check(dump.parse(&sockets, &error) == SocketDiag::ParseFailed && error == ENOENT, "kernel error reported");
+
+    Dump shortError;
+    shortError.append(NLMSG_ERROR, Sequence, &refused, 2);
+    check(shortError.parse(&sockets, &error) == SocketDiag::ParseFailed && error == EBADMSG,
+          "short error message reported as malformed");
+
+    check(std::strcmp(SocketDiag::stateName(SocketDiag::Listen), "LISTENING") == 0 &&
+              std::strcmp(SocketDiag::stateName(SocketDiag::NewSynReceived), "SYN_RECEIVED") == 0 &&
+              std::strcmp(SocketDiag::stateName(200), "UNKNOWN") == 0,
+          "state names");
+}
+
+static void testLiveDump()
+{
+    const int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        ::listen(listener, 1) < 0 ||
+        ::getsockname(listener, reinterpret_cast<sockaddr *>(&address), &addressLength) < 0) {
+        std::printf("SKIP: no listening socket for the live dump\n");
+        return;
+    }
+    const quint16 port = ntohs(address.sin_port);
+
+    SocketDiag diag;
+    std::vector<SocketDiag::Socket> sockets;
+    if (!diag.dump(IPPROTO_TCP, SocketDiag::stateBit(SocketDiag::Listen), &sockets)) {
+        std::printf("SKIP: the kernel refused a dump: %s\n", qPrintable(diag.errorString()));
+        ::close(listener);
+        return;
+    }
+    const SocketDiag::Socket *found = nullptr;
+    for (const SocketDiag::Socket &socket : sockets) {
+        if (socket.localPort == port && socket.ipVersion == 4) {
+            found = &socket;
+        }
+    }
+    check(found && found->state == SocketDiag::Listen && found->localAddress.bytes()[12] == 127,
+          "listening socket in the live dump");
+
+    QHash<quint32, qint64> owners;
+    SocketDiag::socketOwners(&owners);
+    check(found && found->inode != 0 && owners.value(found->inode) == qint64(::getpid()),
+          "owner found from the socket inode");
+    ::close(listener);
+}
+
+int main()
+{
+    testRecords();
+    testSkipped();
+    testErrors();
+    testLiveDump();
+
+    return testSummary("socket diag");
+}
+
+#else
+
+int main()
+{
+    std::printf("SocketDiag is Linux only\n");
+    return 0;
+}
+
+#endif // Q_OS_LINUX
@@ -0,0 +1,323 @@
+#include "src/capture/httplatencytracker.h"
+#include "src/capture/packetdecoder.h"
+#include "src/capture/protocolclassifier.h"
+#include "src/capture/tcpreassembler.h"
+#include "test_harness.h"
+#include <cstring>
+#include <string>
+
+// Tests for TcpReassembler and HttpLatencyTracker: segments delivered in sequence order when
+// they arrive out of order, streams closed at a gap rather than delivered with a hole, the
+// depth cut-off, and pipelined HTTP/1.1 requests matched to their responses in order.
+
+static const quint32 ClientIsn = 1000;
+static const quint32 ServerIsn = 50000;
+
+// The bytes each side of the stream delivered, in delivery order
+struct Recorder {
+    std::string sides[2];
+    quint32 nextOffset[2] = {0, 0};
+    bool contiguous = true;
+    int closed = 0;
+
+    static bool accept(void *, const PacketDescriptor &) { return true; }
+
+    static void data(void *user, const TcpReassembler::Span &span)
+    {
+        Recorder *recorder = static_cast<Recorder *>(user);
+        recorder->contiguous = recorder->contiguous && span.offset == recorder->nextOffset[span.sender];
+        recorder->nextOffset[span.sender] = span.offset + span.length;
+        recorder->sides[span.sender].append(reinterpret_cast<const char *>(span.data), span.length);
+    }
+
+    static void close(void *user, const FlowKey &)
+    {
+        static_cast<Recorder *>(user)->closed++;
+    }
+};
+
+// One TCP segment of the connection 10.0.0.1:40000 -> 10.0.0.2:80. fromClient picks the
+// direction; offset counts payload bytes from the side's first byte after its SYN.
+static PacketDescriptor segment(bool fromClient, quint32 offset, quint8 flags, quint16 length,
+                                quint64 timestampUs = 1000)
+{
+    PacketDescriptor descriptor;
+    descriptor.timestampUs = timestampUs;
+    descriptor.srcAddr = fromClient ? ipv4(10, 0, 0, 1) : ipv4(10, 0, 0, 2);
+    descriptor.dstAddr = fromClient ? ipv4(10, 0, 0, 2) : ipv4(10, 0, 0, 1);
+    descriptor.srcPort = fromClient ? 40000 : 80;
+    descriptor.dstPort = fromClient ? 80 : 40000;
+    descriptor.protocol = PacketDecoder::ProtocolTcp;
+    descriptor.ipVersion = 4;
+    descriptor.tcpFlags = flags;
+    descriptor.tcpSeq = (fromClient ? ClientIsn : ServerIsn) + 1 + offset;
+    descriptor.payloadLength = length;
+    descriptor.capturedPayloadLength = length;
+    return descriptor;
+}
+
+static void handshake(TcpReassembler *reassembler)
+{
+    PacketDescriptor syn = segment(true, 0, PacketDescriptor::TcpSyn, 0);
+    syn.tcpSeq = ClientIsn;
+    PacketDescriptor synAck = segment(false, 0, PacketDescriptor::TcpSyn | PacketDescriptor::TcpAck, 0);
+    synAck.tcpSeq = ServerIsn;
+    reassembler->process(syn, nullptr);
+    reassembler->process(synAck, nullptr);
+}
+
+// Sends part of text, from offset for length bytes, as one segment
+static void send(TcpReassembler *reassembler, bool fromClient, const char *text, quint32 offset, quint16 length,
+                 quint64 timestampUs = 1000)
+{
+    const PacketDescriptor packet = segment(fromClient, offset, PacketDescriptor::TcpAck, length, timestampUs);
+    reassembler->process(packet, reinterpret_cast<const quint8 *>(text) + offset);
+}
+
+static void testOutOfOrder()
+{
+    TcpReassembler reassembler;
+    Recorder recorder;
+    reassembler.addConsumer(Recorder::accept, Recorder::data, Recorder::close, &recorder);
+    handshake(&reassembler);
+
+    const char *text = "first-second-third-fourth";
+    send(&reassembler, true, text, 13, 6);  // "third-"
+    send(&reassembler, true, text, 19, 6);  // "fourth"
+    check(recorder.sides[0].empty(), "segments after a gap wait for it");
+    send(&reassembler, true, text, 0, 6);   // "first-"
+    check(recorder.sides[0] == "first-", "bytes before the gap delivered");
+    send(&reassembler, true, text, 6, 7);   // "second-"
+    check(recorder.sides[0] == text && recorder.contiguous, "waiting segments delivered once the gap fills");
+
+    // A retransmission overlapping what was delivered adds only the new bytes
+    const char *more = "first-second-third-fourth-fifth";
+    send(&reassembler, true, more, 19, 12);
+    check(recorder.sides[0] == more && recorder.contiguous, "overlapping retransmission trimmed");
+    send(&reassembler, true, more, 0, 6);
+    check(recorder.sides[0] == more, "duplicate segment ignored");
+
+    const TcpReassembler::Statistics stats = reassembler.statistics();
+    check(stats.streams == 1 && stats.outOfOrder == 2 && stats.gaps == 0, "out-of-order statistics");
+    check(stats.bytes == std::strlen(more), "delivered bytes counted once");
+}
+
+static void testGaps()
+{
+    // A segment that was not captured whole closes the stream at the hole
+    TcpReassembler reassembler;
+    Recorder recorder;
+    reassembler.addConsumer(Recorder::accept, Recorder::data, Recorder::close, &recorder);
+    handshake(&reassembler);
+
+    const char *text = "0123456789abcdefghij";
+    send(&reassembler, true, text, 0, 5);
+    PacketDescriptor snapped = segment(true, 5, PacketDescriptor::TcpAck, 10);
+    snapped.capturedPayloadLength = 4;
+    reassembler.process(snapped, reinterpret_cast<const quint8 *>(text) + 5);
+    check(recorder.sides[0] == "012345678", "captured part of a snapped segment delivered");
+    check(recorder.closed == 1 && reassembler.statistics().gaps == 1, "stream closed at the missing bytes");
+    send(&reassembler, true, text, 15, 5);
+    check(recorder.sides[0] == "012345678", "nothing delivered past the hole");
+
+    // An early segment that was snapped cannot wait for its gap either
+    TcpReassembler early;
+    Recorder earlyRecorder;
+    early.addConsumer(Recorder::accept, Recorder::data, Recorder::close, &earlyRecorder);
+    handshake(&early);
+    PacketDescriptor ahead = segment(true, 10, PacketDescriptor::TcpAck, 10);
+    ahead.capturedPayloadLength = 6;
+    early.process(ahead, reinterpret_cast<const quint8 *>(text) + 10);
+    check(earlyRecorder.closed == 1 && early.statistics().gaps == 1, "snapped early segment closes the stream");
+
+    // A gap that never fills: the connection ends with the waiting bytes undelivered
+    TcpReassembler unfilled;
+    Recorder unfilledRecorder;
+    unfilled.addConsumer(Recorder::accept, Recorder::data, Recorder::close, &unfilledRecorder);
+    handshake(&unfilled);
+    send(&unfilled, true, text, 0, 5);
+    send(&unfilled, true, text, 10, 5);
+    unfilled.process(segment(true, 15, PacketDescriptor::TcpFin | PacketDescriptor::TcpAck, 0), nullptr);
+    unfilled.process(segment(false, 0, PacketDescriptor::TcpFin | PacketDescriptor::TcpAck, 0), nullptr);
+    check(unfilledRecorder.sides[0] == "01234" && unfilledRecorder.closed == 1,
+          "waiting bytes dropped when the connection ends");
+}
+
+static void testDepth()
+{
+    TcpReassembler reassembler;
+    Recorder recorder;
+    reassembler.addConsumer(Recorder::accept, Recorder::data, Recorder::close, &recorder);
+    reassembler.setDepth(12);
+    handshake(&reassembler);
+
+    const char *request = "GET / HTTP/1.1\r\n";
+    const char *response = "HTTP/1.1 200 OK\r\n";
+    send(&reassembler, true, request, 8, 8);  // Waits, and only its first 4 bytes are within the depth
+    send(&reassembler, true, request, 0, 8);
+    check(recorder.sides[0] == "GET / HTTP/1" && recorder.closed == 0, "client side cut at the depth");
+    send(&reassembler, false, response, 0, 17);
+    check(recorder.sides[1] == "HTTP/1.1 200" && recorder.closed == 1,
+          "stream finished once both sides reach the depth");
+    check(reassembler.statistics().bytes == 24, "bytes past the depth not delivered");
+
+    // A segment wholly past the depth is not buffered at all
+    TcpReassembler beyond;
+    Recorder beyondRecorder;
+    beyond.addConsumer(Recorder::accept, Recorder::data, Recorder::close, &beyondRecorder);
+    beyond.setDepth(4);
+    handshake(&beyond);
+    send(&beyond, true, request, 8, 8);
+    send(&beyond, true, request, 0, 4);
+    check(beyondRecorder.sides[0] == "GET " && beyond.statistics().outOfOrder == 1,
+          "early bytes past the depth skipped");
+
+    // Depth 0 opens no streams
+    TcpReassembler off;
+    Recorder offRecorder;
+    off.addConsumer(Recorder::accept, Recorder::data, Recorder::close, &offRecorder);
+    off.setDepth(0);
+    handshake(&off);
+    send(&off, true, request, 0, 16);
+    check(offRecorder.sides[0].empty() && off.statistics().streams == 0, "depth 0 turns reassembly off");
+}
+
+// Every transaction the tracker queued so far
+static int takeTransactions(HttpLatencyTracker *tracker, HttpTransaction *out, int maxCount)
+{
+    return int(tracker->queue()->popBatch(out, size_t(maxCount)));
+}
+
+static void testPipelining()
+{
+    TcpReassembler reassembler;
+    HttpLatencyTracker tracker;
+    reassembler.addConsumer(HttpLatencyTracker::acceptStream, HttpLatencyTracker::streamData,
+                            HttpLatencyTracker::streamClosed, &tracker);
+    handshake(&reassembler);
+
+    // Three requests in one segment, the second one HEAD
+    const std::string requests = "GET /a HTTP/1.1\r\nHost: example.test\r\n\r\n"
+                                 "HEAD /b HTTP/1.1\r\nHost: example.test\r\n\r\n"
+                                 "POST /c HTTP/1.1\r\nHost: example.test\r\nContent-Length: 5\r\n\r\nhello";
+    send(&reassembler, true, requests.c_str(), 0, quint16(requests.size()), 1000);
+
+    // The responses arrive one at a time; the first is chunked and split across segments, the
+    // second has a length but no body, since it answers HEAD
+    const std::string first = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n";
+    const std::string second = "HTTP/1.1 404 Not Found\r\nContent-Length: 100\r\n\r\n";
+    const std::string third = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+    const std::string responses = first + second + third;
+    const quint32 split = 30;
+    send(&reassembler, false, responses.c_str(), 0, quint16(split), 5000);
+    send(&reassembler, false, responses.c_str(), split, quint16(first.size() - split), 5500);
+    send(&reassembler, false, responses.c_str(), quint32(first.size()), quint16(second.size()), 7000);
+    send(&reassembler, false, responses.c_str(), quint32(first.size() + second.size()), quint16(third.size()),
+         9000);
+
+    HttpTransaction transactions[4];
+    const int count = takeTransactions(&tracker, transactions, 4);
+    check(count == 3, "each pipelined request matched to a response");
+    check(transactions[0].statusCode == 200 && transactions[0].latencyUs == 4000, "first request timed");
+    check(transactions[1].statusCode == 404 && transactions[1].latencyUs == 6000,
+          "HEAD response matched without a body");
+    check(transactions[2].statusCode == 503 && transactions[2].latencyUs == 8000, "third request timed");
+    check(std::strcmp(transactions[0].host, "example.test") == 0 && transactions[0].serverPort == 80 &&
+              transactions[0].client == ipv4(10, 0, 0, 1),
+          "host and endpoints of the transaction");
+
+    const HttpLatencyTracker::Statistics stats = tracker.statistics();
+    check(stats.requests == 3 && stats.responses == 3 && stats.unanswered == 0, "pipelining statistics");
+}
+
+static void testInterimAndUnanswered()
+{
+    TcpReassembler reassembler;
+    HttpLatencyTracker tracker;
+    reassembler.addConsumer(HttpLatencyTracker::acceptStream, HttpLatencyTracker::streamData,
+                            HttpLatencyTracker::streamClosed, &tracker);
+    handshake(&reassembler);
+
+    const std::string requests = "PUT /x HTTP/1.1\r\nContent-Length: 3\r\n\r\nabcGET /y HTTP/1.1\r\n\r\n";
+    send(&reassembler, true, requests.c_str(), 0, quint16(requests.size()), 1000);
+    // 100 Continue is not the response; the final one that follows it is
+    const std::string responses = "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n";
+    send(&reassembler, false, responses.c_str(), 0, 25, 2000);
+    send(&reassembler, false, responses.c_str(), 25, quint16(responses.size() - 25), 3000);
+
+    HttpTransaction transactions[2];
+    check(takeTransactions(&tracker, transactions, 2) == 1 && transactions[0].statusCode == 201 &&
+              transactions[0].latencyUs == 2000,
+          "interim response skipped");
+
+    reassembler.process(segment(true, quint32(requests.size()), PacketDescriptor::TcpRst, 0, 4000), nullptr);
+    check(tracker.statistics().unanswered == 1, "request left open at reset counted unanswered");
+}
+
+static void testNotHttp()
+{
+    TcpReassembler reassembler;
+    HttpLatencyTracker tracker;
+    reassembler.addConsumer(HttpLatencyTracker::acceptStream, HttpLatencyTracker::streamData,
+                            HttpLatencyTracker::streamClosed, &tracker);
+    handshake(&reassembler);
+
+    const char *garbage = "\x16\x03\x01\x02\x00 not HTTP at all\r\nGET / HTTP/1.1\r\n\r\n";
+    send(&reassembler, true, garbage, 0, quint16(std::strlen(garbage)));
+    check(tracker.statistics().requests == 0, "stream that does not start with HTTP ignored");
+
+    // Other ports are not followed unless the classifier called them HTTP
+    PacketDescriptor elsewhere = segment(true, 0, PacketDescriptor::TcpSyn, 0);
+    elsewhere.dstPort = 5432;
+    check(!HttpLatencyTracker::acceptStream(&tracker, elsewhere), "non-HTTP port not accepted");
+    elsewhere.appProtocol = ProtocolClassifier::Http;
+    check(HttpLatencyTracker::acceptStream(&tracker, elsewhere), "classified HTTP accepted on any port");
+}
+
+// Accepts only packets the classifier called HTTP, so later packets reach their stream
+// through the bitmap of open streams
+static bool acceptClassified(void *, const PacketDescriptor &packet)
+{
+    return packet.appProtocol == ProtocolClassifier::Http;
+}
+
+static void testAcceptedFlowsOnly()
+{
+    TcpReassembler reassembler;
+    Recorder recorder;
+    reassembler.addConsumer(acceptClassified, Recorder::data, Recorder::close, &recorder);
+    handshake(&reassembler);
+    check(reassembler.statistics().streams == 0, "unaccepted handshake opens nothing");
+
+    const char *text = "GET / HTTP/1.1\r\n\r\n";
+    PacketDescriptor first = segment(true, 0, PacketDescriptor::TcpAck, 8);
+    first.appProtocol = ProtocolClassifier::Http;
+    reassembler.process(first, reinterpret_cast<const quint8 *>(text));
+    send(&reassembler, true, text, 8, quint16(std::strlen(text) - 8));
+    check(recorder.sides[0] == text, "unclassified packets of an accepted flow still delivered");
+
+    // Another flow between the same hosts is not looked up, let alone opened
+    PacketDescriptor other = segment(true, 0, PacketDescriptor::TcpAck, 8);
+    other.srcPort = 40001;
+    reassembler.process(other, reinterpret_cast<const quint8 *>(text));
+    check(reassembler.statistics().streams == 1 && recorder.sides[0] == text, "unaccepted flow left alone");
+
+    // Once the stream ends and the expiry sweep rebuilds the bitmap, its flow is turned away too
+    reassembler.process(segment(true, 20, PacketDescriptor::TcpRst, 0), nullptr);
+    reassembler.expire(1000 + 2 * TcpReassembler::IdleTimeoutUs);
+    send(&reassembler, true, text, 0, 8, 2000);
+    check(recorder.closed == 1 && recorder.sides[0] == text, "closed flow not reopened without acceptance");
+}
+
+int main()
+{
+    testOutOfOrder();
+    testGaps();
+    testDepth();
+    testPipelining();
+    testInterimAndUnanswered();
+    testNotHttp();
+    testAcceptedFlowsOnly();
+
+    return testSummary("reassembly");
+}
@@ -0,0 +1,163 @@
+#include "src/capture/tlsfingerprint.h"
+#include "src/capture/tlsparser.h"
+#include "test_harness.h"
+#include <cstring>
+#include <vector>
+
+// Tests for TlsParser and TlsFingerprint against published vectors: the JA3 example from the
+// JA3 README and the Chrome ClientHello from the JA4 technical details, sent with GREASE
+// values that both fingerprints must ignore. Also checks that hellos cut short are rejected.
+
+static void appendList16(std::vector<quint8> *out, const std::vector<quint16> &values)
+{
+    appendBe16(out, quint16(2 * values.size()));
+    for (quint16 value : values) {
+        appendBe16(out, value);
+    }
+}
+
+static void appendExtension(std::vector<quint8> *extensions, quint16 type, const std::vector<quint8> &data)
+{
+    appendBe16(extensions, type);
+    appendBe16(extensions, quint16(data.size()));
+    extensions->insert(extensions->end(), data.begin(), data.end());
+}
+
+static std::vector<quint8> serverName(const char *name)
+{
+    const quint16 length = quint16(std::strlen(name));
+    std::vector<quint8> data;
+    appendBe16(&data, quint16(length + 3));
+    data.push_back(0); // host_name
+    appendBe16(&data, length);
+    data.insert(data.end(), name, name + length);
+    return data;
+}
+
+static std::vector<quint8> list16(const std::vector<quint16> &values)
+{
+    std::vector<quint8> data;
+    appendList16(&data, values);
+    return data;
+}
+
+// Record and handshake headers around a ClientHello body with the given fields
+static std::vector<quint8> clientHello(quint16 legacyVersion, const std::vector<quint16> &ciphers,
+                                       const std::vector<quint8> &extensions)
+{
+    std::vector<quint8> body;
+    appendBe16(&body, legacyVersion);
+    body.insert(body.end(), 32, 0x42); // Random
+    body.push_back(32);                // Session ID
+    body.insert(body.end(), 32, 0x17);
+    appendList16(&body, ciphers);
+    body.push_back(1); // Compression methods: null
+    body.push_back(0);
+    appendBe16(&body, quint16(extensions.size()));
+    body.insert(body.end(), extensions.begin(), extensions.end());
+
+    std::vector<quint8> record;
+    record.push_back(quint8(TlsParser::ContentTypeHandshake));
+    appendBe16(&record, 0x0301);
+    appendBe16(&record, quint16(body.size() + TlsParser::HandshakeHeaderLength));
+    record.push_back(quint8(TlsParser::HandshakeClientHello));
+    record.push_back(quint8(body.size() >> 16));
+    record.push_back(quint8(body.size() >> 8));
+    record.push_back(quint8(body.size()));
+    record.insert(record.end(), body.begin(), body.end());
+    return record;
+}
+
+// 769,47-53-5-10-49161-49162-49171-49172-50-56-19-4,0-10-11,23-24-25,0
+static std::vector<quint8> ja3ReadmeHello()
+{
+    std::vector<quint8> extensions;
+    appendExtension(&extensions, TlsParser::ExtensionServerName, serverName("example.com"));
+    appendExtension(&extensions, TlsParser::ExtensionSupportedGroups, list16({23, 24, 25}));
+    appendExtension(&extensions, TlsParser::ExtensionPointFormats, {1, 0});
+    return clientHello(0x0301, {47, 53, 5, 10, 49161, 49162, 49171, 49172, 50, 56, 19, 4}, extensions);
+}
+
+// The JA4 example t13d1516h2_8daaf6152771_e5627efa2ab1, with GREASE around it as Chrome sends it
+static std::vector<quint8> chromeHello()
+{
+    std::vector<quint8> extensions;
+    appendExtension(&extensions, 0x1A1A, {});
+    appendExtension(&extensions, TlsParser::ExtensionServerName, serverName("www.Example.com"));
+    appendExtension(&extensions, 0x0017, {});
+    appendExtension(&extensions, 0xFF01, {0});
+    appendExtension(&extensions, TlsParser::ExtensionSupportedGroups, list16({0x3A3A, 0x001D, 0x0017, 0x0018}));
+    appendExtension(&extensions, TlsParser::ExtensionPointFormats, {1, 0});
+    appendExtension(&extensions, 0x0023, {});
+    appendExtension(&extensions, TlsParser::ExtensionAlpn,
+                    {0, 12, 2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1'});
+    appendExtension(&extensions, 0x0005, {1, 0, 0, 0, 0});
+    appendExtension(&extensions, TlsParser::ExtensionSignatureAlgorithms,
+                    list16({0x0403, 0x0804, 0x0401, 0x0503, 0x0805, 0x0501, 0x0806, 0x0601}));
+    appendExtension(&extensions, 0x0012, {});
+    appendExtension(&extensions, 0x0033, {0, 5, 0x3A, 0x3A, 0, 1, 0});
+    appendExtension(&extensions, 0x002D, {1, 1});
+    appendExtension(&extensions, TlsParser::ExtensionSupportedVersions, {6, 0x6A, 0x6A, 0x03, 0x04, 0x03, 0x03});
+    appendExtension(&extensions, 0x001B, {2, 0, 2});
+    appendExtension(&extensions, 0x4469, {0, 3, 2, 'h', '2'});
+    appendExtension(&extensions, 0x0015, std::vector<quint8>(16, 0));
+    appendExtension(&extensions, 0x2A2A, {0});
+    return clientHello(0x0303,
+                       {0x0A0A, 0x1301, 0x1302, 0x1303, 0xC02B, 0xC02F, 0xC02C, 0xC030, 0xCCA9, 0xCCA8, 0xC013,
+                        0xC014, 0x009C, 0x009D, 0x002F, 0x0035},
+                       extensions);
+}
+
+static void testJa3()
+{
+    const std::vector<quint8> hello = ja3ReadmeHello();
+    TlsClientHello parsed;
+    check(TlsParser::parse(hello.data(), quint32(hello.size()), &parsed), "JA3 example parses");
+    check(TlsFingerprint::ja3String(parsed) ==
+              QString("769,47-53-5-10-49161-49162-49171-49172-50-56-19-4,0-10-11,23-24-25,0"),
+          "JA3 string");
+    const TlsFingerprint fingerprint = TlsFingerprint::fromClientHello(parsed);
+    check(fingerprint.ja3 == QString("ada70206e40642a3e4461f35503241d5"), "JA3 hash");
+    check(fingerprint.serverName == QString("example.com"), "server name");
+}
+
+static void testJa4()
+{
+    const std::vector<quint8> hello = chromeHello();
+    TlsClientHello parsed;
+    check(TlsParser::parse(hello.data(), quint32(hello.size()), &parsed), "Chrome hello parses");
+    check(parsed.supportedVersion == 0x0304, "TLS 1.3 from supported_versions, GREASE skipped");
+    check(parsed.cipherSuiteCount == 16 && parsed.extensionCount == 18, "GREASE values kept in wire order");
+    const TlsFingerprint fingerprint = TlsFingerprint::fromClientHello(parsed);
+    check(fingerprint.ja4 == QString("t13d1516h2_8daaf6152771_e5627efa2ab1"), "JA4 fingerprint");
+    check(fingerprint.serverName == QString("www.example.com") && fingerprint.alpn == QString("h2"),
+          "server name lower-cased and first ALPN protocol");
+    check(TlsFingerprint::ja3String(parsed).startsWith("771,4865-4866-4867-49195-"), "JA3 skips GREASE ciphers");
+}
+
+static void testTruncation()
+{
+    const std::vector<quint8> hello = chromeHello();
+    TlsClientHello parsed;
+    bool allRejected = true;
+    for (quint32 length = 0; length < hello.size(); ++length) {
+        allRejected = allRejected && !TlsParser::parse(hello.data(), length, &parsed);
+    }
+    check(allRejected, "every truncated hello rejected");
+
+    // An extension claiming more bytes than the extensions block holds
+    std::vector<quint8> overrun = ja3ReadmeHello();
+    const size_t groupsLengthField = overrun.size() - 6 - 12 + 2; // Point formats, groups
+    overrun[groupsLengthField] = 0xFF;
+    check(!TlsParser::parse(overrun.data(), quint32(overrun.size()), &parsed), "extension overrun rejected");
+    check(TlsClientHello::isGrease(0xFAFA) && !TlsClientHello::isGrease(0x0A1A), "GREASE values recognised");
+}
+
+int main()
+{
+    testJa3();
+    testJa4();
+    testTruncation();
+
+    return testSummary("TLS");
+}
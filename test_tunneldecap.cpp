@@ -0,0 +1,285 @@
+#include "src/capture/packetdecoder.h"
+#include "src/capture/tunnelendpointtable.h"
+#include "test_harness.h"
+#include <initializer_list>
+#include <vector>
+
+// Tests for tunnel decapsulation in PacketDecoder: VXLAN, GENEVE, GRE and IP-in-IP packets
+// decoded down to the inner packet, the MaxTunnelDepth bound on nesting, inner packets cut
+// short by the snap length falling back to the outer packet, and the TunnelEndpointTable that
+// numbers the outer addresses.
+
+typedef std::vector<quint8> Bytes;
+
+static Bytes concat(std::initializer_list<Bytes> parts)
+{
+    Bytes bytes;
+    for (const Bytes &part : parts) {
+        bytes.insert(bytes.end(), part.begin(), part.end());
+    }
+    return bytes;
+}
+
+static Bytes ethernet(quint16 etherType)
+{
+    Bytes header(PacketDecoder::EthernetHeaderLength, 0);
+    header[0] = 0x02;
+    header[6] = 0x04;
+    putBe16(&header, 12, etherType);
+    return header;
+}
+
+// 10.0.0.host -> 10.0.0.host+1
+static Bytes ipv4Header(quint8 protocol, quint8 host, size_t payloadLength)
+{
+    Bytes header(20, 0);
+    header[0] = 0x45;
+    putBe16(&header, 2, quint16(20 + payloadLength));
+    header[8] = 64;
+    header[9] = protocol;
+    header[12] = 10;
+    header[15] = host;
+    header[16] = 10;
+    header[19] = quint8(host + 1);
+    return header;
+}
+
+// 2001:db8::host -> 2001:db8::host+1
+static Bytes ipv6Header(quint8 nextHeader, quint8 host, size_t payloadLength)
+{
+    Bytes header(40, 0);
+    header[0] = 0x60;
+    putBe16(&header, 4, quint16(payloadLength));
+    header[6] = nextHeader;
+    header[7] = 64;
+    header[8] = 0x20;
+    header[9] = 0x01;
+    header[10] = 0x0d;
+    header[11] = 0xb8;
+    header[23] = host;
+    header[24] = 0x20;
+    header[25] = 0x01;
+    header[26] = 0x0d;
+    header[27] = 0xb8;
+    header[39] = quint8(host + 1);
+    return header;
+}
+
+static Bytes udp(quint16 srcPort, quint16 dstPort, size_t payloadLength)
+{
+    Bytes header(8, 0);
+    putBe16(&header, 0, srcPort);
+    putBe16(&header, 2, dstPort);
+    putBe16(&header, 4, quint16(8 + payloadLength));
+    return header;
+}
+
+static const size_t InnerPayloadLength = 10;
+
+// The packet inside every tunnel: TCP 1234 -> 80 with ten bytes of payload
+static Bytes innerTcp(quint8 host = 100)
+{
+    Bytes tcp(20, 0);
+    putBe16(&tcp, 0, 1234);
+    putBe16(&tcp, 2, 80);
+    tcp[12] = 0x50;
+    tcp[13] = 0x18;
+    return concat({ipv4Header(PacketDecoder::ProtocolTcp, host, tcp.size() + InnerPayloadLength), tcp,
+                   Bytes(InnerPayloadLength, 'A')});
+}
+
+static Bytes vxlanHeader(quint32 vni)
+{
+    Bytes header(8, 0);
+    header[0] = 0x08;
+    header[4] = quint8(vni >> 16);
+    header[5] = quint8(vni >> 8);
+    header[6] = quint8(vni);
+    return header;
+}
+
+// VXLAN over UDP over IPv4 around an inner Ethernet frame
+static Bytes vxlan(const Bytes &innerFrame, quint32 vni)
+{
+    const Bytes tunnel = concat({vxlanHeader(vni), innerFrame});
+    return concat({ethernet(PacketDecoder::EtherTypeIPv4), ipv4Header(PacketDecoder::ProtocolUdp, 1, 8 + tunnel.size()),
+                   udp(5555, 4789, tunnel.size()), tunnel});
+}
+
+static bool decode(const Bytes &frame, bool tunnels, PacketDescriptor *out, quint32 captureLength = 0,
+                   TunnelEndpoints *endpoints = nullptr)
+{
+    const PacketDecoder::DecodeFunction function =
+        PacketDecoder::decoderForDataLink(PacketDecoder::DataLinkEthernet, tunnels);
+    TunnelEndpoints ignored;
+    *out = PacketDescriptor();
+    return function(frame.data(), captureLength ? captureLength : quint32(frame.size()), out,
+                    endpoints ? endpoints : &ignored);
+}
+
+static bool isInner(const PacketDescriptor &packet)
+{
+    return packet.protocol == PacketDecoder::ProtocolTcp && packet.srcPort == 1234 && packet.dstPort == 80;
+}
+
+static void testVxlan()
+{
+    const Bytes frame = vxlan(concat({ethernet(PacketDecoder::EtherTypeIPv4), innerTcp()}), 42);
+    PacketDescriptor packet;
+    check(decode(frame, false, &packet) && packet.dstPort == 4789 && packet.tunnel.type == TunnelInfo::None,
+          "without decapsulation the outer UDP packet is decoded");
+    TunnelEndpoints endpoints;
+    check(decode(frame, true, &packet, 0, &endpoints) && isInner(packet), "VXLAN decapsulated to the inner TCP packet");
+    check(packet.tunnel.type == TunnelInfo::Vxlan && packet.tunnel.id == 42 && packet.tunnel.depth == 1,
+          "VXLAN type, VNI and depth");
+    check(packet.srcAddr.bytes()[15] == 100 && endpoints.outerSrc.bytes()[15] == 1 &&
+              endpoints.outerDst.bytes()[15] == 2,
+          "inner addresses in the descriptor, outer addresses in the endpoints");
+    check(packet.payloadLength == InnerPayloadLength && packet.capturedPayloadLength == InnerPayloadLength,
+          "inner payload length");
+}
+
+static void testGeneveAndGre()
+{
+    // GENEVE with one word of options, carrying an Ethernet frame
+    const Bytes inner = concat({ethernet(PacketDecoder::EtherTypeIPv4), innerTcp()});
+    Bytes geneve(12, 0);
+    geneve[0] = 0x01;
+    putBe16(&geneve, 2, PacketDecoder::EtherTypeTransparentBridging);
+    geneve[6] = 7;
+    const Bytes geneveFrame =
+        concat({ethernet(PacketDecoder::EtherTypeIPv4), ipv4Header(PacketDecoder::ProtocolUdp, 1, 8 + 12 + inner.size()),
+                udp(5555, 6081, 12 + inner.size()), geneve, inner});
+    PacketDescriptor packet;
+    check(decode(geneveFrame, true, &packet) && isInner(packet) && packet.tunnel.type == TunnelInfo::Geneve &&
+              packet.tunnel.id == 7,
+          "GENEVE options skipped and VNI kept");
+
+    // GRE with a key, carrying IPv4 directly
+    Bytes gre(8, 0);
+    gre[0] = 0x20;
+    putBe16(&gre, 2, PacketDecoder::EtherTypeIPv4);
+    gre[7] = 9;
+    const Bytes ip = innerTcp();
+    const Bytes greFrame = concat({ethernet(PacketDecoder::EtherTypeIPv4),
+                                   ipv4Header(PacketDecoder::ProtocolGre, 1, gre.size() + ip.size()), gre, ip});
+    check(decode(greFrame, true, &packet) && isInner(packet) && packet.tunnel.type == TunnelInfo::Gre &&
+              packet.tunnel.id == 9,
+          "GRE key kept");
+
+    // IPv4 in IPv6
+    const Bytes sixFrame = concat({ethernet(PacketDecoder::EtherTypeIPv6),
+                                   ipv6Header(PacketDecoder::ProtocolIPv4Encap, 1, ip.size()), ip});
+    TunnelEndpoints endpoints;
+    check(decode(sixFrame, true, &packet, 0, &endpoints) && isInner(packet) && packet.ipVersion == 4 &&
+              packet.tunnel.type == TunnelInfo::IpInIp && endpoints.outerSrc.bytes()[15] == 1,
+          "IPv4 in IPv6 decapsulated");
+}
+
+static void testNesting()
+{
+    // IP-in-IP inside VXLAN: two layers, within the bound
+    const Bytes ip = innerTcp();
+    const Bytes ipip = concat({ipv4Header(PacketDecoder::ProtocolIPv4Encap, 50, ip.size()), ip});
+    PacketDescriptor packet;
+    check(decode(vxlan(concat({ethernet(PacketDecoder::EtherTypeIPv4), ipip}), 5), true, &packet) &&
+              isInner(packet) && packet.tunnel.depth == PacketDecoder::MaxTunnelDepth,
+          "two nested tunnels decapsulated");
+    check(packet.tunnel.type == TunnelInfo::Vxlan && packet.tunnel.id == 5, "outermost tunnel reported");
+
+    // One layer more stops at the bound, with the packet it reached
+    const Bytes ipipip = concat({ipv4Header(PacketDecoder::ProtocolIPv4Encap, 60, ipip.size()), ipip});
+    check(decode(vxlan(concat({ethernet(PacketDecoder::EtherTypeIPv4), ipipip}), 5), true, &packet) &&
+              packet.tunnel.depth == PacketDecoder::MaxTunnelDepth &&
+              packet.protocol == PacketDecoder::ProtocolIPv4Encap && packet.srcAddr.bytes()[15] == 50,
+          "nesting past MaxTunnelDepth stops at the bound");
+
+    // A GRE packet that claims to carry itself over and over cannot loop
+    Bytes gre(4, 0);
+    putBe16(&gre, 2, PacketDecoder::EtherTypeIPv4);
+    Bytes looped = ip;
+    for (int i = 0; i < 8; ++i) {
+        looped = concat({ipv4Header(PacketDecoder::ProtocolGre, quint8(10 + i), gre.size() + looped.size()), gre, looped});
+    }
+    check(decode(concat({ethernet(PacketDecoder::EtherTypeIPv4), looped}), true, &packet) &&
+              packet.tunnel.depth == PacketDecoder::MaxTunnelDepth && packet.protocol == PacketDecoder::ProtocolGre,
+          "deep GRE nesting bounded");
+}
+
+static void testTruncation()
+{
+    const Bytes inner = concat({ethernet(PacketDecoder::EtherTypeIPv4), innerTcp()});
+    const Bytes frame = vxlan(inner, 42);
+    const quint32 innerHeadersEnd = quint32(frame.size() - InnerPayloadLength);
+    const quint32 tunnelStart = quint32(frame.size() - inner.size() - 8);
+
+    // Cut anywhere in the VXLAN header or the inner headers: the outer packet, unchanged
+    bool allOuter = true;
+    for (quint32 length = tunnelStart; length < innerHeadersEnd; ++length) {
+        PacketDescriptor packet;
+        allOuter = allOuter && decode(frame, true, &packet, length) && packet.dstPort == 4789 &&
+                   packet.protocol == PacketDecoder::ProtocolUdp && packet.tunnel.type == TunnelInfo::None &&
+                   packet.tunnel.depth == 0;
+    }
+    check(allOuter, "inner headers cut short fall back to the outer packet");
+
+    // Cut in the inner payload: the inner packet, with only the captured payload
+    PacketDescriptor packet;
+    check(decode(frame, true, &packet, innerHeadersEnd + 4) && isInner(packet) &&
+              packet.payloadLength == InnerPayloadLength && packet.capturedPayloadLength == 4,
+          "inner payload cut short keeps the inner packet");
+
+    // Every cut of a nested packet decodes without reading past the capture
+    const Bytes ip = innerTcp();
+    const Bytes nested = vxlan(concat({ethernet(PacketDecoder::EtherTypeIPv4),
+                                       ipv4Header(PacketDecoder::ProtocolIPv4Encap, 50, ip.size()), ip}),
+                               5);
+    int decoded = 0;
+    for (quint32 length = 1; length <= nested.size(); ++length) {
+        Bytes copy(nested.begin(), nested.begin() + length); // Exact size, so overreads are caught
+        PacketDescriptor cut;
+        decoded += decode(copy, true, &cut) ? 1 : 0;
+    }
+    check(decoded > 0, "every cut of a nested packet decoded safely");
+}
+
+static void testEndpointTable()
+{
+    TunnelEndpointTable table;
+    TunnelEndpoints forward;
+    forward.outerSrc = ipv4(10, 0, 0, 1);
+    forward.outerDst = ipv4(10, 0, 0, 2);
+    TunnelEndpoints backward;
+    backward.outerSrc = forward.outerDst;
+    backward.outerDst = forward.outerSrc;
+    const quint16 index = table.intern(forward);
+    TunnelEndpoints found;
+    check(index != 0 && table.intern(forward) == index && table.lookup(index, &found) &&
+              found.outerSrc == forward.outerSrc && found.outerDst == forward.outerDst,
+          "a pair keeps its index and looks up to its addresses");
+    check(table.intern(backward) != index, "the reverse direction is another pair");
+    check(!table.lookup(0, &found) && !table.lookup(quint16(table.size() + 1), &found),
+          "index 0 and unknown indices have no addresses");
+
+    for (quint32 i = 0; table.size() < TunnelEndpointTable::MaxEndpoints - 1; ++i) {
+        TunnelEndpoints endpoints;
+        endpoints.outerSrc = ipv4(172, 16, quint8(i >> 8), quint8(i));
+        endpoints.outerDst = forward.outerDst;
+        table.intern(endpoints);
+    }
+    TunnelEndpoints late;
+    late.outerSrc = ipv4(192, 0, 2, 1);
+    late.outerDst = forward.outerDst;
+    check(table.intern(late) == 0 && table.intern(forward) == index, "a full table numbers only the pairs it has");
+}
+
+int main()
+{
+    testVxlan();
+    testGeneveAndGre();
+    testNesting();
+    testTruncation();
+    testEndpointTable();
+
+    return testSummary("tunnel");
+}